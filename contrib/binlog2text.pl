@@ -0,0 +1,149 @@
+#!/usr/bin/perl -w
+
+# Converts nginx binary access logs ("log_format ... escape=binary")
+# to text, either tab-separated values with a header line, or JSON lines.
+#
+# usage: binlog2text.pl [-j] [file ...]
+#
+# gzipped logs can be read with "zcat access.bin.gz | binlog2text.pl".
+
+use warnings;
+use strict;
+
+my $json = 0;
+
+if (@ARGV && $ARGV[0] eq '-j') {
+	$json = 1;
+	shift @ARGV;
+}
+
+my @fields;
+my $header = '';
+
+binmode STDOUT;
+
+@ARGV = ('-') unless @ARGV;
+
+for my $file (@ARGV) {
+	my $fh;
+
+	if ($file eq '-') {
+		$fh = \*STDIN;
+	} else {
+		open($fh, '<', $file) or die "$file: $!\n";
+	}
+
+	binmode $fh;
+
+	my $data = do { local $/; <$fh> };
+	my $pos = 0;
+
+	while ($pos < length($data)) {
+		die "$file: truncated frame at $pos\n" if $pos + 5 > length($data);
+
+		my $len = unpack('V', substr($data, $pos, 4));
+		die "$file: truncated frame at $pos\n"
+			if $len < 1 || $pos + 4 + $len > length($data);
+
+		my $type = substr($data, $pos + 4, 1);
+		my $frame = substr($data, $pos + 5, $len - 1);
+		$pos += 4 + $len;
+
+		if ($type eq 'S') {
+			schema($frame);
+		} elsif ($type eq 'R') {
+			die "$file: record without schema\n" unless @fields;
+			record($frame);
+		}
+
+		# unknown frames are skipped
+	}
+}
+
+sub varint {
+	my ($frame, $off) = @_;
+	my ($n, $shift) = (0, 0);
+
+	for (;;) {
+		die "truncated varint\n" if $$off >= length($$frame);
+		my $b = ord(substr($$frame, $$off++, 1));
+		$n |= ($b & 0x7f) << $shift;
+		last unless $b & 0x80;
+		$shift += 7;
+	}
+
+	return $n;
+}
+
+sub string {
+	my ($frame, $off) = @_;
+	my $len = varint($frame, $off);
+	my $s = substr($$frame, $$off, $len);
+	$$off += $len;
+	return $s;
+}
+
+sub schema {
+	my ($frame) = @_;
+	my $off = 1;
+
+	die "unsupported binary log version " . ord($frame) . "\n"
+		if ord($frame) != 1;
+
+	string(\$frame, \$off);		# format name
+
+	my $n = varint(\$frame, \$off);
+	my @names = map { string(\$frame, \$off) } 1 .. $n;
+
+	my $h = join("\t", @names);
+	return if $h eq $header;
+
+	@fields = @names;
+	$header = $h;
+
+	print "$header\n" unless $json;
+}
+
+sub record {
+	my ($frame) = @_;
+	my $off = 0;
+	my @values;
+
+	for (@fields) {
+		my $len = varint(\$frame, \$off);
+
+		if ($len == 0) {
+			push @values, undef;
+			next;
+		}
+
+		push @values, substr($frame, $off, $len - 1);
+		$off += $len - 1;
+	}
+
+	if ($json) {
+		print '{', join(',', map {
+			json($fields[$_]) . ':'
+			. (defined $values[$_] ? json($values[$_]) : 'null')
+		} 0 .. $#fields), "}\n";
+
+		return;
+	}
+
+	print join("\t", map {
+		my $v = $_;
+		if (defined $v) {
+			$v =~ s/([\\\t\n\r])/sprintf('\\x%02X', ord($1))/ge;
+		} else {
+			$v = '-';
+		}
+		$v;
+	} @values), "\n";
+}
+
+sub json {
+	my ($s) = @_;
+	$s =~ s/(["\\])/\\$1/g;
+	$s =~ s/([\x00-\x1f])/sprintf('\\u%04x', ord($1))/ge;
+	return "\"$s\"";
+}
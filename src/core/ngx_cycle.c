@@ -466,6 +466,7 @@ ngx_init_cycle(ngx_cycle_t *old_cycle)
                 && !shm_zone[i].noreuse)
             {
                 shm_zone[i].shm.addr = oshm_zone[n].shm.addr;
+                shm_zone[i].shm.hugetlb = oshm_zone[n].shm.hugetlb;
 #if (NGX_WIN32)
                 shm_zone[i].shm.handle = oshm_zone[n].shm.handle;
 #endif
@@ -482,6 +483,8 @@ ngx_init_cycle(ngx_cycle_t *old_cycle)
             break;
         }
 
+        shm_zone[i].shm.hugepages = ccf->shm_hugepages;
+
         if (ngx_shm_alloc(&shm_zone[i].shm) != NGX_OK) {
             goto failed;
         }
@@ -99,6 +99,10 @@ typedef struct {
     ngx_int_t                 rlimit_nofile;
     off_t                     rlimit_core;
 
+    size_t                    pool_cache;
+
+    ngx_flag_t                shm_hugepages;
+
     int                       priority;
 
     ngx_uint_t                cpu_affinity_auto;
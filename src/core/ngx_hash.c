@@ -12,7 +12,6 @@
 void *
 ngx_hash_find(ngx_hash_t *hash, ngx_uint_t key, u_char *name, size_t len)
 {
-    ngx_uint_t       i;
     ngx_hash_elt_t  *elt;
 
 #if 0
@@ -26,23 +25,14 @@ ngx_hash_find(ngx_hash_t *hash, ngx_uint_t key, u_char *name, size_t len)
     }
 
     while (elt->value) {
-        if (len != (size_t) elt->len) {
-            goto next;
-        }
-
-        for (i = 0; i < len; i++) {
-            if (name[i] != elt->name[i]) {
-                goto next;
-            }
+        if (len == (size_t) elt->len
+            && ngx_memcmp(name, elt->name, len) == 0)
+        {
+            return elt->value;
         }
 
-        return elt->value;
-
-    next:
-
         elt = (ngx_hash_elt_t *) ngx_align_ptr(&elt->name[0] + elt->len,
                                                sizeof(void *));
-        continue;
     }
 
     return NULL;
@@ -52,40 +42,53 @@ ngx_hash_find(ngx_hash_t *hash, ngx_uint_t key, u_char *name, size_t len)
 void *
 ngx_hash_find_wc_head(ngx_hash_wildcard_t *hwc, u_char *name, size_t len)
 {
-    void        *value;
+    void        *value, *dflt;
     ngx_uint_t   i, n, key;
 
+    /*
+     * the nested hashes form a trie of reversed name labels,
+     * it is walked from the last label down to the first one,
+     * "dflt" keeps the value of the deepest matched "*.example.com"
+     */
+
+    dflt = hwc->value;
+
+    for ( ;; ) {
+
 #if 0
-    ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, 0, "wch:\"%*s\"", len, name);
+        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, 0,
+                      "wch:\"%*s\"", len, name);
 #endif
 
-    n = len;
+        n = len;
 
-    while (n) {
-        if (name[n - 1] == '.') {
-            break;
-        }
+        while (n) {
+            if (name[n - 1] == '.') {
+                break;
+            }
 
-        n--;
-    }
+            n--;
+        }
 
-    key = 0;
+        key = 0;
 
-    for (i = n; i < len; i++) {
-        key = ngx_hash(key, name[i]);
-    }
+        for (i = n; i < len; i++) {
+            key = ngx_hash(key, name[i]);
+        }
 
 #if 0
-    ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, 0, "key:\"%ui\"", key);
+        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, 0, "key:\"%ui\"", key);
 #endif
 
-    value = ngx_hash_find(&hwc->hash, key, &name[n], len - n);
+        value = ngx_hash_find(&hwc->hash, key, &name[n], len - n);
 
 #if 0
-    ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, 0, "value:\"%p\"", value);
+        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, 0, "value:\"%p\"", value);
 #endif
 
-    if (value) {
+        if (value == NULL) {
+            return dflt;
+        }
 
         /*
          * the 2 low bits of value have the special meaning:
@@ -100,28 +103,26 @@ ngx_hash_find_wc_head(ngx_hash_wildcard_t *hwc, u_char *name, size_t len)
 
         if ((uintptr_t) value & 2) {
 
+            hwc = (ngx_hash_wildcard_t *) ((uintptr_t) value & (uintptr_t) ~3);
+
             if (n == 0) {
 
                 /* "example.com" */
 
                 if ((uintptr_t) value & 1) {
-                    return NULL;
+                    return dflt;
                 }
 
-                hwc = (ngx_hash_wildcard_t *)
-                                          ((uintptr_t) value & (uintptr_t) ~3);
-                return hwc->value;
+                return hwc->value ? hwc->value : dflt;
             }
 
-            hwc = (ngx_hash_wildcard_t *) ((uintptr_t) value & (uintptr_t) ~3);
-
-            value = ngx_hash_find_wc_head(hwc, name, n - 1);
-
-            if (value) {
-                return value;
+            if (hwc->value) {
+                dflt = hwc->value;
             }
 
-            return hwc->value;
+            len = n - 1;
+
+            continue;
         }
 
         if ((uintptr_t) value & 1) {
@@ -130,7 +131,7 @@ ngx_hash_find_wc_head(ngx_hash_wildcard_t *hwc, u_char *name, size_t len)
 
                 /* "example.com" */
 
-                return NULL;
+                return dflt;
             }
 
             return (void *) ((uintptr_t) value & (uintptr_t) ~3);
@@ -138,46 +139,51 @@ ngx_hash_find_wc_head(ngx_hash_wildcard_t *hwc, u_char *name, size_t len)
 
         return value;
     }
-
-    return hwc->value;
 }
 
 
 void *
 ngx_hash_find_wc_tail(ngx_hash_wildcard_t *hwc, u_char *name, size_t len)
 {
-    void        *value;
+    void        *value, *dflt;
     ngx_uint_t   i, key;
 
+    dflt = hwc->value;
+
+    for ( ;; ) {
+
 #if 0
-    ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, 0, "wct:\"%*s\"", len, name);
+        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, 0,
+                      "wct:\"%*s\"", len, name);
 #endif
 
-    key = 0;
+        key = 0;
 
-    for (i = 0; i < len; i++) {
-        if (name[i] == '.') {
-            break;
-        }
+        for (i = 0; i < len; i++) {
+            if (name[i] == '.') {
+                break;
+            }
 
-        key = ngx_hash(key, name[i]);
-    }
+            key = ngx_hash(key, name[i]);
+        }
 
-    if (i == len) {
-        return NULL;
-    }
+        if (i == len) {
+            return dflt;
+        }
 
 #if 0
-    ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, 0, "key:\"%ui\"", key);
+        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, 0, "key:\"%ui\"", key);
 #endif
 
-    value = ngx_hash_find(&hwc->hash, key, name, i);
+        value = ngx_hash_find(&hwc->hash, key, name, i);
 
 #if 0
-    ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, 0, "value:\"%p\"", value);
+        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, 0, "value:\"%p\"", value);
 #endif
 
-    if (value) {
+        if (value == NULL) {
+            return dflt;
+        }
 
         /*
          * the 2 low bits of value have the special meaning:
@@ -191,19 +197,18 @@ ngx_hash_find_wc_tail(ngx_hash_wildcard_t *hwc, u_char *name, size_t len)
 
             hwc = (ngx_hash_wildcard_t *) ((uintptr_t) value & (uintptr_t) ~3);
 
-            value = ngx_hash_find_wc_tail(hwc, &name[i], len - i);
-
-            if (value) {
-                return value;
+            if (hwc->value) {
+                dflt = hwc->value;
             }
 
-            return hwc->value;
+            name += i;
+            len -= i;
+
+            continue;
         }
 
         return value;
     }
-
-    return hwc->value;
 }
 
 
@@ -248,14 +253,22 @@ ngx_hash_find_combined(ngx_hash_combined_t *hash, ngx_uint_t key, u_char *name,
 #define NGX_HASH_ELT_SIZE(name)                                               \
     (sizeof(void *) + ngx_align((name)->key.len + 2, sizeof(void *)))
 
+
+typedef struct {
+    ngx_uint_t       key_hash;
+    ngx_uint_t       len;
+} ngx_hash_trial_t;
+
+
 ngx_int_t
 ngx_hash_init(ngx_hash_init_t *hinit, ngx_hash_key_t *names, ngx_uint_t nelts)
 {
-    u_char          *elts;
-    size_t           len;
-    u_short         *test;
-    ngx_uint_t       i, n, key, size, start, bucket_size;
-    ngx_hash_elt_t  *elt, **buckets;
+    u_char            *elts;
+    size_t             len;
+    u_short           *test;
+    ngx_uint_t         i, n, m, key, size, start, bucket_size;
+    ngx_hash_elt_t    *elt, **buckets;
+    ngx_hash_trial_t  *trial;
 
     if (hinit->max_size == 0) {
         ngx_log_error(NGX_LOG_EMERG, hinit->pool->log, 0,
@@ -273,6 +286,20 @@ ngx_hash_init(ngx_hash_init_t *hinit, ngx_hash_key_t *names, ngx_uint_t nelts)
         return NGX_ERROR;
     }
 
+    /*
+     * the size search below makes many passes over the keys, so
+     * the hashes and element sizes of the used keys are copied
+     * into a compact array to keep the passes cache friendly
+     */
+
+    trial = ngx_alloc((nelts ? nelts : 1) * sizeof(ngx_hash_trial_t),
+                      hinit->pool->log);
+    if (trial == NULL) {
+        return NGX_ERROR;
+    }
+
+    m = 0;
+
     for (n = 0; n < nelts; n++) {
         if (names[n].key.data == NULL) {
             continue;
@@ -284,12 +311,18 @@ ngx_hash_init(ngx_hash_init_t *hinit, ngx_hash_key_t *names, ngx_uint_t nelts)
                           "could not build %s, you should "
                           "increase %s_bucket_size: %i",
                           hinit->name, hinit->name, hinit->bucket_size);
+            ngx_free(trial);
             return NGX_ERROR;
         }
+
+        trial[m].key_hash = names[n].key_hash;
+        trial[m].len = NGX_HASH_ELT_SIZE(&names[n]);
+        m++;
     }
 
     test = ngx_alloc(hinit->max_size * sizeof(u_short), hinit->pool->log);
     if (test == NULL) {
+        ngx_free(trial);
         return NGX_ERROR;
     }
 
@@ -306,18 +339,13 @@ ngx_hash_init(ngx_hash_init_t *hinit, ngx_hash_key_t *names, ngx_uint_t nelts)
 
         ngx_memzero(test, size * sizeof(u_short));
 
-        for (n = 0; n < nelts; n++) {
-            if (names[n].key.data == NULL) {
-                continue;
-            }
-
-            key = names[n].key_hash % size;
-            len = test[key] + NGX_HASH_ELT_SIZE(&names[n]);
+        for (n = 0; n < m; n++) {
+            key = trial[n].key_hash % size;
+            len = test[key] + trial[n].len;
 
 #if 0
             ngx_log_error(NGX_LOG_ALERT, hinit->pool->log, 0,
-                          "%ui: %ui %uz \"%V\"",
-                          size, key, len, &names[n].key);
+                          "%ui: %ui %uz", size, key, len);
 #endif
 
             if (len > bucket_size) {
@@ -349,19 +377,16 @@ found:
         test[i] = sizeof(void *);
     }
 
-    for (n = 0; n < nelts; n++) {
-        if (names[n].key.data == NULL) {
-            continue;
-        }
-
-        key = names[n].key_hash % size;
-        len = test[key] + NGX_HASH_ELT_SIZE(&names[n]);
+    for (n = 0; n < m; n++) {
+        key = trial[n].key_hash % size;
+        len = test[key] + trial[n].len;
 
         if (len > 65536 - ngx_cacheline_size) {
             ngx_log_error(NGX_LOG_EMERG, hinit->pool->log, 0,
                           "could not build %s, you should "
                           "increase %s_max_size: %i",
                           hinit->name, hinit->name, hinit->max_size);
+            ngx_free(trial);
             ngx_free(test);
             return NGX_ERROR;
         }
@@ -369,6 +394,8 @@ found:
         test[key] = (u_short) len;
     }
 
+    ngx_free(trial);
+
     len = 0;
 
     for (i = 0; i < size; i++) {
@@ -13,6 +13,17 @@ static ngx_inline void *ngx_palloc_small(ngx_pool_t *pool, size_t size,
     ngx_uint_t align);
 static void *ngx_palloc_block(ngx_pool_t *pool, size_t size);
 static void *ngx_palloc_large(ngx_pool_t *pool, size_t size);
+static ngx_uint_t ngx_pool_cache_slot(size_t size);
+static void *ngx_pool_cache_alloc(size_t size, ngx_log_t *log);
+static void ngx_pool_cache_free(void *p, size_t size);
+
+
+/*
+ * the per-process cache of freed pool blocks and large allocations,
+ * it is enabled in worker processes by the "worker_pool_cache" directive
+ */
+
+ngx_pool_cache_t  ngx_pool_cache;
 
 
 ngx_pool_t *
@@ -20,7 +31,7 @@ ngx_create_pool(size_t size, ngx_log_t *log)
 {
     ngx_pool_t  *p;
 
-    p = ngx_memalign(NGX_POOL_ALIGNMENT, size, log);
+    p = ngx_pool_cache_alloc(size, log);
     if (p == NULL) {
         return NULL;
     }
@@ -82,12 +93,12 @@ ngx_destroy_pool(ngx_pool_t *pool)
 
     for (l = pool->large; l; l = l->next) {
         if (l->alloc) {
-            ngx_free(l->alloc);
+            ngx_pool_cache_free(l->alloc, l->size);
         }
     }
 
     for (p = pool, n = pool->d.next; /* void */; p = n, n = n->d.next) {
-        ngx_free(p);
+        ngx_pool_cache_free(p, p->d.end - (u_char *) p);
 
         if (n == NULL) {
             break;
@@ -104,7 +115,7 @@ ngx_reset_pool(ngx_pool_t *pool)
 
     for (l = pool->large; l; l = l->next) {
         if (l->alloc) {
-            ngx_free(l->alloc);
+            ngx_pool_cache_free(l->alloc, l->size);
         }
     }
 
@@ -183,7 +194,7 @@ ngx_palloc_block(ngx_pool_t *pool, size_t size)
 
     psize = (size_t) (pool->d.end - (u_char *) pool);
 
-    m = ngx_memalign(NGX_POOL_ALIGNMENT, psize, pool->log);
+    m = ngx_pool_cache_alloc(psize, pool->log);
     if (m == NULL) {
         return NULL;
     }
@@ -217,7 +228,20 @@ ngx_palloc_large(ngx_pool_t *pool, size_t size)
     ngx_uint_t         n;
     ngx_pool_large_t  *large;
 
-    p = ngx_alloc(size, pool->log);
+    /*
+     * large allocations only need to be aligned if they may be
+     * cached and reused as pool blocks later
+     */
+
+    if (ngx_pool_cache.max_size
+        && ngx_pool_cache_slot(size) != NGX_POOL_CACHE_SLOTS)
+    {
+        p = ngx_pool_cache_alloc(size, pool->log);
+
+    } else {
+        p = ngx_alloc(size, pool->log);
+    }
+
     if (p == NULL) {
         return NULL;
     }
@@ -227,6 +251,7 @@ ngx_palloc_large(ngx_pool_t *pool, size_t size)
     for (large = pool->large; large; large = large->next) {
         if (large->alloc == NULL) {
             large->alloc = p;
+            large->size = size;
             return p;
         }
 
@@ -237,11 +262,12 @@ ngx_palloc_large(ngx_pool_t *pool, size_t size)
 
     large = ngx_palloc_small(pool, sizeof(ngx_pool_large_t), 1);
     if (large == NULL) {
-        ngx_free(p);
+        ngx_pool_cache_free(p, size);
         return NULL;
     }
 
     large->alloc = p;
+    large->size = size;
     large->next = pool->large;
     pool->large = large;
 
@@ -267,6 +293,7 @@ ngx_pmemalign(ngx_pool_t *pool, size_t size, size_t alignment)
     }
 
     large->alloc = p;
+    large->size = 0;
     large->next = pool->large;
     pool->large = large;
 
@@ -283,7 +310,7 @@ ngx_pfree(ngx_pool_t *pool, void *p)
         if (p == l->alloc) {
             ngx_log_debug1(NGX_LOG_DEBUG_ALLOC, pool->log, 0,
                            "free: %p", l->alloc);
-            ngx_free(l->alloc);
+            ngx_pool_cache_free(l->alloc, l->size);
             l->alloc = NULL;
 
             return NGX_OK;
@@ -401,6 +428,82 @@ ngx_pool_delete_file(void *data)
 }
 
 
+static ngx_uint_t
+ngx_pool_cache_slot(size_t size)
+{
+    ngx_uint_t  n;
+
+    /* only blocks of exactly a slot size are cached */
+
+    if (size < (1 << NGX_POOL_CACHE_SHIFT)
+        || size > (1 << (NGX_POOL_CACHE_SHIFT + NGX_POOL_CACHE_SLOTS - 1))
+        || (size & (size - 1)))
+    {
+        return NGX_POOL_CACHE_SLOTS;
+    }
+
+    for (n = 0; size > (1 << NGX_POOL_CACHE_SHIFT); n++) {
+        size >>= 1;
+    }
+
+    return n;
+}
+
+
+static void *
+ngx_pool_cache_alloc(size_t size, ngx_log_t *log)
+{
+    ngx_uint_t                n;
+    ngx_pool_cached_block_t  *b;
+
+    n = ngx_pool_cache_slot(size);
+
+    if (n == NGX_POOL_CACHE_SLOTS) {
+        return ngx_memalign(NGX_POOL_ALIGNMENT, size, log);
+    }
+
+    b = ngx_pool_cache.slots[n];
+
+    if (b) {
+        ngx_pool_cache.slots[n] = b->next;
+        ngx_pool_cache.size -= size;
+        ngx_pool_cache.hits++;
+
+        return b;
+    }
+
+    if (ngx_pool_cache.max_size) {
+        ngx_pool_cache.misses++;
+    }
+
+    return ngx_memalign(NGX_POOL_ALIGNMENT, size, log);
+}
+
+
+static void
+ngx_pool_cache_free(void *p, size_t size)
+{
+    ngx_uint_t                n;
+    ngx_pool_cached_block_t  *b;
+
+    n = ngx_pool_cache_slot(size);
+
+    if (n == NGX_POOL_CACHE_SLOTS
+        || ngx_pool_cache.size + size > ngx_pool_cache.max_size
+        || ((uintptr_t) p & (NGX_POOL_ALIGNMENT - 1)))
+    {
+        ngx_free(p);
+        return;
+    }
+
+    b = p;
+    b->next = ngx_pool_cache.slots[n];
+
+    ngx_pool_cache.slots[n] = b;
+    ngx_pool_cache.size += size;
+}
+
+
 #if 0
 
 static void *
@@ -26,6 +26,10 @@
     ngx_align((sizeof(ngx_pool_t) + 2 * sizeof(ngx_pool_large_t)),            \
               NGX_POOL_ALIGNMENT)
 
+/* blocks of 256, 512, ... 64K bytes are cached */
+#define NGX_POOL_CACHE_SHIFT     8
+#define NGX_POOL_CACHE_SLOTS     9
+
 
 typedef void (*ngx_pool_cleanup_pt)(void *data);
 
@@ -43,6 +47,7 @@ typedef struct ngx_pool_large_s  ngx_pool_large_t;
 struct ngx_pool_large_s {
     ngx_pool_large_t     *next;
     void                 *alloc;
+    size_t                size;
 };
 
 
@@ -72,6 +77,22 @@ typedef struct {
 } ngx_pool_cleanup_file_t;
 
 
+typedef struct ngx_pool_cached_block_s  ngx_pool_cached_block_t;
+
+struct ngx_pool_cached_block_s {
+    ngx_pool_cached_block_t  *next;
+};
+
+
+typedef struct {
+    ngx_pool_cached_block_t  *slots[NGX_POOL_CACHE_SLOTS];
+    size_t                    max_size;
+    size_t                    size;
+    ngx_uint_t                hits;
+    ngx_uint_t                misses;
+} ngx_pool_cache_t;
+
+
 ngx_pool_t *ngx_create_pool(size_t size, ngx_log_t *log);
 void ngx_destroy_pool(ngx_pool_t *pool);
 void ngx_reset_pool(ngx_pool_t *pool);
@@ -89,4 +110,7 @@ void ngx_pool_cleanup_file(void *data);
 void ngx_pool_delete_file(void *data);
 
 
+extern ngx_pool_cache_t  ngx_pool_cache;
+
+
 #endif /* _NGX_PALLOC_H_INCLUDED_ */
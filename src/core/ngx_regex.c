@@ -15,6 +15,17 @@ typedef struct {
 } ngx_regex_conf_t;
 
 
+#if (NGX_PCRE2)
+
+typedef struct {
+    ngx_str_node_t         sn;
+    ngx_uint_t             generation;
+    pcre2_code            *code;
+} ngx_regex_cache_node_t;
+
+#endif
+
+
 static ngx_inline void ngx_regex_malloc_init(ngx_pool_t *pool);
 static ngx_inline void ngx_regex_malloc_done(void);
 
@@ -27,6 +38,14 @@ static void ngx_libc_cdecl ngx_regex_free(void *p);
 #endif
 static void ngx_regex_cleanup(void *data);
 
+#if (NGX_PCRE2)
+static pcre2_code *ngx_regex_cache_lookup(ngx_regex_compile_t *rc,
+    uint32_t options, uint32_t *hash);
+static void ngx_regex_cache_add(ngx_regex_compile_t *rc, pcre2_code *re,
+    uint32_t hash);
+static void ngx_regex_cache_expire(ngx_log_t *log);
+#endif
+
 static ngx_int_t ngx_regex_module_init(ngx_cycle_t *cycle);
 
 static void *ngx_regex_create_conf(ngx_cycle_t *cycle);
@@ -80,6 +99,15 @@ static ngx_uint_t              ngx_regex_direct_alloc;
 static pcre2_compile_context  *ngx_regex_compile_context;
 static pcre2_match_data       *ngx_regex_match_data;
 static ngx_uint_t              ngx_regex_match_data_size;
+
+/*
+ * compiled patterns survive reloads in the master process, so
+ * patterns which did not change are copied instead of compiled
+ */
+
+static ngx_rbtree_t            ngx_regex_cache;
+static ngx_rbtree_node_t       ngx_regex_cache_sentinel;
+static ngx_uint_t              ngx_regex_cache_generation;
 #endif
 
 
@@ -118,7 +146,7 @@ ngx_regex_compile(ngx_regex_compile_t *rc)
     char                   *p;
     u_char                  errstr[128];
     size_t                  erroff;
-    uint32_t                options;
+    uint32_t                options, hash;
     pcre2_code             *re;
     ngx_regex_elt_t        *elt;
     pcre2_general_context  *gctx;
@@ -171,6 +199,12 @@ ngx_regex_compile(ngx_regex_compile_t *rc)
         return NGX_ERROR;
     }
 
+    re = ngx_regex_cache_lookup(rc, options, &hash);
+
+    if (re) {
+        goto compiled;
+    }
+
     ngx_regex_malloc_init(rc->pool);
 
     re = pcre2_compile(rc->pattern.data, rc->pattern.len, options,
@@ -198,6 +232,10 @@ ngx_regex_compile(ngx_regex_compile_t *rc)
         return NGX_ERROR;
     }
 
+    ngx_regex_cache_add(rc, re, hash);
+
+compiled:
+
     rc->regex = re;
 
     /* do not study at runtime */
@@ -261,6 +299,136 @@ nomem:
     return NGX_ERROR;
 }
 
+
+static pcre2_code *
+ngx_regex_cache_lookup(ngx_regex_compile_t *rc, uint32_t options,
+    uint32_t *hash)
+{
+    pcre2_code              *re;
+    ngx_regex_cache_node_t  *node;
+
+    /* the options are mixed into the key to tell apart equal patterns */
+
+    *hash = ngx_crc32_short(rc->pattern.data, rc->pattern.len) ^ options;
+
+    /* patterns are only cached while parsing configuration */
+
+    if (ngx_regex_studies == NULL) {
+        return NULL;
+    }
+
+    if (ngx_regex_cache.root == NULL) {
+        ngx_rbtree_init(&ngx_regex_cache, &ngx_regex_cache_sentinel,
+                        ngx_str_rbtree_insert_value);
+    }
+
+    node = (ngx_regex_cache_node_t *)
+               ngx_str_rbtree_lookup(&ngx_regex_cache, &rc->pattern, *hash);
+
+    if (node == NULL) {
+        return NULL;
+    }
+
+    ngx_regex_malloc_init(rc->pool);
+
+    re = pcre2_code_copy(node->code);
+
+    ngx_regex_malloc_done();
+
+    if (re == NULL) {
+        return NULL;
+    }
+
+    node->generation = ngx_regex_cache_generation;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_CORE, ngx_cycle->log, 0,
+                   "regex cache hit: \"%V\"", &rc->pattern);
+
+    return re;
+}
+
+
+static void
+ngx_regex_cache_add(ngx_regex_compile_t *rc, pcre2_code *re, uint32_t hash)
+{
+    ngx_regex_cache_node_t  *node;
+
+    if (ngx_regex_studies == NULL) {
+        return;
+    }
+
+    node = ngx_alloc(sizeof(ngx_regex_cache_node_t) + rc->pattern.len,
+                     ngx_cycle->log);
+    if (node == NULL) {
+        return;
+    }
+
+    /* the cached copy is allocated from heap to outlive the cycle */
+
+    ngx_regex_malloc_init(NULL);
+
+    node->code = pcre2_code_copy(re);
+
+    ngx_regex_malloc_done();
+
+    if (node->code == NULL) {
+        ngx_free(node);
+        return;
+    }
+
+    node->sn.node.key = hash;
+    node->sn.str.len = rc->pattern.len;
+    node->sn.str.data = (u_char *) node + sizeof(ngx_regex_cache_node_t);
+    ngx_memcpy(node->sn.str.data, rc->pattern.data, rc->pattern.len);
+
+    node->generation = ngx_regex_cache_generation;
+
+    ngx_rbtree_insert(&ngx_regex_cache, &node->sn.node);
+}
+
+
+static void
+ngx_regex_cache_expire(ngx_log_t *log)
+{
+    ngx_uint_t               n;
+    ngx_rbtree_node_t       *node, *next;
+    ngx_regex_cache_node_t  *cn;
+
+    if (ngx_regex_cache.root == NULL
+        || ngx_regex_cache.root == ngx_regex_cache.sentinel)
+    {
+        return;
+    }
+
+    /* drop patterns not used by the configuration just loaded */
+
+    n = 0;
+
+    node = ngx_rbtree_min(ngx_regex_cache.root, ngx_regex_cache.sentinel);
+
+    ngx_regex_malloc_init(NULL);
+
+    while (node) {
+        next = ngx_rbtree_next(&ngx_regex_cache, node);
+
+        cn = (ngx_regex_cache_node_t *) node;
+
+        if (cn->generation != ngx_regex_cache_generation) {
+            ngx_rbtree_delete(&ngx_regex_cache, node);
+            pcre2_code_free(cn->code);
+            ngx_free(cn);
+            n++;
+        }
+
+        node = next;
+    }
+
+    ngx_regex_malloc_done();
+
+    ngx_log_debug1(NGX_LOG_DEBUG_CORE, log, 0,
+                   "regex cache: %ui patterns expired", n);
+}
+
 #else
 
 ngx_int_t
@@ -711,6 +879,10 @@ ngx_regex_module_init(ngx_cycle_t *cycle)
 
     ngx_regex_studies = NULL;
 
+#if (NGX_PCRE2)
+    ngx_regex_cache_expire(cycle->log);
+#endif
+
     return NGX_OK;
 }
 
@@ -743,6 +915,10 @@ ngx_regex_create_conf(ngx_cycle_t *cycle)
 
     ngx_regex_studies = rcf->studies;
 
+#if (NGX_PCRE2)
+    ngx_regex_cache_generation++;
+#endif
+
     return rcf;
 }
 
@@ -51,6 +51,33 @@ typedef struct {
 } ngx_resolver_an_t;
 
 
+typedef struct {
+    ngx_rbtree_t            rbtree;
+    ngx_rbtree_node_t       sentinel;
+    ngx_queue_t             queue;
+} ngx_resolver_shctx_t;
+
+
+typedef struct {
+    ngx_resolver_shctx_t   *sh;
+    ngx_slab_pool_t        *shpool;
+} ngx_resolver_cache_t;
+
+
+typedef struct {
+    ngx_str_node_t          sn;
+    ngx_queue_t             queue;
+    time_t                  valid;
+    u_short                 naddrs;
+    u_short                 naddrs6;
+    u_short                 cnlen;
+    unsigned                ipv4:1;
+    unsigned                ipv6:1;
+    /* in_addr_t addrs[naddrs], struct in6_addr addrs6[naddrs6], cname, name */
+    u_char                  data[1];
+} ngx_resolver_cache_node_t;
+
+
 #define ngx_resolver_node(n)  ngx_rbtree_data(n, ngx_resolver_node_t, node)
 
 
@@ -58,6 +85,13 @@ static ngx_int_t ngx_udp_connect(ngx_resolver_connection_t *rec);
 static ngx_int_t ngx_tcp_connect(ngx_resolver_connection_t *rec);
 
 
+static ngx_int_t ngx_resolver_init_zone(ngx_shm_zone_t *shm_zone, void *data);
+static ngx_int_t ngx_resolver_cache_lookup(ngx_resolver_t *r,
+    ngx_resolver_node_t *rn, ngx_str_t *name, uint32_t hash);
+static void ngx_resolver_cache_store(ngx_resolver_t *r,
+    ngx_resolver_node_t *rn);
+static void ngx_resolver_cache_expire(ngx_resolver_cache_t *cache,
+    ngx_uint_t n);
 static void ngx_resolver_cleanup(void *data);
 static void ngx_resolver_cleanup_tree(ngx_resolver_t *r, ngx_rbtree_t *tree);
 static ngx_int_t ngx_resolve_name_locked(ngx_resolver_t *r,
@@ -129,14 +163,20 @@ static ngx_resolver_node_t *ngx_resolver_lookup_addr6(ngx_resolver_t *r,
 #endif
 
 
+static ngx_uint_t  ngx_resolver_zone_tag;
+
+
 ngx_resolver_t *
 ngx_resolver_create(ngx_conf_t *cf, ngx_str_t *names, ngx_uint_t n)
 {
-    ngx_str_t                   s;
+    u_char                     *p;
+    ssize_t                     size;
+    ngx_str_t                   s, name;
     ngx_url_t                   u;
     ngx_uint_t                  i, j;
     ngx_resolver_t             *r;
     ngx_pool_cleanup_t         *cln;
+    ngx_resolver_cache_t       *cache;
     ngx_resolver_connection_t  *rec;
 
     r = ngx_pcalloc(cf->pool, sizeof(ngx_resolver_t));
@@ -226,6 +266,56 @@ ngx_resolver_create(ngx_conf_t *cf, ngx_str_t *names, ngx_uint_t n)
             continue;
         }
 
+        if (ngx_strncmp(names[i].data, "zone=", 5) == 0) {
+
+            name.data = names[i].data + 5;
+
+            p = (u_char *) ngx_strchr(name.data, ':');
+
+            if (p == NULL) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid zone size \"%V\"", &names[i]);
+                return NULL;
+            }
+
+            name.len = p - name.data;
+
+            s.data = p + 1;
+            s.len = names[i].data + names[i].len - s.data;
+
+            size = ngx_parse_size(&s);
+
+            if (size == NGX_ERROR) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid zone size \"%V\"", &names[i]);
+                return NULL;
+            }
+
+            if (size < (ssize_t) (8 * ngx_pagesize)) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "zone \"%V\" is too small", &names[i]);
+                return NULL;
+            }
+
+            r->shm_zone = ngx_shared_memory_add(cf, &name, size,
+                                                &ngx_resolver_zone_tag);
+            if (r->shm_zone == NULL) {
+                return NULL;
+            }
+
+            if (r->shm_zone->data == NULL) {
+                cache = ngx_pcalloc(cf->pool, sizeof(ngx_resolver_cache_t));
+                if (cache == NULL) {
+                    return NULL;
+                }
+
+                r->shm_zone->init = ngx_resolver_init_zone;
+                r->shm_zone->data = cache;
+            }
+
+            continue;
+        }
+
 #if (NGX_HAVE_INET6)
         if (ngx_strncmp(names[i].data, "ipv4=", 5) == 0) {
 
@@ -309,6 +399,59 @@ ngx_resolver_create(ngx_conf_t *cf, ngx_str_t *names, ngx_uint_t n)
 }
 
 
+static ngx_int_t
+ngx_resolver_init_zone(ngx_shm_zone_t *shm_zone, void *data)
+{
+    ngx_resolver_cache_t  *ocache = data;
+
+    size_t                 len;
+    ngx_resolver_cache_t  *cache;
+
+    cache = shm_zone->data;
+
+    if (ocache) {
+        cache->sh = ocache->sh;
+        cache->shpool = ocache->shpool;
+
+        return NGX_OK;
+    }
+
+    cache->shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    if (shm_zone->shm.exists) {
+        cache->sh = cache->shpool->data;
+
+        return NGX_OK;
+    }
+
+    cache->sh = ngx_slab_alloc(cache->shpool, sizeof(ngx_resolver_shctx_t));
+    if (cache->sh == NULL) {
+        return NGX_ERROR;
+    }
+
+    cache->shpool->data = cache->sh;
+
+    ngx_rbtree_init(&cache->sh->rbtree, &cache->sh->sentinel,
+                    ngx_str_rbtree_insert_value);
+
+    ngx_queue_init(&cache->sh->queue);
+
+    len = sizeof(" in resolver zone \"\"") + shm_zone->shm.name.len;
+
+    cache->shpool->log_ctx = ngx_slab_alloc(cache->shpool, len);
+    if (cache->shpool->log_ctx == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_sprintf(cache->shpool->log_ctx, " in resolver zone \"%V\"%Z",
+                &shm_zone->shm.name);
+
+    cache->shpool->log_nomem = 0;
+
+    return NGX_OK;
+}
+
+
 static void
 ngx_resolver_cleanup(void *data)
 {
@@ -828,6 +971,30 @@ ngx_resolve_name_locked(ngx_resolver_t *r, ngx_resolver_ctx_t *ctx,
         ngx_rbtree_insert(tree, &rn->node);
     }
 
+    if (r->shm_zone && ctx->service.len == 0) {
+
+        rc = ngx_resolver_cache_lookup(r, rn, name, hash);
+
+        if (rc == NGX_ERROR) {
+            goto failed;
+        }
+
+        if (rc == NGX_OK) {
+            rn->query = NULL;
+#if (NGX_HAVE_INET6)
+            rn->query6 = NULL;
+#endif
+            rn->code = 0;
+            rn->nsrvs = 0;
+            rn->waiting = NULL;
+            rn->expire = ngx_time() + r->expire;
+
+            ngx_queue_insert_head(expire_queue, &rn->queue);
+
+            return ngx_resolve_name_locked(r, ctx, name);
+        }
+    }
+
     if (ctx->service.len) {
         rc = ngx_resolver_create_srv_query(r, rn, name);
 
@@ -2447,6 +2614,10 @@ ngx_resolver_process_a(ngx_resolver_t *r, u_char *buf, size_t n,
 
         ngx_queue_insert_head(&r->name_expire_queue, &rn->queue);
 
+        if (r->shm_zone) {
+            ngx_resolver_cache_store(r, rn);
+        }
+
         next = rn->waiting;
         rn->waiting = NULL;
 
@@ -2519,6 +2690,10 @@ ngx_resolver_process_a(ngx_resolver_t *r, u_char *buf, size_t n,
 
         ngx_queue_insert_head(&r->name_expire_queue, &rn->queue);
 
+        if (r->shm_zone) {
+            ngx_resolver_cache_store(r, rn);
+        }
+
         ngx_resolver_free(r, rn->query);
         rn->query = NULL;
 #if (NGX_HAVE_INET6)
@@ -3660,6 +3835,299 @@ ngx_resolver_rbtree_insert_addr6_value(ngx_rbtree_node_t *temp,
 #endif
 
 
+static ngx_int_t
+ngx_resolver_cache_lookup(ngx_resolver_t *r, ngx_resolver_node_t *rn,
+    ngx_str_t *name, uint32_t hash)
+{
+    u_char                     *p;
+    ngx_uint_t                  naddrs;
+    ngx_resolver_cache_t       *cache;
+    ngx_resolver_cache_node_t  *cn;
+#if (NGX_HAVE_INET6)
+    ngx_uint_t                  naddrs6;
+#endif
+
+    cache = r->shm_zone->data;
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    cn = (ngx_resolver_cache_node_t *)
+             ngx_str_rbtree_lookup(&cache->sh->rbtree, name, hash);
+
+    if (cn == NULL
+        || cn->valid < ngx_time()
+        || (r->ipv4 && !cn->ipv4)
+#if (NGX_HAVE_INET6)
+        || (r->ipv6 && !cn->ipv6)
+#endif
+       )
+    {
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+        return NGX_DECLINED;
+    }
+
+    naddrs = r->ipv4 ? cn->naddrs : 0;
+
+#if (NGX_HAVE_INET6)
+    naddrs6 = r->ipv6 ? cn->naddrs6 : 0;
+
+    if (naddrs + naddrs6 == 0 && cn->cnlen == 0) {
+#else
+    if (naddrs == 0 && cn->cnlen == 0) {
+#endif
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+        return NGX_DECLINED;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_CORE, r->log, 0,
+                   "resolve shared cached \"%V\"", name);
+
+    p = cn->data;
+
+    rn->naddrs = (u_short) naddrs;
+    rn->cnlen = 0;
+#if (NGX_HAVE_INET6)
+    rn->naddrs6 = 0;
+#endif
+
+    if (naddrs == 1) {
+        ngx_memcpy(&rn->u.addr, p, sizeof(in_addr_t));
+
+    } else if (naddrs > 1) {
+        rn->u.addrs = ngx_resolver_dup(r, p, naddrs * sizeof(in_addr_t));
+        if (rn->u.addrs == NULL) {
+            goto failed;
+        }
+    }
+
+    p += cn->naddrs * sizeof(in_addr_t);
+
+#if (NGX_HAVE_INET6)
+    rn->naddrs6 = (u_short) naddrs6;
+
+    if (naddrs6 == 1) {
+        ngx_memcpy(&rn->u6.addr6, p, sizeof(struct in6_addr));
+
+    } else if (naddrs6 > 1) {
+        rn->u6.addrs6 = ngx_resolver_dup(r, p,
+                                         naddrs6 * sizeof(struct in6_addr));
+        if (rn->u6.addrs6 == NULL) {
+            goto failed;
+        }
+    }
+
+    p += cn->naddrs6 * sizeof(struct in6_addr);
+#endif
+
+    if (naddrs == 0 && cn->cnlen) {
+        rn->u.cname = ngx_resolver_dup(r, p, cn->cnlen);
+        if (rn->u.cname == NULL) {
+            goto failed;
+        }
+
+        rn->cnlen = cn->cnlen;
+    }
+
+    rn->valid = cn->valid;
+    rn->ttl = (uint32_t) (cn->valid - ngx_time());
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    return NGX_OK;
+
+failed:
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    if (rn->naddrs > 1) {
+        ngx_resolver_free(r, rn->u.addrs);
+    }
+
+    rn->naddrs = 0;
+    rn->cnlen = 0;
+
+#if (NGX_HAVE_INET6)
+    if (rn->naddrs6 > 1) {
+        ngx_resolver_free(r, rn->u6.addrs6);
+    }
+
+    rn->naddrs6 = 0;
+#endif
+
+    return NGX_ERROR;
+}
+
+
+static void
+ngx_resolver_cache_store(ngx_resolver_t *r, ngx_resolver_node_t *rn)
+{
+    u_char                     *p;
+    size_t                      size;
+    ngx_str_t                   name;
+    ngx_uint_t                  naddrs, naddrs6;
+    ngx_queue_t                *q;
+    ngx_resolver_cache_t       *cache;
+    ngx_resolver_cache_node_t  *cn, *next;
+
+    naddrs = (rn->naddrs == (u_short) -1) ? 0 : rn->naddrs;
+
+#if (NGX_HAVE_INET6)
+    naddrs6 = (rn->naddrs6 == (u_short) -1) ? 0 : rn->naddrs6;
+#else
+    naddrs6 = 0;
+#endif
+
+    if (naddrs + naddrs6 == 0 && rn->cnlen == 0) {
+        return;
+    }
+
+    name.len = rn->nlen;
+    name.data = rn->name;
+
+    size = offsetof(ngx_resolver_cache_node_t, data)
+           + naddrs * sizeof(in_addr_t)
+#if (NGX_HAVE_INET6)
+           + naddrs6 * sizeof(struct in6_addr)
+#endif
+           + rn->cnlen + rn->nlen;
+
+    cache = r->shm_zone->data;
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    cn = (ngx_resolver_cache_node_t *)
+             ngx_str_rbtree_lookup(&cache->sh->rbtree, &name,
+                                   (uint32_t) rn->node.key);
+
+    if (cn) {
+        if (cn->valid >= rn->valid) {
+            ngx_shmtx_unlock(&cache->shpool->mutex);
+            return;
+        }
+
+        ngx_queue_remove(&cn->queue);
+        ngx_rbtree_delete(&cache->sh->rbtree, &cn->sn.node);
+        ngx_slab_free_locked(cache->shpool, cn);
+    }
+
+    ngx_resolver_cache_expire(cache, 1);
+
+    cn = ngx_slab_alloc_locked(cache->shpool, size);
+
+    if (cn == NULL) {
+        ngx_resolver_cache_expire(cache, 0);
+
+        cn = ngx_slab_alloc_locked(cache->shpool, size);
+        if (cn == NULL) {
+            ngx_shmtx_unlock(&cache->shpool->mutex);
+
+            ngx_log_error(NGX_LOG_ALERT, r->log, 0,
+                          "could not allocate node%s", cache->shpool->log_ctx);
+            return;
+        }
+    }
+
+    cn->valid = rn->valid;
+    cn->naddrs = (u_short) naddrs;
+    cn->naddrs6 = (u_short) naddrs6;
+    cn->cnlen = rn->cnlen;
+    cn->ipv4 = r->ipv4;
+#if (NGX_HAVE_INET6)
+    cn->ipv6 = r->ipv6;
+#else
+    cn->ipv6 = 0;
+#endif
+
+    p = cn->data;
+
+    if (naddrs == 1) {
+        p = ngx_cpymem(p, &rn->u.addr, sizeof(in_addr_t));
+
+    } else if (naddrs > 1) {
+        p = ngx_cpymem(p, rn->u.addrs, naddrs * sizeof(in_addr_t));
+    }
+
+#if (NGX_HAVE_INET6)
+    if (naddrs6 == 1) {
+        p = ngx_cpymem(p, &rn->u6.addr6, sizeof(struct in6_addr));
+
+    } else if (naddrs6 > 1) {
+        p = ngx_cpymem(p, rn->u6.addrs6, naddrs6 * sizeof(struct in6_addr));
+    }
+#endif
+
+    if (rn->cnlen) {
+        p = ngx_cpymem(p, rn->u.cname, rn->cnlen);
+    }
+
+    ngx_memcpy(p, rn->name, rn->nlen);
+
+    cn->sn.node.key = rn->node.key;
+    cn->sn.str.len = rn->nlen;
+    cn->sn.str.data = p;
+
+    ngx_rbtree_insert(&cache->sh->rbtree, &cn->sn.node);
+
+    /*
+     * the queue is sorted by expiration time, most recent first;
+     * new answers usually expire last, so the walk is short
+     */
+
+    for (q = ngx_queue_head(&cache->sh->queue);
+         q != ngx_queue_sentinel(&cache->sh->queue);
+         q = ngx_queue_next(q))
+    {
+        next = ngx_queue_data(q, ngx_resolver_cache_node_t, queue);
+
+        if (next->valid <= cn->valid) {
+            break;
+        }
+    }
+
+    ngx_queue_insert_before(q, &cn->queue);
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+}
+
+
+static void
+ngx_resolver_cache_expire(ngx_resolver_cache_t *cache, ngx_uint_t n)
+{
+    time_t                      now;
+    ngx_queue_t                *q;
+    ngx_resolver_cache_node_t  *cn;
+
+    now = ngx_time();
+
+    /*
+     * n == 1 deletes one or two expired entries
+     * n == 0 deletes the entry expiring first by force
+     *        and one or two expired entries
+     */
+
+    while (n < 3) {
+
+        if (ngx_queue_empty(&cache->sh->queue)) {
+            return;
+        }
+
+        q = ngx_queue_last(&cache->sh->queue);
+
+        cn = ngx_queue_data(q, ngx_resolver_cache_node_t, queue);
+
+        if (n++ != 0 && cn->valid >= now) {
+            return;
+        }
+
+        ngx_queue_remove(q);
+
+        ngx_rbtree_delete(&cache->sh->rbtree, &cn->sn.node);
+
+        ngx_slab_free_locked(cache->shpool, cn);
+    }
+}
+
+
 static ngx_int_t
 ngx_resolver_create_name_query(ngx_resolver_t *r, ngx_resolver_node_t *rn,
     ngx_str_t *name)
@@ -185,6 +185,8 @@ struct ngx_resolver_s {
     ngx_queue_t               addr6_expire_queue;
 #endif
 
+    ngx_shm_zone_t           *shm_zone;
+
     time_t                    resend_timeout;
     time_t                    tcp_timeout;
     time_t                    expire;
@@ -23,6 +23,7 @@
 #define NGX_SLAB_SHIFT_MASK  0x0000000f
 #define NGX_SLAB_MAP_MASK    0xffff0000
 #define NGX_SLAB_MAP_SHIFT   16
+#define NGX_SLAB_SIZE_MASK   0x0000ffff
 
 #define NGX_SLAB_BUSY        0xffffffff
 
@@ -35,6 +36,7 @@
 #define NGX_SLAB_SHIFT_MASK  0x000000000000000f
 #define NGX_SLAB_MAP_MASK    0xffffffff00000000
 #define NGX_SLAB_MAP_SHIFT   32
+#define NGX_SLAB_SIZE_MASK   0x00000000ffffffff
 
 #define NGX_SLAB_BUSY        0xffffffffffffffff
 
@@ -69,6 +71,7 @@
 
 #endif
 
+static ngx_uint_t ngx_slab_size_slot(ngx_slab_pool_t *pool, size_t *size);
 static ngx_slab_page_t *ngx_slab_alloc_pages(ngx_slab_pool_t *pool,
     ngx_uint_t pages);
 static void ngx_slab_free_pages(ngx_slab_pool_t *pool, ngx_slab_page_t *page,
@@ -99,7 +102,7 @@ void
 ngx_slab_init(ngx_slab_pool_t *pool)
 {
     u_char           *p;
-    size_t            size;
+    size_t            size, s;
     ngx_int_t         m;
     ngx_uint_t        i, n, pages;
     ngx_slab_page_t  *slots, *page;
@@ -113,7 +116,7 @@ ngx_slab_init(ngx_slab_pool_t *pool)
 
     ngx_slab_junk(p, size);
 
-    n = ngx_pagesize_shift - pool->min_shift;
+    n = ngx_slab_slots_n(pool);
 
     for (i = 0; i < n; i++) {
         /* only "next" is used in list head */
@@ -127,6 +130,12 @@ ngx_slab_init(ngx_slab_pool_t *pool)
     pool->stats = (ngx_slab_stat_t *) p;
     ngx_memzero(pool->stats, n * sizeof(ngx_slab_stat_t));
 
+    for (i = 0, s = pool->min_size; i < n; s++) {
+        if (ngx_slab_size_slot(pool, &s) == i) {
+            pool->stats[i++].size = s;
+        }
+    }
+
     p += n * sizeof(ngx_slab_stat_t);
 
     size -= n * (sizeof(ngx_slab_page_t) + sizeof(ngx_slab_stat_t));
@@ -183,7 +192,6 @@ ngx_slab_alloc(ngx_slab_pool_t *pool, size_t size)
 void *
 ngx_slab_alloc_locked(ngx_slab_pool_t *pool, size_t size)
 {
-    size_t            s;
     uintptr_t         p, m, mask, *bitmap;
     ngx_uint_t        i, n, slot, shift, map;
     ngx_slab_page_t  *page, *prev, *slots;
@@ -205,14 +213,10 @@ ngx_slab_alloc_locked(ngx_slab_pool_t *pool, size_t size)
         goto done;
     }
 
-    if (size > pool->min_size) {
-        shift = 1;
-        for (s = size - 1; s >>= 1; shift++) { /* void */ }
-        slot = shift - pool->min_shift;
+    slot = ngx_slab_size_slot(pool, &size);
 
-    } else {
-        shift = pool->min_shift;
-        slot = 0;
+    for (shift = pool->min_shift; size > ((size_t) 1 << shift); shift++) {
+        /* void */
     }
 
     pool->stats[slot].reqs++;
@@ -295,7 +299,7 @@ ngx_slab_alloc_locked(ngx_slab_pool_t *pool, size_t size)
 
         } else { /* shift > ngx_slab_exact_shift */
 
-            mask = ((uintptr_t) 1 << (ngx_pagesize >> shift)) - 1;
+            mask = ((uintptr_t) 1 << (ngx_pagesize / size)) - 1;
             mask <<= NGX_SLAB_MAP_SHIFT;
 
             for (m = (uintptr_t) 1 << NGX_SLAB_MAP_SHIFT, i = 0;
@@ -317,7 +321,7 @@ ngx_slab_alloc_locked(ngx_slab_pool_t *pool, size_t size)
                     page->prev = NGX_SLAB_BIG;
                 }
 
-                p = ngx_slab_page_addr(pool, page) + (i << shift);
+                p = ngx_slab_page_addr(pool, page) + i * size;
 
                 pool->stats[slot].used++;
 
@@ -388,13 +392,13 @@ ngx_slab_alloc_locked(ngx_slab_pool_t *pool, size_t size)
 
         } else { /* shift > ngx_slab_exact_shift */
 
-            page->slab = ((uintptr_t) 1 << NGX_SLAB_MAP_SHIFT) | shift;
+            page->slab = ((uintptr_t) 1 << NGX_SLAB_MAP_SHIFT) | size;
             page->next = &slots[slot];
             page->prev = (uintptr_t) &slots[slot] | NGX_SLAB_BIG;
 
             slots[slot].next = page;
 
-            pool->stats[slot].total += ngx_pagesize >> shift;
+            pool->stats[slot].total += ngx_pagesize / size;
 
             p = ngx_slab_page_addr(pool, page);
 
@@ -579,18 +583,17 @@ ngx_slab_free_locked(ngx_slab_pool_t *pool, void *p)
 
     case NGX_SLAB_BIG:
 
-        shift = slab & NGX_SLAB_SHIFT_MASK;
-        size = (size_t) 1 << shift;
+        size = slab & NGX_SLAB_SIZE_MASK;
+        n = (uintptr_t) p & (ngx_pagesize - 1);
 
-        if ((uintptr_t) p & (size - 1)) {
+        if (n % size) {
             goto wrong_chunk;
         }
 
-        m = (uintptr_t) 1 << ((((uintptr_t) p & (ngx_pagesize - 1)) >> shift)
-                              + NGX_SLAB_MAP_SHIFT);
+        m = (uintptr_t) 1 << (n / size + NGX_SLAB_MAP_SHIFT);
 
         if (slab & m) {
-            slot = shift - pool->min_shift;
+            slot = ngx_slab_size_slot(pool, &size);
 
             if (page->next == NULL) {
                 slots = ngx_slab_slots(pool);
@@ -610,7 +613,7 @@ ngx_slab_free_locked(ngx_slab_pool_t *pool, void *p)
 
             ngx_slab_free_pages(pool, page, 1);
 
-            pool->stats[slot].total -= ngx_pagesize >> shift;
+            pool->stats[slot].total -= ngx_pagesize / size;
 
             goto done;
         }
@@ -674,56 +677,145 @@ fail:
 }
 
 
+ngx_uint_t
+ngx_slab_slots_n(ngx_slab_pool_t *pool)
+{
+    size_t  size;
+
+    size = ngx_slab_max_size;
+
+    return ngx_slab_size_slot(pool, &size) + 1;
+}
+
+
+void
+ngx_slab_usage_locked(ngx_slab_pool_t *pool, ngx_slab_usage_t *usage)
+{
+    ngx_slab_page_t  *page;
+
+    usage->pages = pool->last - pool->pages;
+    usage->free = pool->pfree;
+    usage->runs = 0;
+    usage->largest = 0;
+
+    for (page = pool->free.next; page != &pool->free; page = page->next) {
+        usage->runs++;
+
+        if (page->slab > usage->largest) {
+            usage->largest = page->slab;
+        }
+    }
+}
+
+
+static ngx_uint_t
+ngx_slab_size_slot(ngx_slab_pool_t *pool, size_t *size)
+{
+    size_t      s;
+    ngx_uint_t  shift, slot;
+
+    if (*size <= pool->min_size) {
+        *size = pool->min_size;
+        return 0;
+    }
+
+    shift = 1;
+    for (s = *size - 1; s >>= 1; shift++) { /* void */ }
+
+    slot = shift - pool->min_shift;
+
+    if (shift <= ngx_slab_exact_shift + 1) {
+        *size = (size_t) 1 << shift;
+        return slot;
+    }
+
+    /*
+     * sizes above twice the exact size are rounded up to a quarter
+     * of a power of two, so there are four slots per power of two,
+     * with at most 1.25 times the requested size used
+     */
+
+    s = (size_t) 1 << (shift - 3);
+    *size = (*size + s - 1) & ~(s - 1);
+
+    return ngx_slab_exact_shift + 2 - pool->min_shift
+           + ((shift - ngx_slab_exact_shift - 2) << 2)
+           + (*size >> (shift - 3)) - 5;
+}
+
+
 static ngx_slab_page_t *
 ngx_slab_alloc_pages(ngx_slab_pool_t *pool, ngx_uint_t pages)
 {
-    ngx_slab_page_t  *page, *p;
+    ngx_slab_page_t   *page, *p;
+    ngx_slab_usage_t   usage;
+
+    /*
+     * the best fitting run of free pages is used,
+     * to keep larger runs for larger allocations
+     */
+
+    p = NULL;
 
     for (page = pool->free.next; page != &pool->free; page = page->next) {
 
-        if (page->slab >= pages) {
+        if (page->slab >= pages && (p == NULL || page->slab < p->slab)) {
+            p = page;
 
-            if (page->slab > pages) {
-                page[page->slab - 1].prev = (uintptr_t) &page[pages];
+            if (page->slab == pages) {
+                break;
+            }
+        }
+    }
 
-                page[pages].slab = page->slab - pages;
-                page[pages].next = page->next;
-                page[pages].prev = page->prev;
+    if (p) {
+        page = p;
 
-                p = (ngx_slab_page_t *) page->prev;
-                p->next = &page[pages];
-                page->next->prev = (uintptr_t) &page[pages];
+        if (page->slab > pages) {
+            page[page->slab - 1].prev = (uintptr_t) &page[pages];
 
-            } else {
-                p = (ngx_slab_page_t *) page->prev;
-                p->next = page->next;
-                page->next->prev = page->prev;
-            }
+            page[pages].slab = page->slab - pages;
+            page[pages].next = page->next;
+            page[pages].prev = page->prev;
 
-            page->slab = pages | NGX_SLAB_PAGE_START;
-            page->next = NULL;
-            page->prev = NGX_SLAB_PAGE;
+            p = (ngx_slab_page_t *) page->prev;
+            p->next = &page[pages];
+            page->next->prev = (uintptr_t) &page[pages];
 
-            pool->pfree -= pages;
+        } else {
+            p = (ngx_slab_page_t *) page->prev;
+            p->next = page->next;
+            page->next->prev = page->prev;
+        }
 
-            if (--pages == 0) {
-                return page;
-            }
+        page->slab = pages | NGX_SLAB_PAGE_START;
+        page->next = NULL;
+        page->prev = NGX_SLAB_PAGE;
 
-            for (p = page + 1; pages; pages--) {
-                p->slab = NGX_SLAB_PAGE_BUSY;
-                p->next = NULL;
-                p->prev = NGX_SLAB_PAGE;
-                p++;
-            }
+        pool->pfree -= pages;
 
+        if (--pages == 0) {
             return page;
         }
+
+        for (p = page + 1; pages; pages--) {
+            p->slab = NGX_SLAB_PAGE_BUSY;
+            p->next = NULL;
+            p->prev = NGX_SLAB_PAGE;
+            p++;
+        }
+
+        return page;
     }
 
     if (pool->log_nomem) {
-        ngx_slab_error(pool, NGX_LOG_CRIT,
-                       "ngx_slab_alloc() failed: no memory");
+        ngx_slab_usage_locked(pool, &usage);
+
+        ngx_log_error(NGX_LOG_CRIT, ngx_cycle->log, 0,
+                      "ngx_slab_alloc() failed: no memory, "
+                      "%ui of %ui pages free in %ui runs, largest %ui%s",
+                      usage.free, usage.pages, usage.runs, usage.largest,
+                      pool->log_ctx);
     }
 
     return NULL;
@@ -28,9 +28,19 @@ typedef struct {
 
     ngx_uint_t        reqs;
     ngx_uint_t        fails;
+
+    size_t            size;
 } ngx_slab_stat_t;
 
 
+typedef struct {
+    ngx_uint_t        pages;
+    ngx_uint_t        free;
+    ngx_uint_t        runs;
+    ngx_uint_t        largest;
+} ngx_slab_usage_t;
+
+
 typedef struct {
     ngx_shmtx_sh_t    lock;
 
@@ -67,6 +77,8 @@ void *ngx_slab_calloc(ngx_slab_pool_t *pool, size_t size);
 void *ngx_slab_calloc_locked(ngx_slab_pool_t *pool, size_t size);
 void ngx_slab_free(ngx_slab_pool_t *pool, void *p);
 void ngx_slab_free_locked(ngx_slab_pool_t *pool, void *p);
+ngx_uint_t ngx_slab_slots_n(ngx_slab_pool_t *pool);
+void ngx_slab_usage_locked(ngx_slab_pool_t *pool, ngx_slab_usage_t *usage);
 
 
 #endif /* _NGX_SLAB_H_INCLUDED_ */
@@ -570,6 +570,7 @@ ngx_event_module_init(ngx_cycle_t *cycle)
     shm.size = size;
     ngx_str_set(&shm.name, "nginx_shared_zone");
     shm.log = cycle->log;
+    shm.hugepages = 0;
 
     if (ngx_shm_alloc(&shm) != NGX_OK) {
         return NGX_ERROR;
@@ -0,0 +1,569 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+
+
+typedef struct {
+    ngx_temp_file_t     *temp_file;
+    size_t               body_start;
+    off_t                input;
+    ngx_uint_t           done;          /* unsigned  done:1; */
+} ngx_http_encoded_cache_ctx_t;
+
+
+static ngx_int_t ngx_http_encoded_cache_header(ngx_http_request_t *r,
+    ngx_http_encoded_cache_ctx_t *ctx);
+static ngx_int_t ngx_http_encoded_cache_coding(ngx_str_t *set,
+    ngx_str_t *coding);
+static void ngx_http_encoded_cache_abort(ngx_http_request_t *r);
+static void ngx_http_encoded_cache_cleanup(void *data);
+static ngx_int_t ngx_http_encoded_cache_filter_init(ngx_conf_t *cf);
+static ngx_int_t ngx_http_encoded_cache_input_filter_init(ngx_conf_t *cf);
+
+
+static ngx_http_module_t  ngx_http_encoded_cache_filter_module_ctx = {
+    NULL,                                  /* preconfiguration */
+    ngx_http_encoded_cache_filter_init,    /* postconfiguration */
+
+    NULL,                                  /* create main configuration */
+    NULL,                                  /* init main configuration */
+
+    NULL,                                  /* create server configuration */
+    NULL,                                  /* merge server configuration */
+
+    NULL,                                  /* create location configuration */
+    NULL                                   /* merge location configuration */
+};
+
+
+ngx_module_t  ngx_http_encoded_cache_filter_module = {
+    NGX_MODULE_V1,
+    &ngx_http_encoded_cache_filter_module_ctx, /* module context */
+    NULL,                                  /* module directives */
+    NGX_HTTP_MODULE,                       /* module type */
+    NULL,                                  /* init master */
+    NULL,                                  /* init module */
+    NULL,                                  /* init process */
+    NULL,                                  /* init thread */
+    NULL,                                  /* exit thread */
+    NULL,                                  /* exit process */
+    NULL,                                  /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+/*
+ * the input filter is placed before the compression filters to check
+ * that the cached response reaches them unchanged by other filters
+ */
+
+static ngx_http_module_t  ngx_http_encoded_cache_input_filter_module_ctx = {
+    NULL,                                  /* preconfiguration */
+    ngx_http_encoded_cache_input_filter_init, /* postconfiguration */
+
+    NULL,                                  /* create main configuration */
+    NULL,                                  /* init main configuration */
+
+    NULL,                                  /* create server configuration */
+    NULL,                                  /* merge server configuration */
+
+    NULL,                                  /* create location configuration */
+    NULL                                   /* merge location configuration */
+};
+
+
+ngx_module_t  ngx_http_encoded_cache_input_filter_module = {
+    NGX_MODULE_V1,
+    &ngx_http_encoded_cache_input_filter_module_ctx, /* module context */
+    NULL,                                  /* module directives */
+    NGX_HTTP_MODULE,                       /* module type */
+    NULL,                                  /* init master */
+    NULL,                                  /* init module */
+    NULL,                                  /* init process */
+    NULL,                                  /* init thread */
+    NULL,                                  /* exit thread */
+    NULL,                                  /* exit process */
+    NULL,                                  /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+/* the cached header lines that are replaced in encoded variants */
+
+static ngx_str_t  ngx_http_encoded_cache_headers[] = {
+    ngx_string("Content-Length"),
+    ngx_string("Transfer-Encoding"),
+    ngx_string("ETag"),
+    ngx_null_string
+};
+
+
+static ngx_http_output_header_filter_pt  ngx_http_next_header_filter;
+static ngx_http_output_body_filter_pt    ngx_http_next_body_filter;
+static ngx_http_output_header_filter_pt  ngx_http_next_input_header_filter;
+static ngx_http_output_body_filter_pt    ngx_http_next_input_body_filter;
+
+
+static ngx_int_t
+ngx_http_encoded_cache_input_header_filter(ngx_http_request_t *r)
+{
+    ngx_http_cache_t  *c;
+
+    c = r->cache;
+
+    if (c == NULL || c->encoded_node == NULL || r != r->main) {
+        return ngx_http_next_input_header_filter(r);
+    }
+
+    /*
+     * SSI, sub_filter, addition and other filters transforming
+     * the response per request reset or change its length
+     */
+
+    if (r->headers_out.content_length_n
+        != c->length - (off_t) c->body_start)
+    {
+        ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "http encoded cache: response is transformed");
+
+        ngx_http_file_cache_encoded_free(c);
+    }
+
+    return ngx_http_next_input_header_filter(r);
+}
+
+
+static ngx_int_t
+ngx_http_encoded_cache_input_body_filter(ngx_http_request_t *r,
+    ngx_chain_t *in)
+{
+    off_t                          length;
+    ngx_chain_t                   *cl;
+    ngx_http_encoded_cache_ctx_t  *ctx;
+
+    ctx = ngx_http_get_module_ctx(r, ngx_http_encoded_cache_filter_module);
+
+    if (ctx == NULL || ctx->done || in == NULL) {
+        return ngx_http_next_input_body_filter(r, in);
+    }
+
+    /* the output of subrequests is passed here by the postpone filter */
+
+    length = r->cache->length - (off_t) r->cache->body_start;
+
+    for (cl = in; cl; cl = cl->next) {
+
+        if (!ngx_buf_special(cl->buf)) {
+            ctx->input += ngx_buf_size(cl->buf);
+        }
+
+        if (ctx->input > length
+            || (cl->buf->last_buf && ctx->input != length))
+        {
+            ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                           "http encoded cache: body is transformed: "
+                           "%O %O", ctx->input, length);
+
+            ngx_http_encoded_cache_abort(r);
+            break;
+        }
+    }
+
+    return ngx_http_next_input_body_filter(r, in);
+}
+
+
+static ngx_int_t
+ngx_http_encoded_cache_header_filter(ngx_http_request_t *r)
+{
+    ngx_int_t                      rc;
+    ngx_http_cache_t              *c;
+    ngx_pool_cleanup_t            *cln;
+    ngx_http_encoded_cache_ctx_t  *ctx;
+
+    c = r->cache;
+
+    if (c == NULL || c->encoded_node == NULL) {
+        return ngx_http_next_header_filter(r);
+    }
+
+    /*
+     * the encoded variant is stored only if the cached response
+     * was compressed by one of the compression filters
+     */
+
+    if (r->upstream == NULL
+        || r->upstream->cache_status != NGX_HTTP_CACHE_HIT
+        || r->headers_out.status != NGX_HTTP_OK
+        || r->header_only
+        || r != r->main
+        || c->vary.len
+        || r->headers_out.content_encoding == NULL
+        || ngx_http_encoded_cache_coding(&c->encoding,
+                                  &r->headers_out.content_encoding->value)
+           != NGX_OK)
+    {
+        ngx_http_file_cache_encoded_free(c);
+        return ngx_http_next_header_filter(r);
+    }
+
+    ctx = ngx_pcalloc(r->pool, sizeof(ngx_http_encoded_cache_ctx_t));
+    if (ctx == NULL) {
+        return NGX_ERROR;
+    }
+
+    cln = ngx_pool_cleanup_add(r->pool, 0);
+    if (cln == NULL) {
+        return NGX_ERROR;
+    }
+
+    cln->handler = ngx_http_encoded_cache_cleanup;
+    cln->data = ctx;
+
+    rc = ngx_http_encoded_cache_header(r, ctx);
+
+    if (rc == NGX_ERROR) {
+        return NGX_ERROR;
+    }
+
+    if (rc == NGX_DECLINED) {
+        ngx_http_file_cache_encoded_free(c);
+        return ngx_http_next_header_filter(r);
+    }
+
+    ngx_http_set_ctx(r, ctx, ngx_http_encoded_cache_filter_module);
+
+    return ngx_http_next_header_filter(r);
+}
+
+
+static ngx_int_t
+ngx_http_encoded_cache_body_filter(ngx_http_request_t *r, ngx_chain_t *in)
+{
+    off_t                          size;
+    ssize_t                        n;
+    ngx_uint_t                     last;
+    ngx_chain_t                   *cl;
+    ngx_http_encoded_cache_ctx_t  *ctx;
+
+    ctx = ngx_http_get_module_ctx(r, ngx_http_encoded_cache_filter_module);
+
+    if (ctx == NULL || ctx->done || in == NULL) {
+        return ngx_http_next_body_filter(r, in);
+    }
+
+    size = 0;
+    last = 0;
+
+    for (cl = in; cl; cl = cl->next) {
+
+        if (cl->buf->last_buf) {
+            last = 1;
+        }
+
+        if (ngx_buf_special(cl->buf)) {
+            continue;
+        }
+
+        if (!ngx_buf_in_memory(cl->buf)) {
+            ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                           "http encoded cache: file buf");
+            goto failed;
+        }
+
+        size += cl->buf->last - cl->buf->pos;
+    }
+
+    if (size) {
+        n = ngx_write_chain_to_temp_file(ctx->temp_file, in);
+
+        if (n == NGX_ERROR) {
+            goto failed;
+        }
+
+        ctx->temp_file->offset += n;
+    }
+
+    if (last) {
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "http encoded cache store: %O",
+                       ctx->temp_file->offset);
+
+        ctx->done = 1;
+
+        ngx_http_file_cache_encoded_update(r, ctx->temp_file, ctx->body_start);
+    }
+
+    return ngx_http_next_body_filter(r, in);
+
+failed:
+
+    ngx_http_encoded_cache_abort(r);
+
+    return ngx_http_next_body_filter(r, in);
+}
+
+
+static ngx_int_t
+ngx_http_encoded_cache_header(ngx_http_request_t *r,
+    ngx_http_encoded_cache_ctx_t *ctx)
+{
+    u_char                        *p, *last, *line, *name;
+    size_t                         len;
+    ssize_t                        n;
+    ngx_str_t                     *h;
+    ngx_buf_t                     *b;
+    ngx_chain_t                    out;
+    ngx_table_elt_t               *ce, *etag;
+    ngx_temp_file_t               *tf;
+    ngx_http_cache_t              *c;
+    ngx_http_upstream_t           *u;
+    ngx_http_file_cache_header_t  *fh;
+
+    c = r->cache;
+    u = r->upstream;
+
+    if (c->header_start == c->body_start
+        || (size_t) (c->buf->last - c->buf->pos) < c->body_start)
+    {
+        return NGX_DECLINED;
+    }
+
+    ce = r->headers_out.content_encoding;
+    etag = r->headers_out.etag;
+
+    len = c->body_start
+          + sizeof("Content-Encoding: " CRLF) - 1 + ce->value.len;
+
+    if (etag) {
+        len += sizeof("ETag: " CRLF) - 1 + etag->value.len;
+    }
+
+    if (len > c->buffer_size || len > 65535) {
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "http encoded cache: header is too long: %uz", len);
+        return NGX_DECLINED;
+    }
+
+    b = ngx_create_temp_buf(r->pool, len);
+    if (b == NULL) {
+        return NGX_ERROR;
+    }
+
+    if (ngx_http_file_cache_set_header(r, b->pos) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    b->last = b->pos + c->header_start;
+
+    /* copy the cached header lines except the replaced ones */
+
+    p = c->buf->pos + c->header_start;
+    last = c->buf->pos + c->body_start;
+
+    while (p < last) {
+
+        line = p;
+
+        p = ngx_strlchr(p, last, LF);
+        if (p == NULL) {
+            return NGX_DECLINED;
+        }
+
+        p++;
+
+        if (line == c->buf->pos + c->header_start) {
+            /* status line */
+            b->last = ngx_cpymem(b->last, line, p - line);
+            continue;
+        }
+
+        if (*line == CR || *line == LF) {
+
+            /* the end of the header */
+
+            b->last = ngx_cpymem(b->last, "Content-Encoding: ",
+                                 sizeof("Content-Encoding: ") - 1);
+            b->last = ngx_cpymem(b->last, ce->value.data, ce->value.len);
+            *b->last++ = CR; *b->last++ = LF;
+
+            if (etag) {
+                b->last = ngx_cpymem(b->last, "ETag: ", sizeof("ETag: ") - 1);
+                b->last = ngx_cpymem(b->last, etag->value.data,
+                                     etag->value.len);
+                *b->last++ = CR; *b->last++ = LF;
+            }
+
+            b->last = ngx_cpymem(b->last, line, p - line);
+
+            break;
+        }
+
+        name = ngx_strlchr(line, p, ':');
+        if (name == NULL) {
+            return NGX_DECLINED;
+        }
+
+        n = name - line;
+
+        if (n == sizeof("Content-Encoding") - 1
+            && ngx_strncasecmp(line, (u_char *) "Content-Encoding", n) == 0)
+        {
+            /* the cached response is already encoded */
+            return NGX_DECLINED;
+        }
+
+        for (h = ngx_http_encoded_cache_headers; h->len; h++) {
+            if ((size_t) n == h->len
+                && ngx_strncasecmp(line, h->data, h->len) == 0)
+            {
+                break;
+            }
+        }
+
+        if (h->len == 0) {
+            b->last = ngx_cpymem(b->last, line, p - line);
+        }
+    }
+
+    ctx->body_start = b->last - b->pos;
+
+    fh = (ngx_http_file_cache_header_t *) b->pos;
+    fh->body_start = (u_short) ctx->body_start;
+
+    tf = ngx_pcalloc(r->pool, sizeof(ngx_temp_file_t));
+    if (tf == NULL) {
+        return NGX_ERROR;
+    }
+
+    tf->file.fd = NGX_INVALID_FILE;
+    tf->file.log = r->connection->log;
+    tf->path = c->file_cache->use_temp_path ? u->conf->temp_path
+                                            : c->file_cache->path;
+    tf->pool = r->pool;
+    tf->persistent = 1;
+
+    ctx->temp_file = tf;
+
+    out.buf = b;
+    out.next = NULL;
+
+    n = ngx_write_chain_to_temp_file(tf, &out);
+
+    if (n == NGX_ERROR) {
+        return NGX_DECLINED;
+    }
+
+    tf->offset += n;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http encoded cache: \"%V\" %uz",
+                   &ce->value, ctx->body_start);
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_encoded_cache_coding(ngx_str_t *set, ngx_str_t *coding)
+{
+    u_char  *p, *last, *start;
+
+    p = set->data;
+    last = p + set->len;
+
+    while (p < last) {
+        start = p;
+
+        while (p < last && *p != ',' && *p != ';') {
+            p++;
+        }
+
+        if ((size_t) (p - start) == coding->len
+            && ngx_strncasecmp(start, coding->data, coding->len) == 0)
+        {
+            return NGX_OK;
+        }
+
+        while (p < last && *p++ != ',') { /* void */ }
+    }
+
+    return NGX_DECLINED;
+}
+
+
+static void
+ngx_http_encoded_cache_abort(ngx_http_request_t *r)
+{
+    ngx_http_encoded_cache_ctx_t  *ctx;
+
+    ctx = ngx_http_get_module_ctx(r, ngx_http_encoded_cache_filter_module);
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http encoded cache abort");
+
+    ngx_http_encoded_cache_cleanup(ctx);
+
+    ctx->done = 1;
+
+    ngx_http_file_cache_encoded_free(r->cache);
+}
+
+
+static void
+ngx_http_encoded_cache_cleanup(void *data)
+{
+    ngx_http_encoded_cache_ctx_t  *ctx = data;
+
+    ngx_temp_file_t  *tf;
+
+    tf = ctx->temp_file;
+
+    if (ctx->done || tf == NULL || tf->file.fd == NGX_INVALID_FILE) {
+        return;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, tf->file.log, 0,
+                   "http encoded cache incomplete: \"%s\"",
+                   tf->file.name.data);
+
+    if (ngx_delete_file(tf->file.name.data) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_CRIT, tf->file.log, ngx_errno,
+                      ngx_delete_file_n " \"%s\" failed",
+                      tf->file.name.data);
+    }
+
+    ctx->temp_file = NULL;
+}
+
+
+static ngx_int_t
+ngx_http_encoded_cache_filter_init(ngx_conf_t *cf)
+{
+    ngx_http_next_header_filter = ngx_http_top_header_filter;
+    ngx_http_top_header_filter = ngx_http_encoded_cache_header_filter;
+
+    ngx_http_next_body_filter = ngx_http_top_body_filter;
+    ngx_http_top_body_filter = ngx_http_encoded_cache_body_filter;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_encoded_cache_input_filter_init(ngx_conf_t *cf)
+{
+    ngx_http_next_input_header_filter = ngx_http_top_header_filter;
+    ngx_http_top_header_filter = ngx_http_encoded_cache_input_header_filter;
+
+    ngx_http_next_input_body_filter = ngx_http_top_body_filter;
+    ngx_http_top_body_filter = ngx_http_encoded_cache_input_body_filter;
+
+    return NGX_OK;
+}
@@ -3217,6 +3217,19 @@ ngx_http_fastcgi_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
     ngx_conf_merge_value(conf->upstream.cache_background_update,
                               prev->upstream.cache_background_update, 0);
 
+    if (conf->upstream.cache_zone
+        && !conf->upstream.cache_background_update
+        && ((ngx_http_file_cache_t *) conf->upstream.cache_zone->data)
+               ->refresh_ahead)
+    {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"fastcgi_cache\" zone \"%V\" with "
+                           "\"refresh_ahead\" requires "
+                           "\"fastcgi_cache_background_update\"",
+                           &conf->upstream.cache_zone->shm.name);
+        return NGX_CONF_ERROR;
+    }
+
 #endif
 
     ngx_conf_merge_value(conf->upstream.pass_request_headers,
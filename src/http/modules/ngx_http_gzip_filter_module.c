@@ -27,6 +27,11 @@ typedef struct {
     ssize_t              min_length;
 
     ngx_array_t         *types_keys;
+
+#if (NGX_THREADS)
+    ngx_thread_pool_t   *thread_pool;
+    size_t               thread_min_size;
+#endif
 } ngx_http_gzip_conf_t;
 
 
@@ -58,12 +63,27 @@ typedef struct {
     unsigned             buffering:1;
     unsigned             zlib_ng:1;
     unsigned             state_allocated:1;
+    unsigned             thread:1;
+    unsigned             thread_running:1;
+    unsigned             thread_complete:1;
+    unsigned             thread_deflated:1;
 
     size_t               zin;
     size_t               zout;
 
     z_stream             zstream;
     ngx_http_request_t  *request;
+
+#if (NGX_THREADS)
+    ngx_thread_task_t   *thread_task;
+    ngx_chain_t         *thread_taken;
+    ngx_chain_t         *thread_in;
+    ngx_chain_t         *thread_out;
+    ngx_chain_t         *thread_full;
+    ngx_chain_t        **thread_last;
+    ngx_chain_t         *thread_spare;
+    int                  thread_rc;
+#endif
 } ngx_http_gzip_ctx_t;
 
 
@@ -79,6 +99,8 @@ static ngx_int_t ngx_http_gzip_filter_get_buf(ngx_http_request_t *r,
     ngx_http_gzip_ctx_t *ctx);
 static ngx_int_t ngx_http_gzip_filter_deflate(ngx_http_request_t *r,
     ngx_http_gzip_ctx_t *ctx);
+static ngx_int_t ngx_http_gzip_filter_deflate_out(ngx_http_request_t *r,
+    ngx_http_gzip_ctx_t *ctx, int rc);
 static ngx_int_t ngx_http_gzip_filter_deflate_end(ngx_http_request_t *r,
     ngx_http_gzip_ctx_t *ctx);
 
@@ -88,6 +110,15 @@ static void ngx_http_gzip_filter_free(void *opaque, void *address);
 static void ngx_http_gzip_filter_free_copy_buf(ngx_http_request_t *r,
     ngx_http_gzip_ctx_t *ctx);
 
+#if (NGX_THREADS)
+static ngx_int_t ngx_http_gzip_filter_thread_post(ngx_http_request_t *r,
+    ngx_http_gzip_ctx_t *ctx);
+static void ngx_http_gzip_filter_thread(void *data, ngx_log_t *log);
+static void ngx_http_gzip_filter_thread_event_handler(ngx_event_t *ev);
+static ngx_int_t ngx_http_gzip_filter_thread_done(ngx_http_request_t *r,
+    ngx_http_gzip_ctx_t *ctx);
+#endif
+
 static ngx_int_t ngx_http_gzip_add_variables(ngx_conf_t *cf);
 static ngx_int_t ngx_http_gzip_ratio_variable(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data);
@@ -98,6 +129,8 @@ static char *ngx_http_gzip_merge_conf(ngx_conf_t *cf,
     void *parent, void *child);
 static char *ngx_http_gzip_window(ngx_conf_t *cf, void *post, void *data);
 static char *ngx_http_gzip_hash(ngx_conf_t *cf, void *post, void *data);
+static char *ngx_http_gzip_threads(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
 
 
 static ngx_conf_num_bounds_t  ngx_http_gzip_comp_level_bounds = {
@@ -174,6 +207,13 @@ static ngx_command_t  ngx_http_gzip_filter_commands[] = {
       offsetof(ngx_http_gzip_conf_t, min_length),
       NULL },
 
+    { ngx_string("gzip_threads"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_1MORE,
+      ngx_http_gzip_threads,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL },
+
       ngx_null_command
 };
 
@@ -273,6 +313,14 @@ ngx_http_gzip_header_filter(ngx_http_request_t *r)
     ctx->request = r;
     ctx->buffering = (conf->postpone_gzipping != 0);
 
+#if (NGX_THREADS)
+    if (conf->thread_pool
+        && r->headers_out.content_length_n >= (off_t) conf->thread_min_size)
+    {
+        ctx->thread = 1;
+    }
+#endif
+
     ngx_http_gzip_filter_memory(r, ctx);
 
     h = ngx_list_push(&r->headers_out.headers);
@@ -357,6 +405,31 @@ ngx_http_gzip_body_filter(ngx_http_request_t *r, ngx_chain_t *in)
         r->connection->buffered |= NGX_HTTP_GZIP_BUFFERED;
     }
 
+#if (NGX_THREADS)
+
+    if (ctx->thread_running) {
+        return NGX_AGAIN;
+    }
+
+    if (ctx->thread_complete) {
+        if (ngx_http_gzip_filter_thread_done(r, ctx) == NGX_ERROR) {
+            goto failed;
+        }
+
+    } else if (!ctx->thread) {
+        ngx_http_gzip_conf_t  *conf;
+
+        conf = ngx_http_get_module_loc_conf(r, ngx_http_gzip_filter_module);
+
+        if (conf->thread_pool
+            && ctx->zstream.total_in >= conf->thread_min_size)
+        {
+            ctx->thread = 1;
+        }
+    }
+
+#endif
+
     if (ctx->nomem) {
 
         /* flush busy buffers */
@@ -382,6 +455,23 @@ ngx_http_gzip_body_filter(ngx_http_request_t *r, ngx_chain_t *in)
 
         for ( ;; ) {
 
+#if (NGX_THREADS)
+
+            if (ctx->thread) {
+
+                /* large responses are compressed in a thread pool */
+
+                rc = ngx_http_gzip_filter_thread_post(r, ctx);
+
+                if (rc == NGX_ERROR) {
+                    goto failed;
+                }
+
+                break;
+            }
+
+#endif
+
             /* cycle while there is data to feed zlib and ... */
 
             rc = ngx_http_gzip_filter_add_data(r, ctx);
@@ -424,7 +514,7 @@ ngx_http_gzip_body_filter(ngx_http_request_t *r, ngx_chain_t *in)
         if (ctx->out == NULL && !flush) {
             ngx_http_gzip_filter_free_copy_buf(r, ctx);
 
-            return ctx->busy ? NGX_AGAIN : NGX_OK;
+            return (ctx->busy || ctx->thread_running) ? NGX_AGAIN : NGX_OK;
         }
 
         rc = ngx_http_next_body_filter(r, ctx->out);
@@ -439,6 +529,10 @@ ngx_http_gzip_body_filter(ngx_http_request_t *r, ngx_chain_t *in)
                                 (ngx_buf_tag_t) &ngx_http_gzip_filter_module);
         ctx->last_out = &ctx->out;
 
+        if (ctx->thread_running) {
+            return NGX_AGAIN;
+        }
+
         ctx->nomem = 0;
         flush = 0;
 
@@ -745,10 +839,7 @@ ngx_http_gzip_filter_get_buf(ngx_http_request_t *r, ngx_http_gzip_ctx_t *ctx)
 static ngx_int_t
 ngx_http_gzip_filter_deflate(ngx_http_request_t *r, ngx_http_gzip_ctx_t *ctx)
 {
-    int                    rc;
-    ngx_buf_t             *b;
-    ngx_chain_t           *cl;
-    ngx_http_gzip_conf_t  *conf;
+    int  rc;
 
     ngx_log_debug6(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                  "deflate in: ni:%p no:%p ai:%ud ao:%ud fl:%d redo:%d",
@@ -770,6 +861,18 @@ ngx_http_gzip_filter_deflate(ngx_http_request_t *r, ngx_http_gzip_ctx_t *ctx)
                    ctx->zstream.avail_in, ctx->zstream.avail_out,
                    rc);
 
+    return ngx_http_gzip_filter_deflate_out(r, ctx, rc);
+}
+
+
+static ngx_int_t
+ngx_http_gzip_filter_deflate_out(ngx_http_request_t *r,
+    ngx_http_gzip_ctx_t *ctx, int rc)
+{
+    ngx_buf_t             *b;
+    ngx_chain_t           *cl;
+    ngx_http_gzip_conf_t  *conf;
+
     ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                    "gzip in_buf:%p pos:%p",
                    ctx->in_buf, ctx->in_buf->pos);
@@ -919,6 +1022,375 @@ ngx_http_gzip_filter_deflate_end(ngx_http_request_t *r,
 }
 
 
+#if (NGX_THREADS)
+
+static ngx_int_t
+ngx_http_gzip_filter_thread_post(ngx_http_request_t *r,
+    ngx_http_gzip_ctx_t *ctx)
+{
+    ngx_buf_t             *b;
+    ngx_chain_t           *cl, **ll;
+    ngx_thread_task_t     *task;
+    ngx_http_gzip_conf_t  *conf;
+
+    if (ctx->done
+        || (ctx->zstream.avail_in == 0
+            && ctx->flush == Z_NO_FLUSH
+            && !ctx->redo
+            && ctx->in == NULL))
+    {
+        return NGX_DECLINED;
+    }
+
+    conf = ngx_http_get_module_loc_conf(r, ngx_http_gzip_filter_module);
+
+    /*
+     * the thread cannot allocate memory from the request pool,
+     * so all output buffers are handed to it in advance
+     */
+
+    ctx->thread_out = ctx->free;
+    ctx->free = NULL;
+
+    for (ll = &ctx->thread_out; *ll; ll = &(*ll)->next) { /* void */ }
+
+    while (ctx->bufs < conf->bufs.num) {
+
+        b = ngx_create_temp_buf(r->pool, conf->bufs.size);
+        if (b == NULL) {
+            return NGX_ERROR;
+        }
+
+        b->tag = (ngx_buf_tag_t) &ngx_http_gzip_filter_module;
+        b->recycled = 1;
+        ctx->bufs++;
+
+        cl = ngx_alloc_chain_link(r->pool);
+        if (cl == NULL) {
+            return NGX_ERROR;
+        }
+
+        cl->buf = b;
+        cl->next = NULL;
+        *ll = cl;
+        ll = &cl->next;
+    }
+
+    if (ctx->zstream.avail_out == 0 && ctx->thread_out == NULL) {
+        ctx->nomem = 1;
+        return NGX_DECLINED;
+    }
+
+    task = ctx->thread_task;
+
+    if (task == NULL) {
+        task = ngx_thread_task_alloc(r->pool, 0);
+        if (task == NULL) {
+            return NGX_ERROR;
+        }
+
+        task->ctx = ctx;
+        task->handler = ngx_http_gzip_filter_thread;
+        task->event.data = r;
+        task->event.handler = ngx_http_gzip_filter_thread_event_handler;
+
+        ctx->thread_task = task;
+    }
+
+    ctx->thread_in = ctx->in;
+    ctx->thread_taken = ctx->in;
+    ctx->in = NULL;
+
+    ctx->thread_full = NULL;
+    ctx->thread_last = &ctx->thread_full;
+    ctx->thread_spare = NULL;
+    ctx->thread_rc = Z_OK;
+    ctx->thread_deflated = 0;
+
+    /*
+     * the thread changes the zlib state and the bit fields, so the context
+     * is not modified here until the task is done
+     */
+
+    ctx->thread_running = 1;
+
+    if (ngx_thread_task_post(conf->thread_pool, task) != NGX_OK) {
+        ctx->thread_running = 0;
+        return NGX_ERROR;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "gzip thread post: %p", task);
+
+    r->main->blocked++;
+    r->aio = 1;
+
+    r->connection->buffered |= NGX_HTTP_GZIP_BUFFERED;
+
+    return NGX_AGAIN;
+}
+
+
+static void
+ngx_http_gzip_filter_thread(void *data, ngx_log_t *log)
+{
+    ngx_http_gzip_ctx_t *ctx = data;
+
+    int           rc;
+    ngx_buf_t    *b;
+    ngx_chain_t  *cl;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_CORE, log, 0, "gzip thread handler");
+
+    rc = Z_OK;
+
+    /* the same cycle as in ngx_http_gzip_body_filter() */
+
+    for ( ;; ) {
+
+        if (ctx->zstream.avail_in == 0
+            && ctx->flush == Z_NO_FLUSH
+            && !ctx->redo)
+        {
+            cl = ctx->thread_in;
+
+            if (cl == NULL) {
+                break;
+            }
+
+            ctx->thread_in = cl->next;
+            ctx->in_buf = cl->buf;
+
+            ctx->zstream.next_in = ctx->in_buf->pos;
+            ctx->zstream.avail_in = ctx->in_buf->last - ctx->in_buf->pos;
+
+            if (ctx->in_buf->last_buf) {
+                ctx->flush = Z_FINISH;
+
+            } else if (ctx->in_buf->flush) {
+                ctx->flush = Z_SYNC_FLUSH;
+
+            } else if (ctx->zstream.avail_in == 0) {
+                continue;
+            }
+        }
+
+        if (ctx->zstream.avail_out == 0) {
+
+            cl = ctx->thread_out;
+
+            if (cl == NULL) {
+                break;
+            }
+
+            ctx->thread_out = cl->next;
+            b = cl->buf;
+
+            if (ctx->thread_deflated) {
+
+                /* the previous buffer was filled by this thread */
+
+                cl->buf = ctx->out_buf;
+                cl->next = NULL;
+                *ctx->thread_last = cl;
+                ctx->thread_last = &cl->next;
+
+            } else {
+                cl->next = ctx->thread_spare;
+                ctx->thread_spare = cl;
+            }
+
+            ctx->out_buf = b;
+            ctx->zstream.next_out = b->pos;
+            ctx->zstream.avail_out = b->end - b->start;
+
+            ctx->thread_deflated = 0;
+        }
+
+        rc = deflate(&ctx->zstream, ctx->flush);
+
+        if (rc != Z_OK && rc != Z_STREAM_END && rc != Z_BUF_ERROR) {
+            break;
+        }
+
+        if (ctx->zstream.next_in) {
+            ctx->in_buf->pos = ctx->zstream.next_in;
+
+            if (ctx->zstream.avail_in == 0) {
+                ctx->zstream.next_in = NULL;
+            }
+        }
+
+        ctx->out_buf->last = ctx->zstream.next_out;
+        ctx->thread_deflated = 1;
+
+        if (ctx->zstream.avail_out == 0 && rc != Z_STREAM_END) {
+            ctx->redo = 1;
+            continue;
+        }
+
+        ctx->redo = 0;
+
+        if (ctx->flush != Z_NO_FLUSH) {
+
+            /* flushes and the stream end are handled in the main thread */
+
+            break;
+        }
+    }
+
+    ctx->thread_rc = rc;
+}
+
+
+static void
+ngx_http_gzip_filter_thread_event_handler(ngx_event_t *ev)
+{
+    ngx_connection_t     *c;
+    ngx_http_request_t   *r;
+    ngx_http_gzip_ctx_t  *ctx;
+
+    r = ev->data;
+    c = r->connection;
+
+    ngx_http_set_log_request(c->log, r);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "http gzip thread: \"%V?%V\"", &r->uri, &r->args);
+
+    ctx = ngx_http_get_module_ctx(r, ngx_http_gzip_filter_module);
+
+    ctx->thread_running = 0;
+    ctx->thread_complete = 1;
+
+    r->main->blocked--;
+    r->aio = 0;
+
+#if (NGX_HTTP_V2)
+
+    if (r->stream) {
+        /*
+         * for HTTP/2, update write event to make sure processing will
+         * reach the main connection to handle the compressed output
+         */
+
+        c->write->ready = 1;
+        c->write->active = 0;
+    }
+
+#endif
+
+    if (r->done) {
+        /*
+         * trigger connection event handler if the subrequest was
+         * already finalized
+         */
+
+        c->write->handler(c->write);
+
+    } else {
+        r->write_event_handler(r);
+        ngx_http_run_posted_requests(c);
+    }
+}
+
+
+static ngx_int_t
+ngx_http_gzip_filter_thread_done(ngx_http_request_t *r,
+    ngx_http_gzip_ctx_t *ctx)
+{
+    int           rc;
+    ngx_chain_t  *cl, *next;
+
+    ctx->thread_complete = 0;
+
+    /* the input buffers taken by the thread */
+
+    if (ctx->thread_taken != ctx->thread_in && ctx->copy_buf) {
+        ctx->copy_buf->next = ctx->copied;
+        ctx->copied = ctx->copy_buf;
+        ctx->copy_buf = NULL;
+    }
+
+    for (cl = ctx->thread_taken; cl != ctx->thread_in; cl = next) {
+        next = cl->next;
+
+        if (cl->buf->tag != (ngx_buf_tag_t) &ngx_http_gzip_filter_module) {
+            ngx_free_chain(r->pool, cl);
+            continue;
+        }
+
+        if (cl->buf == ctx->in_buf) {
+            ctx->copy_buf = cl;
+
+        } else {
+            cl->next = ctx->copied;
+            ctx->copied = cl;
+        }
+    }
+
+    /* the input left goes before the input added meanwhile */
+
+    if (ctx->thread_in) {
+        for (cl = ctx->thread_in; cl->next; cl = cl->next) { /* void */ }
+
+        cl->next = ctx->in;
+        ctx->in = ctx->thread_in;
+        ctx->thread_in = NULL;
+    }
+
+    /* the output buffers filled by the thread */
+
+    if (ctx->thread_full) {
+        *ctx->last_out = ctx->thread_full;
+        ctx->last_out = ctx->thread_last;
+        ctx->thread_full = NULL;
+    }
+
+    if (ctx->thread_out) {
+        for (cl = ctx->thread_out; cl->next; cl = cl->next) { /* void */ }
+
+        cl->next = ctx->free;
+        ctx->free = ctx->thread_out;
+        ctx->thread_out = NULL;
+    }
+
+    while (ctx->thread_spare) {
+        cl = ctx->thread_spare;
+        ctx->thread_spare = cl->next;
+        ngx_free_chain(r->pool, cl);
+    }
+
+    rc = ctx->thread_rc;
+
+    if (rc != Z_OK && rc != Z_STREAM_END && rc != Z_BUF_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, r->connection->log, 0,
+                      "deflate() failed: %d, %d", ctx->flush, rc);
+        return NGX_ERROR;
+    }
+
+    if (!ctx->thread_deflated) {
+        return NGX_OK;
+    }
+
+    ctx->thread_deflated = 0;
+
+    ngx_log_debug5(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "deflate thread out: ni:%p no:%p ai:%ud ao:%ud rc:%d",
+                   ctx->zstream.next_in, ctx->zstream.next_out,
+                   ctx->zstream.avail_in, ctx->zstream.avail_out,
+                   rc);
+
+    if (ngx_http_gzip_filter_deflate_out(r, ctx, rc) == NGX_ERROR) {
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+#endif
+
+
 static void *
 ngx_http_gzip_filter_alloc(void *opaque, u_int items, u_int size)
 {
@@ -1082,6 +1554,11 @@ ngx_http_gzip_create_conf(ngx_conf_t *cf)
     conf->memlevel = NGX_CONF_UNSET_SIZE;
     conf->min_length = NGX_CONF_UNSET;
 
+#if (NGX_THREADS)
+    conf->thread_pool = NGX_CONF_UNSET_PTR;
+    conf->thread_min_size = NGX_CONF_UNSET_SIZE;
+#endif
+
     return conf;
 }
 
@@ -1106,6 +1583,12 @@ ngx_http_gzip_merge_conf(ngx_conf_t *cf, void *parent, void *child)
                               MAX_MEM_LEVEL - 1);
     ngx_conf_merge_value(conf->min_length, prev->min_length, 20);
 
+#if (NGX_THREADS)
+    ngx_conf_merge_ptr_value(conf->thread_pool, prev->thread_pool, NULL);
+    ngx_conf_merge_size_value(conf->thread_min_size, prev->thread_min_size,
+                              256 * 1024);
+#endif
+
     if (ngx_http_merge_types(cf, &conf->types_keys, &conf->types,
                              &prev->types_keys, &prev->types,
                              ngx_http_html_default_types)
@@ -1177,3 +1660,102 @@ ngx_http_gzip_hash(ngx_conf_t *cf, void *post, void *data)
 
     return "must be 512, 1k, 2k, 4k, 8k, 16k, 32k, 64k, or 128k";
 }
+
+
+static char *
+ngx_http_gzip_threads(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_str_t  *value;
+
+    value = cf->args->elts;
+
+#if (NGX_THREADS)
+    {
+    ngx_http_gzip_conf_t *gzcf = conf;
+
+    ssize_t      size;
+    ngx_str_t    s, name;
+    ngx_uint_t   i;
+
+    if (gzcf->thread_pool != NGX_CONF_UNSET_PTR) {
+        return "is duplicate";
+    }
+
+    if (ngx_strcmp(value[1].data, "off") == 0) {
+
+        if (cf->args->nelts != 2) {
+            return "invalid parameter";
+        }
+
+        gzcf->thread_pool = NULL;
+
+        return NGX_CONF_OK;
+    }
+
+    ngx_str_null(&name);
+
+    for (i = 1; i < cf->args->nelts; i++) {
+
+        if (i == 1 && ngx_strcmp(value[i].data, "on") == 0) {
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "pool=", 5) == 0) {
+
+            name.len = value[i].len - 5;
+            name.data = value[i].data + 5;
+
+            if (name.len == 0) {
+                goto invalid;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "min_size=", 9) == 0) {
+
+            s.len = value[i].len - 9;
+            s.data = value[i].data + 9;
+
+            size = ngx_parse_size(&s);
+
+            if (size == NGX_ERROR) {
+                goto invalid;
+            }
+
+            gzcf->thread_min_size = size;
+
+            continue;
+        }
+
+        goto invalid;
+    }
+
+    gzcf->thread_pool = ngx_thread_pool_add(cf, name.len ? &name : NULL);
+    if (gzcf->thread_pool == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    return NGX_CONF_OK;
+
+invalid:
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "invalid parameter \"%V\"", &value[i]);
+
+    return NGX_CONF_ERROR;
+    }
+
+#else
+
+    if (cf->args->nelts == 2 && ngx_strcmp(value[1].data, "off") == 0) {
+        return NGX_CONF_OK;
+    }
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "\"gzip_threads\" is unsupported on this platform");
+
+    return NGX_CONF_ERROR;
+
+#endif
+}
@@ -17,10 +17,21 @@
 
 typedef struct {
     ngx_uint_t  enable;
+    ngx_flag_t  zstd;
+    ngx_flag_t  brotli;
 } ngx_http_gzip_static_conf_t;
 
 
+typedef struct {
+    ngx_str_t   ext;
+    ngx_str_t   encoding;
+} ngx_http_gzip_static_variant_t;
+
+
 static ngx_int_t ngx_http_gzip_static_handler(ngx_http_request_t *r);
+static ngx_int_t ngx_http_gzip_static_open(ngx_http_request_t *r,
+    ngx_http_core_loc_conf_t *clcf, ngx_str_t *path,
+    ngx_open_file_info_t *of);
 static void *ngx_http_gzip_static_create_conf(ngx_conf_t *cf);
 static char *ngx_http_gzip_static_merge_conf(ngx_conf_t *cf, void *parent,
     void *child);
@@ -44,6 +55,20 @@ static ngx_command_t  ngx_http_gzip_static_commands[] = {
       offsetof(ngx_http_gzip_static_conf_t, enable),
       &ngx_http_gzip_static },
 
+    { ngx_string("zstd_static"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_gzip_static_conf_t, zstd),
+      NULL },
+
+    { ngx_string("brotli_static"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_gzip_static_conf_t, brotli),
+      NULL },
+
       ngx_null_command
 };
 
@@ -79,21 +104,31 @@ ngx_module_t  ngx_http_gzip_static_module = {
 };
 
 
+/* in the order of preference */
+
+static ngx_http_gzip_static_variant_t  ngx_http_gzip_static_variants[] = {
+    { ngx_string(".zst"), ngx_string("zstd") },
+    { ngx_string(".br"), ngx_string("br") },
+    { ngx_string(".gz"), ngx_string("gzip") }
+};
+
+
 static ngx_int_t
 ngx_http_gzip_static_handler(ngx_http_request_t *r)
 {
-    u_char                       *p;
-    size_t                        root;
-    ngx_str_t                     path;
-    ngx_int_t                     rc;
-    ngx_uint_t                    level;
-    ngx_log_t                    *log;
-    ngx_buf_t                    *b;
-    ngx_chain_t                   out;
-    ngx_table_elt_t              *h;
-    ngx_open_file_info_t          of;
-    ngx_http_core_loc_conf_t     *clcf;
-    ngx_http_gzip_static_conf_t  *gzcf;
+    u_char                          *p;
+    size_t                           root;
+    ngx_str_t                        path;
+    ngx_int_t                        rc;
+    ngx_uint_t                       i, n, enable;
+    ngx_log_t                       *log;
+    ngx_buf_t                       *b;
+    ngx_chain_t                      out;
+    ngx_table_elt_t                 *h;
+    ngx_open_file_info_t             of;
+    ngx_http_core_loc_conf_t        *clcf;
+    ngx_http_gzip_static_conf_t     *gzcf;
+    ngx_http_gzip_static_variant_t  *v;
 
     if (!(r->method & (NGX_HTTP_GET|NGX_HTTP_HEAD))) {
         return NGX_DECLINED;
@@ -105,95 +140,92 @@ ngx_http_gzip_static_handler(ngx_http_request_t *r)
 
     gzcf = ngx_http_get_module_loc_conf(r, ngx_http_gzip_static_module);
 
-    if (gzcf->enable == NGX_HTTP_GZIP_STATIC_OFF) {
+    if (gzcf->enable == NGX_HTTP_GZIP_STATIC_OFF
+        && !gzcf->zstd && !gzcf->brotli)
+    {
         return NGX_DECLINED;
     }
 
-    if (gzcf->enable == NGX_HTTP_GZIP_STATIC_ON) {
-        rc = ngx_http_gzip_ok(r);
-
-    } else {
-        /* always */
-        rc = NGX_OK;
-    }
-
     clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
 
-    if (!clcf->gzip_vary && rc != NGX_OK) {
-        return NGX_DECLINED;
-    }
-
     log = r->connection->log;
 
-    p = ngx_http_map_uri_to_path(r, &path, &root, sizeof(".gz") - 1);
+    p = ngx_http_map_uri_to_path(r, &path, &root, sizeof(".zst") - 1);
     if (p == NULL) {
         return NGX_HTTP_INTERNAL_SERVER_ERROR;
     }
 
-    *p++ = '.';
-    *p++ = 'g';
-    *p++ = 'z';
-    *p = '\0';
+    n = sizeof(ngx_http_gzip_static_variants)
+        / sizeof(ngx_http_gzip_static_variant_t);
 
-    path.len = p - path.data;
+    for (i = 0; i < n; i++) {
 
-    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, log, 0,
-                   "http filename: \"%s\"", path.data);
+        v = &ngx_http_gzip_static_variants[i];
 
-    ngx_memzero(&of, sizeof(ngx_open_file_info_t));
+        switch (i) {
 
-    of.read_ahead = clcf->read_ahead;
-    of.directio = clcf->directio;
-    of.valid = clcf->open_file_cache_valid;
-    of.min_uses = clcf->open_file_cache_min_uses;
-    of.errors = clcf->open_file_cache_errors;
-    of.events = clcf->open_file_cache_events;
+        case 0:
+            enable = gzcf->zstd ? NGX_HTTP_GZIP_STATIC_ON
+                                : NGX_HTTP_GZIP_STATIC_OFF;
+            break;
 
-    if (ngx_http_set_disable_symlinks(r, clcf, &path, &of) != NGX_OK) {
-        return NGX_HTTP_INTERNAL_SERVER_ERROR;
-    }
+        case 1:
+            enable = gzcf->brotli ? NGX_HTTP_GZIP_STATIC_ON
+                                  : NGX_HTTP_GZIP_STATIC_OFF;
+            break;
 
-    if (ngx_open_cached_file(clcf->open_file_cache, &path, &of, r->pool)
-        != NGX_OK)
-    {
-        switch (of.err) {
+        default: /* gzip */
+            enable = gzcf->enable;
+            break;
+        }
 
-        case 0:
-            return NGX_HTTP_INTERNAL_SERVER_ERROR;
+        if (enable == NGX_HTTP_GZIP_STATIC_OFF) {
+            continue;
+        }
 
-        case NGX_ENOENT:
-        case NGX_ENOTDIR:
-        case NGX_ENAMETOOLONG:
+        if (enable == NGX_HTTP_GZIP_STATIC_ALWAYS) {
+            rc = NGX_OK;
 
-            return NGX_DECLINED;
+        } else if (i == n - 1) {
+            rc = ngx_http_gzip_ok(r);
 
-        case NGX_EACCES:
-#if (NGX_HAVE_OPENAT)
-        case NGX_EMLINK:
-        case NGX_ELOOP:
-#endif
+        } else {
+            rc = ngx_http_encoding_ok(r, &v->encoding);
+        }
 
-            level = NGX_LOG_ERR;
-            break;
+        if (!clcf->gzip_vary && rc != NGX_OK) {
+            continue;
+        }
+
+        ngx_memcpy(p, v->ext.data, v->ext.len + 1);
 
-        default:
+        path.len = p + v->ext.len - path.data;
 
-            level = NGX_LOG_CRIT;
+        switch (ngx_http_gzip_static_open(r, clcf, &path, &of)) {
+
+        case NGX_OK:
             break;
-        }
 
-        ngx_log_error(level, log, of.err,
-                      "%s \"%s\" failed", of.failed, path.data);
+        case NGX_DECLINED:
+            continue;
 
-        return NGX_DECLINED;
-    }
+        default: /* NGX_ERROR */
+            return NGX_HTTP_INTERNAL_SERVER_ERROR;
+        }
 
-    if (gzcf->enable == NGX_HTTP_GZIP_STATIC_ON) {
-        r->gzip_vary = 1;
+        if (enable == NGX_HTTP_GZIP_STATIC_ON) {
+            r->gzip_vary = 1;
 
-        if (rc != NGX_OK) {
-            return NGX_DECLINED;
+            if (rc != NGX_OK) {
+                continue;
+            }
         }
+
+        break;
+    }
+
+    if (i == n) {
+        return NGX_DECLINED;
     }
 
     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, log, 0, "http static fd: %d", of.fd);
@@ -244,7 +276,7 @@ ngx_http_gzip_static_handler(ngx_http_request_t *r)
     h->hash = 1;
     h->next = NULL;
     ngx_str_set(&h->key, "Content-Encoding");
-    ngx_str_set(&h->value, "gzip");
+    h->value = v->encoding;
     r->headers_out.content_encoding = h;
 
     r->allow_ranges = 1;
@@ -287,6 +319,67 @@ ngx_http_gzip_static_handler(ngx_http_request_t *r)
 }
 
 
+static ngx_int_t
+ngx_http_gzip_static_open(ngx_http_request_t *r,
+    ngx_http_core_loc_conf_t *clcf, ngx_str_t *path, ngx_open_file_info_t *of)
+{
+    ngx_uint_t  level;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http filename: \"%s\"", path->data);
+
+    ngx_memzero(of, sizeof(ngx_open_file_info_t));
+
+    of->read_ahead = clcf->read_ahead;
+    of->directio = clcf->directio;
+    of->valid = clcf->open_file_cache_valid;
+    of->min_uses = clcf->open_file_cache_min_uses;
+    of->errors = clcf->open_file_cache_errors;
+    of->events = clcf->open_file_cache_events;
+
+    if (ngx_http_set_disable_symlinks(r, clcf, path, of) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    if (ngx_open_cached_file(clcf->open_file_cache, path, of, r->pool)
+        == NGX_OK)
+    {
+        return NGX_OK;
+    }
+
+    switch (of->err) {
+
+    case 0:
+        return NGX_ERROR;
+
+    case NGX_ENOENT:
+    case NGX_ENOTDIR:
+    case NGX_ENAMETOOLONG:
+
+        return NGX_DECLINED;
+
+    case NGX_EACCES:
+#if (NGX_HAVE_OPENAT)
+    case NGX_EMLINK:
+    case NGX_ELOOP:
+#endif
+
+        level = NGX_LOG_ERR;
+        break;
+
+    default:
+
+        level = NGX_LOG_CRIT;
+        break;
+    }
+
+    ngx_log_error(level, r->connection->log, of->err,
+                  "%s \"%s\" failed", of->failed, path->data);
+
+    return NGX_DECLINED;
+}
+
+
 static void *
 ngx_http_gzip_static_create_conf(ngx_conf_t *cf)
 {
@@ -298,6 +391,8 @@ ngx_http_gzip_static_create_conf(ngx_conf_t *cf)
     }
 
     conf->enable = NGX_CONF_UNSET_UINT;
+    conf->zstd = NGX_CONF_UNSET;
+    conf->brotli = NGX_CONF_UNSET;
 
     return conf;
 }
@@ -311,6 +406,8 @@ ngx_http_gzip_static_merge_conf(ngx_conf_t *cf, void *parent, void *child)
 
     ngx_conf_merge_uint_value(conf->enable, prev->enable,
                               NGX_HTTP_GZIP_STATIC_OFF);
+    ngx_conf_merge_value(conf->zstd, prev->zstd, 0);
+    ngx_conf_merge_value(conf->brotli, prev->brotli, 0);
 
     return NGX_CONF_OK;
 }
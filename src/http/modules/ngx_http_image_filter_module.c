@@ -32,11 +32,17 @@
 #define NGX_HTTP_IMAGE_GIF       2
 #define NGX_HTTP_IMAGE_PNG       3
 #define NGX_HTTP_IMAGE_WEBP      4
+#define NGX_HTTP_IMAGE_AVIF      5
+
+#define NGX_HTTP_IMAGE_AUTO      6
 
 
 #define NGX_HTTP_IMAGE_BUFFERED  0x08
 
 
+#define NGX_HTTP_IMAGE_AGAIN     ((ngx_buf_t *) NGX_AGAIN)
+
+
 typedef struct {
     ngx_uint_t                   filter;
     ngx_uint_t                   width;
@@ -46,6 +52,8 @@ typedef struct {
     ngx_uint_t                   webp_quality;
     ngx_uint_t                   sharpen;
 
+    ngx_uint_t                   output;
+
     ngx_flag_t                   transparency;
     ngx_flag_t                   interlace;
 
@@ -57,6 +65,10 @@ typedef struct {
     ngx_http_complex_value_t    *shcv;
 
     size_t                       buffer_size;
+
+#if (NGX_THREADS)
+    ngx_thread_pool_t           *thread_pool;
+#endif
 } ngx_http_image_filter_conf_t;
 
 
@@ -74,10 +86,33 @@ typedef struct {
 
     ngx_uint_t                   phase;
     ngx_uint_t                   type;
+    ngx_uint_t                   output;
     ngx_uint_t                   force;
+
+    ngx_int_t                    sharpen;
+    ngx_int_t                    quality;
+
+    u_char                      *out;
+    int                          size;
+
+    /* set by the transformation, which may run in a thread */
+    ngx_uint_t                   asis;
+
+    unsigned                     thread_running:1;
+    unsigned                     thread_complete:1;
 } ngx_http_image_filter_ctx_t;
 
 
+#if (NGX_THREADS)
+
+typedef struct {
+    ngx_http_image_filter_ctx_t   *ctx;
+    ngx_http_image_filter_conf_t  *conf;
+} ngx_http_image_thread_ctx_t;
+
+#endif
+
+
 static ngx_int_t ngx_http_image_send(ngx_http_request_t *r,
     ngx_http_image_filter_ctx_t *ctx, ngx_chain_t *in);
 static ngx_uint_t ngx_http_image_test(ngx_http_request_t *r, ngx_chain_t *in);
@@ -91,14 +126,25 @@ static void ngx_http_image_length(ngx_http_request_t *r, ngx_buf_t *b);
 static ngx_int_t ngx_http_image_size(ngx_http_request_t *r,
     ngx_http_image_filter_ctx_t *ctx);
 
+static ngx_uint_t ngx_http_image_output(ngx_http_request_t *r,
+    ngx_http_image_filter_conf_t *conf);
+
 static ngx_buf_t *ngx_http_image_resize(ngx_http_request_t *r,
     ngx_http_image_filter_ctx_t *ctx);
-static gdImagePtr ngx_http_image_source(ngx_http_request_t *r,
+static ngx_buf_t *ngx_http_image_resized(ngx_http_request_t *r,
     ngx_http_image_filter_ctx_t *ctx);
-static gdImagePtr ngx_http_image_new(ngx_http_request_t *r, int w, int h,
+static void ngx_http_image_transform(ngx_http_image_filter_ctx_t *ctx,
+    ngx_http_image_filter_conf_t *conf, ngx_log_t *log);
+#if (NGX_THREADS)
+static void ngx_http_image_thread_handler(void *data, ngx_log_t *log);
+static void ngx_http_image_thread_event_handler(ngx_event_t *ev);
+#endif
+static gdImagePtr ngx_http_image_source(ngx_http_image_filter_ctx_t *ctx,
+    ngx_log_t *log);
+static gdImagePtr ngx_http_image_new(ngx_log_t *log, int w, int h,
     int colors);
-static u_char *ngx_http_image_out(ngx_http_request_t *r, ngx_uint_t type,
-    gdImagePtr img, int *size);
+static u_char *ngx_http_image_out(ngx_http_image_filter_ctx_t *ctx,
+    gdImagePtr img, ngx_log_t *log);
 static void ngx_http_image_cleanup(void *data);
 static ngx_uint_t ngx_http_image_filter_get_value(ngx_http_request_t *r,
     ngx_http_complex_value_t *cv, ngx_uint_t v);
@@ -116,9 +162,20 @@ static char *ngx_http_image_filter_webp_quality(ngx_conf_t *cf,
     ngx_command_t *cmd, void *conf);
 static char *ngx_http_image_filter_sharpen(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
+static char *ngx_http_image_filter_threads(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
 static ngx_int_t ngx_http_image_filter_init(ngx_conf_t *cf);
 
 
+static ngx_conf_enum_t  ngx_http_image_filter_output[] = {
+    { ngx_string("original"), NGX_HTTP_IMAGE_NONE },
+    { ngx_string("webp"), NGX_HTTP_IMAGE_WEBP },
+    { ngx_string("avif"), NGX_HTTP_IMAGE_AVIF },
+    { ngx_string("auto"), NGX_HTTP_IMAGE_AUTO },
+    { ngx_null_string, 0 }
+};
+
+
 static ngx_command_t  ngx_http_image_filter_commands[] = {
 
     { ngx_string("image_filter"),
@@ -170,6 +227,20 @@ static ngx_command_t  ngx_http_image_filter_commands[] = {
       offsetof(ngx_http_image_filter_conf_t, buffer_size),
       NULL },
 
+    { ngx_string("image_filter_output"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_enum_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_image_filter_conf_t, output),
+      &ngx_http_image_filter_output },
+
+    { ngx_string("image_filter_threads"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE12,
+      ngx_http_image_filter_threads,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL },
+
       ngx_null_command
 };
 
@@ -213,7 +284,8 @@ static ngx_str_t  ngx_http_image_types[] = {
     ngx_string("image/jpeg"),
     ngx_string("image/gif"),
     ngx_string("image/png"),
-    ngx_string("image/webp")
+    ngx_string("image/webp"),
+    ngx_string("image/avif")
 };
 
 
@@ -221,6 +293,7 @@ static ngx_int_t
 ngx_http_image_header_filter(ngx_http_request_t *r)
 {
     off_t                          len;
+    ngx_table_elt_t               *h;
     ngx_http_image_filter_ctx_t   *ctx;
     ngx_http_image_filter_conf_t  *conf;
 
@@ -281,6 +354,25 @@ ngx_http_image_header_filter(ngx_http_request_t *r)
         r->headers_out.refresh->hash = 0;
     }
 
+    if (conf->filter == NGX_HTTP_IMAGE_RESIZE
+        || conf->filter == NGX_HTTP_IMAGE_CROP
+        || conf->filter == NGX_HTTP_IMAGE_ROTATE)
+    {
+        ctx->output = ngx_http_image_output(r, conf);
+
+        if (conf->output == NGX_HTTP_IMAGE_AUTO) {
+            h = ngx_list_push(&r->headers_out.headers);
+            if (h == NULL) {
+                return NGX_ERROR;
+            }
+
+            h->hash = 1;
+            h->next = NULL;
+            ngx_str_set(&h->key, "Vary");
+            ngx_str_set(&h->value, "Accept");
+        }
+    }
+
     r->main_filter_need_in_memory = 1;
     r->allow_ranges = 0;
 
@@ -299,16 +391,16 @@ ngx_http_image_body_filter(ngx_http_request_t *r, ngx_chain_t *in)
 
     ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0, "image filter");
 
-    if (in == NULL) {
-        return ngx_http_next_body_filter(r, in);
-    }
-
     ctx = ngx_http_get_module_ctx(r, ngx_http_image_filter_module);
 
     if (ctx == NULL) {
         return ngx_http_next_body_filter(r, in);
     }
 
+    if (in == NULL && ctx->phase != NGX_HTTP_IMAGE_PROCESS) {
+        return ngx_http_next_body_filter(r, in);
+    }
+
     switch (ctx->phase) {
 
     case NGX_HTTP_IMAGE_START:
@@ -342,6 +434,10 @@ ngx_http_image_body_filter(ngx_http_request_t *r, ngx_chain_t *in)
         r->headers_out.content_type = *ct;
         r->headers_out.content_type_lowcase = NULL;
 
+        if (ctx->output == NGX_HTTP_IMAGE_NONE) {
+            ctx->output = ctx->type;
+        }
+
         if (conf->filter == NGX_HTTP_IMAGE_TEST) {
             ctx->phase = NGX_HTTP_IMAGE_PASS;
 
@@ -366,11 +462,29 @@ ngx_http_image_body_filter(ngx_http_request_t *r, ngx_chain_t *in)
                                               NGX_HTTP_UNSUPPORTED_MEDIA_TYPE);
         }
 
+        ctx->phase = NGX_HTTP_IMAGE_PROCESS;
+
         /* fall through */
 
     case NGX_HTTP_IMAGE_PROCESS:
 
-        out.buf = ngx_http_image_process(r);
+        if (ctx->thread_running) {
+            return NGX_AGAIN;
+        }
+
+        if (ctx->thread_complete) {
+            ctx->thread_complete = 0;
+            r->connection->buffered &= ~NGX_HTTP_IMAGE_BUFFERED;
+
+            out.buf = ngx_http_image_resized(r, ctx);
+
+        } else {
+            out.buf = ngx_http_image_process(r);
+
+            if (out.buf == NGX_HTTP_IMAGE_AGAIN) {
+                return NGX_AGAIN;
+            }
+        }
 
         if (out.buf == NULL) {
             return ngx_http_filter_finalize_request(r,
@@ -566,6 +680,7 @@ ngx_http_image_process(ngx_http_request_t *r)
         && ctx->width <= ctx->max_width
         && ctx->height <= ctx->max_height
         && ctx->angle == 0
+        && ctx->output == ctx->type
         && !ctx->force)
     {
         return ngx_http_image_asis(r, ctx);
@@ -816,37 +931,224 @@ ngx_http_image_size(ngx_http_request_t *r, ngx_http_image_filter_ctx_t *ctx)
 }
 
 
+static ngx_uint_t
+ngx_http_image_output(ngx_http_request_t *r, ngx_http_image_filter_conf_t *conf)
+{
+    ngx_uint_t        i, output;
+    ngx_list_part_t  *part;
+    ngx_table_elt_t  *h;
+
+    if (conf->output != NGX_HTTP_IMAGE_AUTO) {
+        return conf->output;
+    }
+
+    output = NGX_HTTP_IMAGE_NONE;
+
+    part = &r->headers_in.headers.part;
+    h = part->elts;
+
+    for (i = 0; /* void */; i++) {
+
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                break;
+            }
+
+            part = part->next;
+            h = part->elts;
+            i = 0;
+        }
+
+        if (h[i].hash == 0
+            || h[i].key.len != sizeof("Accept") - 1
+            || ngx_strncasecmp(h[i].key.data, (u_char *) "Accept",
+                               sizeof("Accept") - 1)
+               != 0)
+        {
+            continue;
+        }
+
+#if (NGX_HAVE_GD_AVIF)
+        if (ngx_strcasestrn(h[i].value.data, "image/avif", 10 - 1)) {
+            return NGX_HTTP_IMAGE_AVIF;
+        }
+#endif
+
+#if (NGX_HAVE_GD_WEBP)
+        if (ngx_strcasestrn(h[i].value.data, "image/webp", 10 - 1)) {
+            output = NGX_HTTP_IMAGE_WEBP;
+        }
+#endif
+    }
+
+    return output;
+}
+
+
 static ngx_buf_t *
 ngx_http_image_resize(ngx_http_request_t *r, ngx_http_image_filter_ctx_t *ctx)
 {
-    int                            sx, sy, dx, dy, ox, oy, ax, ay, size,
-                                   colors, palette, transparent, sharpen,
+    ngx_http_image_filter_conf_t  *conf;
+#if (NGX_THREADS)
+    ngx_thread_task_t             *task;
+    ngx_http_image_thread_ctx_t   *tctx;
+#endif
+
+    conf = ngx_http_get_module_loc_conf(r, ngx_http_image_filter_module);
+
+    /* variables are evaluated here as the transformation may run in a thread */
+
+    ctx->sharpen = ngx_http_image_filter_get_value(r, conf->shcv,
+                                                   conf->sharpen);
+
+    switch (ctx->output) {
+
+    case NGX_HTTP_IMAGE_JPEG:
+        ctx->quality = ngx_http_image_filter_get_value(r, conf->jqcv,
+                                                       conf->jpeg_quality);
+        if (ctx->quality <= 0) {
+            return NULL;
+        }
+
+        break;
+
+    case NGX_HTTP_IMAGE_WEBP:
+        ctx->quality = ngx_http_image_filter_get_value(r, conf->wqcv,
+                                                       conf->webp_quality);
+        if (ctx->quality <= 0) {
+            return NULL;
+        }
+
+        break;
+
+    default:
+        ctx->quality = 0;
+        break;
+    }
+
+#if (NGX_THREADS)
+
+    if (conf->thread_pool) {
+        task = ngx_thread_task_alloc(r->pool,
+                                     sizeof(ngx_http_image_thread_ctx_t));
+        if (task == NULL) {
+            return NULL;
+        }
+
+        tctx = task->ctx;
+
+        tctx->ctx = ctx;
+        tctx->conf = conf;
+
+        task->handler = ngx_http_image_thread_handler;
+        task->event.data = r;
+        task->event.handler = ngx_http_image_thread_event_handler;
+
+        ctx->thread_running = 1;
+
+        if (ngx_thread_task_post(conf->thread_pool, task) != NGX_OK) {
+            ctx->thread_running = 0;
+            return NULL;
+        }
+
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "image thread post: %p", task);
+
+        r->main->blocked++;
+        r->aio = 1;
+
+        r->connection->buffered |= NGX_HTTP_IMAGE_BUFFERED;
+
+        return NGX_HTTP_IMAGE_AGAIN;
+    }
+
+#endif
+
+    ngx_http_image_transform(ctx, conf, r->connection->log);
+
+    return ngx_http_image_resized(r, ctx);
+}
+
+
+static ngx_buf_t *
+ngx_http_image_resized(ngx_http_request_t *r, ngx_http_image_filter_ctx_t *ctx)
+{
+    ngx_str_t           *ct;
+    ngx_buf_t           *b;
+    ngx_pool_cleanup_t  *cln;
+
+    if (ctx->asis) {
+        return ngx_http_image_asis(r, ctx);
+    }
+
+    ngx_pfree(r->pool, ctx->image);
+
+    if (ctx->out == NULL) {
+        return NULL;
+    }
+
+    cln = ngx_pool_cleanup_add(r->pool, 0);
+    if (cln == NULL) {
+        gdFree(ctx->out);
+        return NULL;
+    }
+
+    b = ngx_calloc_buf(r->pool);
+    if (b == NULL) {
+        gdFree(ctx->out);
+        return NULL;
+    }
+
+    cln->handler = ngx_http_image_cleanup;
+    cln->data = ctx->out;
+
+    b->pos = ctx->out;
+    b->last = ctx->out + ctx->size;
+    b->memory = 1;
+    b->last_buf = 1;
+
+    if (ctx->output != ctx->type) {
+        ct = &ngx_http_image_types[ctx->output - 1];
+        r->headers_out.content_type_len = ct->len;
+        r->headers_out.content_type = *ct;
+        r->headers_out.content_type_lowcase = NULL;
+    }
+
+    ngx_http_image_length(r, b);
+    ngx_http_weak_etag(r);
+
+    return b;
+}
+
+
+static void
+ngx_http_image_transform(ngx_http_image_filter_ctx_t *ctx,
+    ngx_http_image_filter_conf_t *conf, ngx_log_t *log)
+{
+    int                            sx, sy, dx, dy, ox, oy, ax, ay,
+                                   colors, palette, transparent,
                                    red, green, blue, t;
-    u_char                        *out;
-    ngx_buf_t                     *b;
     ngx_uint_t                     resize;
     gdImagePtr                     src, dst;
-    ngx_pool_cleanup_t            *cln;
-    ngx_http_image_filter_conf_t  *conf;
 
-    src = ngx_http_image_source(r, ctx);
+    src = ngx_http_image_source(ctx, log);
 
     if (src == NULL) {
-        return NULL;
+        return;
     }
 
     sx = gdImageSX(src);
     sy = gdImageSY(src);
 
-    conf = ngx_http_get_module_loc_conf(r, ngx_http_image_filter_module);
-
     if (!ctx->force
         && ctx->angle == 0
+        && ctx->output == ctx->type
         && (ngx_uint_t) sx <= ctx->max_width
         && (ngx_uint_t) sy <= ctx->max_height)
     {
         gdImageDestroy(src);
-        return ngx_http_image_asis(r, ctx);
+        ctx->asis = 1;
+        return;
     }
 
     colors = gdImageColorsTotal(src);
@@ -920,10 +1222,10 @@ transparent:
     }
 
     if (resize) {
-        dst = ngx_http_image_new(r, dx, dy, palette);
+        dst = ngx_http_image_new(log, dx, dy, palette);
         if (dst == NULL) {
             gdImageDestroy(src);
-            return NULL;
+            return;
         }
 
         if (colors == 0) {
@@ -953,10 +1255,10 @@ transparent:
 
         case 90:
         case 270:
-            dst = ngx_http_image_new(r, dy, dx, palette);
+            dst = ngx_http_image_new(log, dy, dx, palette);
             if (dst == NULL) {
                 gdImageDestroy(src);
-                return NULL;
+                return;
             }
             if (ctx->angle == 90) {
                 ox = dy / 2 + ay;
@@ -977,10 +1279,10 @@ transparent:
             break;
 
         case 180:
-            dst = ngx_http_image_new(r, dx, dy, palette);
+            dst = ngx_http_image_new(log, dx, dy, palette);
             if (dst == NULL) {
                 gdImageDestroy(src);
-                return NULL;
+                return;
             }
             gdImageCopyRotated(dst, src, dx / 2 - ax, dy / 2 - ay, 0, 0,
                                dx + ax, dy + ay, ctx->angle);
@@ -1009,17 +1311,17 @@ transparent:
 
         if (ox || oy) {
 
-            dst = ngx_http_image_new(r, dx - ox, dy - oy, colors);
+            dst = ngx_http_image_new(log, dx - ox, dy - oy, colors);
 
             if (dst == NULL) {
                 gdImageDestroy(src);
-                return NULL;
+                return;
             }
 
             ox /= 2;
             oy /= 2;
 
-            ngx_log_debug4(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+            ngx_log_debug4(NGX_LOG_DEBUG_HTTP, log, 0,
                            "image crop: %d x %d @ %d x %d",
                            dx, dy, ox, oy);
 
@@ -1042,54 +1344,74 @@ transparent:
         gdImageColorTransparent(dst, gdImageColorExact(dst, red, green, blue));
     }
 
-    sharpen = ngx_http_image_filter_get_value(r, conf->shcv, conf->sharpen);
-    if (sharpen > 0) {
-        gdImageSharpen(dst, sharpen);
+    if (ctx->sharpen > 0) {
+        gdImageSharpen(dst, ctx->sharpen);
     }
 
     gdImageInterlace(dst, (int) conf->interlace);
 
-    out = ngx_http_image_out(r, ctx->type, dst, &size);
+    if ((ctx->output == NGX_HTTP_IMAGE_WEBP
+         || ctx->output == NGX_HTTP_IMAGE_AVIF)
+        && !gdImageTrueColor(dst))
+    {
+        /* WebP and AVIF encoders do not support palette images */
+        gdImagePaletteToTrueColor(dst);
+    }
+
+    ctx->out = ngx_http_image_out(ctx, dst, log);
 
-    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, log, 0,
                    "image: %d x %d %d", sx, sy, colors);
 
     gdImageDestroy(dst);
-    ngx_pfree(r->pool, ctx->image);
+}
 
-    if (out == NULL) {
-        return NULL;
-    }
 
-    cln = ngx_pool_cleanup_add(r->pool, 0);
-    if (cln == NULL) {
-        gdFree(out);
-        return NULL;
-    }
+#if (NGX_THREADS)
 
-    b = ngx_calloc_buf(r->pool);
-    if (b == NULL) {
-        gdFree(out);
-        return NULL;
-    }
+static void
+ngx_http_image_thread_handler(void *data, ngx_log_t *log)
+{
+    ngx_http_image_thread_ctx_t  *tctx = data;
 
-    cln->handler = ngx_http_image_cleanup;
-    cln->data = out;
+    ngx_log_debug0(NGX_LOG_DEBUG_CORE, log, 0, "image thread handler");
 
-    b->pos = out;
-    b->last = out + size;
-    b->memory = 1;
-    b->last_buf = 1;
+    ngx_http_image_transform(tctx->ctx, tctx->conf, log);
+}
 
-    ngx_http_image_length(r, b);
-    ngx_http_weak_etag(r);
 
-    return b;
+static void
+ngx_http_image_thread_event_handler(ngx_event_t *ev)
+{
+    ngx_connection_t             *c;
+    ngx_http_request_t           *r;
+    ngx_http_image_filter_ctx_t  *ctx;
+
+    r = ev->data;
+    c = r->connection;
+
+    ngx_http_set_log_request(c->log, r);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "http image thread: \"%V?%V\"", &r->uri, &r->args);
+
+    ctx = ngx_http_get_module_ctx(r, ngx_http_image_filter_module);
+
+    ctx->thread_running = 0;
+    ctx->thread_complete = 1;
+
+    r->main->blocked--;
+    r->aio = 0;
+
+    r->write_event_handler(r);
+    ngx_http_run_posted_requests(c);
 }
 
+#endif
+
 
 static gdImagePtr
-ngx_http_image_source(ngx_http_request_t *r, ngx_http_image_filter_ctx_t *ctx)
+ngx_http_image_source(ngx_http_image_filter_ctx_t *ctx, ngx_log_t *log)
 {
     char        *failed;
     gdImagePtr   img;
@@ -1128,7 +1450,7 @@ ngx_http_image_source(ngx_http_request_t *r, ngx_http_image_filter_ctx_t *ctx)
     }
 
     if (img == NULL) {
-        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0, failed);
+        ngx_log_error(NGX_LOG_ERR, log, 0, failed);
     }
 
     return img;
@@ -1136,7 +1458,7 @@ ngx_http_image_source(ngx_http_request_t *r, ngx_http_image_filter_ctx_t *ctx)
 
 
 static gdImagePtr
-ngx_http_image_new(ngx_http_request_t *r, int w, int h, int colors)
+ngx_http_image_new(ngx_log_t *log, int w, int h, int colors)
 {
     gdImagePtr  img;
 
@@ -1144,7 +1466,7 @@ ngx_http_image_new(ngx_http_request_t *r, int w, int h, int colors)
         img = gdImageCreateTrueColor(w, h);
 
         if (img == NULL) {
-            ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+            ngx_log_error(NGX_LOG_ERR, log, 0,
                           "gdImageCreateTrueColor() failed");
             return NULL;
         }
@@ -1153,8 +1475,7 @@ ngx_http_image_new(ngx_http_request_t *r, int w, int h, int colors)
         img = gdImageCreate(w, h);
 
         if (img == NULL) {
-            ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
-                          "gdImageCreate() failed");
+            ngx_log_error(NGX_LOG_ERR, log, 0, "gdImageCreate() failed");
             return NULL;
         }
     }
@@ -1164,63 +1485,56 @@ ngx_http_image_new(ngx_http_request_t *r, int w, int h, int colors)
 
 
 static u_char *
-ngx_http_image_out(ngx_http_request_t *r, ngx_uint_t type, gdImagePtr img,
-    int *size)
+ngx_http_image_out(ngx_http_image_filter_ctx_t *ctx, gdImagePtr img,
+    ngx_log_t *log)
 {
-    char                          *failed;
-    u_char                        *out;
-    ngx_int_t                      q;
-    ngx_http_image_filter_conf_t  *conf;
+    char    *failed;
+    u_char  *out;
 
     out = NULL;
 
-    switch (type) {
+    switch (ctx->output) {
 
     case NGX_HTTP_IMAGE_JPEG:
-        conf = ngx_http_get_module_loc_conf(r, ngx_http_image_filter_module);
-
-        q = ngx_http_image_filter_get_value(r, conf->jqcv, conf->jpeg_quality);
-        if (q <= 0) {
-            return NULL;
-        }
-
-        out = gdImageJpegPtr(img, size, q);
+        out = gdImageJpegPtr(img, &ctx->size, ctx->quality);
         failed = "gdImageJpegPtr() failed";
         break;
 
     case NGX_HTTP_IMAGE_GIF:
-        out = gdImageGifPtr(img, size);
+        out = gdImageGifPtr(img, &ctx->size);
         failed = "gdImageGifPtr() failed";
         break;
 
     case NGX_HTTP_IMAGE_PNG:
-        out = gdImagePngPtr(img, size);
+        out = gdImagePngPtr(img, &ctx->size);
         failed = "gdImagePngPtr() failed";
         break;
 
     case NGX_HTTP_IMAGE_WEBP:
 #if (NGX_HAVE_GD_WEBP)
-        conf = ngx_http_get_module_loc_conf(r, ngx_http_image_filter_module);
-
-        q = ngx_http_image_filter_get_value(r, conf->wqcv, conf->webp_quality);
-        if (q <= 0) {
-            return NULL;
-        }
-
-        out = gdImageWebpPtrEx(img, size, q);
+        out = gdImageWebpPtrEx(img, &ctx->size, ctx->quality);
         failed = "gdImageWebpPtrEx() failed";
 #else
         failed = "nginx was built without GD WebP support";
 #endif
         break;
 
+    case NGX_HTTP_IMAGE_AVIF:
+#if (NGX_HAVE_GD_AVIF)
+        out = gdImageAvifPtr(img, &ctx->size);
+        failed = "gdImageAvifPtr() failed";
+#else
+        failed = "nginx was built without GD AVIF support";
+#endif
+        break;
+
     default:
         failed = "unknown image type";
         break;
     }
 
     if (out == NULL) {
-        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0, failed);
+        ngx_log_error(NGX_LOG_ERR, log, 0, failed);
     }
 
     return out;
@@ -1299,9 +1613,13 @@ ngx_http_image_filter_create_conf(ngx_conf_t *cf)
     conf->jpeg_quality = NGX_CONF_UNSET_UINT;
     conf->webp_quality = NGX_CONF_UNSET_UINT;
     conf->sharpen = NGX_CONF_UNSET_UINT;
+    conf->output = NGX_CONF_UNSET_UINT;
     conf->transparency = NGX_CONF_UNSET;
     conf->interlace = NGX_CONF_UNSET;
     conf->buffer_size = NGX_CONF_UNSET_SIZE;
+#if (NGX_THREADS)
+    conf->thread_pool = NGX_CONF_UNSET_PTR;
+#endif
 
     return conf;
 }
@@ -1357,6 +1675,27 @@ ngx_http_image_filter_merge_conf(ngx_conf_t *cf, void *parent, void *child)
         }
     }
 
+    ngx_conf_merge_uint_value(conf->output, prev->output,
+                              NGX_HTTP_IMAGE_NONE);
+
+#if !(NGX_HAVE_GD_WEBP)
+    if (conf->output == NGX_HTTP_IMAGE_WEBP) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"image_filter_output webp\" requires "
+                           "GD WebP support");
+        return NGX_CONF_ERROR;
+    }
+#endif
+
+#if !(NGX_HAVE_GD_AVIF)
+    if (conf->output == NGX_HTTP_IMAGE_AVIF) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"image_filter_output avif\" requires "
+                           "GD AVIF support");
+        return NGX_CONF_ERROR;
+    }
+#endif
+
     ngx_conf_merge_value(conf->transparency, prev->transparency, 1);
 
     ngx_conf_merge_value(conf->interlace, prev->interlace, 0);
@@ -1364,6 +1703,10 @@ ngx_http_image_filter_merge_conf(ngx_conf_t *cf, void *parent, void *child)
     ngx_conf_merge_size_value(conf->buffer_size, prev->buffer_size,
                               1 * 1024 * 1024);
 
+#if (NGX_THREADS)
+    ngx_conf_merge_ptr_value(conf->thread_pool, prev->thread_pool, NULL);
+#endif
+
     return NGX_CONF_OK;
 }
 
@@ -1662,6 +2005,89 @@ ngx_http_image_filter_sharpen(ngx_conf_t *cf, ngx_command_t *cmd,
 }
 
 
+static char *
+ngx_http_image_filter_threads(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_str_t  *value;
+
+    value = cf->args->elts;
+
+#if (NGX_THREADS)
+    {
+    ngx_http_image_filter_conf_t *imcf = conf;
+
+    ngx_str_t    name;
+    ngx_uint_t   i;
+
+    if (imcf->thread_pool != NGX_CONF_UNSET_PTR) {
+        return "is duplicate";
+    }
+
+    if (ngx_strcmp(value[1].data, "off") == 0) {
+
+        if (cf->args->nelts != 2) {
+            return "invalid parameter";
+        }
+
+        imcf->thread_pool = NULL;
+
+        return NGX_CONF_OK;
+    }
+
+    ngx_str_null(&name);
+
+    for (i = 1; i < cf->args->nelts; i++) {
+
+        if (i == 1 && ngx_strcmp(value[i].data, "on") == 0) {
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "pool=", 5) == 0) {
+
+            name.len = value[i].len - 5;
+            name.data = value[i].data + 5;
+
+            if (name.len == 0) {
+                goto invalid;
+            }
+
+            continue;
+        }
+
+        goto invalid;
+    }
+
+    imcf->thread_pool = ngx_thread_pool_add(cf, name.len ? &name : NULL);
+    if (imcf->thread_pool == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    return NGX_CONF_OK;
+
+invalid:
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "invalid parameter \"%V\"", &value[i]);
+
+    return NGX_CONF_ERROR;
+    }
+
+#else
+
+    if (cf->args->nelts == 2 && ngx_strcmp(value[1].data, "off") == 0) {
+        return NGX_CONF_OK;
+    }
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "\"image_filter_threads\" is unsupported "
+                       "on this platform");
+
+    return NGX_CONF_ERROR;
+
+#endif
+}
+
+
 static ngx_int_t
 ngx_http_image_filter_init(ngx_conf_t *cf)
 {
@@ -35,15 +35,70 @@ typedef struct {
     ngx_str_t                   name;
     ngx_array_t                *flushes;
     ngx_array_t                *ops;        /* array of ngx_http_log_op_t */
+    ngx_str_t                   schema;     /* binary formats only */
 } ngx_http_log_fmt_t;
 
 
+typedef struct {
+    ngx_open_file_t            *file;
+    ngx_str_t                   format;
+    ngx_uint_t                  binary;     /* unsigned  binary:1 */
+} ngx_http_log_file_t;
+
+
 typedef struct {
     ngx_array_t                 formats;    /* array of ngx_http_log_fmt_t */
+    ngx_array_t                 files;      /* array of ngx_http_log_file_t */
     ngx_uint_t                  combined_used; /* unsigned  combined_used:1 */
 } ngx_http_log_main_conf_t;
 
 
+#if (NGX_THREADS)
+
+#define NGX_HTTP_LOG_ASYNC_IOVS     64
+
+
+typedef struct {
+    ngx_fd_t                    fd;
+    ngx_int_t                   gzip;
+
+    struct iovec                iovs[NGX_HTTP_LOG_ASYNC_IOVS];
+    ngx_uint_t                  niovs;
+    size_t                      size;
+
+    size_t                      written;
+    ngx_err_t                   err;
+
+    ngx_thread_mutex_t          mutex;
+    ngx_thread_cond_t           cond;
+    ngx_uint_t                  done;   /* unsigned  done:1; */
+} ngx_http_log_async_ctx_t;
+
+
+typedef struct {
+    u_char                     *start;      /* ring of segments */
+    size_t                      size;       /* segment size */
+    ngx_uint_t                  nsegs;
+
+    ngx_uint_t                  head;       /* first unwritten segment */
+    ngx_uint_t                  cur;        /* segment being filled */
+    ngx_uint_t                  inflight;   /* segments being written */
+    size_t                     *len;
+
+    ngx_uint_t                  dropped;
+    ngx_uint_t                  stalled;
+    time_t                      drop_log_time;
+    time_t                      error_log_time;
+
+    ngx_thread_pool_t          *thread_pool;
+    ngx_thread_task_t          *task;
+
+    unsigned                    drop:1;
+} ngx_http_log_async_t;
+
+#endif
+
+
 typedef struct {
     u_char                     *start;
     u_char                     *pos;
@@ -52,6 +107,12 @@ typedef struct {
     ngx_event_t                *event;
     ngx_msec_t                  flush;
     ngx_int_t                   gzip;
+
+    ngx_http_log_fmt_t         *binary;
+
+#if (NGX_THREADS)
+    ngx_http_log_async_t       *async;
+#endif
 } ngx_http_log_buf_t;
 
 
@@ -61,6 +122,16 @@ typedef struct {
 } ngx_http_log_script_t;
 
 
+typedef struct {
+    ngx_uint_t                  rate;       /* log 1 of rate requests */
+    ngx_uint_t                  budget;     /* entries per second */
+    ngx_uint_t                  stride;     /* current rate */
+    ngx_uint_t                  seen;
+    time_t                      time;
+    ngx_http_complex_value_t   *always;
+} ngx_http_log_sample_t;
+
+
 typedef struct {
     ngx_open_file_t            *file;
     ngx_http_log_script_t      *script;
@@ -69,6 +140,7 @@ typedef struct {
     ngx_syslog_peer_t          *syslog_peer;
     ngx_http_log_fmt_t         *format;
     ngx_http_complex_value_t   *filter;
+    ngx_http_log_sample_t      *sample;
 } ngx_http_log_t;
 
 
@@ -93,8 +165,31 @@ typedef struct {
 #define NGX_HTTP_LOG_ESCAPE_DEFAULT  0
 #define NGX_HTTP_LOG_ESCAPE_JSON     1
 #define NGX_HTTP_LOG_ESCAPE_NONE     2
+#define NGX_HTTP_LOG_ESCAPE_BINARY   3
+
+
+/*
+ * a binary log is a sequence of frames:
+ *
+ *     length    4 bytes, little-endian, the frame size without the length
+ *     type      1 byte, 'S' or 'R'
+ *     payload
+ *
+ * a schema frame ('S') starts each buffer written and contains
+ * the version, the format name, the number of fields and the field names,
+ * strings are prefixed with their varint length;
+ *
+ * a record frame ('R') contains fields in schema order, each is
+ * a varint of the value length plus one followed by the value,
+ * or a single zero byte if the variable is not found
+ */
 
+#define NGX_HTTP_LOG_BINARY_VERSION  1
+#define NGX_HTTP_LOG_BINARY_HEADER   5
 
+
+static ngx_int_t ngx_http_log_sample(ngx_http_request_t *r,
+    ngx_http_log_sample_t *sample);
 static void ngx_http_log_write(ngx_http_request_t *r, ngx_http_log_t *log,
     u_char *buf, size_t len);
 static ssize_t ngx_http_log_script_write(ngx_http_request_t *r,
@@ -111,6 +206,19 @@ static void ngx_http_log_gzip_free(void *opaque, void *address);
 static void ngx_http_log_flush(ngx_open_file_t *file, ngx_log_t *log);
 static void ngx_http_log_flush_handler(ngx_event_t *ev);
 
+#if (NGX_THREADS)
+static ngx_int_t ngx_http_log_async_switch(ngx_open_file_t *file);
+static void ngx_http_log_async_post(ngx_open_file_t *file, ngx_log_t *log);
+static void ngx_http_log_async_fill(ngx_open_file_t *file);
+static void ngx_http_log_async_write(ngx_http_log_async_ctx_t *ctx,
+    ngx_log_t *log);
+static void ngx_http_log_async_thread(void *data, ngx_log_t *log);
+static void ngx_http_log_async_handler(ngx_event_t *ev);
+static void ngx_http_log_async_done(ngx_open_file_t *file, ngx_log_t *log);
+static void ngx_http_log_async_flush(ngx_open_file_t *file, ngx_log_t *log);
+static void ngx_http_log_async_cleanup(void *data);
+#endif
+
 static u_char *ngx_http_log_pipe(ngx_http_request_t *r, u_char *buf,
     ngx_http_log_op_t *op);
 static u_char *ngx_http_log_time(ngx_http_request_t *r, u_char *buf,
@@ -141,6 +249,15 @@ static size_t ngx_http_log_json_variable_getlen(ngx_http_request_t *r,
     uintptr_t data);
 static u_char *ngx_http_log_json_variable(ngx_http_request_t *r, u_char *buf,
     ngx_http_log_op_t *op);
+static size_t ngx_http_log_binary_variable_getlen(ngx_http_request_t *r,
+    uintptr_t data);
+static u_char *ngx_http_log_binary_variable(ngx_http_request_t *r,
+    u_char *buf, ngx_http_log_op_t *op);
+static u_char *ngx_http_log_binary_record(ngx_http_request_t *r, u_char *buf,
+    ngx_http_log_fmt_t *fmt);
+static u_char *ngx_http_log_frame(u_char *buf, u_char type, size_t len);
+static size_t ngx_http_log_varint_len(size_t n);
+static u_char *ngx_http_log_varint(u_char *buf, size_t n);
 static size_t ngx_http_log_unescaped_variable_getlen(ngx_http_request_t *r,
     uintptr_t data);
 static u_char *ngx_http_log_unescaped_variable(ngx_http_request_t *r,
@@ -151,14 +268,21 @@ static void *ngx_http_log_create_main_conf(ngx_conf_t *cf);
 static void *ngx_http_log_create_loc_conf(ngx_conf_t *cf);
 static char *ngx_http_log_merge_loc_conf(ngx_conf_t *cf, void *parent,
     void *child);
+static ngx_int_t ngx_http_log_add_file(ngx_conf_t *cf,
+    ngx_http_log_main_conf_t *lmcf, ngx_http_log_t *log);
 static char *ngx_http_log_set_log(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 static char *ngx_http_log_set_format(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
+static char *ngx_http_log_binary_schema(ngx_conf_t *cf,
+    ngx_http_log_fmt_t *fmt);
 static char *ngx_http_log_compile_format(ngx_conf_t *cf,
     ngx_array_t *flushes, ngx_array_t *ops, ngx_array_t *args, ngx_uint_t s);
 static char *ngx_http_log_open_file_cache(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
+static ngx_int_t ngx_http_log_add_variables(ngx_conf_t *cf);
+static ngx_int_t ngx_http_log_sample_weight_variable(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data);
 static ngx_int_t ngx_http_log_init(ngx_conf_t *cf);
 
 
@@ -191,7 +315,7 @@ static ngx_command_t  ngx_http_log_commands[] = {
 
 
 static ngx_http_module_t  ngx_http_log_module_ctx = {
-    NULL,                                  /* preconfiguration */
+    ngx_http_log_add_variables,            /* preconfiguration */
     ngx_http_log_init,                     /* postconfiguration */
 
     ngx_http_log_create_main_conf,         /* create main configuration */
@@ -230,6 +354,19 @@ static ngx_str_t  ngx_http_combined_fmt =
                "\"$http_referer\" \"$http_user_agent\"");
 
 
+/* the weight of the entry being logged, see ngx_http_log_sample() */
+static ngx_uint_t  ngx_http_log_sample_weight = 1;
+
+
+static ngx_http_variable_t  ngx_http_log_variables[] = {
+
+    { ngx_string("log_sample_weight"), NULL,
+      ngx_http_log_sample_weight_variable, 0, NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+      ngx_http_null_variable
+};
+
+
 static ngx_http_log_var_t  ngx_http_log_vars[] = {
     { ngx_string("pipe"), 1, ngx_http_log_pipe },
     { ngx_string("time_local"), sizeof("28/Sep/1970:12:00:00 +0600") - 1,
@@ -261,6 +398,7 @@ ngx_http_log_handler(ngx_http_request_t *r)
     ngx_http_log_t           *log;
     ngx_http_log_op_t        *op;
     ngx_http_log_buf_t       *buffer;
+    ngx_http_log_fmt_t       *fmt;
     ngx_http_log_loc_conf_t  *lcf;
 
     ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
@@ -285,6 +423,20 @@ ngx_http_log_handler(ngx_http_request_t *r)
             }
         }
 
+        if (log[l].sample) {
+            switch (ngx_http_log_sample(r, log[l].sample)) {
+
+            case NGX_ERROR:
+                return NGX_ERROR;
+
+            case NGX_DECLINED:
+                continue;
+            }
+
+        } else {
+            ngx_http_log_sample_weight = 1;
+        }
+
         if (ngx_time() == log[l].disk_full_time) {
 
             /*
@@ -296,7 +448,9 @@ ngx_http_log_handler(ngx_http_request_t *r)
             continue;
         }
 
-        ngx_http_script_flush_no_cacheable_variables(r, log[l].format->flushes);
+        fmt = log[l].format;
+
+        ngx_http_script_flush_no_cacheable_variables(r, fmt->flushes);
 
         len = 0;
         op = log[l].format->ops->elts;
@@ -319,7 +473,12 @@ ngx_http_log_handler(ngx_http_request_t *r)
             goto alloc_line;
         }
 
-        len += NGX_LINEFEED_SIZE;
+        if (fmt->schema.len) {
+            len += fmt->schema.len + NGX_HTTP_LOG_BINARY_HEADER;
+
+        } else {
+            len += NGX_LINEFEED_SIZE;
+        }
 
         buffer = log[l].file ? log[l].file->data : NULL;
 
@@ -327,10 +486,47 @@ ngx_http_log_handler(ngx_http_request_t *r)
 
             if (len > (size_t) (buffer->last - buffer->pos)) {
 
-                ngx_http_log_write(r, &log[l], buffer->start,
-                                   buffer->pos - buffer->start);
+#if (NGX_THREADS)
+                if (buffer->async) {
+
+                    if (len > buffer->async->size) {
+
+                        /*
+                         * the entry does not fit into a segment and is
+                         * written in place, after the queued entries
+                         */
+
+                        ngx_http_log_async_flush(log[l].file,
+                                                 r->connection->log);
+
+                    } else {
+
+                        if (ngx_http_log_async_switch(log[l].file) != NGX_OK)
+                        {
+                            if (buffer->async->drop) {
+                                buffer->async->dropped++;
+                                continue;
+                            }
+
+                            /* the ring is full, write it in place */
+
+                            buffer->async->stalled++;
+                            ngx_http_log_async_flush(log[l].file,
+                                                     r->connection->log);
+                        }
 
-                buffer->pos = buffer->start;
+                        ngx_http_log_async_post(log[l].file,
+                                                r->connection->log);
+                    }
+
+                } else
+#endif
+                {
+                    ngx_http_log_write(r, &log[l], buffer->start,
+                                       buffer->pos - buffer->start);
+
+                    buffer->pos = buffer->start;
+                }
             }
 
             if (len <= (size_t) (buffer->last - buffer->pos)) {
@@ -341,11 +537,21 @@ ngx_http_log_handler(ngx_http_request_t *r)
                     ngx_add_timer(buffer->event, buffer->flush);
                 }
 
-                for (i = 0; i < log[l].format->ops->nelts; i++) {
-                    p = op[i].run(r, p, &op[i]);
-                }
+                if (fmt->schema.len) {
+
+                    if (p == buffer->start) {
+                        p = ngx_cpymem(p, fmt->schema.data, fmt->schema.len);
+                    }
+
+                    p = ngx_http_log_binary_record(r, p, fmt);
+
+                } else {
+                    for (i = 0; i < log[l].format->ops->nelts; i++) {
+                        p = op[i].run(r, p, &op[i]);
+                    }
 
-                ngx_linefeed(p);
+                    ngx_linefeed(p);
+                }
 
                 buffer->pos = p;
 
@@ -366,6 +572,15 @@ ngx_http_log_handler(ngx_http_request_t *r)
 
         p = line;
 
+        if (fmt->schema.len) {
+            p = ngx_cpymem(p, fmt->schema.data, fmt->schema.len);
+            p = ngx_http_log_binary_record(r, p, fmt);
+
+            ngx_http_log_write(r, &log[l], line, p - line);
+
+            continue;
+        }
+
         if (log[l].syslog_peer) {
             p = ngx_syslog_add_header(log[l].syslog_peer, line);
         }
@@ -402,6 +617,56 @@ ngx_http_log_handler(ngx_http_request_t *r)
 }
 
 
+static ngx_int_t
+ngx_http_log_sample(ngx_http_request_t *r, ngx_http_log_sample_t *sample)
+{
+    time_t      now;
+    ngx_str_t   val;
+    ngx_uint_t  rate;
+
+    ngx_http_log_sample_weight = 1;
+
+    if (sample->always) {
+        if (ngx_http_complex_value(r, sample->always, &val) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        if (val.len && (val.len != 1 || val.data[0] != '0')) {
+            return NGX_OK;
+        }
+    }
+
+    if (sample->budget) {
+        now = ngx_time();
+
+        if (now != sample->time) {
+
+            /*
+             * adapt the rate once a second: sample so that the requests
+             * seen during the last period would fit into the budget
+             */
+
+            rate = sample->seen / (now > sample->time ? now - sample->time : 1);
+            rate = (rate + sample->budget - 1) / sample->budget;
+
+            sample->stride = ngx_max(rate, sample->rate);
+            sample->seen = 0;
+            sample->time = now;
+        }
+
+        sample->seen++;
+    }
+
+    if (sample->stride > 1 && (ngx_uint_t) ngx_random() % sample->stride) {
+        return NGX_DECLINED;
+    }
+
+    ngx_http_log_sample_weight = sample->stride;
+
+    return NGX_OK;
+}
+
+
 static void
 ngx_http_log_write(ngx_http_request_t *r, ngx_http_log_t *log, u_char *buf,
     size_t len)
@@ -593,7 +858,6 @@ ngx_http_log_gzip(ngx_fd_t fd, u_char *buf, size_t len, ngx_int_t level,
     ssize_t      n;
     z_stream     zstream;
     ngx_err_t    err;
-    ngx_pool_t  *pool;
 
     wbits = MAX_WBITS;
     memlevel = MAX_MEM_LEVEL - 1;
@@ -612,21 +876,19 @@ ngx_http_log_gzip(ngx_fd_t fd, u_char *buf, size_t len, ngx_int_t level,
 
     ngx_memzero(&zstream, sizeof(z_stream));
 
-    pool = ngx_create_pool(256, log);
-    if (pool == NULL) {
-        /* simulate successful logging */
-        return len;
-    }
-
-    pool->log = log;
+    /*
+     * memory is allocated from heap rather than from a pool,
+     * as logs may be compressed in a thread
+     */
 
     zstream.zalloc = ngx_http_log_gzip_alloc;
     zstream.zfree = ngx_http_log_gzip_free;
-    zstream.opaque = pool;
+    zstream.opaque = log;
 
-    out = ngx_pnalloc(pool, size);
+    out = ngx_alloc(size, log);
     if (out == NULL) {
-        goto done;
+        /* simulate successful logging */
+        return len;
     }
 
     zstream.next_in = buf;
@@ -639,7 +901,8 @@ ngx_http_log_gzip(ngx_fd_t fd, u_char *buf, size_t len, ngx_int_t level,
 
     if (rc != Z_OK) {
         ngx_log_error(NGX_LOG_ALERT, log, 0, "deflateInit2() failed: %d", rc);
-        goto done;
+        ngx_free(out);
+        return len;
     }
 
     ngx_log_debug4(NGX_LOG_DEBUG_HTTP, log, 0,
@@ -652,6 +915,7 @@ ngx_http_log_gzip(ngx_fd_t fd, u_char *buf, size_t len, ngx_int_t level,
     if (rc != Z_STREAM_END) {
         ngx_log_error(NGX_LOG_ALERT, log, 0,
                       "deflate(Z_FINISH) failed: %d", rc);
+        (void) deflateEnd(&zstream);
         goto done;
     }
 
@@ -675,7 +939,7 @@ ngx_http_log_gzip(ngx_fd_t fd, u_char *buf, size_t len, ngx_int_t level,
     if (n != (ssize_t) size) {
         err = (n == -1) ? ngx_errno : 0;
 
-        ngx_destroy_pool(pool);
+        ngx_free(out);
 
         ngx_set_errno(err);
         return -1;
@@ -683,7 +947,7 @@ ngx_http_log_gzip(ngx_fd_t fd, u_char *buf, size_t len, ngx_int_t level,
 
 done:
 
-    ngx_destroy_pool(pool);
+    ngx_free(out);
 
     /* simulate successful logging */
     return len;
@@ -693,12 +957,12 @@ done:
 static void *
 ngx_http_log_gzip_alloc(void *opaque, u_int items, u_int size)
 {
-    ngx_pool_t *pool = opaque;
+    ngx_log_t *log = opaque;
 
-    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, pool->log, 0,
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, log, 0,
                    "gzip alloc: n:%ud s:%ud", items, size);
 
-    return ngx_palloc(pool, items * size);
+    return ngx_alloc(items * size, log);
 }
 
 
@@ -706,10 +970,12 @@ static void
 ngx_http_log_gzip_free(void *opaque, void *address)
 {
 #if 0
-    ngx_pool_t *pool = opaque;
+    ngx_log_t *log = opaque;
 
-    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, pool->log, 0, "gzip free: %p", address);
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, log, 0, "gzip free: %p", address);
 #endif
+
+    ngx_free(address);
 }
 
 #endif
@@ -724,6 +990,13 @@ ngx_http_log_flush(ngx_open_file_t *file, ngx_log_t *log)
 
     buffer = file->data;
 
+#if (NGX_THREADS)
+    if (buffer->async) {
+        ngx_http_log_async_flush(file, log);
+        return;
+    }
+#endif
+
     len = buffer->pos - buffer->start;
 
     if (len == 0) {
@@ -762,151 +1035,500 @@ ngx_http_log_flush(ngx_open_file_t *file, ngx_log_t *log)
 static void
 ngx_http_log_flush_handler(ngx_event_t *ev)
 {
+#if (NGX_THREADS)
+    ngx_open_file_t     *file;
+    ngx_http_log_buf_t  *buffer;
+#endif
+
     ngx_log_debug0(NGX_LOG_DEBUG_EVENT, ev->log, 0,
                    "http log buffer flush handler");
 
-    ngx_http_log_flush(ev->data, ev->log);
-}
+#if (NGX_THREADS)
 
+    file = ev->data;
+    buffer = file->data;
 
-static u_char *
-ngx_http_log_copy_short(ngx_http_request_t *r, u_char *buf,
-    ngx_http_log_op_t *op)
-{
-    size_t     len;
-    uintptr_t  data;
+    if (buffer->async) {
 
-    len = op->len;
-    data = op->data;
+        if (ngx_http_log_async_switch(file) != NGX_OK) {
+            /* the ring is full, retry later */
+            ngx_add_timer(ev, buffer->flush);
+        }
 
-    while (len--) {
-        *buf++ = (u_char) (data & 0xff);
-        data >>= 8;
+        ngx_http_log_async_post(file, ev->log);
+        return;
     }
 
-    return buf;
+#endif
+
+    ngx_http_log_flush(ev->data, ev->log);
 }
 
 
-static u_char *
-ngx_http_log_copy_long(ngx_http_request_t *r, u_char *buf,
-    ngx_http_log_op_t *op)
+#if (NGX_THREADS)
+
+static ngx_int_t
+ngx_http_log_async_switch(ngx_open_file_t *file)
 {
-    return ngx_cpymem(buf, (u_char *) op->data, op->len);
-}
+    ngx_uint_t             next;
+    ngx_http_log_buf_t    *buffer;
+    ngx_http_log_async_t  *async;
 
+    buffer = file->data;
+    async = buffer->async;
 
-static u_char *
-ngx_http_log_pipe(ngx_http_request_t *r, u_char *buf, ngx_http_log_op_t *op)
-{
-    if (r->pipeline) {
-        *buf = 'p';
-    } else {
-        *buf = '.';
+    if (buffer->pos == buffer->start) {
+        return NGX_OK;
     }
 
-    return buf + 1;
-}
+    next = async->cur + 1;
 
+    if (next == async->nsegs) {
+        next = 0;
+    }
 
-static u_char *
-ngx_http_log_time(ngx_http_request_t *r, u_char *buf, ngx_http_log_op_t *op)
-{
-    return ngx_cpymem(buf, ngx_cached_http_log_time.data,
-                      ngx_cached_http_log_time.len);
-}
+    if (next == async->head) {
+        return NGX_BUSY;
+    }
 
-static u_char *
-ngx_http_log_iso8601(ngx_http_request_t *r, u_char *buf, ngx_http_log_op_t *op)
-{
-    return ngx_cpymem(buf, ngx_cached_http_log_iso8601.data,
-                      ngx_cached_http_log_iso8601.len);
-}
+    async->len[async->cur] = buffer->pos - buffer->start;
+    async->cur = next;
 
-static u_char *
-ngx_http_log_msec(ngx_http_request_t *r, u_char *buf, ngx_http_log_op_t *op)
-{
-    ngx_time_t  *tp;
+    buffer->start = async->start + next * async->size;
+    buffer->pos = buffer->start;
+    buffer->last = buffer->start + async->size;
 
-    tp = ngx_timeofday();
+    if (buffer->event && buffer->event->timer_set) {
+        ngx_del_timer(buffer->event);
+    }
 
-    return ngx_sprintf(buf, "%T.%03M", tp->sec, tp->msec);
+    return NGX_OK;
 }
 
 
-static u_char *
-ngx_http_log_request_time(ngx_http_request_t *r, u_char *buf,
-    ngx_http_log_op_t *op)
+static void
+ngx_http_log_async_post(ngx_open_file_t *file, ngx_log_t *log)
 {
-    ngx_time_t      *tp;
-    ngx_msec_int_t   ms;
+    ngx_thread_task_t     *task;
+    ngx_http_log_buf_t    *buffer;
+    ngx_http_log_async_t  *async;
 
-    tp = ngx_timeofday();
+    buffer = file->data;
+    async = buffer->async;
+    task = async->task;
 
-    ms = (ngx_msec_int_t)
-             ((tp->sec - r->start_sec) * 1000 + (tp->msec - r->start_msec));
-    ms = ngx_max(ms, 0);
+    if (async->inflight || task->event.active || async->head == async->cur) {
+        return;
+    }
 
-    return ngx_sprintf(buf, "%T.%03M", (time_t) ms / 1000, ms % 1000);
+    ngx_http_log_async_fill(file);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, log, 0,
+                   "http log async post: %ui segments, %uz bytes",
+                   async->inflight,
+                   ((ngx_http_log_async_ctx_t *) task->ctx)->size);
+
+    if (ngx_thread_task_post(async->thread_pool, task) != NGX_OK) {
+
+        /* the thread pool queue is overflowed, write in place */
+
+        ngx_http_log_async_write(task->ctx, log);
+        ngx_http_log_async_done(file, log);
+    }
 }
 
 
-static u_char *
-ngx_http_log_status(ngx_http_request_t *r, u_char *buf, ngx_http_log_op_t *op)
+static void
+ngx_http_log_async_fill(ngx_open_file_t *file)
 {
-    ngx_uint_t  status;
+    ngx_uint_t                 i, n;
+    ngx_http_log_buf_t        *buffer;
+    ngx_http_log_async_t      *async;
+    ngx_http_log_async_ctx_t  *ctx;
 
-    if (r->err_status) {
-        status = r->err_status;
+    buffer = file->data;
+    async = buffer->async;
+    ctx = async->task->ctx;
 
-    } else if (r->headers_out.status) {
-        status = r->headers_out.status;
+    ctx->fd = file->fd;
+    ctx->gzip = buffer->gzip;
+    ctx->size = 0;
+    ctx->written = 0;
+    ctx->err = 0;
+    ctx->done = 0;
 
-    } else if (r->http_version == NGX_HTTP_VERSION_9) {
-        status = 9;
+    n = 0;
 
-    } else {
-        status = 0;
+    for (i = async->head;
+         i != async->cur && n < NGX_HTTP_LOG_ASYNC_IOVS;
+         i = (i + 1 == async->nsegs) ? 0 : i + 1)
+    {
+        ctx->iovs[n].iov_base = async->start + i * async->size;
+        ctx->iovs[n].iov_len = async->len[i];
+        ctx->size += async->len[i];
+        n++;
     }
 
-    return ngx_sprintf(buf, "%03ui", status);
+    ctx->niovs = n;
+
+    async->inflight = n;
 }
 
 
-static u_char *
-ngx_http_log_bytes_sent(ngx_http_request_t *r, u_char *buf,
-    ngx_http_log_op_t *op)
+static void
+ngx_http_log_async_write(ngx_http_log_async_ctx_t *ctx, ngx_log_t *log)
 {
-    return ngx_sprintf(buf, "%O", r->connection->sent);
-}
+    ssize_t        n;
+    ngx_err_t      err;
+    ngx_uint_t     niovs;
+    struct iovec  *iov;
 
+#if (NGX_ZLIB)
+    if (ctx->gzip) {
+        ngx_uint_t  i;
 
-/*
- * although there is a real $body_bytes_sent variable,
- * this log operation code function is more optimized for logging
- */
+        for (i = 0; i < ctx->niovs; i++) {
+            n = ngx_http_log_gzip(ctx->fd, ctx->iovs[i].iov_base,
+                                  ctx->iovs[i].iov_len, ctx->gzip, log);
 
-static u_char *
-ngx_http_log_body_bytes_sent(ngx_http_request_t *r, u_char *buf,
-    ngx_http_log_op_t *op)
-{
-    off_t  length;
+            if (n == -1) {
+                ctx->err = ngx_errno;
+                return;
+            }
 
-    length = r->connection->sent - r->header_size;
+            ctx->written += ctx->iovs[i].iov_len;
+        }
 
-    if (length > 0) {
-        return ngx_sprintf(buf, "%O", length);
+        return;
     }
+#endif
 
-    *buf = '0';
+    iov = ctx->iovs;
+    niovs = ctx->niovs;
 
-    return buf + 1;
-}
+    for ( ;; ) {
+        n = writev(ctx->fd, iov, niovs);
 
+        if (n == -1) {
+            err = ngx_errno;
 
-static u_char *
-ngx_http_log_request_length(ngx_http_request_t *r, u_char *buf,
-    ngx_http_log_op_t *op)
+            if (err == NGX_EINTR) {
+                continue;
+            }
+
+            ctx->err = err;
+            return;
+        }
+
+        ctx->written += n;
+
+        if (ctx->written == ctx->size || n == 0) {
+            return;
+        }
+
+        while ((size_t) n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            niovs--;
+        }
+
+        iov->iov_base = (u_char *) iov->iov_base + n;
+        iov->iov_len -= n;
+    }
+}
+
+
+static void
+ngx_http_log_async_thread(void *data, ngx_log_t *log)
+{
+    ngx_http_log_async_ctx_t  *ctx = data;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, log, 0,
+                   "http log async thread: %uz bytes", ctx->size);
+
+    ngx_http_log_async_write(ctx, log);
+
+    (void) ngx_thread_mutex_lock(&ctx->mutex, log);
+
+    ctx->done = 1;
+
+    (void) ngx_thread_cond_signal(&ctx->cond, log);
+    (void) ngx_thread_mutex_unlock(&ctx->mutex, log);
+}
+
+
+static void
+ngx_http_log_async_handler(ngx_event_t *ev)
+{
+    ngx_open_file_t       *file;
+    ngx_http_log_buf_t    *buffer;
+    ngx_http_log_async_t  *async;
+
+    file = ev->data;
+    buffer = file->data;
+    async = buffer->async;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ev->log, 0,
+                   "http log async handler");
+
+    /* the segments may be already accounted by a flush */
+
+    if (async->inflight) {
+        ngx_http_log_async_done(file, ev->log);
+    }
+
+    ngx_http_log_async_post(file, ev->log);
+}
+
+
+static void
+ngx_http_log_async_done(ngx_open_file_t *file, ngx_log_t *log)
+{
+    time_t                     now;
+    ngx_http_log_buf_t        *buffer;
+    ngx_http_log_async_t      *async;
+    ngx_http_log_async_ctx_t  *ctx;
+
+    buffer = file->data;
+    async = buffer->async;
+    ctx = async->task->ctx;
+
+    async->head = (async->head + async->inflight) % async->nsegs;
+    async->inflight = 0;
+
+    now = ngx_time();
+
+    if (ctx->written != ctx->size && now - async->error_log_time > 59) {
+
+        if (ctx->err) {
+            ngx_log_error(NGX_LOG_ALERT, log, ctx->err,
+                          "writev() to \"%s\" failed", file->name.data);
+
+        } else {
+            ngx_log_error(NGX_LOG_ALERT, log, 0,
+                          "writev() to \"%s\" was incomplete: %uz of %uz",
+                          file->name.data, ctx->written, ctx->size);
+        }
+
+        async->error_log_time = now;
+    }
+
+    if ((async->dropped || async->stalled)
+        && now - async->drop_log_time > 59)
+    {
+        ngx_log_error(NGX_LOG_WARN, log, 0,
+                      "log ring of \"%s\" was full: %ui entries dropped, "
+                      "%ui times written in place",
+                      file->name.data, async->dropped, async->stalled);
+
+        async->dropped = 0;
+        async->stalled = 0;
+        async->drop_log_time = now;
+    }
+}
+
+
+static void
+ngx_http_log_async_flush(ngx_open_file_t *file, ngx_log_t *log)
+{
+    ngx_http_log_buf_t        *buffer;
+    ngx_http_log_async_t      *async;
+    ngx_http_log_async_ctx_t  *ctx;
+
+    buffer = file->data;
+    async = buffer->async;
+    ctx = async->task->ctx;
+
+    /*
+     * wait until the thread signals completion of the task,
+     * then write everything in place
+     */
+
+    if (async->inflight) {
+
+        if (ngx_thread_mutex_lock(&ctx->mutex, log) != NGX_OK) {
+            return;
+        }
+
+        while (!ctx->done) {
+            if (ngx_thread_cond_wait(&ctx->cond, &ctx->mutex, log) != NGX_OK) {
+                (void) ngx_thread_mutex_unlock(&ctx->mutex, log);
+                return;
+            }
+        }
+
+        (void) ngx_thread_mutex_unlock(&ctx->mutex, log);
+
+        ngx_http_log_async_done(file, log);
+    }
+
+    for ( ;; ) {
+
+        while (async->head != async->cur) {
+            ngx_http_log_async_fill(file);
+            ngx_http_log_async_write(ctx, log);
+            ngx_http_log_async_done(file, log);
+        }
+
+        if (buffer->pos == buffer->start) {
+            break;
+        }
+
+        (void) ngx_http_log_async_switch(file);
+    }
+}
+
+
+static void
+ngx_http_log_async_cleanup(void *data)
+{
+    ngx_http_log_async_ctx_t  *ctx = data;
+
+    (void) ngx_thread_cond_destroy(&ctx->cond, ngx_cycle->log);
+    (void) ngx_thread_mutex_destroy(&ctx->mutex, ngx_cycle->log);
+}
+
+#endif
+
+
+static u_char *
+ngx_http_log_copy_short(ngx_http_request_t *r, u_char *buf,
+    ngx_http_log_op_t *op)
+{
+    size_t     len;
+    uintptr_t  data;
+
+    len = op->len;
+    data = op->data;
+
+    while (len--) {
+        *buf++ = (u_char) (data & 0xff);
+        data >>= 8;
+    }
+
+    return buf;
+}
+
+
+static u_char *
+ngx_http_log_copy_long(ngx_http_request_t *r, u_char *buf,
+    ngx_http_log_op_t *op)
+{
+    return ngx_cpymem(buf, (u_char *) op->data, op->len);
+}
+
+
+static u_char *
+ngx_http_log_pipe(ngx_http_request_t *r, u_char *buf, ngx_http_log_op_t *op)
+{
+    if (r->pipeline) {
+        *buf = 'p';
+    } else {
+        *buf = '.';
+    }
+
+    return buf + 1;
+}
+
+
+static u_char *
+ngx_http_log_time(ngx_http_request_t *r, u_char *buf, ngx_http_log_op_t *op)
+{
+    return ngx_cpymem(buf, ngx_cached_http_log_time.data,
+                      ngx_cached_http_log_time.len);
+}
+
+static u_char *
+ngx_http_log_iso8601(ngx_http_request_t *r, u_char *buf, ngx_http_log_op_t *op)
+{
+    return ngx_cpymem(buf, ngx_cached_http_log_iso8601.data,
+                      ngx_cached_http_log_iso8601.len);
+}
+
+static u_char *
+ngx_http_log_msec(ngx_http_request_t *r, u_char *buf, ngx_http_log_op_t *op)
+{
+    ngx_time_t  *tp;
+
+    tp = ngx_timeofday();
+
+    return ngx_sprintf(buf, "%T.%03M", tp->sec, tp->msec);
+}
+
+
+static u_char *
+ngx_http_log_request_time(ngx_http_request_t *r, u_char *buf,
+    ngx_http_log_op_t *op)
+{
+    ngx_time_t      *tp;
+    ngx_msec_int_t   ms;
+
+    tp = ngx_timeofday();
+
+    ms = (ngx_msec_int_t)
+             ((tp->sec - r->start_sec) * 1000 + (tp->msec - r->start_msec));
+    ms = ngx_max(ms, 0);
+
+    return ngx_sprintf(buf, "%T.%03M", (time_t) ms / 1000, ms % 1000);
+}
+
+
+static u_char *
+ngx_http_log_status(ngx_http_request_t *r, u_char *buf, ngx_http_log_op_t *op)
+{
+    ngx_uint_t  status;
+
+    if (r->err_status) {
+        status = r->err_status;
+
+    } else if (r->headers_out.status) {
+        status = r->headers_out.status;
+
+    } else if (r->http_version == NGX_HTTP_VERSION_9) {
+        status = 9;
+
+    } else {
+        status = 0;
+    }
+
+    return ngx_sprintf(buf, "%03ui", status);
+}
+
+
+static u_char *
+ngx_http_log_bytes_sent(ngx_http_request_t *r, u_char *buf,
+    ngx_http_log_op_t *op)
+{
+    return ngx_sprintf(buf, "%O", r->connection->sent);
+}
+
+
+/*
+ * although there is a real $body_bytes_sent variable,
+ * this log operation code function is more optimized for logging
+ */
+
+static u_char *
+ngx_http_log_body_bytes_sent(ngx_http_request_t *r, u_char *buf,
+    ngx_http_log_op_t *op)
+{
+    off_t  length;
+
+    length = r->connection->sent - r->header_size;
+
+    if (length > 0) {
+        return ngx_sprintf(buf, "%O", length);
+    }
+
+    *buf = '0';
+
+    return buf + 1;
+}
+
+
+static u_char *
+ngx_http_log_request_length(ngx_http_request_t *r, u_char *buf,
+    ngx_http_log_op_t *op)
 {
     return ngx_sprintf(buf, "%O", r->request_length);
 }
@@ -926,6 +1548,11 @@ ngx_http_log_variable_compile(ngx_conf_t *cf, ngx_http_log_op_t *op,
     op->len = 0;
 
     switch (escape) {
+    case NGX_HTTP_LOG_ESCAPE_BINARY:
+        op->getlen = ngx_http_log_binary_variable_getlen;
+        op->run = ngx_http_log_binary_variable;
+        break;
+
     case NGX_HTTP_LOG_ESCAPE_JSON:
         op->getlen = ngx_http_log_json_variable_getlen;
         op->run = ngx_http_log_json_variable;
@@ -1122,6 +1749,103 @@ ngx_http_log_unescaped_variable(ngx_http_request_t *r, u_char *buf,
 }
 
 
+static size_t
+ngx_http_log_binary_variable_getlen(ngx_http_request_t *r, uintptr_t data)
+{
+    ngx_http_variable_value_t  *value;
+
+    value = ngx_http_get_indexed_variable(r, data);
+
+    if (value == NULL || value->not_found) {
+        return 1;
+    }
+
+    return ngx_http_log_varint_len(value->len + 1) + value->len;
+}
+
+
+static u_char *
+ngx_http_log_binary_variable(ngx_http_request_t *r, u_char *buf,
+    ngx_http_log_op_t *op)
+{
+    ngx_http_variable_value_t  *value;
+
+    value = ngx_http_get_indexed_variable(r, op->data);
+
+    if (value == NULL || value->not_found) {
+        *buf++ = 0;
+        return buf;
+    }
+
+    buf = ngx_http_log_varint(buf, value->len + 1);
+
+    return ngx_cpymem(buf, value->data, value->len);
+}
+
+
+static u_char *
+ngx_http_log_binary_record(ngx_http_request_t *r, u_char *buf,
+    ngx_http_log_fmt_t *fmt)
+{
+    u_char             *p;
+    ngx_uint_t          i;
+    ngx_http_log_op_t  *op;
+
+    p = buf + NGX_HTTP_LOG_BINARY_HEADER;
+
+    op = fmt->ops->elts;
+    for (i = 0; i < fmt->ops->nelts; i++) {
+        p = op[i].run(r, p, &op[i]);
+    }
+
+    (void) ngx_http_log_frame(buf, 'R', p - buf - NGX_HTTP_LOG_BINARY_HEADER);
+
+    return p;
+}
+
+
+static u_char *
+ngx_http_log_frame(u_char *buf, u_char type, size_t len)
+{
+    len++;
+
+    *buf++ = (u_char) len;
+    *buf++ = (u_char) (len >> 8);
+    *buf++ = (u_char) (len >> 16);
+    *buf++ = (u_char) (len >> 24);
+    *buf++ = type;
+
+    return buf;
+}
+
+
+static size_t
+ngx_http_log_varint_len(size_t n)
+{
+    size_t  len;
+
+    for (len = 1; n >= 0x80; len++) {
+        n >>= 7;
+    }
+
+    return len;
+}
+
+
+static u_char *
+ngx_http_log_varint(u_char *buf, size_t n)
+{
+    while (n >= 0x80) {
+        *buf++ = (u_char) (n | 0x80);
+        n >>= 7;
+    }
+
+    *buf++ = (u_char) n;
+
+    return buf;
+}
+
+
 static void *
 ngx_http_log_create_main_conf(ngx_conf_t *cf)
 {
@@ -1140,6 +1864,12 @@ ngx_http_log_create_main_conf(ngx_conf_t *cf)
         return NULL;
     }
 
+    if (ngx_array_init(&conf->files, cf->pool, 4, sizeof(ngx_http_log_file_t))
+        != NGX_OK)
+    {
+        return NULL;
+    }
+
     fmt = ngx_array_push(&conf->formats);
     if (fmt == NULL) {
         return NULL;
@@ -1216,21 +1946,70 @@ ngx_http_log_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
         return NGX_CONF_ERROR;
     }
 
-    ngx_memzero(log, sizeof(ngx_http_log_t));
-
-    log->file = ngx_conf_open_file(cf->cycle, &ngx_http_access_log);
-    if (log->file == NULL) {
-        return NGX_CONF_ERROR;
+    ngx_memzero(log, sizeof(ngx_http_log_t));
+
+    log->file = ngx_conf_open_file(cf->cycle, &ngx_http_access_log);
+    if (log->file == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    lmcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_log_module);
+    fmt = lmcf->formats.elts;
+
+    /* the default "combined" format */
+    log->format = &fmt[0];
+    lmcf->combined_used = 1;
+
+    if (ngx_http_log_add_file(cf, lmcf, log) != NGX_OK) {
+        return NGX_CONF_ERROR;
+    }
+
+    return NGX_CONF_OK;
+}
+
+
+static ngx_int_t
+ngx_http_log_add_file(ngx_conf_t *cf, ngx_http_log_main_conf_t *lmcf,
+    ngx_http_log_t *log)
+{
+    ngx_uint_t            i;
+    ngx_http_log_file_t  *lf;
+
+    /* a binary log cannot share its file with any other format */
+
+    lf = lmcf->files.elts;
+    for (i = 0; i < lmcf->files.nelts; i++) {
+
+        if (lf[i].file != log->file) {
+            continue;
+        }
+
+        if (lf[i].format.len == log->format->name.len
+            && ngx_strcasecmp(lf[i].format.data, log->format->name.data) == 0)
+        {
+            return NGX_OK;
+        }
+
+        if (lf[i].binary || log->format->schema.len) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "binary log \"%V\" cannot be shared by "
+                               "log formats \"%V\" and \"%V\"",
+                               &log->file->name, &lf[i].format,
+                               &log->format->name);
+            return NGX_ERROR;
+        }
+    }
+
+    lf = ngx_array_push(&lmcf->files);
+    if (lf == NULL) {
+        return NGX_ERROR;
     }
 
-    lmcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_log_module);
-    fmt = lmcf->formats.elts;
-
-    /* the default "combined" format */
-    log->format = &fmt[0];
-    lmcf->combined_used = 1;
+    lf->file = log->file;
+    lf->format = log->format->name;
+    lf->binary = log->format->schema.len ? 1 : 0;
 
-    return NGX_CONF_OK;
+    return NGX_OK;
 }
 
 
@@ -1250,7 +2029,18 @@ ngx_http_log_set_log(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     ngx_http_log_fmt_t                *fmt;
     ngx_http_log_main_conf_t          *lmcf;
     ngx_http_script_compile_t          sc;
+    ngx_http_complex_value_t          *always;
     ngx_http_compile_complex_value_t   ccv;
+    ngx_int_t                          rate, budget;
+#if (NGX_THREADS)
+    ssize_t                            ring;
+    ngx_uint_t                         async, drop;
+    ngx_str_t                          pool;
+    ngx_thread_pool_t                 *tp;
+    ngx_pool_cleanup_t                *cln;
+    ngx_http_log_async_t              *as;
+    ngx_http_log_async_ctx_t          *actx;
+#endif
 
     value = cf->args->elts;
 
@@ -1361,9 +2151,24 @@ process_formats:
         return NGX_CONF_ERROR;
     }
 
+    if (log->file && ngx_http_log_add_file(cf, lmcf, log) != NGX_OK) {
+        return NGX_CONF_ERROR;
+    }
+
     size = 0;
     flush = 0;
     gzip = 0;
+    rate = 0;
+    budget = 0;
+    always = NULL;
+
+#if (NGX_THREADS)
+    ring = 0;
+    async = 0;
+    drop = 0;
+    ngx_str_null(&pool);
+    tp = NULL;
+#endif
 
     for (i = 3; i < cf->args->nelts; i++) {
 
@@ -1430,6 +2235,132 @@ process_formats:
 #endif
         }
 
+        if (ngx_strncmp(value[i].data, "async", 5) == 0
+            && (value[i].len == 5 || value[i].data[5] == '='))
+        {
+#if (NGX_THREADS)
+            async = 1;
+
+            if (value[i].len > 6) {
+                pool.len = value[i].len - 6;
+                pool.data = value[i].data + 6;
+            }
+
+            continue;
+
+#else
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "\"async\" is unsupported "
+                               "on this platform");
+            return NGX_CONF_ERROR;
+#endif
+        }
+
+        if (ngx_strncmp(value[i].data, "ring=", 5) == 0) {
+#if (NGX_THREADS)
+            s.len = value[i].len - 5;
+            s.data = value[i].data + 5;
+
+            ring = ngx_parse_size(&s);
+
+            if (ring == NGX_ERROR || ring == 0) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid ring size \"%V\"", &s);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+
+#else
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "\"ring\" is unsupported "
+                               "on this platform");
+            return NGX_CONF_ERROR;
+#endif
+        }
+
+        if (ngx_strncmp(value[i].data, "overflow=", 9) == 0) {
+#if (NGX_THREADS)
+            if (ngx_strcmp(&value[i].data[9], "drop") == 0) {
+                drop = 1;
+                continue;
+            }
+
+            if (ngx_strcmp(&value[i].data[9], "wait") == 0) {
+                drop = 0;
+                continue;
+            }
+
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "invalid overflow \"%V\"", &value[i]);
+            return NGX_CONF_ERROR;
+
+#else
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "\"overflow\" is unsupported "
+                               "on this platform");
+            return NGX_CONF_ERROR;
+#endif
+        }
+
+        if (ngx_strncmp(value[i].data, "sample=", 7) == 0) {
+            s.len = value[i].len - 7;
+            s.data = value[i].data + 7;
+
+            if (s.len > 2 && s.data[0] == '1' && s.data[1] == '/') {
+                rate = ngx_atoi(s.data + 2, s.len - 2);
+
+            } else {
+                rate = NGX_ERROR;
+            }
+
+            if (rate == NGX_ERROR || rate == 0) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid sample rate \"%V\"", &s);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "budget=", 7) == 0) {
+            s.len = value[i].len - 7;
+            s.data = value[i].data + 7;
+
+            budget = ngx_atoi(s.data, s.len);
+
+            if (budget == NGX_ERROR || budget == 0) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid budget \"%V\"", &s);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "always_if=", 10) == 0) {
+            s.len = value[i].len - 10;
+            s.data = value[i].data + 10;
+
+            ngx_memzero(&ccv, sizeof(ngx_http_compile_complex_value_t));
+
+            ccv.cf = cf;
+            ccv.value = &s;
+            ccv.complex_value = ngx_palloc(cf->pool,
+                                           sizeof(ngx_http_complex_value_t));
+            if (ccv.complex_value == NULL) {
+                return NGX_CONF_ERROR;
+            }
+
+            if (ngx_http_compile_complex_value(&ccv) != NGX_OK) {
+                return NGX_CONF_ERROR;
+            }
+
+            always = ccv.complex_value;
+
+            continue;
+        }
+
         if (ngx_strncmp(value[i].data, "if=", 3) == 0) {
             s.len = value[i].len - 3;
             s.data = value[i].data + 3;
@@ -1458,6 +2389,76 @@ process_formats:
         return NGX_CONF_ERROR;
     }
 
+    if (rate || budget) {
+        log->sample = ngx_pcalloc(cf->pool, sizeof(ngx_http_log_sample_t));
+        if (log->sample == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        log->sample->rate = rate ? rate : 1;
+        log->sample->stride = log->sample->rate;
+        log->sample->budget = budget;
+        log->sample->always = always;
+
+    } else if (always) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"always_if\" requires \"sample\" or \"budget\" "
+                           "for access_log \"%V\"", &value[1]);
+        return NGX_CONF_ERROR;
+    }
+
+    if (log->format->schema.len) {
+
+        if (log->syslog_peer) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "binary log format \"%V\" cannot be used "
+                               "with syslog", &log->format->name);
+            return NGX_CONF_ERROR;
+        }
+
+        /* binary logs are always buffered, a schema starts each buffer */
+
+        if (size == 0) {
+            size = 64 * 1024;
+        }
+    }
+
+#if (NGX_THREADS)
+
+    if ((ring || drop) && !async) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"%s\" requires \"async\" "
+                           "for access_log \"%V\"",
+                           ring ? "ring" : "overflow", &value[1]);
+        return NGX_CONF_ERROR;
+    }
+
+    if (async) {
+
+        if (size == 0) {
+            size = 64 * 1024;
+        }
+
+        if (ring == 0) {
+            ring = 8 * size;
+        }
+
+        if (ring < 2 * size) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "ring size %z is too small for buffer size %z "
+                               "in access_log \"%V\"",
+                               ring, size, &value[1]);
+            return NGX_CONF_ERROR;
+        }
+
+        tp = ngx_thread_pool_add(cf, pool.len ? &pool : NULL);
+        if (tp == NULL) {
+            return NGX_CONF_ERROR;
+        }
+    }
+
+#endif
+
     if (flush && size == 0) {
         ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
                            "no buffer is defined for access_log \"%V\"",
@@ -1484,7 +2485,17 @@ process_formats:
 
             if (buffer->last - buffer->start != size
                 || buffer->flush != flush
-                || buffer->gzip != gzip)
+                || buffer->gzip != gzip
+                || buffer->binary != (log->format->schema.len ? log->format
+                                                               : NULL)
+#if (NGX_THREADS)
+                || (buffer->async == NULL) != (async == 0)
+                || (buffer->async
+                    && (buffer->async->nsegs != (ngx_uint_t) (ring / size)
+                        || buffer->async->thread_pool != tp
+                        || buffer->async->drop != drop))
+#endif
+               )
             {
                 ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
                                    "access_log \"%V\" already defined "
@@ -1501,13 +2512,76 @@ process_formats:
             return NGX_CONF_ERROR;
         }
 
-        buffer->start = ngx_pnalloc(cf->pool, size);
-        if (buffer->start == NULL) {
-            return NGX_CONF_ERROR;
-        }
+#if (NGX_THREADS)
+
+        if (async) {
+            as = ngx_pcalloc(cf->pool, sizeof(ngx_http_log_async_t));
+            if (as == NULL) {
+                return NGX_CONF_ERROR;
+            }
+
+            as->size = size;
+            as->nsegs = ring / size;
+
+            as->start = ngx_pnalloc(cf->pool, as->nsegs * size);
+            if (as->start == NULL) {
+                return NGX_CONF_ERROR;
+            }
+
+            as->len = ngx_pcalloc(cf->pool, as->nsegs * sizeof(size_t));
+            if (as->len == NULL) {
+                return NGX_CONF_ERROR;
+            }
+
+            as->task = ngx_thread_task_alloc(cf->pool,
+                                             sizeof(ngx_http_log_async_ctx_t));
+            if (as->task == NULL) {
+                return NGX_CONF_ERROR;
+            }
 
-        buffer->pos = buffer->start;
-        buffer->last = buffer->start + size;
+            actx = as->task->ctx;
+
+            if (ngx_thread_mutex_create(&actx->mutex, cf->log) != NGX_OK) {
+                return NGX_CONF_ERROR;
+            }
+
+            if (ngx_thread_cond_create(&actx->cond, cf->log) != NGX_OK) {
+                return NGX_CONF_ERROR;
+            }
+
+            cln = ngx_pool_cleanup_add(cf->pool, 0);
+            if (cln == NULL) {
+                return NGX_CONF_ERROR;
+            }
+
+            cln->handler = ngx_http_log_async_cleanup;
+            cln->data = actx;
+
+            as->task->handler = ngx_http_log_async_thread;
+            as->task->event.data = log->file;
+            as->task->event.handler = ngx_http_log_async_handler;
+            as->task->event.log = &cf->cycle->new_log;
+
+            as->thread_pool = tp;
+            as->drop = drop;
+
+            buffer->start = as->start;
+            buffer->pos = buffer->start;
+            buffer->last = buffer->start + size;
+
+            buffer->async = as;
+
+        } else
+#endif
+        {
+            buffer->start = ngx_pnalloc(cf->pool, size);
+            if (buffer->start == NULL) {
+                return NGX_CONF_ERROR;
+            }
+
+            buffer->pos = buffer->start;
+            buffer->last = buffer->start + size;
+        }
 
         if (flush) {
             buffer->event = ngx_pcalloc(cf->pool, sizeof(ngx_event_t));
@@ -1525,6 +2599,10 @@ process_formats:
 
         buffer->gzip = gzip;
 
+        if (log->format->schema.len) {
+            buffer->binary = log->format;
+        }
+
         log->file->flush = ngx_http_log_flush;
         log->file->data = buffer;
     }
@@ -1573,7 +2651,75 @@ ngx_http_log_set_format(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
         return NGX_CONF_ERROR;
     }
 
-    return ngx_http_log_compile_format(cf, fmt->flushes, fmt->ops, cf->args, 2);
+    if (ngx_http_log_compile_format(cf, fmt->flushes, fmt->ops, cf->args, 2)
+        != NGX_CONF_OK)
+    {
+        return NGX_CONF_ERROR;
+    }
+
+    if (cf->args->nelts > 2 && ngx_strcmp(value[2].data, "escape=binary") == 0)
+    {
+        return ngx_http_log_binary_schema(cf, fmt);
+    }
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_http_log_binary_schema(ngx_conf_t *cf, ngx_http_log_fmt_t *fmt)
+{
+    u_char                     *p;
+    size_t                      len;
+    ngx_uint_t                  i;
+    ngx_http_variable_t        *v;
+    ngx_http_log_op_t          *op;
+    ngx_http_core_main_conf_t  *cmcf;
+
+    if (fmt->ops->nelts == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "no variables in binary log format \"%V\"",
+                           &fmt->name);
+        return NGX_CONF_ERROR;
+    }
+
+    cmcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_core_module);
+
+    v = cmcf->variables.elts;
+    op = fmt->ops->elts;
+
+    len = NGX_HTTP_LOG_BINARY_HEADER + 1
+          + ngx_http_log_varint_len(fmt->name.len) + fmt->name.len
+          + ngx_http_log_varint_len(fmt->ops->nelts);
+
+    for (i = 0; i < fmt->ops->nelts; i++) {
+        len += ngx_http_log_varint_len(v[op[i].data].name.len)
+               + v[op[i].data].name.len;
+    }
+
+    p = ngx_pnalloc(cf->pool, len);
+    if (p == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    fmt->schema.data = p;
+    fmt->schema.len = len;
+
+    p = ngx_http_log_frame(p, 'S', len - NGX_HTTP_LOG_BINARY_HEADER);
+
+    *p++ = NGX_HTTP_LOG_BINARY_VERSION;
+
+    p = ngx_http_log_varint(p, fmt->name.len);
+    p = ngx_cpymem(p, fmt->name.data, fmt->name.len);
+
+    p = ngx_http_log_varint(p, fmt->ops->nelts);
+
+    for (i = 0; i < fmt->ops->nelts; i++) {
+        p = ngx_http_log_varint(p, v[op[i].data].name.len);
+        p = ngx_cpymem(p, v[op[i].data].name.data, v[op[i].data].name.len);
+    }
+
+    return NGX_CONF_OK;
 }
 
 
@@ -1601,6 +2747,9 @@ ngx_http_log_compile_format(ngx_conf_t *cf, ngx_array_t *flushes,
         } else if (ngx_strcmp(data, "none") == 0) {
             escape = NGX_HTTP_LOG_ESCAPE_NONE;
 
+        } else if (ngx_strcmp(data, "binary") == 0) {
+            escape = NGX_HTTP_LOG_ESCAPE_BINARY;
+
         } else if (ngx_strcmp(data, "default") != 0) {
             ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
                                "unknown log format escaping \"%s\"", data);
@@ -1674,6 +2823,11 @@ ngx_http_log_compile_format(ngx_conf_t *cf, ngx_array_t *flushes,
                     goto invalid;
                 }
 
+                if (escape == NGX_HTTP_LOG_ESCAPE_BINARY) {
+                    /* the same values are available as variables */
+                    goto variable;
+                }
+
                 for (v = ngx_http_log_vars; v->name.len; v++) {
 
                     if (v->name.len == var.len
@@ -1688,6 +2842,8 @@ ngx_http_log_compile_format(ngx_conf_t *cf, ngx_array_t *flushes,
                     }
                 }
 
+            variable:
+
                 if (ngx_http_log_variable_compile(cf, op, &var, escape)
                     != NGX_OK)
                 {
@@ -1717,6 +2873,23 @@ ngx_http_log_compile_format(ngx_conf_t *cf, ngx_array_t *flushes,
 
             len = &value[s].data[i] - data;
 
+            if (escape == NGX_HTTP_LOG_ESCAPE_BINARY) {
+
+                /* only separators between variables are allowed */
+
+                for (p = data; p < data + len; p++) {
+                    if (*p != ' ' && *p != '\t' && *p != ',') {
+                        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                           "text \"%*s\" is not allowed "
+                                           "in binary log format", len, data);
+                        return NGX_CONF_ERROR;
+                    }
+                }
+
+                ops->nelts--;
+                continue;
+            }
+
             if (len) {
 
                 op->len = len;
@@ -1864,6 +3037,46 @@ ngx_http_log_open_file_cache(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 }
 
 
+static ngx_int_t
+ngx_http_log_sample_weight_variable(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data)
+{
+    u_char  *p;
+
+    p = ngx_pnalloc(r->pool, NGX_INT_T_LEN);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    v->len = ngx_sprintf(p, "%ui", ngx_http_log_sample_weight) - p;
+    v->valid = 1;
+    v->no_cacheable = 0;
+    v->not_found = 0;
+    v->data = p;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_log_add_variables(ngx_conf_t *cf)
+{
+    ngx_http_variable_t  *var, *v;
+
+    for (v = ngx_http_log_variables; v->name.len; v++) {
+        var = ngx_http_add_variable(cf, &v->name, v->flags);
+        if (var == NULL) {
+            return NGX_ERROR;
+        }
+
+        var->get_handler = v->get_handler;
+        var->data = v->data;
+    }
+
+    return NGX_OK;
+}
+
+
 static ngx_int_t
 ngx_http_log_init(ngx_conf_t *cf)
 {
@@ -42,13 +42,56 @@
 #define NGX_HTTP_MP4_LAST_ATOM    NGX_HTTP_MP4_CO64_DATA
 
 
+#define NGX_HTTP_MP4_FRAGMENT_INIT   1
+#define NGX_HTTP_MP4_FRAGMENT_MEDIA  2
+
+
 typedef struct {
     size_t                buffer_size;
     size_t                max_buffer_size;
     ngx_flag_t            start_key_frame;
+    ngx_flag_t            fragment;
+    ngx_shm_zone_t       *cache_zone;
 } ngx_http_mp4_conf_t;
 
 
+typedef struct {
+    off_t                 moov_offset;
+    off_t                 mdat_offset;
+    uint64_t              mdat_size;
+    size_t                moov_size;
+    size_t                ftyp_size;
+    ngx_uint_t            mdat_first;
+} ngx_http_mp4_index_t;
+
+
+typedef struct {
+    u_char                color;
+    u_char                deleted;
+    u_short               len;
+    ngx_uint_t            count;        /* requests copying the index */
+    ngx_queue_t           queue;
+    ngx_file_uniq_t       uniq;
+    time_t                mtime;
+    off_t                 size;
+    ngx_http_mp4_index_t  index;
+    u_char                data[1];
+} ngx_http_mp4_cache_node_t;
+
+
+typedef struct {
+    ngx_rbtree_t          rbtree;
+    ngx_rbtree_node_t     sentinel;
+    ngx_queue_t           queue;
+} ngx_http_mp4_cache_shctx_t;
+
+
+typedef struct {
+    ngx_http_mp4_cache_shctx_t  *sh;
+    ngx_slab_pool_t             *shpool;
+} ngx_http_mp4_cache_t;
+
+
 typedef struct {
     u_char                chunk[4];
     u_char                samples[4];
@@ -161,6 +204,16 @@ typedef struct {
     ngx_uint_t            length;
     uint32_t              timescale;
     ngx_http_request_t   *request;
+
+    ngx_uint_t            fragment;
+    ngx_uint_t            fragment_start;
+    ngx_uint_t            fragment_length;
+    ngx_uint_t            track;
+
+    ngx_file_uniq_t       uniq;
+    time_t                mtime;
+    ngx_http_mp4_index_t  index;
+    u_char               *moov_data;
     ngx_array_t           trak;
     ngx_http_mp4_trak_t   traks[2];
 
@@ -263,6 +316,7 @@ static ngx_int_t ngx_http_mp4_handler(ngx_http_request_t *r);
 static ngx_int_t ngx_http_mp4_atofp(u_char *line, size_t n, size_t point);
 
 static ngx_int_t ngx_http_mp4_process(ngx_http_mp4_file_t *mp4);
+static ngx_int_t ngx_http_mp4_read_index(ngx_http_mp4_file_t *mp4);
 static ngx_int_t ngx_http_mp4_read_atom(ngx_http_mp4_file_t *mp4,
     ngx_http_mp4_atom_handler_t *atom, uint64_t atom_data_size);
 static ngx_int_t ngx_http_mp4_read(ngx_http_mp4_file_t *mp4, size_t size);
@@ -355,7 +409,35 @@ static ngx_int_t ngx_http_mp4_update_co64_atom(ngx_http_mp4_file_t *mp4,
 static void ngx_http_mp4_adjust_co64_atom(ngx_http_mp4_file_t *mp4,
     ngx_http_mp4_trak_t *trak, off_t adjustment);
 
+static ngx_int_t ngx_http_mp4_fragment(ngx_http_mp4_file_t *mp4);
+static ngx_int_t ngx_http_mp4_fragment_init(ngx_http_mp4_file_t *mp4,
+    ngx_http_mp4_trak_t *trak, ngx_uint_t n);
+static ngx_int_t ngx_http_mp4_fragment_media(ngx_http_mp4_file_t *mp4,
+    ngx_http_mp4_trak_t *trak, ngx_uint_t n);
+static u_char *ngx_http_mp4_fragment_traf(ngx_http_mp4_file_t *mp4,
+    ngx_http_mp4_trak_t *trak, u_char *p, off_t *offset, ngx_chain_t ***last);
+static ngx_uint_t ngx_http_mp4_fragment_sample(ngx_http_mp4_trak_t *trak,
+    uint64_t time);
+static uint32_t ngx_http_mp4_track_id(ngx_http_mp4_trak_t *trak);
+static off_t ngx_http_mp4_chunk_offset(ngx_http_mp4_trak_t *trak,
+    uint32_t chunk);
+
+static ngx_int_t ngx_http_mp4_cache_lookup(ngx_http_mp4_file_t *mp4,
+    ngx_http_mp4_cache_t *cache);
+static void ngx_http_mp4_cache_store(ngx_http_mp4_file_t *mp4,
+    ngx_http_mp4_cache_t *cache);
+static ngx_http_mp4_cache_node_t *ngx_http_mp4_cache_find(
+    ngx_http_mp4_cache_t *cache, ngx_str_t *name, uint32_t hash);
+static void ngx_http_mp4_cache_delete(ngx_http_mp4_cache_t *cache,
+    ngx_http_mp4_cache_node_t *cn);
+static void ngx_http_mp4_cache_rbtree_insert_value(ngx_rbtree_node_t *temp,
+    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel);
+static ngx_int_t ngx_http_mp4_cache_init_zone(ngx_shm_zone_t *shm_zone,
+    void *data);
+
 static char *ngx_http_mp4(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
+static char *ngx_http_mp4_index_cache(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
 static void *ngx_http_mp4_create_conf(ngx_conf_t *cf);
 static char *ngx_http_mp4_merge_conf(ngx_conf_t *cf, void *parent, void *child);
 
@@ -390,6 +472,20 @@ static ngx_command_t  ngx_http_mp4_commands[] = {
       offsetof(ngx_http_mp4_conf_t, start_key_frame),
       NULL },
 
+    { ngx_string("mp4_fragment"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_mp4_conf_t, fragment),
+      NULL },
+
+    { ngx_string("mp4_index_cache"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_http_mp4_index_cache,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL },
+
       ngx_null_command
 };
 
@@ -478,12 +574,13 @@ ngx_http_mp4_handler(ngx_http_request_t *r)
 {
     u_char                    *last;
     size_t                     root;
-    ngx_int_t                  rc, start, end;
-    ngx_uint_t                 level, length;
+    ngx_int_t                  rc, start, end, track;
+    ngx_uint_t                 level, length, fragment;
     ngx_str_t                  path, value;
     ngx_log_t                 *log;
     ngx_buf_t                 *b;
     ngx_chain_t                out;
+    ngx_http_mp4_conf_t       *conf;
     ngx_http_mp4_file_t       *mp4;
     ngx_open_file_info_t       of;
     ngx_http_core_loc_conf_t  *clcf;
@@ -579,6 +676,8 @@ ngx_http_mp4_handler(ngx_http_request_t *r)
 
     start = -1;
     length = 0;
+    fragment = 0;
+    track = 0;
     r->headers_out.content_length_n = of.size;
     mp4 = NULL;
     b = NULL;
@@ -609,9 +708,34 @@ ngx_http_mp4_handler(ngx_http_request_t *r)
                 }
             }
         }
+
+        conf = ngx_http_get_module_loc_conf(r, ngx_http_mp4_module);
+
+        if (conf->fragment
+            && ngx_http_arg(r, (u_char *) "fragment", 8, &value) == NGX_OK)
+        {
+            if (value.len == 4 && ngx_strncmp(value.data, "init", 4) == 0) {
+                fragment = NGX_HTTP_MP4_FRAGMENT_INIT;
+
+            } else if (value.len == 5
+                       && ngx_strncmp(value.data, "media", 5) == 0)
+            {
+                fragment = NGX_HTTP_MP4_FRAGMENT_MEDIA;
+            }
+        }
+
+        if (fragment
+            && ngx_http_arg(r, (u_char *) "track", 5, &value) == NGX_OK)
+        {
+            track = ngx_atoi(value.data, value.len);
+
+            if (track == NGX_ERROR) {
+                track = 0;
+            }
+        }
     }
 
-    if (start >= 0) {
+    if (start >= 0 || fragment) {
         r->single_range = 1;
 
         mp4 = ngx_pcalloc(r->pool, sizeof(ngx_http_mp4_file_t));
@@ -623,9 +747,21 @@ ngx_http_mp4_handler(ngx_http_request_t *r)
         mp4->file.name = path;
         mp4->file.log = r->connection->log;
         mp4->end = of.size;
-        mp4->start = (ngx_uint_t) start;
-        mp4->length = length;
         mp4->request = r;
+        mp4->uniq = of.uniq;
+        mp4->mtime = of.mtime;
+
+        if (fragment) {
+            /* the whole moov atom is needed to build fragments */
+            mp4->fragment = fragment;
+            mp4->fragment_start = (start > 0) ? (ngx_uint_t) start : 0;
+            mp4->fragment_length = length;
+            mp4->track = (ngx_uint_t) track;
+
+        } else {
+            mp4->start = (ngx_uint_t) start;
+            mp4->length = length;
+        }
 
         switch (ngx_http_mp4_process(mp4)) {
 
@@ -789,7 +925,7 @@ ngx_http_mp4_process(ngx_http_mp4_file_t *mp4)
 {
     off_t                  start_offset, end_offset, adjustment;
     ngx_int_t              rc;
-    ngx_uint_t             i, j;
+    ngx_uint_t             i, j, cached;
     ngx_chain_t          **prev;
     ngx_http_mp4_trak_t   *trak;
     ngx_http_mp4_conf_t   *conf;
@@ -801,7 +937,25 @@ ngx_http_mp4_process(ngx_http_mp4_file_t *mp4)
 
     mp4->buffer_size = conf->buffer_size;
 
-    rc = ngx_http_mp4_read_atom(mp4, ngx_http_mp4_atoms, mp4->end);
+    rc = NGX_DECLINED;
+
+    if (conf->cache_zone) {
+        rc = ngx_http_mp4_cache_lookup(mp4, conf->cache_zone->data);
+
+        if (rc == NGX_ERROR) {
+            return NGX_ERROR;
+        }
+    }
+
+    cached = (rc == NGX_OK);
+
+    if (cached) {
+        rc = ngx_http_mp4_read_index(mp4);
+
+    } else {
+        rc = ngx_http_mp4_read_atom(mp4, ngx_http_mp4_atoms, mp4->end);
+    }
+
     if (rc != NGX_OK) {
         return rc;
     }
@@ -820,6 +974,14 @@ ngx_http_mp4_process(ngx_http_mp4_file_t *mp4)
         return NGX_ERROR;
     }
 
+    if (conf->cache_zone && !cached) {
+        ngx_http_mp4_cache_store(mp4, conf->cache_zone->data);
+    }
+
+    if (mp4->fragment) {
+        return ngx_http_mp4_fragment(mp4);
+    }
+
     prev = &mp4->out;
 
     if (mp4->ftyp_atom.buf) {
@@ -939,6 +1101,62 @@ ngx_http_mp4_process(ngx_http_mp4_file_t *mp4)
 }
 
 
+static ngx_int_t
+ngx_http_mp4_read_index(ngx_http_mp4_file_t *mp4)
+{
+    u_char                *ftyp_atom;
+    ngx_int_t              rc;
+    ngx_buf_t             *atom;
+    ngx_http_mp4_index_t  *index;
+
+    /* replay processing of the top level atoms found in the index cache */
+
+    index = &mp4->index;
+
+    if (index->ftyp_size) {
+        ftyp_atom = mp4->moov_data + index->moov_size;
+
+        atom = &mp4->ftyp_atom_buf;
+        atom->temporary = 1;
+        atom->pos = ftyp_atom;
+        atom->last = ftyp_atom + index->ftyp_size;
+
+        mp4->ftyp_atom.buf = atom;
+        mp4->ftyp_size = index->ftyp_size;
+        mp4->content_length = index->ftyp_size;
+    }
+
+    if (index->mdat_first) {
+        mp4->offset = index->mdat_offset;
+
+        rc = ngx_http_mp4_read_mdat_atom(mp4, index->mdat_size);
+        if (rc != NGX_OK) {
+            return rc;
+        }
+    }
+
+    mp4->buffer = mp4->moov_data;
+    mp4->buffer_start = mp4->moov_data;
+    mp4->buffer_pos = mp4->moov_data;
+    mp4->buffer_end = mp4->moov_data + index->moov_size;
+    mp4->buffer_size = index->moov_size;
+    mp4->offset = index->moov_offset;
+
+    rc = ngx_http_mp4_read_moov_atom(mp4, index->moov_size);
+    if (rc != NGX_OK) {
+        return rc;
+    }
+
+    if (!index->mdat_first) {
+        mp4->offset = index->mdat_offset;
+
+        rc = ngx_http_mp4_read_mdat_atom(mp4, index->mdat_size);
+    }
+
+    return rc;
+}
+
+
 typedef struct {
     u_char    size[4];
     u_char    name[4];
@@ -1178,7 +1396,7 @@ ngx_http_mp4_read_moov_atom(ngx_http_mp4_file_t *mp4, uint64_t atom_data_size)
 
     no_mdat = (mp4->mdat_atom.buf == NULL);
 
-    if (no_mdat && mp4->start == 0 && mp4->length == 0) {
+    if (no_mdat && mp4->start == 0 && mp4->length == 0 && !mp4->fragment) {
         /*
          * send original file if moov atom resides before
          * mdat atom and client requests integral file
@@ -1217,6 +1435,27 @@ ngx_http_mp4_read_moov_atom(ngx_http_mp4_file_t *mp4, uint64_t atom_data_size)
         return NGX_ERROR;
     }
 
+    if (conf->cache_zone && mp4->moov_data == NULL) {
+
+        /*
+         * atoms are modified in place while being processed,
+         * so the index cache needs an unmodified copy
+         */
+
+        mp4->moov_data = ngx_pnalloc(mp4->request->pool,
+                                     (size_t) atom_data_size);
+        if (mp4->moov_data == NULL) {
+            return NGX_ERROR;
+        }
+
+        ngx_memcpy(mp4->moov_data, ngx_mp4_atom_data(mp4),
+                   (size_t) atom_data_size);
+
+        mp4->index.moov_offset = mp4->offset;
+        mp4->index.moov_size = (size_t) atom_data_size;
+        mp4->index.mdat_first = !no_mdat;
+    }
+
     mp4->trak.elts = &mp4->traks;
     mp4->trak.size = sizeof(ngx_http_mp4_trak_t);
     mp4->trak.nalloc = 2;
@@ -1265,6 +1504,9 @@ ngx_http_mp4_read_mdat_atom(ngx_http_mp4_file_t *mp4, uint64_t atom_data_size)
         return NGX_ERROR;
     }
 
+    mp4->index.mdat_offset = mp4->offset;
+    mp4->index.mdat_size = atom_data_size;
+
     data = &mp4->mdat_data_buf;
     data->file = &mp4->file;
     data->in_file = 1;
@@ -3903,13 +4145,1289 @@ ngx_http_mp4_adjust_co64_atom(ngx_http_mp4_file_t *mp4,
 }
 
 
-static char *
-ngx_http_mp4(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+typedef struct {
+    u_char    size[4];
+    u_char    name[4];
+    u_char    version[1];
+    u_char    flags[3];
+    u_char    track_id[4];
+    u_char    default_sample_description_index[4];
+    u_char    default_sample_duration[4];
+    u_char    default_sample_size[4];
+    u_char    default_sample_flags[4];
+} ngx_mp4_trex_atom_t;
+
+typedef struct {
+    u_char    size[4];
+    u_char    name[4];
+    u_char    version[1];
+    u_char    flags[3];
+    u_char    sequence_number[4];
+} ngx_mp4_mfhd_atom_t;
+
+typedef struct {
+    u_char    size[4];
+    u_char    name[4];
+    u_char    version[1];
+    u_char    flags[3];
+    u_char    track_id[4];
+} ngx_mp4_tfhd_atom_t;
+
+typedef struct {
+    u_char    size[4];
+    u_char    name[4];
+    u_char    version[1];
+    u_char    flags[3];
+    u_char    base_media_decode_time[8];
+} ngx_mp4_tfdt_atom_t;
+
+typedef struct {
+    u_char    size[4];
+    u_char    name[4];
+    u_char    version[1];
+    u_char    flags[3];
+    u_char    sample_count[4];
+    u_char    data_offset[4];
+} ngx_mp4_trun_atom_t;
+
+typedef struct {
+    u_char    duration[4];
+    u_char    size[4];
+    u_char    flags[4];
+    u_char    composition_offset[4];
+} ngx_mp4_trun_entry_t;
+
+
+static u_char  ngx_http_mp4_fragment_ftyp[] = {
+    0x00, 0x00, 0x00, 0x1c, 'f', 't', 'y', 'p',
+    'i', 's', 'o', '6', 0x00, 0x00, 0x00, 0x00,
+    'i', 's', 'o', '6', 'c', 'm', 'f', 'c', 'm', 'p', '4', '1'
+};
+
+
+/* empty sample tables of a fragmented mp4 initialization segment */
+
+static u_char  ngx_http_mp4_fragment_stbl[] = {
+    0x00, 0x00, 0x00, 0x10, 's', 't', 't', 's',
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x10, 's', 't', 's', 'c',
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x14, 's', 't', 's', 'z',
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x10, 's', 't', 'c', 'o',
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+};
+
+
+static ngx_int_t
+ngx_http_mp4_fragment(ngx_http_mp4_file_t *mp4)
 {
-    ngx_http_core_loc_conf_t  *clcf;
+    ngx_uint_t            i, n;
+    ngx_http_mp4_trak_t  *trak;
 
-    clcf = ngx_http_conf_get_module_loc_conf(cf, ngx_http_core_module);
-    clcf->handler = ngx_http_mp4_handler;
+    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, mp4->file.log, 0,
+                   "mp4 fragment:%ui start:%ui, length:%ui",
+                   mp4->fragment, mp4->fragment_start, mp4->fragment_length);
+
+    trak = mp4->trak.elts;
+    n = mp4->trak.nelts;
+
+    if (mp4->track) {
+        if (mp4->track > n) {
+            ngx_log_error(NGX_LOG_ERR, mp4->file.log, 0,
+                          "mp4 track %ui was not found in \"%s\"",
+                          mp4->track, mp4->file.name.data);
+            return NGX_ERROR;
+        }
+
+        trak += mp4->track - 1;
+        n = 1;
+    }
+
+    for (i = 0; i < n; i++) {
+
+        if (trak[i].out[NGX_HTTP_MP4_TKHD_ATOM].buf == NULL
+            || trak[i].out[NGX_HTTP_MP4_MDHD_ATOM].buf == NULL
+            || trak[i].out[NGX_HTTP_MP4_HDLR_ATOM].buf == NULL
+            || trak[i].out[NGX_HTTP_MP4_STSD_ATOM].buf == NULL
+            || trak[i].out[NGX_HTTP_MP4_STTS_DATA].buf == NULL
+            || trak[i].out[NGX_HTTP_MP4_STSC_DATA].buf == NULL
+            || trak[i].out[NGX_HTTP_MP4_STSZ_ATOM].buf == NULL
+            || (trak[i].out[NGX_HTTP_MP4_STCO_DATA].buf == NULL
+                && trak[i].out[NGX_HTTP_MP4_CO64_DATA].buf == NULL))
+        {
+            ngx_log_error(NGX_LOG_ERR, mp4->file.log, 0,
+                          "incomplete mp4 trak atom in \"%s\"",
+                          mp4->file.name.data);
+            return NGX_ERROR;
+        }
+    }
+
+    mp4->content_length = 0;
+
+    if (mp4->fragment == NGX_HTTP_MP4_FRAGMENT_INIT) {
+        return ngx_http_mp4_fragment_init(mp4, trak, n);
+    }
+
+    return ngx_http_mp4_fragment_media(mp4, trak, n);
+}
+
+
+static ngx_int_t
+ngx_http_mp4_fragment_init(ngx_http_mp4_file_t *mp4,
+    ngx_http_mp4_trak_t *trak, ngx_uint_t n)
+{
+    size_t                stbl_size, minf_size, mdia_size, trak_size,
+                          mvex_size;
+    ngx_buf_t            *b;
+    ngx_uint_t            i, j;
+    ngx_chain_t          *cl, **prev;
+    ngx_mp4_trex_atom_t  *trex_atom;
+
+    /*
+     * initialization segment: ftyp and moov atoms with the original
+     * sample descriptions, empty sample tables, and mvex atom
+     */
+
+    prev = &mp4->out;
+
+    b = &mp4->ftyp_atom_buf;
+    ngx_memzero(b, sizeof(ngx_buf_t));
+
+    b->memory = 1;
+    b->pos = ngx_http_mp4_fragment_ftyp;
+    b->last = ngx_http_mp4_fragment_ftyp + sizeof(ngx_http_mp4_fragment_ftyp);
+
+    mp4->ftyp_atom.buf = b;
+    mp4->content_length = sizeof(ngx_http_mp4_fragment_ftyp);
+
+    *prev = &mp4->ftyp_atom;
+    prev = &mp4->ftyp_atom.next;
+
+    *prev = &mp4->moov_atom;
+    prev = &mp4->moov_atom.next;
+
+    mp4->moov_size = sizeof(ngx_mp4_atom_header_t);
+
+    if (mp4->mvhd_atom.buf) {
+        mp4->moov_size += mp4->mvhd_atom_buf.last - mp4->mvhd_atom_buf.pos;
+        *prev = &mp4->mvhd_atom;
+        prev = &mp4->mvhd_atom.next;
+    }
+
+    for (i = 0; i < n; i++) {
+
+        stbl_size = sizeof(ngx_mp4_atom_header_t)
+                    + (trak[i].stsd_atom_buf.last - trak[i].stsd_atom_buf.pos)
+                    + sizeof(ngx_http_mp4_fragment_stbl);
+
+        minf_size = sizeof(ngx_mp4_atom_header_t) + trak[i].vmhd_size
+                    + trak[i].smhd_size + trak[i].dinf_size + stbl_size;
+
+        mdia_size = sizeof(ngx_mp4_atom_header_t) + trak[i].mdhd_size
+                    + trak[i].hdlr_size + minf_size;
+
+        trak_size = sizeof(ngx_mp4_atom_header_t) + trak[i].tkhd_size
+                    + mdia_size;
+
+        ngx_mp4_set_32value(trak[i].stbl_atom_buf.pos, stbl_size);
+        ngx_mp4_set_32value(trak[i].minf_atom_buf.pos, minf_size);
+        ngx_mp4_set_32value(trak[i].mdia_atom_buf.pos, mdia_size);
+        ngx_mp4_set_32value(trak[i].trak_atom_buf.pos, trak_size);
+
+        mp4->moov_size += trak_size;
+
+        for (j = 0; j <= NGX_HTTP_MP4_STSD_ATOM; j++) {
+            if (trak[i].out[j].buf) {
+                *prev = &trak[i].out[j];
+                prev = &trak[i].out[j].next;
+            }
+        }
+
+        b = ngx_calloc_buf(mp4->request->pool);
+        if (b == NULL) {
+            return NGX_ERROR;
+        }
+
+        b->memory = 1;
+        b->pos = ngx_http_mp4_fragment_stbl;
+        b->last = ngx_http_mp4_fragment_stbl
+                  + sizeof(ngx_http_mp4_fragment_stbl);
+
+        cl = ngx_alloc_chain_link(mp4->request->pool);
+        if (cl == NULL) {
+            return NGX_ERROR;
+        }
+
+        cl->buf = b;
+
+        *prev = cl;
+        prev = &cl->next;
+    }
+
+    mvex_size = sizeof(ngx_mp4_atom_header_t) + n * sizeof(ngx_mp4_trex_atom_t);
+
+    b = ngx_create_temp_buf(mp4->request->pool, mvex_size);
+    if (b == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_memzero(b->pos, mvex_size);
+
+    ngx_mp4_set_32value(b->pos, mvex_size);
+    ngx_mp4_set_atom_name(b->pos, 'm', 'v', 'e', 'x');
+
+    trex_atom = (ngx_mp4_trex_atom_t *) (b->pos + sizeof(ngx_mp4_atom_header_t));
+
+    for (i = 0; i < n; i++) {
+        ngx_mp4_set_32value(trex_atom->size, sizeof(ngx_mp4_trex_atom_t));
+        ngx_mp4_set_atom_name(trex_atom, 't', 'r', 'e', 'x');
+        ngx_mp4_set_32value(trex_atom->track_id,
+                            ngx_http_mp4_track_id(&trak[i]));
+        ngx_mp4_set_32value(trex_atom->default_sample_description_index, 1);
+        trex_atom++;
+    }
+
+    b->last = b->pos + mvex_size;
+    b->last_buf = (mp4->request == mp4->request->main) ? 1 : 0;
+    b->last_in_chain = 1;
+
+    cl = ngx_alloc_chain_link(mp4->request->pool);
+    if (cl == NULL) {
+        return NGX_ERROR;
+    }
+
+    cl->buf = b;
+    cl->next = NULL;
+
+    *prev = cl;
+
+    mp4->moov_size += mvex_size;
+
+    ngx_mp4_set_32value(mp4->moov_atom_header, mp4->moov_size);
+    ngx_mp4_set_atom_name(mp4->moov_atom_header, 'm', 'o', 'o', 'v');
+    mp4->content_length += mp4->moov_size;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_mp4_fragment_media(ngx_http_mp4_file_t *mp4,
+    ngx_http_mp4_trak_t *trak, ngx_uint_t n)
+{
+    off_t                 offset;
+    u_char               *p;
+    size_t                moof_size, entry_size;
+    uint64_t              start_time, end_time;
+    ngx_buf_t            *b, *atom;
+    ngx_uint_t            i, samples;
+    ngx_chain_t          *cl, **last;
+    ngx_mp4_mfhd_atom_t  *mfhd_atom;
+
+    /*
+     * media segment: moof atom with a traf atom for each track
+     * followed by mdat atom with the samples sent from the file
+     */
+
+    moof_size = sizeof(ngx_mp4_atom_header_t) + sizeof(ngx_mp4_mfhd_atom_t);
+    samples = 0;
+
+    for (i = 0; i < n; i++) {
+
+        start_time = (uint64_t) mp4->fragment_start * trak[i].timescale / 1000;
+
+        if (mp4->fragment_length) {
+            end_time = (uint64_t) (mp4->fragment_start + mp4->fragment_length)
+                       * trak[i].timescale / 1000;
+
+        } else {
+            end_time = (uint64_t) -1;
+        }
+
+        trak[i].start_sample = ngx_http_mp4_fragment_sample(&trak[i],
+                                                            start_time);
+        trak[i].end_sample = ngx_http_mp4_fragment_sample(&trak[i], end_time);
+
+        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, mp4->file.log, 0,
+                       "mp4 fragment samples:%ui-%ui",
+                       trak[i].start_sample, trak[i].end_sample);
+
+        if (trak[i].start_sample >= trak[i].end_sample) {
+            continue;
+        }
+
+        entry_size = sizeof(ngx_mp4_trun_entry_t);
+
+        if (trak[i].out[NGX_HTTP_MP4_CTTS_DATA].buf == NULL) {
+            entry_size -= sizeof(((ngx_mp4_trun_entry_t *) 0)
+                                 ->composition_offset);
+        }
+
+        moof_size += sizeof(ngx_mp4_atom_header_t)
+                     + sizeof(ngx_mp4_tfhd_atom_t)
+                     + sizeof(ngx_mp4_tfdt_atom_t)
+                     + sizeof(ngx_mp4_trun_atom_t)
+                     + (trak[i].end_sample - trak[i].start_sample)
+                       * entry_size;
+
+        samples += trak[i].end_sample - trak[i].start_sample;
+    }
+
+    if (samples == 0) {
+        ngx_log_error(NGX_LOG_ERR, mp4->file.log, 0,
+                      "start time is out mp4 samples in \"%s\"",
+                      mp4->file.name.data);
+        return NGX_ERROR;
+    }
+
+    b = ngx_create_temp_buf(mp4->request->pool, moof_size);
+    if (b == NULL) {
+        return NGX_ERROR;
+    }
+
+    p = b->pos;
+
+    ngx_mp4_set_32value(p, moof_size);
+    ngx_mp4_set_atom_name(p, 'm', 'o', 'o', 'f');
+    p += sizeof(ngx_mp4_atom_header_t);
+
+    /* the start time makes sequence numbers grow with fragments */
+
+    mfhd_atom = (ngx_mp4_mfhd_atom_t *) p;
+    ngx_mp4_set_32value(mfhd_atom->size, sizeof(ngx_mp4_mfhd_atom_t));
+    ngx_mp4_set_atom_name(mfhd_atom, 'm', 'f', 'h', 'd');
+    ngx_mp4_set_32value(mfhd_atom->version, 0);
+    ngx_mp4_set_32value(mfhd_atom->sequence_number, mp4->fragment_start + 1);
+    p += sizeof(ngx_mp4_mfhd_atom_t);
+
+    mp4->moov_atom.buf = b;
+    mp4->out = &mp4->moov_atom;
+
+    mp4->mdat_atom.buf = &mp4->mdat_atom_buf;
+    mp4->moov_atom.next = &mp4->mdat_atom;
+    last = &mp4->mdat_atom.next;
+
+    offset = moof_size + sizeof(ngx_mp4_atom_header_t);
+
+    for (i = 0; i < n; i++) {
+
+        if (trak[i].start_sample >= trak[i].end_sample) {
+            continue;
+        }
+
+        p = ngx_http_mp4_fragment_traf(mp4, &trak[i], p, &offset, &last);
+        if (p == NULL) {
+            return NGX_ERROR;
+        }
+    }
+
+    b->last = p;
+
+    offset -= moof_size;
+
+    if (offset > 0xffffffff) {
+        ngx_log_error(NGX_LOG_ERR, mp4->file.log, 0,
+                      "mp4 fragment is too large in \"%s\"",
+                      mp4->file.name.data);
+        return NGX_ERROR;
+    }
+
+    ngx_mp4_set_32value(mp4->mdat_atom_header, offset);
+    ngx_mp4_set_atom_name(mp4->mdat_atom_header, 'm', 'd', 'a', 't');
+
+    atom = &mp4->mdat_atom_buf;
+    atom->temporary = 1;
+    atom->pos = mp4->mdat_atom_header;
+    atom->last = mp4->mdat_atom_header + sizeof(ngx_mp4_atom_header_t);
+
+    *last = NULL;
+
+    for (cl = mp4->out; cl->next; cl = cl->next) { /* void */ }
+
+    b = cl->buf;
+    b->last_buf = (mp4->request == mp4->request->main) ? 1 : 0;
+    b->last_in_chain = 1;
+
+    mp4->content_length = moof_size + offset;
+
+    return NGX_OK;
+}
+
+
+static u_char *
+ngx_http_mp4_fragment_traf(ngx_http_mp4_file_t *mp4,
+    ngx_http_mp4_trak_t *trak, u_char *p, off_t *offset, ngx_chain_t ***last)
+{
+    off_t                  pos;
+    u_char                *traf, *sizes;
+    uint32_t               chunk, next, chunk_samples, in_chunk, duration,
+                           rest, composition, composition_rest, size, flags;
+    uint64_t               time;
+    ngx_buf_t             *b, *data;
+    ngx_uint_t             sample, samples;
+    ngx_chain_t           *cl;
+    ngx_mp4_trun_atom_t   *trun_atom;
+    ngx_mp4_tfhd_atom_t   *tfhd_atom;
+    ngx_mp4_tfdt_atom_t   *tfdt_atom;
+    ngx_mp4_stsz_atom_t   *stsz_atom;
+    ngx_mp4_ctts_atom_t   *ctts_atom;
+    ngx_mp4_stts_entry_t  *stts, *stts_end;
+    ngx_mp4_ctts_entry_t  *ctts, *ctts_end;
+    ngx_mp4_stsc_entry_t  *stsc, *stsc_end;
+    uint32_t              *stss, *stss_end;
+
+    samples = trak->end_sample - trak->start_sample;
+
+    /* time-to-sample */
+
+    data = trak->out[NGX_HTTP_MP4_STTS_DATA].buf;
+    stts = (ngx_mp4_stts_entry_t *) data->pos;
+    stts_end = (ngx_mp4_stts_entry_t *) data->last;
+
+    sample = trak->start_sample;
+    time = 0;
+    rest = 0;
+    duration = 0;
+
+    while (stts < stts_end) {
+        rest = ngx_mp4_get_32value(stts->count);
+        duration = ngx_mp4_get_32value(stts->duration);
+
+        if (sample < rest) {
+            time += (uint64_t) sample * duration;
+            rest -= sample;
+            break;
+        }
+
+        sample -= rest;
+        time += (uint64_t) rest * duration;
+        stts++;
+    }
+
+    if (stts == stts_end) {
+        goto invalid;
+    }
+
+    /* composition offsets */
+
+    data = trak->out[NGX_HTTP_MP4_CTTS_DATA].buf;
+
+    if (data) {
+        ctts = (ngx_mp4_ctts_entry_t *) data->pos;
+        ctts_end = (ngx_mp4_ctts_entry_t *) data->last;
+
+    } else {
+        ctts = NULL;
+        ctts_end = NULL;
+    }
+
+    sample = trak->start_sample;
+    composition = 0;
+    composition_rest = 0;
+
+    while (ctts < ctts_end) {
+        composition_rest = ngx_mp4_get_32value(ctts->count);
+        composition = ngx_mp4_get_32value(ctts->offset);
+
+        if (sample < composition_rest) {
+            composition_rest -= sample;
+            break;
+        }
+
+        sample -= composition_rest;
+        ctts++;
+    }
+
+    /* sync samples */
+
+    data = trak->out[NGX_HTTP_MP4_STSS_DATA].buf;
+
+    if (data) {
+        stss = (uint32_t *) data->pos;
+        stss_end = (uint32_t *) data->last;
+
+        while (stss < stss_end
+               && ngx_mp4_get_32value(stss) <= trak->start_sample)
+        {
+            stss++;
+        }
+
+    } else {
+        stss = NULL;
+        stss_end = NULL;
+    }
+
+    /* sample sizes */
+
+    data = trak->out[NGX_HTTP_MP4_STSZ_DATA].buf;
+
+    if (data) {
+        if (trak->end_sample > trak->sample_sizes_entries) {
+            goto invalid;
+        }
+
+        sizes = data->pos;
+        size = 0;
+
+    } else {
+        sizes = NULL;
+        stsz_atom = (ngx_mp4_stsz_atom_t *) trak->stsz_atom_buf.pos;
+        size = ngx_mp4_get_32value(stsz_atom->uniform_size);
+    }
+
+    /* sample-to-chunk */
+
+    data = trak->out[NGX_HTTP_MP4_STSC_DATA].buf;
+    stsc = (ngx_mp4_stsc_entry_t *) data->pos;
+    stsc_end = (ngx_mp4_stsc_entry_t *) data->last;
+
+    sample = trak->start_sample;
+    chunk = 0;
+    chunk_samples = 0;
+    next = 0;
+
+    while (stsc < stsc_end) {
+        chunk = ngx_mp4_get_32value(stsc->chunk);
+        chunk_samples = ngx_mp4_get_32value(stsc->samples);
+
+        next = (stsc + 1 < stsc_end) ? ngx_mp4_get_32value((stsc + 1)->chunk)
+                                     : trak->chunks + 1;
+
+        if (chunk == 0 || next < chunk) {
+            goto invalid;
+        }
+
+        if (sample < (ngx_uint_t) (next - chunk) * chunk_samples) {
+            chunk += sample / chunk_samples;
+            break;
+        }
+
+        sample -= (next - chunk) * chunk_samples;
+        stsc++;
+    }
+
+    if (stsc == stsc_end || chunk > trak->chunks) {
+        goto invalid;
+    }
+
+    in_chunk = sample % chunk_samples;
+    pos = ngx_http_mp4_chunk_offset(trak, chunk);
+
+    for (sample = trak->start_sample - in_chunk;
+         sample < trak->start_sample;
+         sample++)
+    {
+        pos += sizes ? ngx_mp4_get_32value(sizes + sample * sizeof(uint32_t))
+                     : size;
+    }
+
+    /* traf, tfhd, tfdt, and trun atoms */
+
+    traf = p;
+    p += sizeof(ngx_mp4_atom_header_t);
+
+    tfhd_atom = (ngx_mp4_tfhd_atom_t *) p;
+    ngx_mp4_set_32value(tfhd_atom->size, sizeof(ngx_mp4_tfhd_atom_t));
+    ngx_mp4_set_atom_name(tfhd_atom, 't', 'f', 'h', 'd');
+
+    /* default-base-is-moof */
+    ngx_mp4_set_32value(tfhd_atom->version, 0x00020000);
+    ngx_mp4_set_32value(tfhd_atom->track_id, ngx_http_mp4_track_id(trak));
+    p += sizeof(ngx_mp4_tfhd_atom_t);
+
+    tfdt_atom = (ngx_mp4_tfdt_atom_t *) p;
+    ngx_mp4_set_32value(tfdt_atom->size, sizeof(ngx_mp4_tfdt_atom_t));
+    ngx_mp4_set_atom_name(tfdt_atom, 't', 'f', 'd', 't');
+    ngx_mp4_set_32value(tfdt_atom->version, 0x01000000);
+    ngx_mp4_set_64value(tfdt_atom->base_media_decode_time, time);
+    p += sizeof(ngx_mp4_tfdt_atom_t);
+
+    trun_atom = (ngx_mp4_trun_atom_t *) p;
+    ngx_mp4_set_atom_name(trun_atom, 't', 'r', 'u', 'n');
+
+    /* data-offset, sample-duration, sample-size, and sample-flags present */
+    flags = 0x000701;
+
+    if (ctts) {
+        /* sample-composition-time-offset present */
+        flags |= 0x000800;
+
+        ctts_atom = (ngx_mp4_ctts_atom_t *) trak->ctts_atom_buf.pos;
+
+        if (ctts_atom->version[0] == 1) {
+            /* signed composition offsets */
+            flags |= 0x01000000;
+        }
+    }
+
+    ngx_mp4_set_32value(trun_atom->version, flags);
+    ngx_mp4_set_32value(trun_atom->sample_count, samples);
+    ngx_mp4_set_32value(trun_atom->data_offset, *offset);
+    p += sizeof(ngx_mp4_trun_atom_t);
+
+    b = NULL;
+
+    for (sample = trak->start_sample; sample < trak->end_sample; sample++) {
+
+        while (rest == 0) {
+            if (++stts == stts_end) {
+                goto invalid;
+            }
+
+            rest = ngx_mp4_get_32value(stts->count);
+            duration = ngx_mp4_get_32value(stts->duration);
+        }
+
+        rest--;
+
+        while (in_chunk >= chunk_samples) {
+            if (++chunk > trak->chunks) {
+                goto invalid;
+            }
+
+            if (chunk >= next) {
+                stsc++;
+                chunk_samples = ngx_mp4_get_32value(stsc->samples);
+                next = (stsc + 1 < stsc_end)
+                       ? ngx_mp4_get_32value((stsc + 1)->chunk)
+                       : trak->chunks + 1;
+            }
+
+            in_chunk = 0;
+            pos = ngx_http_mp4_chunk_offset(trak, chunk);
+        }
+
+        in_chunk++;
+
+        if (sizes) {
+            size = ngx_mp4_get_32value(sizes + sample * sizeof(uint32_t));
+        }
+
+        ngx_mp4_set_32value(p, duration);
+        p += 4;
+
+        ngx_mp4_set_32value(p, size);
+        p += 4;
+
+        if (stss == NULL) {
+            flags = 0x02000000;
+
+        } else if (stss < stss_end
+                   && ngx_mp4_get_32value(stss) == sample + 1)
+        {
+            flags = 0x02000000;
+            stss++;
+
+        } else {
+            /* sample depends on others and is not a sync sample */
+            flags = 0x01010000;
+        }
+
+        ngx_mp4_set_32value(p, flags);
+        p += 4;
+
+        if (ctts) {
+            if (composition_rest == 0 && ctts + 1 < ctts_end) {
+                ctts++;
+                composition_rest = ngx_mp4_get_32value(ctts->count);
+                composition = ngx_mp4_get_32value(ctts->offset);
+            }
+
+            if (composition_rest) {
+                composition_rest--;
+
+            } else {
+                composition = 0;
+            }
+
+            ngx_mp4_set_32value(p, composition);
+            p += 4;
+        }
+
+        if (size == 0) {
+            continue;
+        }
+
+        if (pos < 0 || pos + size > mp4->end) {
+            goto invalid;
+        }
+
+        if (b && b->file_last == pos) {
+            b->file_last += size;
+
+        } else {
+            b = ngx_calloc_buf(mp4->request->pool);
+            if (b == NULL) {
+                return NULL;
+            }
+
+            b->file = &mp4->file;
+            b->in_file = 1;
+            b->file_pos = pos;
+            b->file_last = pos + size;
+
+            cl = ngx_alloc_chain_link(mp4->request->pool);
+            if (cl == NULL) {
+                return NULL;
+            }
+
+            cl->buf = b;
+
+            **last = cl;
+            *last = &cl->next;
+        }
+
+        pos += size;
+        *offset += size;
+    }
+
+    ngx_mp4_set_32value(trun_atom->size, p - (u_char *) trun_atom);
+
+    ngx_mp4_set_32value(traf, p - traf);
+    ngx_mp4_set_atom_name(traf, 't', 'r', 'a', 'f');
+
+    return p;
+
+invalid:
+
+    ngx_log_error(NGX_LOG_ERR, mp4->file.log, 0,
+                  "invalid mp4 sample tables in \"%s\"", mp4->file.name.data);
+
+    return NULL;
+}
+
+
+static ngx_uint_t
+ngx_http_mp4_fragment_sample(ngx_http_mp4_trak_t *trak, uint64_t time)
+{
+    uint32_t               count, duration, *entry, *end;
+    uint64_t               dts;
+    ngx_buf_t             *data;
+    ngx_uint_t             sample, samples;
+    ngx_mp4_stts_entry_t  *stts, *stts_end;
+
+    /*
+     * the first sample decoded at the time or later,
+     * moved forward to a sync sample if sync samples are known
+     */
+
+    samples = trak->sample_sizes_entries;
+
+    data = trak->out[NGX_HTTP_MP4_STTS_DATA].buf;
+    stts = (ngx_mp4_stts_entry_t *) data->pos;
+    stts_end = (ngx_mp4_stts_entry_t *) data->last;
+
+    sample = 0;
+    dts = 0;
+
+    while (stts < stts_end) {
+        count = ngx_mp4_get_32value(stts->count);
+        duration = ngx_mp4_get_32value(stts->duration);
+
+        if (dts + (uint64_t) count * duration > time) {
+            if (time > dts) {
+                sample += (time - dts + duration - 1) / duration;
+            }
+
+            goto found;
+        }
+
+        sample += count;
+        dts += (uint64_t) count * duration;
+        stts++;
+    }
+
+    return samples;
+
+found:
+
+    data = trak->out[NGX_HTTP_MP4_STSS_DATA].buf;
+
+    if (data && sample < samples) {
+        entry = (uint32_t *) data->pos;
+        end = (uint32_t *) data->last;
+
+        /* sync samples starts from 1 */
+
+        while (entry < end) {
+            if (ngx_mp4_get_32value(entry) > sample) {
+                sample = ngx_mp4_get_32value(entry) - 1;
+                goto done;
+            }
+
+            entry++;
+        }
+
+        return samples;
+    }
+
+done:
+
+    return ngx_min(sample, samples);
+}
+
+
+static uint32_t
+ngx_http_mp4_track_id(ngx_http_mp4_trak_t *trak)
+{
+    ngx_mp4_tkhd_atom_t    *tkhd_atom;
+    ngx_mp4_tkhd64_atom_t  *tkhd64_atom;
+
+    tkhd_atom = (ngx_mp4_tkhd_atom_t *) trak->tkhd_atom_buf.pos;
+
+    if (tkhd_atom->version[0] == 0) {
+        return ngx_mp4_get_32value(tkhd_atom->track_id);
+    }
+
+    tkhd64_atom = (ngx_mp4_tkhd64_atom_t *) trak->tkhd_atom_buf.pos;
+
+    return ngx_mp4_get_32value(tkhd64_atom->track_id);
+}
+
+
+static off_t
+ngx_http_mp4_chunk_offset(ngx_http_mp4_trak_t *trak, uint32_t chunk)
+{
+    u_char     *p;
+    ngx_buf_t  *data;
+
+    /* chunks start from 1 */
+
+    data = trak->out[NGX_HTTP_MP4_CO64_DATA].buf;
+
+    if (data) {
+        p = data->pos + (chunk - 1) * sizeof(uint64_t);
+        return (off_t) ngx_mp4_get_64value(p);
+    }
+
+    data = trak->out[NGX_HTTP_MP4_STCO_DATA].buf;
+    p = data->pos + (chunk - 1) * sizeof(uint32_t);
+
+    return ngx_mp4_get_32value(p);
+}
+
+
+static ngx_int_t
+ngx_http_mp4_cache_lookup(ngx_http_mp4_file_t *mp4, ngx_http_mp4_cache_t *cache)
+{
+    size_t                      size;
+    ngx_rbtree_node_t          *node;
+    ngx_http_mp4_cache_node_t  *cn;
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    cn = ngx_http_mp4_cache_find(cache, &mp4->file.name,
+                                 ngx_crc32_short(mp4->file.name.data,
+                                                 mp4->file.name.len));
+
+    if (cn == NULL) {
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+        goto miss;
+    }
+
+    if (cn->uniq != mp4->uniq
+        || cn->mtime != mp4->mtime
+        || cn->size != mp4->end)
+    {
+        ngx_http_mp4_cache_delete(cache, cn);
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+        goto miss;
+    }
+
+    ngx_queue_remove(&cn->queue);
+    ngx_queue_insert_head(&cache->sh->queue, &cn->queue);
+
+    /* the node is pinned, so the index is copied without the lock */
+
+    cn->count++;
+
+    mp4->index = cn->index;
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    size = mp4->index.moov_size + mp4->index.ftyp_size;
+
+    mp4->moov_data = ngx_pnalloc(mp4->request->pool, size);
+
+    if (mp4->moov_data) {
+        ngx_memcpy(mp4->moov_data, cn->data + cn->len, size);
+    }
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    if (--cn->count == 0 && cn->deleted) {
+        node = (ngx_rbtree_node_t *)
+                   ((u_char *) cn - offsetof(ngx_rbtree_node_t, color));
+
+        ngx_slab_free_locked(cache->shpool, node);
+    }
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    if (mp4->moov_data == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, mp4->file.log, 0,
+                   "mp4 index cache hit: \"%V\"", &mp4->file.name);
+
+    return NGX_OK;
+
+miss:
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, mp4->file.log, 0,
+                   "mp4 index cache miss: \"%V\"", &mp4->file.name);
+
+    return NGX_DECLINED;
+}
+
+
+static void
+ngx_http_mp4_cache_store(ngx_http_mp4_file_t *mp4, ngx_http_mp4_cache_t *cache)
+{
+    u_char                     *p;
+    size_t                      size;
+    uint32_t                    hash;
+    ngx_queue_t                *q;
+    ngx_rbtree_node_t          *node;
+    ngx_http_mp4_cache_node_t  *cn;
+
+    if (mp4->moov_data == NULL || mp4->file.name.len > 65535) {
+        return;
+    }
+
+    mp4->index.ftyp_size = mp4->ftyp_atom.buf ? mp4->ftyp_size : 0;
+
+    size = offsetof(ngx_rbtree_node_t, color)
+           + offsetof(ngx_http_mp4_cache_node_t, data)
+           + mp4->file.name.len
+           + mp4->index.moov_size + mp4->index.ftyp_size;
+
+    /* a single index should not evict the whole zone */
+
+    if (size > (size_t) (cache->shpool->end - cache->shpool->start) / 2) {
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, mp4->file.log, 0,
+                       "mp4 index is too large for cache: %uz", size);
+        return;
+    }
+
+    hash = ngx_crc32_short(mp4->file.name.data, mp4->file.name.len);
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    cn = ngx_http_mp4_cache_find(cache, &mp4->file.name, hash);
+
+    if (cn) {
+        ngx_http_mp4_cache_delete(cache, cn);
+    }
+
+    for ( ;; ) {
+        node = ngx_slab_alloc_locked(cache->shpool, size);
+
+        if (node || ngx_queue_empty(&cache->sh->queue)) {
+            break;
+        }
+
+        /* evict the least recently used index */
+
+        q = ngx_queue_last(&cache->sh->queue);
+        cn = ngx_queue_data(q, ngx_http_mp4_cache_node_t, queue);
+
+        ngx_http_mp4_cache_delete(cache, cn);
+    }
+
+    if (node == NULL) {
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+
+        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, 0,
+                      "could not allocate node%s", cache->shpool->log_ctx);
+        return;
+    }
+
+    node->key = hash;
+
+    cn = (ngx_http_mp4_cache_node_t *) &node->color;
+
+    cn->deleted = 0;
+    cn->len = (u_short) mp4->file.name.len;
+    cn->count = 0;
+    cn->uniq = mp4->uniq;
+    cn->mtime = mp4->mtime;
+    cn->size = mp4->end;
+    cn->index = mp4->index;
+
+    p = ngx_cpymem(cn->data, mp4->file.name.data, mp4->file.name.len);
+    p = ngx_cpymem(p, mp4->moov_data, mp4->index.moov_size);
+
+    if (mp4->index.ftyp_size) {
+        ngx_memcpy(p, mp4->ftyp_atom_buf.pos, mp4->index.ftyp_size);
+    }
+
+    ngx_rbtree_insert(&cache->sh->rbtree, node);
+
+    ngx_queue_insert_head(&cache->sh->queue, &cn->queue);
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, mp4->file.log, 0,
+                   "mp4 index cache store: \"%V\"", &mp4->file.name);
+
+    ngx_pfree(mp4->request->pool, mp4->moov_data);
+    mp4->moov_data = NULL;
+}
+
+
+static ngx_http_mp4_cache_node_t *
+ngx_http_mp4_cache_find(ngx_http_mp4_cache_t *cache, ngx_str_t *name,
+    uint32_t hash)
+{
+    ngx_int_t                   rc;
+    ngx_rbtree_node_t          *node, *sentinel;
+    ngx_http_mp4_cache_node_t  *cn;
+
+    node = cache->sh->rbtree.root;
+    sentinel = cache->sh->rbtree.sentinel;
+
+    while (node != sentinel) {
+
+        if (hash < node->key) {
+            node = node->left;
+            continue;
+        }
+
+        if (hash > node->key) {
+            node = node->right;
+            continue;
+        }
+
+        /* hash == node->key */
+
+        cn = (ngx_http_mp4_cache_node_t *) &node->color;
+
+        rc = ngx_memn2cmp(name->data, cn->data, name->len, (size_t) cn->len);
+
+        if (rc == 0) {
+            return cn;
+        }
+
+        node = (rc < 0) ? node->left : node->right;
+    }
+
+    return NULL;
+}
+
+
+static void
+ngx_http_mp4_cache_delete(ngx_http_mp4_cache_t *cache,
+    ngx_http_mp4_cache_node_t *cn)
+{
+    ngx_rbtree_node_t  *node;
+
+    ngx_queue_remove(&cn->queue);
+
+    node = (ngx_rbtree_node_t *)
+               ((u_char *) cn - offsetof(ngx_rbtree_node_t, color));
+
+    ngx_rbtree_delete(&cache->sh->rbtree, node);
+
+    if (cn->count) {
+        /* freed when the last request finishes copying the index */
+        cn->deleted = 1;
+        return;
+    }
+
+    ngx_slab_free_locked(cache->shpool, node);
+}
+
+
+static void
+ngx_http_mp4_cache_rbtree_insert_value(ngx_rbtree_node_t *temp,
+    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel)
+{
+    ngx_rbtree_node_t          **p;
+    ngx_http_mp4_cache_node_t   *cn, *cnt;
+
+    for ( ;; ) {
+
+        if (node->key < temp->key) {
+
+            p = &temp->left;
+
+        } else if (node->key > temp->key) {
+
+            p = &temp->right;
+
+        } else { /* node->key == temp->key */
+
+            cn = (ngx_http_mp4_cache_node_t *) &node->color;
+            cnt = (ngx_http_mp4_cache_node_t *) &temp->color;
+
+            p = (ngx_memn2cmp(cn->data, cnt->data, cn->len, cnt->len) < 0)
+                ? &temp->left : &temp->right;
+        }
+
+        if (*p == sentinel) {
+            break;
+        }
+
+        temp = *p;
+    }
+
+    *p = node;
+    node->parent = temp;
+    node->left = sentinel;
+    node->right = sentinel;
+    ngx_rbt_red(node);
+}
+
+
+static ngx_int_t
+ngx_http_mp4_cache_init_zone(ngx_shm_zone_t *shm_zone, void *data)
+{
+    ngx_http_mp4_cache_t  *ocache = data;
+
+    size_t                 len;
+    ngx_http_mp4_cache_t  *cache;
+
+    cache = shm_zone->data;
+
+    if (ocache) {
+        cache->sh = ocache->sh;
+        cache->shpool = ocache->shpool;
+
+        return NGX_OK;
+    }
+
+    cache->shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    if (shm_zone->shm.exists) {
+        cache->sh = cache->shpool->data;
+
+        return NGX_OK;
+    }
+
+    cache->sh = ngx_slab_alloc(cache->shpool,
+                               sizeof(ngx_http_mp4_cache_shctx_t));
+    if (cache->sh == NULL) {
+        return NGX_ERROR;
+    }
+
+    cache->shpool->data = cache->sh;
+
+    ngx_rbtree_init(&cache->sh->rbtree, &cache->sh->sentinel,
+                    ngx_http_mp4_cache_rbtree_insert_value);
+
+    ngx_queue_init(&cache->sh->queue);
+
+    len = sizeof(" in mp4_index_cache zone \"\"") + shm_zone->shm.name.len;
+
+    cache->shpool->log_ctx = ngx_slab_alloc(cache->shpool, len);
+    if (cache->shpool->log_ctx == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_sprintf(cache->shpool->log_ctx, " in mp4_index_cache zone \"%V\"%Z",
+                &shm_zone->shm.name);
+
+    cache->shpool->log_nomem = 0;
+
+    return NGX_OK;
+}
+
+
+static char *
+ngx_http_mp4(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_core_loc_conf_t  *clcf;
+
+    clcf = ngx_http_conf_get_module_loc_conf(cf, ngx_http_core_module);
+    clcf->handler = ngx_http_mp4_handler;
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_http_mp4_index_cache(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_mp4_conf_t *mcf = conf;
+
+    u_char                *p;
+    ssize_t                size;
+    ngx_str_t             *value, name, s;
+    ngx_shm_zone_t        *shm_zone;
+    ngx_http_mp4_cache_t  *cache;
+
+    if (mcf->cache_zone != NGX_CONF_UNSET_PTR) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    if (ngx_strcmp(value[1].data, "off") == 0) {
+        mcf->cache_zone = NULL;
+        return NGX_CONF_OK;
+    }
+
+    if (ngx_strncmp(value[1].data, "zone=", 5) != 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid parameter \"%V\"", &value[1]);
+        return NGX_CONF_ERROR;
+    }
+
+    name.data = value[1].data + 5;
+    size = 0;
+
+    p = (u_char *) ngx_strchr(name.data, ':');
+
+    if (p == NULL) {
+        name.len = value[1].len - 5;
+
+    } else {
+        name.len = p - name.data;
+
+        s.data = p + 1;
+        s.len = value[1].data + value[1].len - s.data;
+
+        size = ngx_parse_size(&s);
+
+        if (size == NGX_ERROR) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "invalid zone size \"%V\"", &value[1]);
+            return NGX_CONF_ERROR;
+        }
+
+        if (size < (ssize_t) (8 * ngx_pagesize)) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "zone \"%V\" is too small", &value[1]);
+            return NGX_CONF_ERROR;
+        }
+    }
+
+    if (name.len == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid zone name \"%V\"", &value[1]);
+        return NGX_CONF_ERROR;
+    }
+
+    shm_zone = ngx_shared_memory_add(cf, &name, size, &ngx_http_mp4_module);
+    if (shm_zone == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    if (shm_zone->data == NULL) {
+        cache = ngx_pcalloc(cf->pool, sizeof(ngx_http_mp4_cache_t));
+        if (cache == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        shm_zone->init = ngx_http_mp4_cache_init_zone;
+        shm_zone->data = cache;
+    }
+
+    mcf->cache_zone = shm_zone;
 
     return NGX_CONF_OK;
 }
@@ -3928,6 +5446,8 @@ ngx_http_mp4_create_conf(ngx_conf_t *cf)
     conf->buffer_size = NGX_CONF_UNSET_SIZE;
     conf->max_buffer_size = NGX_CONF_UNSET_SIZE;
     conf->start_key_frame = NGX_CONF_UNSET;
+    conf->fragment = NGX_CONF_UNSET;
+    conf->cache_zone = NGX_CONF_UNSET_PTR;
 
     return conf;
 }
@@ -3943,6 +5463,8 @@ ngx_http_mp4_merge_conf(ngx_conf_t *cf, void *parent, void *child)
     ngx_conf_merge_size_value(conf->max_buffer_size, prev->max_buffer_size,
                               10 * 1024 * 1024);
     ngx_conf_merge_value(conf->start_key_frame, prev->start_key_frame, 0);
+    ngx_conf_merge_value(conf->fragment, prev->fragment, 0);
+    ngx_conf_merge_ptr_value(conf->cache_zone, prev->cache_zone, NULL);
 
     return NGX_CONF_OK;
 }
@@ -70,10 +70,18 @@ typedef struct {
 } ngx_http_proxy_vars_t;
 
 
+typedef struct {
+    ngx_str_t                      key;
+    ngx_http_script_part_t        *parts;
+    ngx_uint_t                     nparts;
+} ngx_http_proxy_header_t;
+
+
 typedef struct {
     ngx_array_t                   *flushes;
     ngx_array_t                   *lengths;
     ngx_array_t                   *values;
+    ngx_array_t                   *fields;
     ngx_hash_t                     hash;
 } ngx_http_proxy_headers_t;
 
@@ -199,6 +207,8 @@ static void *ngx_http_proxy_create_main_conf(ngx_conf_t *cf);
 static void *ngx_http_proxy_create_loc_conf(ngx_conf_t *cf);
 static char *ngx_http_proxy_merge_loc_conf(ngx_conf_t *cf,
     void *parent, void *child);
+static ngx_int_t ngx_http_proxy_init_header_parts(ngx_conf_t *cf,
+    ngx_http_proxy_headers_t *headers, ngx_uint_t n);
 static ngx_int_t ngx_http_proxy_init_headers(ngx_conf_t *cf,
     ngx_http_proxy_loc_conf_t *conf, ngx_http_proxy_headers_t *headers,
     ngx_keyval_t *default_headers);
@@ -613,6 +623,13 @@ static ngx_command_t  ngx_http_proxy_commands[] = {
       offsetof(ngx_http_proxy_loc_conf_t, upstream.cache_background_update),
       NULL },
 
+    { ngx_string("proxy_cache_encodings"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_proxy_loc_conf_t, upstream.cache_encodings),
+      NULL },
+
 #endif
 
     { ngx_string("proxy_temp_path"),
@@ -657,6 +674,13 @@ static ngx_command_t  ngx_http_proxy_commands[] = {
       offsetof(ngx_http_proxy_loc_conf_t, upstream.next_upstream_timeout),
       NULL },
 
+    { ngx_string("proxy_hedge_after"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_msec_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_proxy_loc_conf_t, upstream.hedge_after),
+      NULL },
+
     { ngx_string("proxy_pass_header"),
       NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
       ngx_conf_set_str_array_slot,
@@ -1247,6 +1271,7 @@ ngx_http_proxy_create_request(ngx_http_request_t *r)
     ngx_http_upstream_t          *u;
     ngx_http_proxy_ctx_t         *ctx;
     ngx_http_script_code_pt       code;
+    ngx_http_proxy_header_t      *field;
     ngx_http_proxy_headers_t     *headers;
     ngx_http_script_engine_t      e, le;
     ngx_http_proxy_loc_conf_t    *plcf;
@@ -1345,25 +1370,42 @@ ngx_http_proxy_create_request(ngx_http_request_t *r)
         ctx->internal_body_length = r->headers_in.content_length_n;
     }
 
-    le.ip = headers->lengths->elts;
-    le.request = r;
-    le.flushed = 1;
+    if (headers->fields) {
+        field = headers->fields->elts;
+
+        for (i = 0; i < headers->fields->nelts; i++) {
+
+            val_len = ngx_http_script_parts_len(r, field[i].parts,
+                                                field[i].nparts);
+            if (val_len == 0) {
+                continue;
+            }
+
+            len += field[i].key.len + sizeof(": ") - 1
+                   + val_len + sizeof(CRLF) - 1;
+        }
 
-    while (*(uintptr_t *) le.ip) {
+    } else {
+        le.ip = headers->lengths->elts;
+        le.request = r;
+        le.flushed = 1;
 
-        lcode = *(ngx_http_script_len_code_pt *) le.ip;
-        key_len = lcode(&le);
+        while (*(uintptr_t *) le.ip) {
 
-        for (val_len = 0; *(uintptr_t *) le.ip; val_len += lcode(&le)) {
             lcode = *(ngx_http_script_len_code_pt *) le.ip;
-        }
-        le.ip += sizeof(uintptr_t);
+            key_len = lcode(&le);
 
-        if (val_len == 0) {
-            continue;
-        }
+            for (val_len = 0; *(uintptr_t *) le.ip; val_len += lcode(&le)) {
+                lcode = *(ngx_http_script_len_code_pt *) le.ip;
+            }
+            le.ip += sizeof(uintptr_t);
+
+            if (val_len == 0) {
+                continue;
+            }
 
-        len += key_len + sizeof(": ") - 1 + val_len + sizeof(CRLF) - 1;
+            len += key_len + sizeof(": ") - 1 + val_len + sizeof(CRLF) - 1;
+        }
     }
 
 
@@ -1460,44 +1502,67 @@ ngx_http_proxy_create_request(ngx_http_request_t *r)
     e.request = r;
     e.flushed = 1;
 
-    le.ip = headers->lengths->elts;
+    if (headers->fields) {
+        field = headers->fields->elts;
 
-    while (*(uintptr_t *) le.ip) {
+        for (i = 0; i < headers->fields->nelts; i++) {
 
-        lcode = *(ngx_http_script_len_code_pt *) le.ip;
-        (void) lcode(&le);
+            val_len = ngx_http_script_parts_len(r, field[i].parts,
+                                                field[i].nparts);
+            if (val_len == 0) {
+                continue;
+            }
 
-        for (val_len = 0; *(uintptr_t *) le.ip; val_len += lcode(&le)) {
-            lcode = *(ngx_http_script_len_code_pt *) le.ip;
+            e.pos = ngx_cpymem(e.pos, field[i].key.data, field[i].key.len);
+
+            *e.pos++ = ':'; *e.pos++ = ' ';
+
+            e.pos = ngx_http_script_parts_copy(r, e.pos, field[i].parts,
+                                               field[i].nparts);
+
+            *e.pos++ = CR; *e.pos++ = LF;
         }
-        le.ip += sizeof(uintptr_t);
 
-        if (val_len == 0) {
-            e.skip = 1;
+    } else {
+        le.ip = headers->lengths->elts;
 
-            while (*(uintptr_t *) e.ip) {
-                code = *(ngx_http_script_code_pt *) e.ip;
-                code((ngx_http_script_engine_t *) &e);
+        while (*(uintptr_t *) le.ip) {
+
+            lcode = *(ngx_http_script_len_code_pt *) le.ip;
+            (void) lcode(&le);
+
+            for (val_len = 0; *(uintptr_t *) le.ip; val_len += lcode(&le)) {
+                lcode = *(ngx_http_script_len_code_pt *) le.ip;
             }
-            e.ip += sizeof(uintptr_t);
+            le.ip += sizeof(uintptr_t);
 
-            e.skip = 0;
+            if (val_len == 0) {
+                e.skip = 1;
 
-            continue;
-        }
+                while (*(uintptr_t *) e.ip) {
+                    code = *(ngx_http_script_code_pt *) e.ip;
+                    code((ngx_http_script_engine_t *) &e);
+                }
+                e.ip += sizeof(uintptr_t);
 
-        code = *(ngx_http_script_code_pt *) e.ip;
-        code((ngx_http_script_engine_t *) &e);
+                e.skip = 0;
 
-        *e.pos++ = ':'; *e.pos++ = ' ';
+                continue;
+            }
 
-        while (*(uintptr_t *) e.ip) {
             code = *(ngx_http_script_code_pt *) e.ip;
             code((ngx_http_script_engine_t *) &e);
-        }
-        e.ip += sizeof(uintptr_t);
 
-        *e.pos++ = CR; *e.pos++ = LF;
+            *e.pos++ = ':'; *e.pos++ = ' ';
+
+            while (*(uintptr_t *) e.ip) {
+                code = *(ngx_http_script_code_pt *) e.ip;
+                code((ngx_http_script_engine_t *) &e);
+            }
+            e.ip += sizeof(uintptr_t);
+
+            *e.pos++ = CR; *e.pos++ = LF;
+        }
     }
 
     b->last = e.pos;
@@ -3368,6 +3433,7 @@ ngx_http_proxy_create_loc_conf(ngx_conf_t *cf)
     conf->upstream.send_timeout = NGX_CONF_UNSET_MSEC;
     conf->upstream.read_timeout = NGX_CONF_UNSET_MSEC;
     conf->upstream.next_upstream_timeout = NGX_CONF_UNSET_MSEC;
+    conf->upstream.hedge_after = NGX_CONF_UNSET_MSEC;
 
     conf->upstream.send_lowat = NGX_CONF_UNSET_SIZE;
     conf->upstream.buffer_size = NGX_CONF_UNSET_SIZE;
@@ -3393,6 +3459,7 @@ ngx_http_proxy_create_loc_conf(ngx_conf_t *cf)
     conf->upstream.cache_revalidate = NGX_CONF_UNSET;
     conf->upstream.cache_convert_head = NGX_CONF_UNSET;
     conf->upstream.cache_background_update = NGX_CONF_UNSET;
+    conf->upstream.cache_encodings = NGX_CONF_UNSET;
 #endif
 
     conf->upstream.hide_headers = NGX_CONF_UNSET_PTR;
@@ -3508,6 +3575,9 @@ ngx_http_proxy_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
     ngx_conf_merge_msec_value(conf->upstream.next_upstream_timeout,
                               prev->upstream.next_upstream_timeout, 0);
 
+    ngx_conf_merge_msec_value(conf->upstream.hedge_after,
+                              prev->upstream.hedge_after, 0);
+
     ngx_conf_merge_size_value(conf->upstream.send_lowat,
                               prev->upstream.send_lowat, 0);
 
@@ -3714,6 +3784,22 @@ ngx_http_proxy_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
     ngx_conf_merge_value(conf->upstream.cache_background_update,
                               prev->upstream.cache_background_update, 0);
 
+    if (conf->upstream.cache_zone
+        && !conf->upstream.cache_background_update
+        && ((ngx_http_file_cache_t *) conf->upstream.cache_zone->data)
+               ->refresh_ahead)
+    {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"proxy_cache\" zone \"%V\" with "
+                           "\"refresh_ahead\" requires "
+                           "\"proxy_cache_background_update\"",
+                           &conf->upstream.cache_zone->shm.name);
+        return NGX_CONF_ERROR;
+    }
+
+    ngx_conf_merge_value(conf->upstream.cache_encodings,
+                              prev->upstream.cache_encodings, 0);
+
 #endif
 
     ngx_conf_merge_value(conf->upstream.pass_request_headers,
@@ -3950,7 +4036,7 @@ ngx_http_proxy_init_headers(ngx_conf_t *cf, ngx_http_proxy_loc_conf_t *conf,
     u_char                       *p;
     size_t                        size;
     uintptr_t                    *code;
-    ngx_uint_t                    i;
+    ngx_uint_t                    i, n;
     ngx_array_t                   headers_names, headers_merged;
     ngx_keyval_t                 *src, *s, *h;
     ngx_hash_key_t               *hk;
@@ -4022,6 +4108,8 @@ ngx_http_proxy_init_headers(ngx_conf_t *cf, ngx_http_proxy_loc_conf_t *conf,
     }
 
 
+    n = 0;
+
     src = headers_merged.elts;
     for (i = 0; i < headers_merged.nelts; i++) {
 
@@ -4038,6 +4126,8 @@ ngx_http_proxy_init_headers(ngx_conf_t *cf, ngx_http_proxy_loc_conf_t *conf,
             continue;
         }
 
+        n++;
+
         copy = ngx_array_push_n(headers->lengths,
                                 sizeof(ngx_http_script_copy_code_t));
         if (copy == NULL) {
@@ -4097,6 +4187,10 @@ ngx_http_proxy_init_headers(ngx_conf_t *cf, ngx_http_proxy_loc_conf_t *conf,
 
     *code = (uintptr_t) NULL;
 
+    if (ngx_http_proxy_init_header_parts(cf, headers, n) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
 
     hash.hash = &headers->hash;
     hash.key = ngx_hash_key_lc;
@@ -4110,6 +4204,86 @@ ngx_http_proxy_init_headers(ngx_conf_t *cf, ngx_http_proxy_loc_conf_t *conf,
 }
 
 
+static ngx_int_t
+ngx_http_proxy_init_header_parts(ngx_conf_t *cf,
+    ngx_http_proxy_headers_t *headers, ngx_uint_t n)
+{
+    u_char                       *ip;
+    ngx_int_t                     rc;
+    ngx_uint_t                    i, start;
+    ngx_array_t                  *fields, *parts;
+    ngx_http_script_part_t       *part;
+    ngx_http_proxy_header_t      *field;
+    ngx_http_script_copy_code_t  *copy;
+
+    /*
+     * if all header values consist of constant strings and variables,
+     * the headers are created from parts instead of running the codes
+     */
+
+    if (n == 0) {
+        return NGX_OK;
+    }
+
+    fields = ngx_array_create(cf->pool, n, sizeof(ngx_http_proxy_header_t));
+    if (fields == NULL) {
+        return NGX_ERROR;
+    }
+
+    parts = ngx_array_create(cf->pool, 2 * n, sizeof(ngx_http_script_part_t));
+    if (parts == NULL) {
+        return NGX_ERROR;
+    }
+
+    ip = headers->values->elts;
+
+    for (i = 0; i < n; i++) {
+
+        /* the header name is always copied with a single code */
+
+        copy = (ngx_http_script_copy_code_t *) ip;
+
+        field = ngx_array_push(fields);
+        if (field == NULL) {
+            return NGX_ERROR;
+        }
+
+        field->key.len = copy->len;
+        field->key.data = ip + sizeof(ngx_http_script_copy_code_t);
+
+        ip += sizeof(ngx_http_script_copy_code_t)
+              + ((copy->len + sizeof(uintptr_t) - 1)
+                 & ~(sizeof(uintptr_t) - 1));
+
+        start = parts->nelts;
+
+        rc = ngx_http_script_compile_parts(parts, &ip);
+
+        if (rc == NGX_ERROR) {
+            return NGX_ERROR;
+        }
+
+        if (rc == NGX_DECLINED) {
+            return NGX_OK;
+        }
+
+        field->nparts = parts->nelts - start;
+    }
+
+    part = parts->elts;
+    field = fields->elts;
+
+    for (i = 0; i < n; i++) {
+        field[i].parts = part;
+        part += field[i].nparts;
+    }
+
+    headers->fields = fields;
+
+    return NGX_OK;
+}
+
+
 static char *
 ngx_http_proxy_pass(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
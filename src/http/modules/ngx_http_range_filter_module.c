@@ -48,19 +48,24 @@
 typedef struct {
     off_t        start;
     off_t        end;
-    ngx_str_t    content_range;
+    ngx_str_t    header;
 } ngx_http_range_t;
 
 
 typedef struct {
     off_t        offset;
     ngx_str_t    boundary_header;
+    ngx_str_t    last_boundary;
     ngx_array_t  ranges;
 } ngx_http_range_filter_ctx_t;
 
 
 static ngx_int_t ngx_http_range_parse(ngx_http_request_t *r,
     ngx_http_range_filter_ctx_t *ctx, ngx_uint_t ranges);
+static ngx_int_t ngx_http_range_coalesce(ngx_http_request_t *r,
+    ngx_http_range_filter_ctx_t *ctx);
+static int ngx_libc_cdecl ngx_http_range_cmp(const void *one,
+    const void *two);
 static ngx_int_t ngx_http_range_singlepart_header(ngx_http_request_t *r,
     ngx_http_range_filter_ctx_t *ctx);
 static ngx_int_t ngx_http_range_multipart_header(ngx_http_request_t *r,
@@ -405,10 +410,101 @@ ngx_http_range_parse(ngx_http_request_t *r, ngx_http_range_filter_ctx_t *ctx,
         return NGX_DECLINED;
     }
 
+    if (ctx->ranges.nelts > 1) {
+        return ngx_http_range_coalesce(r, ctx);
+    }
+
     return NGX_OK;
 }
 
 
+static ngx_int_t
+ngx_http_range_coalesce(ngx_http_request_t *r,
+    ngx_http_range_filter_ctx_t *ctx)
+{
+    off_t              gap;
+    ngx_uint_t         i, j, n;
+    ngx_http_range_t  *range, *sorted;
+
+    /*
+     * overlapping ranges and ranges separated by a gap smaller than
+     * the overhead of sending multiple parts are coalesced (RFC 9110)
+     */
+
+    gap = sizeof(CRLF "--" CRLF "Content-Type: " CRLF
+                 "Content-Range: bytes -/" CRLF CRLF) - 1
+          + NGX_ATOMIC_T_LEN + r->headers_out.content_type.len;
+
+    range = ctx->ranges.elts;
+    n = ctx->ranges.nelts;
+
+    for (i = 1; i < n; i++) {
+        if (range[i].start < range[i - 1].start) {
+            break;
+        }
+    }
+
+    if (i == n) {
+        sorted = range;
+
+    } else {
+        sorted = ngx_palloc(r->pool, n * sizeof(ngx_http_range_t));
+        if (sorted == NULL) {
+            return NGX_ERROR;
+        }
+
+        ngx_memcpy(sorted, range, n * sizeof(ngx_http_range_t));
+
+        ngx_qsort(sorted, (size_t) n, sizeof(ngx_http_range_t),
+                  ngx_http_range_cmp);
+    }
+
+    for (i = 1, j = 0; i < n; i++) {
+
+        if (sorted[i].start <= sorted[j].end + gap) {
+
+            if (sorted[i].end > sorted[j].end) {
+                sorted[j].end = sorted[i].end;
+            }
+
+            continue;
+        }
+
+        sorted[++j] = sorted[i];
+    }
+
+    if (++j == n) {
+        /* nothing to coalesce, keep the requested order */
+        return NGX_OK;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http range coalesced %ui ranges into %ui", n, j);
+
+    ctx->ranges.elts = sorted;
+    ctx->ranges.nelts = j;
+    ctx->ranges.nalloc = n;
+
+    return NGX_OK;
+}
+
+
+static int ngx_libc_cdecl
+ngx_http_range_cmp(const void *one, const void *two)
+{
+    ngx_http_range_t  *first, *second;
+
+    first = (ngx_http_range_t *) one;
+    second = (ngx_http_range_t *) two;
+
+    if (first->start == second->start) {
+        return 0;
+    }
+
+    return (first->start < second->start) ? -1 : 1;
+}
+
+
 static ngx_int_t
 ngx_http_range_singlepart_header(ngx_http_request_t *r,
     ngx_http_range_filter_ctx_t *ctx)
@@ -469,6 +565,7 @@ static ngx_int_t
 ngx_http_range_multipart_header(ngx_http_request_t *r,
     ngx_http_range_filter_ctx_t *ctx)
 {
+    u_char             *p;
     off_t               len;
     size_t              size;
     ngx_uint_t          i;
@@ -557,28 +654,49 @@ ngx_http_range_multipart_header(ngx_http_request_t *r,
 
     len = sizeof(CRLF "--") - 1 + NGX_ATOMIC_T_LEN + sizeof("--" CRLF) - 1;
 
+    /*
+     * the headers of all parts and the last boundary are built
+     * in a single buffer, so the body filter only links them
+     * with the range data
+     */
+
+    size = ctx->ranges.nelts
+           * (ctx->boundary_header.len + 3 * NGX_OFF_T_LEN + 2 + 4)
+           + (size_t) len;
+
+    p = ngx_pnalloc(r->pool, size);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
     range = ctx->ranges.elts;
     for (i = 0; i < ctx->ranges.nelts; i++) {
 
-        /* the size of the range: "SSSS-EEEE/TTTT" CRLF CRLF */
+        /* the boundary header and "SSSS-EEEE/TTTT" CRLF CRLF */
 
-        range[i].content_range.data =
-                               ngx_pnalloc(r->pool, 3 * NGX_OFF_T_LEN + 2 + 4);
+        range[i].header.data = p;
 
-        if (range[i].content_range.data == NULL) {
-            return NGX_ERROR;
-        }
+        p = ngx_cpymem(p, ctx->boundary_header.data, ctx->boundary_header.len);
+        p = ngx_sprintf(p, "%O-%O/%O" CRLF CRLF,
+                        range[i].start, range[i].end - 1,
+                        r->headers_out.content_length_n);
 
-        range[i].content_range.len = ngx_sprintf(range[i].content_range.data,
-                                               "%O-%O/%O" CRLF CRLF,
-                                               range[i].start, range[i].end - 1,
-                                               r->headers_out.content_length_n)
-                                     - range[i].content_range.data;
+        range[i].header.len = p - range[i].header.data;
 
-        len += ctx->boundary_header.len + range[i].content_range.len
-                                             + (range[i].end - range[i].start);
+        len += range[i].header.len + (range[i].end - range[i].start);
     }
 
+    /* the last boundary CRLF "--0123456789--" CRLF */
+
+    ctx->last_boundary.data = p;
+
+    p = ngx_cpymem(p, ctx->boundary_header.data,
+                   sizeof(CRLF "--") - 1 + NGX_ATOMIC_T_LEN);
+    *p++ = '-'; *p++ = '-';
+    *p++ = CR; *p++ = LF;
+
+    ctx->last_boundary.len = p - ctx->last_boundary.data;
+
     r->headers_out.content_length_n = len;
 
     if (r->headers_out.content_length) {
@@ -839,66 +957,51 @@ ngx_http_range_multipart_body(ngx_http_request_t *r,
     ngx_http_range_filter_ctx_t *ctx, ngx_chain_t *in)
 {
     ngx_buf_t         *b, *buf;
-    ngx_uint_t         i;
-    ngx_chain_t       *out, *hcl, *rcl, *dcl, **ll;
+    ngx_uint_t         i, n;
+    ngx_chain_t       *out, *cl, **ll;
     ngx_http_range_t  *range;
 
     ll = &out;
     buf = in->buf;
     range = ctx->ranges.elts;
 
+    /* a header and a data buffer for each range, and the last boundary */
+
+    n = 2 * ctx->ranges.nelts + 1;
+
+    b = ngx_pcalloc(r->pool, n * sizeof(ngx_buf_t));
+    if (b == NULL) {
+        return NGX_ERROR;
+    }
+
+    cl = ngx_palloc(r->pool, n * sizeof(ngx_chain_t));
+    if (cl == NULL) {
+        return NGX_ERROR;
+    }
+
     for (i = 0; i < ctx->ranges.nelts; i++) {
 
         /*
-         * The boundary header of the range:
+         * The header of the range:
          * CRLF
          * "--0123456789" CRLF
          * "Content-Type: image/jpeg" CRLF
-         * "Content-Range: bytes "
+         * "Content-Range: bytes SSSS-EEEE/TTTT" CRLF CRLF
          */
 
-        b = ngx_calloc_buf(r->pool);
-        if (b == NULL) {
-            return NGX_ERROR;
-        }
-
         b->memory = 1;
-        b->pos = ctx->boundary_header.data;
-        b->last = ctx->boundary_header.data + ctx->boundary_header.len;
+        b->pos = range[i].header.data;
+        b->last = range[i].header.data + range[i].header.len;
 
-        hcl = ngx_alloc_chain_link(r->pool);
-        if (hcl == NULL) {
-            return NGX_ERROR;
-        }
+        cl->buf = b;
+        *ll = cl;
+        ll = &cl->next;
 
-        hcl->buf = b;
+        b++;
+        cl++;
 
 
-        /* "SSSS-EEEE/TTTT" CRLF CRLF */
-
-        b = ngx_calloc_buf(r->pool);
-        if (b == NULL) {
-            return NGX_ERROR;
-        }
-
-        b->temporary = 1;
-        b->pos = range[i].content_range.data;
-        b->last = range[i].content_range.data + range[i].content_range.len;
-
-        rcl = ngx_alloc_chain_link(r->pool);
-        if (rcl == NULL) {
-            return NGX_ERROR;
-        }
-
-        rcl->buf = b;
-
-
-        /* the range data */
-
-        b = ngx_calloc_buf(r->pool);
-        if (b == NULL) {
-            return NGX_ERROR;
-        }
+        /* the range data, sent with sendfile() if the body is in a file */
 
         b->in_file = buf->in_file;
         b->temporary = buf->temporary;
@@ -916,49 +1019,24 @@ ngx_http_range_multipart_body(ngx_http_request_t *r,
             b->last = buf->pos + (size_t) range[i].end;
         }
 
-        dcl = ngx_alloc_chain_link(r->pool);
-        if (dcl == NULL) {
-            return NGX_ERROR;
-        }
-
-        dcl->buf = b;
+        cl->buf = b;
+        *ll = cl;
+        ll = &cl->next;
 
-        *ll = hcl;
-        hcl->next = rcl;
-        rcl->next = dcl;
-        ll = &dcl->next;
+        b++;
+        cl++;
     }
 
     /* the last boundary CRLF "--0123456789--" CRLF  */
 
-    b = ngx_calloc_buf(r->pool);
-    if (b == NULL) {
-        return NGX_ERROR;
-    }
-
-    b->temporary = 1;
+    b->memory = 1;
     b->last_buf = 1;
+    b->pos = ctx->last_boundary.data;
+    b->last = ctx->last_boundary.data + ctx->last_boundary.len;
 
-    b->pos = ngx_pnalloc(r->pool, sizeof(CRLF "--") - 1 + NGX_ATOMIC_T_LEN
-                                  + sizeof("--" CRLF) - 1);
-    if (b->pos == NULL) {
-        return NGX_ERROR;
-    }
-
-    b->last = ngx_cpymem(b->pos, ctx->boundary_header.data,
-                         sizeof(CRLF "--") - 1 + NGX_ATOMIC_T_LEN);
-    *b->last++ = '-'; *b->last++ = '-';
-    *b->last++ = CR; *b->last++ = LF;
-
-    hcl = ngx_alloc_chain_link(r->pool);
-    if (hcl == NULL) {
-        return NGX_ERROR;
-    }
-
-    hcl->buf = b;
-    hcl->next = NULL;
-
-    *ll = hcl;
+    cl->buf = b;
+    cl->next = NULL;
+    *ll = cl;
 
     return ngx_http_next_body_filter(r, out);
 }
@@ -18,20 +18,61 @@
 
 
 typedef struct {
-    ngx_flag_t    enable;
-    ngx_flag_t    silent_errors;
-    ngx_flag_t    ignore_recycled_buffers;
-    ngx_flag_t    last_modified;
+    ngx_flag_t       enable;
+    ngx_flag_t       silent_errors;
+    ngx_flag_t       ignore_recycled_buffers;
+    ngx_flag_t       last_modified;
 
-    ngx_hash_t    types;
+    ngx_hash_t       types;
 
-    size_t        min_file_chunk;
-    size_t        value_len;
+    size_t           min_file_chunk;
+    size_t           value_len;
 
-    ngx_array_t  *types_keys;
+    ngx_array_t     *types_keys;
+
+    ngx_shm_zone_t  *cache_zone;
+    time_t           cache_valid;
+    size_t           cache_max_size;
 } ngx_http_ssi_loc_conf_t;
 
 
+typedef struct {
+    u_char                       color;
+    u_char                       dummy;
+    u_short                      len;
+    ngx_queue_t                  queue;
+    time_t                       expire;
+    size_t                       size;
+    u_char                       data[1];
+} ngx_http_ssi_cache_node_t;
+
+
+typedef struct {
+    ngx_rbtree_t                 rbtree;
+    ngx_rbtree_node_t            sentinel;
+    ngx_queue_t                  queue;
+} ngx_http_ssi_cache_shctx_t;
+
+
+typedef struct {
+    ngx_http_ssi_cache_shctx_t  *sh;
+    ngx_slab_pool_t             *shpool;
+} ngx_http_ssi_cache_t;
+
+
+typedef struct {
+    ngx_str_t                    key;
+    ngx_http_ssi_cache_t        *cache;
+    time_t                       valid;
+    size_t                       max_size;
+    size_t                       size;
+    ngx_chain_t                 *bufs;
+    ngx_chain_t                **last;
+    unsigned                     complete:1;
+    unsigned                     uncacheable:1;
+} ngx_http_ssi_fragment_t;
+
+
 typedef struct {
     ngx_str_t     name;
     ngx_uint_t    key;
@@ -89,6 +130,24 @@ static ngx_int_t ngx_http_ssi_stub_output(ngx_http_request_t *r, void *data,
     ngx_int_t rc);
 static ngx_int_t ngx_http_ssi_set_variable(ngx_http_request_t *r, void *data,
     ngx_int_t rc);
+static ngx_int_t ngx_http_ssi_cache_lookup(ngx_http_request_t *r,
+    ngx_http_ssi_ctx_t *ctx, ngx_http_ssi_cache_t *cache, ngx_str_t *key);
+static ngx_int_t ngx_http_ssi_cache_fragment(ngx_http_request_t *r, void *data,
+    ngx_int_t rc);
+static ngx_int_t ngx_http_ssi_cache_body(ngx_http_request_t *r,
+    ngx_chain_t *in);
+static ngx_int_t ngx_http_ssi_cache_cacheable(ngx_http_request_t *r);
+static void ngx_http_ssi_cache_store(ngx_http_ssi_fragment_t *f);
+static ngx_http_ssi_cache_node_t *ngx_http_ssi_cache_find(
+    ngx_http_ssi_cache_t *cache, ngx_str_t *key, uint32_t hash);
+static void ngx_http_ssi_cache_delete(ngx_http_ssi_cache_t *cache,
+    ngx_http_ssi_cache_node_t *fn);
+static void ngx_http_ssi_cache_expire(ngx_http_ssi_cache_t *cache,
+    ngx_uint_t n);
+static void ngx_http_ssi_cache_rbtree_insert_value(ngx_rbtree_node_t *temp,
+    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel);
+static ngx_int_t ngx_http_ssi_cache_init_zone(ngx_shm_zone_t *shm_zone,
+    void *data);
 static ngx_int_t ngx_http_ssi_echo(ngx_http_request_t *r,
     ngx_http_ssi_ctx_t *ctx, ngx_str_t **params);
 static ngx_int_t ngx_http_ssi_config(ngx_http_request_t *r,
@@ -115,6 +174,8 @@ static char *ngx_http_ssi_init_main_conf(ngx_conf_t *cf, void *conf);
 static void *ngx_http_ssi_create_loc_conf(ngx_conf_t *cf);
 static char *ngx_http_ssi_merge_loc_conf(ngx_conf_t *cf,
     void *parent, void *child);
+static char *ngx_http_ssi_include_cache(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
 static ngx_int_t ngx_http_ssi_filter_init(ngx_conf_t *cf);
 
 
@@ -170,6 +231,13 @@ static ngx_command_t  ngx_http_ssi_filter_commands[] = {
       offsetof(ngx_http_ssi_loc_conf_t, last_modified),
       NULL },
 
+    { ngx_string("ssi_include_cache"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_1MORE,
+      ngx_http_ssi_include_cache,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL },
+
       ngx_null_command
 };
 
@@ -437,6 +505,10 @@ ngx_http_ssi_body_filter(ngx_http_request_t *r, ngx_chain_t *in)
             && ctx->in == NULL
             && ctx->busy == NULL))
     {
+        if (ngx_http_ssi_cache_body(r, in) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
         return ngx_http_next_body_filter(r, in);
     }
 
@@ -960,6 +1032,10 @@ ngx_http_ssi_output(ngx_http_request_t *r, ngx_http_ssi_ctx_t *ctx)
     }
 #endif
 
+    if (ngx_http_ssi_cache_body(r, ctx->out) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
     rc = ngx_http_next_body_filter(r, ctx->out);
 
     if (ctx->busy == NULL) {
@@ -2013,6 +2089,7 @@ static ngx_int_t
 ngx_http_ssi_include(ngx_http_request_t *r, ngx_http_ssi_ctx_t *ctx,
     ngx_str_t **params)
 {
+    u_char                      *p;
     ngx_int_t                    rc;
     ngx_str_t                   *uri, *file, *wait, *set, *stub, args;
     ngx_buf_t                   *b;
@@ -2022,6 +2099,8 @@ ngx_http_ssi_include(ngx_http_request_t *r, ngx_http_ssi_ctx_t *ctx,
     ngx_http_ssi_var_t          *var;
     ngx_http_ssi_ctx_t          *mctx;
     ngx_http_ssi_block_t        *bl;
+    ngx_http_ssi_loc_conf_t     *slcf;
+    ngx_http_ssi_fragment_t     *f;
     ngx_http_post_subrequest_t  *psr;
 
     uri = params[NGX_HTTP_SSI_INCLUDE_VIRTUAL];
@@ -2093,7 +2172,62 @@ ngx_http_ssi_include(ngx_http_request_t *r, ngx_http_ssi_ctx_t *ctx,
         return NGX_HTTP_SSI_ERROR;
     }
 
+    if (r->post_subrequest
+        && r->post_subrequest->handler == ngx_http_ssi_cache_fragment)
+    {
+        /* fragments with inclusions are not cached */
+
+        f = r->post_subrequest->data;
+        f->uncacheable = 1;
+    }
+
     psr = NULL;
+    f = NULL;
+
+    slcf = ngx_http_get_module_loc_conf(r, ngx_http_ssi_filter_module);
+
+    if (slcf->cache_zone && set == NULL && stub == NULL) {
+
+        f = ngx_pcalloc(r->pool, sizeof(ngx_http_ssi_fragment_t));
+        if (f == NULL) {
+            return NGX_ERROR;
+        }
+
+        /* the key is "host/uri?args" */
+
+        f->key.len = r->headers_in.server.len + uri->len + 1 + args.len;
+
+        f->key.data = ngx_pnalloc(r->pool, f->key.len);
+        if (f->key.data == NULL) {
+            return NGX_ERROR;
+        }
+
+        p = ngx_cpymem(f->key.data, r->headers_in.server.data,
+                       r->headers_in.server.len);
+        p = ngx_cpymem(p, uri->data, uri->len);
+        *p++ = '?';
+        ngx_memcpy(p, args.data, args.len);
+
+        f->cache = slcf->cache_zone->data;
+
+        rc = ngx_http_ssi_cache_lookup(r, ctx, f->cache, &f->key);
+
+        if (rc != NGX_DECLINED) {
+            return rc;
+        }
+
+        f->valid = slcf->cache_valid;
+        f->max_size = slcf->cache_max_size;
+        f->last = &f->bufs;
+
+        psr = ngx_palloc(r->pool, sizeof(ngx_http_post_subrequest_t));
+        if (psr == NULL) {
+            return NGX_ERROR;
+        }
+
+        psr->handler = ngx_http_ssi_cache_fragment;
+        psr->data = f;
+    }
 
     mctx = ngx_http_get_module_ctx(r->main, ngx_http_ssi_filter_module);
 
@@ -2207,6 +2341,10 @@ ngx_http_ssi_include(ngx_http_request_t *r, ngx_http_ssi_ctx_t *ctx,
         return NGX_HTTP_SSI_ERROR;
     }
 
+    if (f) {
+        sr->filter_need_in_memory = 1;
+    }
+
     if (wait == NULL && set == NULL) {
         return NGX_OK;
     }
@@ -2269,6 +2407,505 @@ ngx_http_ssi_set_variable(ngx_http_request_t *r, void *data, ngx_int_t rc)
 }
 
 
+static ngx_int_t
+ngx_http_ssi_cache_lookup(ngx_http_request_t *r, ngx_http_ssi_ctx_t *ctx,
+    ngx_http_ssi_cache_t *cache, ngx_str_t *key)
+{
+    ngx_buf_t                  *b;
+    ngx_chain_t                *cl;
+    ngx_http_ssi_cache_node_t  *fn;
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    fn = ngx_http_ssi_cache_find(cache, key, ngx_crc32_short(key->data,
+                                                             key->len));
+
+    if (fn == NULL) {
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+        goto miss;
+    }
+
+    if (fn->expire <= ngx_time()) {
+        ngx_http_ssi_cache_delete(cache, fn);
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+        goto miss;
+    }
+
+    ngx_queue_remove(&fn->queue);
+    ngx_queue_insert_head(&cache->sh->queue, &fn->queue);
+
+    if (fn->size == 0) {
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+        goto hit;
+    }
+
+    b = ngx_create_temp_buf(r->pool, fn->size);
+    if (b == NULL) {
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+        return NGX_ERROR;
+    }
+
+    b->last = ngx_cpymem(b->pos, fn->data + fn->len, fn->size);
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    cl = ngx_alloc_chain_link(r->pool);
+    if (cl == NULL) {
+        return NGX_ERROR;
+    }
+
+    cl->buf = b;
+    cl->next = NULL;
+    *ctx->last_out = cl;
+    ctx->last_out = &cl->next;
+
+hit:
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "ssi include cache hit: \"%V\"", key);
+
+    return NGX_OK;
+
+miss:
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "ssi include cache miss: \"%V\"", key);
+
+    return NGX_DECLINED;
+}
+
+
+static ngx_int_t
+ngx_http_ssi_cache_fragment(ngx_http_request_t *r, void *data, ngx_int_t rc)
+{
+    ngx_http_ssi_fragment_t  *f = data;
+
+    if (rc == NGX_ERROR
+        || r->connection->error
+        || !f->complete
+        || f->uncacheable
+        || ngx_http_ssi_cache_cacheable(r) != NGX_OK)
+    {
+        return rc;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "ssi include cache store: \"%V\", %uz",
+                   &f->key, f->size);
+
+    ngx_http_ssi_cache_store(f);
+
+    f->uncacheable = 1;
+
+    return rc;
+}
+
+
+static ngx_int_t
+ngx_http_ssi_cache_body(ngx_http_request_t *r, ngx_chain_t *in)
+{
+    size_t                    size;
+    ngx_buf_t                *b;
+    ngx_chain_t              *cl, *tl;
+    ngx_http_ssi_fragment_t  *f;
+
+    if (r->post_subrequest == NULL
+        || r->post_subrequest->handler != ngx_http_ssi_cache_fragment)
+    {
+        return NGX_OK;
+    }
+
+    f = r->post_subrequest->data;
+
+    if (f->uncacheable) {
+        return NGX_OK;
+    }
+
+    if (ngx_http_ssi_cache_cacheable(r) != NGX_OK) {
+        f->uncacheable = 1;
+        return NGX_OK;
+    }
+
+    for (cl = in; cl; cl = cl->next) {
+        b = cl->buf;
+
+        if (b->last_buf || b->last_in_chain) {
+            f->complete = 1;
+        }
+
+        if (ngx_buf_special(b)) {
+            continue;
+        }
+
+        if (!ngx_buf_in_memory(b)) {
+            f->uncacheable = 1;
+            return NGX_OK;
+        }
+
+        size = b->last - b->pos;
+
+        if (size == 0) {
+            continue;
+        }
+
+        if (f->size + size > f->max_size) {
+            ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                           "ssi include cache: \"%V\" is too big", &f->key);
+
+            f->uncacheable = 1;
+            return NGX_OK;
+        }
+
+        tl = ngx_alloc_chain_link(r->pool);
+        if (tl == NULL) {
+            return NGX_ERROR;
+        }
+
+        tl->buf = ngx_create_temp_buf(r->pool, size);
+        if (tl->buf == NULL) {
+            return NGX_ERROR;
+        }
+
+        tl->buf->last = ngx_cpymem(tl->buf->pos, b->pos, size);
+        tl->next = NULL;
+
+        *f->last = tl;
+        f->last = &tl->next;
+
+        f->size += size;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_ssi_cache_cacheable(ngx_http_request_t *r)
+{
+    u_char           *p, *last;
+    ngx_uint_t        i;
+    ngx_list_part_t  *part;
+    ngx_table_elt_t  *h;
+
+    if (r->headers_out.status != NGX_HTTP_OK) {
+        return NGX_DECLINED;
+    }
+
+    for (h = r->headers_out.cache_control; h; h = h->next) {
+
+        if (h->hash == 0) {
+            continue;
+        }
+
+        p = h->value.data;
+        last = p + h->value.len;
+
+        if (ngx_strlcasestrn(p, last, (u_char *) "no-cache", 8 - 1) != NULL
+            || ngx_strlcasestrn(p, last, (u_char *) "no-store", 8 - 1) != NULL
+            || ngx_strlcasestrn(p, last, (u_char *) "private", 7 - 1) != NULL)
+        {
+            return NGX_DECLINED;
+        }
+    }
+
+    part = &r->headers_out.headers.part;
+    h = part->elts;
+
+    for (i = 0; /* void */; i++) {
+
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                break;
+            }
+
+            part = part->next;
+            h = part->elts;
+            i = 0;
+        }
+
+        if (h[i].hash == 0) {
+            continue;
+        }
+
+        if (h[i].key.len == sizeof("Set-Cookie") - 1
+            && ngx_strncasecmp(h[i].key.data, (u_char *) "Set-Cookie",
+                               sizeof("Set-Cookie") - 1)
+               == 0)
+        {
+            return NGX_DECLINED;
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_ssi_cache_store(ngx_http_ssi_fragment_t *f)
+{
+    u_char                     *p;
+    size_t                      size;
+    uint32_t                    hash;
+    ngx_chain_t                *cl;
+    ngx_rbtree_node_t          *node;
+    ngx_http_ssi_cache_t       *cache;
+    ngx_http_ssi_cache_node_t  *fn;
+
+    if (f->key.len > 65535) {
+        return;
+    }
+
+    cache = f->cache;
+    hash = ngx_crc32_short(f->key.data, f->key.len);
+
+    size = offsetof(ngx_rbtree_node_t, color)
+           + offsetof(ngx_http_ssi_cache_node_t, data)
+           + f->key.len + f->size;
+
+    /* the zone may be referenced with a larger max_size elsewhere */
+
+    if (size > (size_t) (cache->shpool->end - cache->shpool->start) / 2) {
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                       "ssi fragment is too large for cache: %uz", size);
+        return;
+    }
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    fn = ngx_http_ssi_cache_find(cache, &f->key, hash);
+
+    if (fn) {
+        ngx_http_ssi_cache_delete(cache, fn);
+    }
+
+    ngx_http_ssi_cache_expire(cache, 1);
+
+    for ( ;; ) {
+        node = ngx_slab_alloc_locked(cache->shpool, size);
+
+        if (node || ngx_queue_empty(&cache->sh->queue)) {
+            break;
+        }
+
+        ngx_http_ssi_cache_expire(cache, 0);
+    }
+
+    if (node == NULL) {
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+
+        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, 0,
+                      "could not allocate node%s", cache->shpool->log_ctx);
+        return;
+    }
+
+    node->key = hash;
+
+    fn = (ngx_http_ssi_cache_node_t *) &node->color;
+
+    fn->len = (u_short) f->key.len;
+    fn->expire = ngx_time() + f->valid;
+    fn->size = f->size;
+
+    p = ngx_cpymem(fn->data, f->key.data, f->key.len);
+
+    for (cl = f->bufs; cl; cl = cl->next) {
+        p = ngx_cpymem(p, cl->buf->pos, cl->buf->last - cl->buf->pos);
+    }
+
+    ngx_rbtree_insert(&cache->sh->rbtree, node);
+
+    ngx_queue_insert_head(&cache->sh->queue, &fn->queue);
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+}
+
+
+static ngx_http_ssi_cache_node_t *
+ngx_http_ssi_cache_find(ngx_http_ssi_cache_t *cache, ngx_str_t *key,
+    uint32_t hash)
+{
+    ngx_int_t                   rc;
+    ngx_rbtree_node_t          *node, *sentinel;
+    ngx_http_ssi_cache_node_t  *fn;
+
+    node = cache->sh->rbtree.root;
+    sentinel = cache->sh->rbtree.sentinel;
+
+    while (node != sentinel) {
+
+        if (hash < node->key) {
+            node = node->left;
+            continue;
+        }
+
+        if (hash > node->key) {
+            node = node->right;
+            continue;
+        }
+
+        /* hash == node->key */
+
+        fn = (ngx_http_ssi_cache_node_t *) &node->color;
+
+        rc = ngx_memn2cmp(key->data, fn->data, key->len, (size_t) fn->len);
+
+        if (rc == 0) {
+            return fn;
+        }
+
+        node = (rc < 0) ? node->left : node->right;
+    }
+
+    return NULL;
+}
+
+
+static void
+ngx_http_ssi_cache_delete(ngx_http_ssi_cache_t *cache,
+    ngx_http_ssi_cache_node_t *fn)
+{
+    ngx_rbtree_node_t  *node;
+
+    ngx_queue_remove(&fn->queue);
+
+    node = (ngx_rbtree_node_t *)
+               ((u_char *) fn - offsetof(ngx_rbtree_node_t, color));
+
+    ngx_rbtree_delete(&cache->sh->rbtree, node);
+
+    ngx_slab_free_locked(cache->shpool, node);
+}
+
+
+static void
+ngx_http_ssi_cache_expire(ngx_http_ssi_cache_t *cache, ngx_uint_t n)
+{
+    time_t                      now;
+    ngx_queue_t                *q;
+    ngx_http_ssi_cache_node_t  *fn;
+
+    now = ngx_time();
+
+    /*
+     * n == 1 deletes one or two expired entries
+     * n == 0 deletes the least recently used entry by force
+     *        and one or two expired entries
+     */
+
+    while (n < 3) {
+
+        if (ngx_queue_empty(&cache->sh->queue)) {
+            return;
+        }
+
+        q = ngx_queue_last(&cache->sh->queue);
+
+        fn = ngx_queue_data(q, ngx_http_ssi_cache_node_t, queue);
+
+        if (n++ != 0 && fn->expire > now) {
+            return;
+        }
+
+        ngx_http_ssi_cache_delete(cache, fn);
+    }
+}
+
+
+static void
+ngx_http_ssi_cache_rbtree_insert_value(ngx_rbtree_node_t *temp,
+    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel)
+{
+    ngx_rbtree_node_t          **p;
+    ngx_http_ssi_cache_node_t   *fn, *fnt;
+
+    for ( ;; ) {
+
+        if (node->key < temp->key) {
+
+            p = &temp->left;
+
+        } else if (node->key > temp->key) {
+
+            p = &temp->right;
+
+        } else { /* node->key == temp->key */
+
+            fn = (ngx_http_ssi_cache_node_t *) &node->color;
+            fnt = (ngx_http_ssi_cache_node_t *) &temp->color;
+
+            p = (ngx_memn2cmp(fn->data, fnt->data, fn->len, fnt->len) < 0)
+                ? &temp->left : &temp->right;
+        }
+
+        if (*p == sentinel) {
+            break;
+        }
+
+        temp = *p;
+    }
+
+    *p = node;
+    node->parent = temp;
+    node->left = sentinel;
+    node->right = sentinel;
+    ngx_rbt_red(node);
+}
+
+
+static ngx_int_t
+ngx_http_ssi_cache_init_zone(ngx_shm_zone_t *shm_zone, void *data)
+{
+    ngx_http_ssi_cache_t  *ocache = data;
+
+    size_t                 len;
+    ngx_http_ssi_cache_t  *cache;
+
+    cache = shm_zone->data;
+
+    if (ocache) {
+        cache->sh = ocache->sh;
+        cache->shpool = ocache->shpool;
+
+        return NGX_OK;
+    }
+
+    cache->shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    if (shm_zone->shm.exists) {
+        cache->sh = cache->shpool->data;
+
+        return NGX_OK;
+    }
+
+    cache->sh = ngx_slab_alloc(cache->shpool,
+                               sizeof(ngx_http_ssi_cache_shctx_t));
+    if (cache->sh == NULL) {
+        return NGX_ERROR;
+    }
+
+    cache->shpool->data = cache->sh;
+
+    ngx_rbtree_init(&cache->sh->rbtree, &cache->sh->sentinel,
+                    ngx_http_ssi_cache_rbtree_insert_value);
+
+    ngx_queue_init(&cache->sh->queue);
+
+    len = sizeof(" in ssi_include_cache zone \"\"") + shm_zone->shm.name.len;
+
+    cache->shpool->log_ctx = ngx_slab_alloc(cache->shpool, len);
+    if (cache->shpool->log_ctx == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_sprintf(cache->shpool->log_ctx, " in ssi_include_cache zone \"%V\"%Z",
+                &shm_zone->shm.name);
+
+    cache->shpool->log_nomem = 0;
+
+    return NGX_OK;
+}
+
+
 static ngx_int_t
 ngx_http_ssi_echo(ngx_http_request_t *r, ngx_http_ssi_ctx_t *ctx,
     ngx_str_t **params)
@@ -2916,6 +3553,8 @@ ngx_http_ssi_create_loc_conf(ngx_conf_t *cf)
     slcf->min_file_chunk = NGX_CONF_UNSET_SIZE;
     slcf->value_len = NGX_CONF_UNSET_SIZE;
 
+    slcf->cache_zone = NGX_CONF_UNSET_PTR;
+
     return slcf;
 }
 
@@ -2935,6 +3574,16 @@ ngx_http_ssi_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
     ngx_conf_merge_size_value(conf->min_file_chunk, prev->min_file_chunk, 1024);
     ngx_conf_merge_size_value(conf->value_len, prev->value_len, 255);
 
+    if (conf->cache_zone == NGX_CONF_UNSET_PTR) {
+        conf->cache_zone = prev->cache_zone;
+        conf->cache_valid = prev->cache_valid;
+        conf->cache_max_size = prev->cache_max_size;
+    }
+
+    if (conf->cache_zone == NGX_CONF_UNSET_PTR) {
+        conf->cache_zone = NULL;
+    }
+
     if (ngx_http_merge_types(cf, &conf->types_keys, &conf->types,
                              &prev->types_keys, &prev->types,
                              ngx_http_html_default_types)
@@ -2946,6 +3595,150 @@ ngx_http_ssi_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
     return NGX_CONF_OK;
 }
 
+static char *
+ngx_http_ssi_include_cache(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_ssi_loc_conf_t *slcf = conf;
+
+    u_char                *p;
+    time_t                 valid;
+    size_t                 max_size;
+    ssize_t                size;
+    ngx_str_t             *value, name, s;
+    ngx_uint_t             i;
+    ngx_shm_zone_t        *shm_zone;
+    ngx_http_ssi_cache_t  *cache;
+
+    if (slcf->cache_zone != NGX_CONF_UNSET_PTR) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    if (ngx_strcmp(value[1].data, "off") == 0) {
+
+        if (cf->args->nelts != 2) {
+            return "is invalid";
+        }
+
+        slcf->cache_zone = NULL;
+        return NGX_CONF_OK;
+    }
+
+    ngx_str_null(&name);
+    size = 0;
+    valid = 60;
+    max_size = 65536;
+
+    for (i = 1; i < cf->args->nelts; i++) {
+
+        if (ngx_strncmp(value[i].data, "zone=", 5) == 0) {
+
+            name.data = value[i].data + 5;
+
+            p = (u_char *) ngx_strchr(name.data, ':');
+
+            if (p == NULL) {
+                name.len = value[i].len - 5;
+                continue;
+            }
+
+            name.len = p - name.data;
+
+            s.data = p + 1;
+            s.len = value[i].data + value[i].len - s.data;
+
+            size = ngx_parse_size(&s);
+
+            if (size == NGX_ERROR) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid zone size \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            if (size < (ssize_t) (8 * ngx_pagesize)) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "zone \"%V\" is too small", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "valid=", 6) == 0) {
+
+            s.len = value[i].len - 6;
+            s.data = value[i].data + 6;
+
+            valid = ngx_parse_time(&s, 1);
+            if (valid == (time_t) NGX_ERROR || valid == 0) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid valid value \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "max_size=", 9) == 0) {
+
+            s.len = value[i].len - 9;
+            s.data = value[i].data + 9;
+
+            max_size = ngx_parse_size(&s);
+            if (max_size == (size_t) NGX_ERROR) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid max_size value \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid parameter \"%V\"", &value[i]);
+        return NGX_CONF_ERROR;
+    }
+
+    if (name.len == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"%V\" must have \"zone\" parameter",
+                           &cmd->name);
+        return NGX_CONF_ERROR;
+    }
+
+    /* a single fragment should not evict the whole zone */
+
+    if (size && max_size > (size_t) size / 2) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"max_size\" is too large for zone \"%V\"",
+                           &name);
+        return NGX_CONF_ERROR;
+    }
+
+    shm_zone = ngx_shared_memory_add(cf, &name, size,
+                                     &ngx_http_ssi_filter_module);
+    if (shm_zone == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    if (shm_zone->data == NULL) {
+        cache = ngx_pcalloc(cf->pool, sizeof(ngx_http_ssi_cache_t));
+        if (cache == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        shm_zone->init = ngx_http_ssi_cache_init_zone;
+        shm_zone->data = cache;
+    }
+
+    slcf->cache_zone = shm_zone;
+    slcf->cache_valid = valid;
+    slcf->cache_max_size = max_size;
+
+    return NGX_CONF_OK;
+}
+
 
 static ngx_int_t
 ngx_http_ssi_filter_init(ngx_conf_t *cf)
@@ -76,6 +76,15 @@ static ngx_http_variable_t  ngx_http_stub_status_vars[] = {
     { ngx_string("connections_waiting"), NULL, ngx_http_stub_status_variable,
       3, NGX_HTTP_VAR_NOCACHEABLE, 0 },
 
+    { ngx_string("pool_cache_hits"), NULL, ngx_http_stub_status_variable,
+      4, NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("pool_cache_misses"), NULL, ngx_http_stub_status_variable,
+      5, NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("pool_cache_size"), NULL, ngx_http_stub_status_variable,
+      6, NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
       ngx_http_null_variable
 };
 
@@ -179,6 +188,20 @@ ngx_http_stub_status_variable(ngx_http_request_t *r,
         value = *ngx_stat_waiting;
         break;
 
+    /* per worker process */
+
+    case 4:
+        value = ngx_pool_cache.hits;
+        break;
+
+    case 5:
+        value = ngx_pool_cache.misses;
+        break;
+
+    case 6:
+        value = ngx_pool_cache.size;
+        break;
+
     /* suppress warning */
     default:
         value = 0;
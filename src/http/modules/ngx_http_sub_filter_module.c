@@ -22,21 +22,54 @@ typedef struct {
 } ngx_http_sub_match_t;
 
 
+#define NGX_HTTP_SUB_CACHE_SIZE    8
+
+
+typedef struct {
+    uint32_t                   depth;
+    uint32_t                   match;   /* pattern index + 1 */
+    uint32_t                   link;    /* the next state with a match */
+} ngx_http_sub_state_t;
+
+
+/*
+ * the Aho-Corasick automaton for all patterns of a location,
+ * the transitions are indexed by the state and the character class
+ */
+
 typedef struct {
-    ngx_uint_t                 min_match_len;
     ngx_uint_t                 max_match_len;
+    ngx_uint_t                 classes;
+
+    uint32_t                  *next;
+    ngx_http_sub_state_t      *states;
 
-    u_char                     index[257];
-    u_char                     shift[256];
+    u_char                     map[256];
 } ngx_http_sub_tables_t;
 
 
+typedef struct {
+    ngx_http_sub_tables_t      tables;
+    ngx_pool_t                *pool;
+    ngx_uint_t                 count;       /* requests using the tables */
+    ngx_uint_t                 cached;      /* unsigned  cached:1; */
+} ngx_http_sub_automaton_t;
+
+
+typedef struct {
+    ngx_str_t                  key;
+    ngx_uint_t                 used;
+    ngx_http_sub_automaton_t  *automaton;
+} ngx_http_sub_cache_t;
+
+
 typedef struct {
     ngx_uint_t                 dynamic; /* unsigned dynamic:1; */
 
     ngx_array_t               *pairs;
 
     ngx_http_sub_tables_t     *tables;
+    ngx_http_sub_cache_t      *cache;
 
     ngx_hash_t                 types;
 
@@ -71,30 +104,39 @@ typedef struct {
 
     ngx_int_t                  offset;
     ngx_uint_t                 index;
+    ngx_uint_t                 state;
+
+    ngx_int_t                  match_start;
+    ngx_uint_t                 match_len;
 
     ngx_http_sub_tables_t     *tables;
     ngx_array_t               *matches;
 } ngx_http_sub_ctx_t;
 
 
-static ngx_uint_t ngx_http_sub_cmp_index;
+static ngx_uint_t ngx_http_sub_cache_used;
 
 
 static ngx_int_t ngx_http_sub_output(ngx_http_request_t *r,
     ngx_http_sub_ctx_t *ctx);
 static ngx_int_t ngx_http_sub_parse(ngx_http_request_t *r,
-    ngx_http_sub_ctx_t *ctx, ngx_uint_t flush);
-static ngx_int_t ngx_http_sub_match(ngx_http_sub_ctx_t *ctx, ngx_int_t start,
-    ngx_str_t *m);
+    ngx_http_sub_ctx_t *ctx);
+static ngx_uint_t ngx_http_sub_match(ngx_http_request_t *r,
+    ngx_http_sub_ctx_t *ctx, ngx_uint_t state);
+static ngx_http_sub_tables_t *ngx_http_sub_cached_tables(
+    ngx_http_request_t *r, ngx_http_sub_loc_conf_t *slcf,
+    ngx_http_sub_match_t *match, ngx_uint_t n);
 
 static char * ngx_http_sub_filter(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 static void *ngx_http_sub_create_conf(ngx_conf_t *cf);
 static char *ngx_http_sub_merge_conf(ngx_conf_t *cf,
     void *parent, void *child);
-static void ngx_http_sub_init_tables(ngx_http_sub_tables_t *tables,
-    ngx_http_sub_match_t *match, ngx_uint_t n);
-static ngx_int_t ngx_http_sub_cmp_matches(const void *one, const void *two);
+static ngx_int_t ngx_http_sub_init_tables(ngx_pool_t *pool, ngx_log_t *log,
+    ngx_http_sub_tables_t *tables, ngx_http_sub_match_t *match, ngx_uint_t n);
+static void ngx_http_sub_automaton_cleanup(void *data);
+static void ngx_http_sub_automaton_free(ngx_http_sub_automaton_t *a);
+static void ngx_http_sub_cache_cleanup(void *data);
 static ngx_int_t ngx_http_sub_filter_init(ngx_conf_t *cf);
 
 
@@ -239,28 +281,24 @@ ngx_http_sub_header_filter(ngx_http_request_t *r)
         ctx->matches->elts = matches;
         ctx->matches->nelts = j;
 
-        ctx->tables = ngx_palloc(r->pool, sizeof(ngx_http_sub_tables_t));
+        ctx->tables = ngx_http_sub_cached_tables(r, slcf, matches, j);
         if (ctx->tables == NULL) {
             return NGX_ERROR;
         }
-
-        ngx_http_sub_init_tables(ctx->tables, ctx->matches->elts,
-                                 ctx->matches->nelts);
     }
 
-    ctx->saved.data = ngx_pnalloc(r->pool, ctx->tables->max_match_len - 1);
+    ctx->saved.data = ngx_pnalloc(r->pool, ctx->tables->max_match_len);
     if (ctx->saved.data == NULL) {
         return NGX_ERROR;
     }
 
-    ctx->looked.data = ngx_pnalloc(r->pool, ctx->tables->max_match_len - 1);
+    ctx->looked.data = ngx_pnalloc(r->pool, ctx->tables->max_match_len);
     if (ctx->looked.data == NULL) {
         return NGX_ERROR;
     }
 
     ngx_http_set_ctx(r, ctx, ngx_http_sub_filter_module);
 
-    ctx->offset = ctx->tables->min_match_len - 1;
     ctx->last_out = &ctx->out;
 
     r->filter_need_in_memory = 1;
@@ -287,7 +325,6 @@ ngx_http_sub_body_filter(ngx_http_request_t *r, ngx_chain_t *in)
     ngx_int_t                  rc;
     ngx_buf_t                 *b;
     ngx_str_t                 *sub;
-    ngx_uint_t                 flush, last;
     ngx_chain_t               *cl;
     ngx_http_sub_ctx_t        *ctx;
     ngx_http_sub_match_t      *match;
@@ -329,9 +366,6 @@ ngx_http_sub_body_filter(ngx_http_request_t *r, ngx_chain_t *in)
     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                    "http sub filter \"%V\"", &r->uri);
 
-    flush = 0;
-    last = 0;
-
     while (ctx->in || ctx->buf) {
 
         if (ctx->buf == NULL) {
@@ -340,19 +374,13 @@ ngx_http_sub_body_filter(ngx_http_request_t *r, ngx_chain_t *in)
             ctx->pos = ctx->buf->pos;
         }
 
-        if (ctx->buf->flush || ctx->buf->recycled) {
-            flush = 1;
-        }
-
-        if (ctx->in == NULL) {
-            last = flush;
-        }
-
         b = NULL;
 
-        while (ctx->pos < ctx->buf->last) {
-
-            rc = ngx_http_sub_parse(r, ctx, last);
+        while (ctx->pos < ctx->buf->last
+               || (ctx->match_len
+                   && (ctx->buf->last_buf || ctx->buf->last_in_chain)))
+        {
+            rc = ngx_http_sub_parse(r, ctx);
 
             ngx_log_debug4(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                            "parse: %i, looked: \"%V\" %p-%p",
@@ -604,27 +632,26 @@ ngx_http_sub_output(ngx_http_request_t *r, ngx_http_sub_ctx_t *ctx)
 
 
 static ngx_int_t
-ngx_http_sub_parse(ngx_http_request_t *r, ngx_http_sub_ctx_t *ctx,
-    ngx_uint_t flush)
+ngx_http_sub_parse(ngx_http_request_t *r, ngx_http_sub_ctx_t *ctx)
 {
-    u_char                   *p, c;
-    ngx_str_t                *m;
-    ngx_int_t                 offset, start, next, end, len, rc;
-    ngx_uint_t                shift, i, j;
-    ngx_http_sub_match_t     *match;
-    ngx_http_sub_tables_t    *tables;
-    ngx_http_sub_loc_conf_t  *slcf;
+    u_char                 *p, c;
+    ngx_int_t               offset, start, next, end, len, rc;
+    ngx_uint_t              state, s;
+    ngx_http_sub_state_t   *states;
+    ngx_http_sub_tables_t  *tables;
 
-    slcf = ngx_http_get_module_loc_conf(r, ngx_http_sub_filter_module);
     tables = ctx->tables;
-    match = ctx->matches->elts;
+    states = tables->states;
 
     offset = ctx->offset;
     end = ctx->buf->last - ctx->pos;
+    state = ctx->state;
 
     if (ctx->once) {
         /* sets start and next to end */
-        offset = end + (ngx_int_t) tables->min_match_len - 1;
+        offset = end;
+        state = 0;
+        ctx->match_len = 0;
         goto again;
     }
 
@@ -633,83 +660,72 @@ ngx_http_sub_parse(ngx_http_request_t *r, ngx_http_sub_ctx_t *ctx,
         c = offset < 0 ? ctx->looked.data[ctx->looked.len + offset]
                        : ctx->pos[offset];
 
-        c = ngx_tolower(c);
+        state = tables->next[state * tables->classes + tables->map[c]];
+        offset++;
 
-        shift = tables->shift[c];
-        if (shift > 0) {
-            offset += shift;
-            continue;
+        if (ctx->match_len
+            && offset - (ngx_int_t) states[state].depth > ctx->match_start)
+        {
+            /* no match can start earlier or be longer */
+            goto found;
         }
 
-        /* a potential match */
-
-        start = offset - (ngx_int_t) tables->min_match_len + 1;
-
-        i = ngx_max((ngx_uint_t) tables->index[c], ctx->index);
-        j = tables->index[c + 1];
-
-        while (i != j) {
-
-            if (slcf->once && ctx->sub && ctx->sub[i].data) {
-                goto next;
-            }
+        s = ngx_http_sub_match(r, ctx, state);
 
-            m = &match[i].match;
+        if (s == 0) {
+            continue;
+        }
 
-            rc = ngx_http_sub_match(ctx, start, m);
+        /* the leftmost match wins, the longest one among equal starts */
 
-            if (rc == NGX_DECLINED) {
-                goto next;
-            }
+        len = states[s].depth;
+        start = offset - len;
 
-            ctx->index = i;
+        if (ctx->match_len == 0
+            || start < ctx->match_start
+            || (start == ctx->match_start && len > (ngx_int_t) ctx->match_len))
+        {
+            ctx->match_start = start;
+            ctx->match_len = len;
+            ctx->index = states[s].match - 1;
+        }
+    }
 
-            if (rc == NGX_AGAIN) {
-                goto again;
-            }
+    if (ctx->match_len && (ctx->buf->last_buf || ctx->buf->last_in_chain)) {
+        goto found;
+    }
 
-            ctx->offset = offset + (ngx_int_t) m->len;
-            next = start + (ngx_int_t) m->len;
-            end = ngx_max(next, 0);
-            rc = NGX_OK;
+again:
 
-            goto done;
+    /* keep the longest prefix of a pattern and a pending match */
 
-        next:
+    ctx->offset = offset;
+    ctx->state = state;
 
-            i++;
-        }
+    start = offset - (ngx_int_t) states[state].depth;
 
-        offset++;
-        ctx->index = 0;
+    if (ctx->match_len && ctx->match_start < start) {
+        start = ctx->match_start;
     }
 
-    if (flush) {
-        for ( ;; ) {
-            start = offset - (ngx_int_t) tables->min_match_len + 1;
+    next = start;
+    rc = NGX_AGAIN;
 
-            if (start >= end) {
-                break;
-            }
+    goto done;
 
-            for (i = 0; i < ctx->matches->nelts; i++) {
-                m = &match[i].match;
+found:
 
-                if (ngx_http_sub_match(ctx, start, m) == NGX_AGAIN) {
-                    goto again;
-                }
-            }
+    /* the scan is restarted right after the match */
 
-            offset++;
-        }
-    }
+    start = ctx->match_start;
+    next = start + (ngx_int_t) ctx->match_len;
+    end = ngx_max(next, 0);
 
-again:
+    ctx->offset = next;
+    ctx->state = 0;
+    ctx->match_len = 0;
 
-    ctx->offset = offset;
-    start = offset - (ngx_int_t) tables->min_match_len + 1;
-    next = start;
-    rc = NGX_AGAIN;
+    rc = NGX_OK;
 
 done:
 
@@ -735,53 +751,39 @@ done:
 
     ctx->pos += end;
     ctx->offset -= end;
+    ctx->match_start -= end;
 
     return rc;
 }
 
 
-static ngx_int_t
-ngx_http_sub_match(ngx_http_sub_ctx_t *ctx, ngx_int_t start, ngx_str_t *m)
+static ngx_uint_t
+ngx_http_sub_match(ngx_http_request_t *r, ngx_http_sub_ctx_t *ctx,
+    ngx_uint_t state)
 {
-    u_char  *p, *last, *pat, *pat_end;
-
-    pat = m->data;
-    pat_end = m->data + m->len;
-
-    if (start >= 0) {
-        p = ctx->pos + start;
+    ngx_http_sub_state_t     *states;
+    ngx_http_sub_loc_conf_t  *slcf;
 
-    } else {
-        last = ctx->looked.data + ctx->looked.len;
-        p = last + start;
+    slcf = ngx_http_get_module_loc_conf(r, ngx_http_sub_filter_module);
+    states = ctx->tables->states;
 
-        while (p < last && pat < pat_end) {
-            if (ngx_tolower(*p) != *pat) {
-                return NGX_DECLINED;
-            }
+    if (states[state].match == 0) {
+        state = states[state].link;
+    }
 
-            p++;
-            pat++;
-        }
+    /* the longest pattern ending here goes first */
 
-        p = ctx->pos;
-    }
+    while (state) {
 
-    while (p < ctx->buf->last && pat < pat_end) {
-        if (ngx_tolower(*p) != *pat) {
-            return NGX_DECLINED;
+        if (!(slcf->once && ctx->sub && ctx->sub[states[state].match - 1].data))
+        {
+            return state;
         }
 
-        p++;
-        pat++;
-    }
-
-    if (pat != pat_end) {
-        /* partial match */
-        return NGX_AGAIN;
+        state = states[state].link;
     }
 
-    return NGX_OK;
+    return 0;
 }
 
 
@@ -870,6 +872,7 @@ ngx_http_sub_create_conf(ngx_conf_t *cf)
      *     conf->dynamic = 0;
      *     conf->pairs = NULL;
      *     conf->tables = NULL;
+     *     conf->cache = NULL;
      *     conf->types = { NULL };
      *     conf->types_keys = NULL;
      *     conf->matches = NULL;
@@ -886,6 +889,7 @@ static char *
 ngx_http_sub_merge_conf(ngx_conf_t *cf, void *parent, void *child)
 {
     ngx_uint_t                i, n;
+    ngx_pool_cleanup_t       *cln;
     ngx_http_sub_pair_t      *pairs;
     ngx_http_sub_match_t     *matches;
     ngx_http_sub_loc_conf_t  *prev = parent;
@@ -907,6 +911,7 @@ ngx_http_sub_merge_conf(ngx_conf_t *cf, void *parent, void *child)
         conf->pairs = prev->pairs;
         conf->matches = prev->matches;
         conf->tables = prev->tables;
+        conf->cache = prev->cache;
     }
 
     if (conf->pairs && conf->dynamic == 0 && conf->tables == NULL) {
@@ -936,72 +941,309 @@ ngx_http_sub_merge_conf(ngx_conf_t *cf, void *parent, void *child)
             return NGX_CONF_ERROR;
         }
 
-        ngx_http_sub_init_tables(conf->tables, conf->matches->elts,
-                                 conf->matches->nelts);
+        if (ngx_http_sub_init_tables(cf->pool, cf->log, conf->tables,
+                                     matches, n)
+            != NGX_OK)
+        {
+            return NGX_CONF_ERROR;
+        }
+    }
+
+    if (conf->pairs && conf->dynamic && conf->cache == NULL) {
+        conf->cache = ngx_pcalloc(cf->pool, NGX_HTTP_SUB_CACHE_SIZE
+                                            * sizeof(ngx_http_sub_cache_t));
+        if (conf->cache == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        cln = ngx_pool_cleanup_add(cf->pool, 0);
+        if (cln == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        cln->handler = ngx_http_sub_cache_cleanup;
+        cln->data = conf->cache;
     }
 
     return NGX_CONF_OK;
 }
 
 
-static void
-ngx_http_sub_init_tables(ngx_http_sub_tables_t *tables,
-    ngx_http_sub_match_t *match, ngx_uint_t n)
+static ngx_int_t
+ngx_http_sub_init_tables(ngx_pool_t *pool, ngx_log_t *log,
+    ngx_http_sub_tables_t *tables, ngx_http_sub_match_t *match, ngx_uint_t n)
 {
-    u_char      c;
-    ngx_uint_t  i, j, min, max, ch;
+    u_char                 c;
+    uint32_t               s, t, f, *next, *fail, *queue;
+    ngx_uint_t             i, j, k, size, max, classes, head, tail;
+    ngx_http_sub_state_t  *states;
+
+    /* only characters of the patterns get their own classes */
+
+    ngx_memzero(tables->map, 256);
+
+    classes = 1;
+    size = 1;
+    max = 0;
+
+    for (i = 0; i < n; i++) {
 
-    min = match[0].match.len;
-    max = match[0].match.len;
+        for (j = 0; j < match[i].match.len; j++) {
+            c = match[i].match.data[j];
 
-    for (i = 1; i < n; i++) {
-        min = ngx_min(min, match[i].match.len);
+            if (tables->map[c] == 0) {
+                tables->map[c] = (u_char) classes++;
+            }
+        }
+
+        size += match[i].match.len;
         max = ngx_max(max, match[i].match.len);
     }
 
-    tables->min_match_len = min;
+    for (c = 'A'; c <= 'Z'; c++) {
+        tables->map[c] = tables->map[c | 0x20];
+    }
+
+    next = ngx_pcalloc(pool, size * classes * sizeof(uint32_t));
+    if (next == NULL) {
+        return NGX_ERROR;
+    }
+
+    states = ngx_pcalloc(pool, size * sizeof(ngx_http_sub_state_t));
+    if (states == NULL) {
+        return NGX_ERROR;
+    }
+
     tables->max_match_len = max;
+    tables->classes = classes;
+    tables->next = next;
+    tables->states = states;
+
+    /* the trie of the patterns */
+
+    size = 1;
+
+    for (i = 0; i < n; i++) {
+        s = 0;
+
+        for (j = 0; j < match[i].match.len; j++) {
+            k = s * classes + tables->map[match[i].match.data[j]];
+            t = next[k];
+
+            if (t == 0) {
+                t = size++;
+                next[k] = t;
+                states[t].depth = states[s].depth + 1;
+            }
+
+            s = t;
+        }
+
+        if (states[s].match == 0) {
+            states[s].match = i + 1;
+        }
+    }
+
+    /*
+     * failure links are resolved breadth-first, and the missing
+     * transitions are replaced with those of the failure states
+     */
+
+    fail = ngx_alloc(2 * size * sizeof(uint32_t), log);
+    if (fail == NULL) {
+        return NGX_ERROR;
+    }
+
+    queue = fail + size;
+    head = 0;
+    tail = 0;
+
+    for (k = 0; k < classes; k++) {
+        t = next[k];
 
-    ngx_http_sub_cmp_index = tables->min_match_len - 1;
-    ngx_sort(match, n, sizeof(ngx_http_sub_match_t), ngx_http_sub_cmp_matches);
+        if (t) {
+            fail[t] = 0;
+            queue[tail++] = t;
+        }
+    }
+
+    while (head < tail) {
+        s = queue[head++];
+        f = fail[s];
+
+        states[s].link = states[f].match ? f : states[f].link;
 
-    min = ngx_min(min, 255);
-    ngx_memset(tables->shift, min, 256);
+        for (k = 0; k < classes; k++) {
+            t = next[s * classes + k];
+
+            if (t) {
+                fail[t] = next[f * classes + k];
+                queue[tail++] = t;
+
+            } else {
+                next[s * classes + k] = next[f * classes + k];
+            }
+        }
+    }
+
+    ngx_free(fail);
+
+    return NGX_OK;
+}
+
+
+static ngx_http_sub_tables_t *
+ngx_http_sub_cached_tables(ngx_http_request_t *r,
+    ngx_http_sub_loc_conf_t *slcf, ngx_http_sub_match_t *match, ngx_uint_t n)
+{
+    u_char                    *p;
+    size_t                     len;
+    ngx_str_t                  key;
+    ngx_uint_t                 i;
+    ngx_pool_t                *pool;
+    ngx_pool_cleanup_t        *cln;
+    ngx_http_sub_cache_t      *cache, *entry;
+    ngx_http_sub_automaton_t  *a;
+
+    /* automatons are cached per worker by the values of the patterns */
+
+    len = 0;
+
+    for (i = 0; i < n; i++) {
+        len += NGX_SIZE_T_LEN + 1 + match[i].match.len;
+    }
+
+    key.data = ngx_pnalloc(r->pool, len);
+    if (key.data == NULL) {
+        return NULL;
+    }
 
-    ch = 0;
+    p = key.data;
 
     for (i = 0; i < n; i++) {
+        p = ngx_sprintf(p, "%uz:%V", match[i].match.len, &match[i].match);
+    }
+
+    key.len = p - key.data;
+
+    cln = ngx_pool_cleanup_add(r->pool, 0);
+    if (cln == NULL) {
+        return NULL;
+    }
+
+    cache = slcf->cache;
+    entry = &cache[0];
+
+    for (i = 0; i < NGX_HTTP_SUB_CACHE_SIZE; i++) {
 
-        for (j = 0; j < min; j++) {
-            c = match[i].match.data[tables->min_match_len - 1 - j];
-            tables->shift[c] = ngx_min(tables->shift[c], (u_char) j);
+        if (cache[i].key.len == key.len
+            && ngx_memcmp(cache[i].key.data, key.data, key.len) == 0)
+        {
+            cache[i].used = ++ngx_http_sub_cache_used;
+            a = cache[i].automaton;
+            goto found;
         }
 
-        c = match[i].match.data[tables->min_match_len - 1];
-        while (ch <= (ngx_uint_t) c) {
-            tables->index[ch++] = (u_char) i;
+        if (cache[i].used < entry->used) {
+            entry = &cache[i];
         }
     }
 
-    while (ch < 257) {
-        tables->index[ch++] = (u_char) n;
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http sub filter automaton: \"%V\"", &key);
+
+    if (entry->automaton) {
+
+        /* the evicted automaton is freed by the last request using it */
+
+        entry->automaton->cached = 0;
+        ngx_http_sub_automaton_free(entry->automaton);
+
+        ngx_memzero(entry, sizeof(ngx_http_sub_cache_t));
     }
+
+    pool = ngx_create_pool(NGX_DEFAULT_POOL_SIZE, ngx_cycle->log);
+    if (pool == NULL) {
+        return NULL;
+    }
+
+    a = ngx_palloc(pool, sizeof(ngx_http_sub_automaton_t));
+    if (a == NULL) {
+        goto failed;
+    }
+
+    if (ngx_http_sub_init_tables(pool, r->connection->log, &a->tables,
+                                 match, n)
+        != NGX_OK)
+    {
+        goto failed;
+    }
+
+    entry->key.data = ngx_pstrdup(pool, &key);
+    if (entry->key.data == NULL) {
+        goto failed;
+    }
+
+    a->pool = pool;
+    a->count = 0;
+    a->cached = 1;
+
+    entry->key.len = key.len;
+    entry->used = ++ngx_http_sub_cache_used;
+    entry->automaton = a;
+
+found:
+
+    a->count++;
+
+    cln->handler = ngx_http_sub_automaton_cleanup;
+    cln->data = a;
+
+    return &a->tables;
+
+failed:
+
+    ngx_destroy_pool(pool);
+
+    return NULL;
 }
 
 
-static ngx_int_t
-ngx_http_sub_cmp_matches(const void *one, const void *two)
+static void
+ngx_http_sub_automaton_cleanup(void *data)
 {
-    ngx_int_t              c1, c2;
-    ngx_http_sub_match_t  *first, *second;
+    ngx_http_sub_automaton_t  *a = data;
 
-    first = (ngx_http_sub_match_t *) one;
-    second = (ngx_http_sub_match_t *) two;
+    a->count--;
+
+    ngx_http_sub_automaton_free(a);
+}
 
-    c1 = first->match.data[ngx_http_sub_cmp_index];
-    c2 = second->match.data[ngx_http_sub_cmp_index];
 
-    return c1 - c2;
+static void
+ngx_http_sub_automaton_free(ngx_http_sub_automaton_t *a)
+{
+    if (a->count || a->cached) {
+        return;
+    }
+
+    ngx_destroy_pool(a->pool);
+}
+
+
+static void
+ngx_http_sub_cache_cleanup(void *data)
+{
+    ngx_http_sub_cache_t  *cache = data;
+
+    ngx_uint_t  i;
+
+    for (i = 0; i < NGX_HTTP_SUB_CACHE_SIZE; i++) {
+        if (cache[i].automaton) {
+            cache[i].automaton->cached = 0;
+            ngx_http_sub_automaton_free(cache[i].automaton);
+        }
+    }
 }
 
 
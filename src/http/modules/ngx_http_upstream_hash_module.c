@@ -176,6 +176,10 @@ ngx_http_upstream_get_hash_peer(ngx_peer_connection_t *pc, void *data)
     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, pc->log, 0,
                    "get hash peer, try: %ui", pc->tries);
 
+    if (ngx_http_upstream_rr_peers_admit(pc, &hp->rrp) != NGX_OK) {
+        return NGX_BUSY;
+    }
+
     ngx_http_upstream_rr_peers_rlock(hp->rrp.peers);
 
     if (hp->tries > 20 || hp->rrp.peers->single || hp->key.len == 0) {
@@ -246,6 +250,11 @@ ngx_http_upstream_get_hash_peer(ngx_peer_connection_t *pc, void *data)
             goto next;
         }
 
+        if (ngx_http_upstream_rr_peer_ejected(peer)) {
+            ngx_http_upstream_rr_peer_unlock(hp->rrp.peers, peer);
+            goto next;
+        }
+
         if (peer->max_conns && peer->conns >= peer->max_conns) {
             ngx_http_upstream_rr_peer_unlock(hp->rrp.peers, peer);
             goto next;
@@ -269,6 +278,8 @@ ngx_http_upstream_get_hash_peer(ngx_peer_connection_t *pc, void *data)
 
     peer->conns++;
 
+    ngx_http_upstream_rr_peers_acquire(&hp->rrp);
+
     if (now - peer->checked > peer->fail_timeout) {
         peer->checked = now;
     }
@@ -507,6 +518,10 @@ ngx_http_upstream_get_chash_peer(ngx_peer_connection_t *pc, void *data)
     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, pc->log, 0,
                    "get consistent hash peer, try: %ui", pc->tries);
 
+    if (ngx_http_upstream_rr_peers_admit(pc, &hp->rrp) != NGX_OK) {
+        return NGX_BUSY;
+    }
+
     ngx_http_upstream_rr_peers_wlock(hp->rrp.peers);
 
     if (hp->tries > 20 || hp->rrp.peers->single || hp->key.len == 0) {
@@ -556,6 +571,10 @@ ngx_http_upstream_get_chash_peer(ngx_peer_connection_t *pc, void *data)
                 continue;
             }
 
+            if (ngx_http_upstream_rr_peer_ejected(peer)) {
+                continue;
+            }
+
             if (peer->max_conns && peer->conns >= peer->max_conns) {
                 continue;
             }
@@ -604,6 +623,8 @@ found:
 
     best->conns++;
 
+    ngx_http_upstream_rr_peers_acquire(&hp->rrp);
+
     if (now - best->checked > best->fail_timeout) {
         best->checked = now;
     }
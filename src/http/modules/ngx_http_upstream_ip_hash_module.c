@@ -159,6 +159,10 @@ ngx_http_upstream_get_ip_hash_peer(ngx_peer_connection_t *pc, void *data)
     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, pc->log, 0,
                    "get ip hash peer, try: %ui", pc->tries);
 
+    if (ngx_http_upstream_rr_peers_admit(pc, &iphp->rrp) != NGX_OK) {
+        return NGX_BUSY;
+    }
+
     /* TODO: cached */
 
     ngx_http_upstream_rr_peers_rlock(iphp->rrp.peers);
@@ -216,6 +220,11 @@ ngx_http_upstream_get_ip_hash_peer(ngx_peer_connection_t *pc, void *data)
             goto next;
         }
 
+        if (ngx_http_upstream_rr_peer_ejected(peer)) {
+            ngx_http_upstream_rr_peer_unlock(iphp->rrp.peers, peer);
+            goto next;
+        }
+
         if (peer->max_conns && peer->conns >= peer->max_conns) {
             ngx_http_upstream_rr_peer_unlock(iphp->rrp.peers, peer);
             goto next;
@@ -239,6 +248,8 @@ ngx_http_upstream_get_ip_hash_peer(ngx_peer_connection_t *pc, void *data)
 
     peer->conns++;
 
+    ngx_http_upstream_rr_peers_acquire(&iphp->rrp);
+
     if (now - peer->checked > peer->fail_timeout) {
         peer->checked = now;
     }
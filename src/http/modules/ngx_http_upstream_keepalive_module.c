@@ -10,6 +10,10 @@
 #include <ngx_http.h>
 
 
+typedef struct ngx_http_upstream_keepalive_warm_peer_s
+    ngx_http_upstream_keepalive_warm_peer_t;
+
+
 typedef struct {
     ngx_uint_t                         max_cached;
     ngx_uint_t                         requests;
@@ -19,18 +23,41 @@ typedef struct {
     ngx_queue_t                        cache;
     ngx_queue_t                        free;
 
+    ngx_uint_t                         warm;
+    ngx_msec_t                         warm_interval;
+    ngx_flag_t                         warm_adaptive;
+
+    ngx_uint_t                         active;
+    ngx_uint_t                         peak;
+
+    ngx_uint_t                         nwarm;
+    ngx_http_upstream_keepalive_warm_peer_t  *warm_peers;
+    ngx_event_t                       *warm_event;
+
     ngx_http_upstream_init_pt          original_init_upstream;
     ngx_http_upstream_init_peer_pt     original_init_peer;
 
 } ngx_http_upstream_keepalive_srv_conf_t;
 
 
+struct ngx_http_upstream_keepalive_warm_peer_s {
+    ngx_http_upstream_keepalive_srv_conf_t  *conf;
+
+    ngx_http_upstream_rr_peers_t      *peers;
+    ngx_http_upstream_rr_peer_t       *peer;
+    ngx_uint_t                         connecting;
+    ngx_uint_t                         idle;
+};
+
+
 typedef struct {
     ngx_http_upstream_keepalive_srv_conf_t  *conf;
 
     ngx_queue_t                        queue;
     ngx_connection_t                  *connection;
 
+    ngx_http_upstream_keepalive_warm_peer_t  *warm;
+
     socklen_t                          socklen;
     ngx_sockaddr_t                     sockaddr;
 
@@ -44,8 +71,11 @@ typedef struct {
 
     void                              *data;
 
+    ngx_uint_t                         active;  /* unsigned  active:1; */
+
     ngx_event_get_peer_pt              original_get_peer;
     ngx_event_free_peer_pt             original_free_peer;
+    ngx_event_notify_peer_pt           original_notify;
 
 #if (NGX_HTTP_SSL)
     ngx_event_set_peer_session_pt      original_set_session;
@@ -61,11 +91,22 @@ static ngx_int_t ngx_http_upstream_get_keepalive_peer(ngx_peer_connection_t *pc,
     void *data);
 static void ngx_http_upstream_free_keepalive_peer(ngx_peer_connection_t *pc,
     void *data, ngx_uint_t state);
+static void ngx_http_upstream_notify_keepalive_peer(ngx_peer_connection_t *pc,
+    void *data, ngx_uint_t type);
 
 static void ngx_http_upstream_keepalive_dummy_handler(ngx_event_t *ev);
 static void ngx_http_upstream_keepalive_close_handler(ngx_event_t *ev);
 static void ngx_http_upstream_keepalive_close(ngx_connection_t *c);
 
+static void ngx_http_upstream_keepalive_warm_handler(ngx_event_t *ev);
+static ngx_int_t ngx_http_upstream_keepalive_warm_connect(
+    ngx_http_upstream_keepalive_warm_peer_t *wp);
+static void ngx_http_upstream_keepalive_warm_connect_handler(ngx_event_t *ev);
+static ngx_int_t ngx_http_upstream_keepalive_warm_acquire(
+    ngx_http_upstream_keepalive_warm_peer_t *wp);
+static void ngx_http_upstream_keepalive_warm_release(
+    ngx_http_upstream_keepalive_warm_peer_t *wp);
+
 #if (NGX_HTTP_SSL)
 static ngx_int_t ngx_http_upstream_keepalive_set_session(
     ngx_peer_connection_t *pc, void *data);
@@ -76,6 +117,9 @@ static void ngx_http_upstream_keepalive_save_session(ngx_peer_connection_t *pc,
 static void *ngx_http_upstream_keepalive_create_conf(ngx_conf_t *cf);
 static char *ngx_http_upstream_keepalive(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
+static char *ngx_http_upstream_keepalive_warm(ngx_conf_t *cf,
+    ngx_command_t *cmd, void *conf);
+static ngx_int_t ngx_http_upstream_keepalive_init_process(ngx_cycle_t *cycle);
 
 
 static ngx_command_t  ngx_http_upstream_keepalive_commands[] = {
@@ -108,6 +152,13 @@ static ngx_command_t  ngx_http_upstream_keepalive_commands[] = {
       offsetof(ngx_http_upstream_keepalive_srv_conf_t, requests),
       NULL },
 
+    { ngx_string("keepalive_warm"),
+      NGX_HTTP_UPS_CONF|NGX_CONF_TAKE123,
+      ngx_http_upstream_keepalive_warm,
+      NGX_HTTP_SRV_CONF_OFFSET,
+      0,
+      NULL },
+
       ngx_null_command
 };
 
@@ -134,7 +185,7 @@ ngx_module_t  ngx_http_upstream_keepalive_module = {
     NGX_HTTP_MODULE,                       /* module type */
     NULL,                                  /* init master */
     NULL,                                  /* init module */
-    NULL,                                  /* init process */
+    ngx_http_upstream_keepalive_init_process, /* init process */
     NULL,                                  /* init thread */
     NULL,                                  /* exit thread */
     NULL,                                  /* exit process */
@@ -214,13 +265,19 @@ ngx_http_upstream_init_keepalive_peer(ngx_http_request_t *r,
     kp->conf = kcf;
     kp->upstream = r->upstream;
     kp->data = r->upstream->peer.data;
+    kp->active = 0;
     kp->original_get_peer = r->upstream->peer.get;
     kp->original_free_peer = r->upstream->peer.free;
+    kp->original_notify = r->upstream->peer.notify;
 
     r->upstream->peer.data = kp;
     r->upstream->peer.get = ngx_http_upstream_get_keepalive_peer;
     r->upstream->peer.free = ngx_http_upstream_free_keepalive_peer;
 
+    if (kp->original_notify) {
+        r->upstream->peer.notify = ngx_http_upstream_notify_keepalive_peer;
+    }
+
 #if (NGX_HTTP_SSL)
     kp->original_set_session = r->upstream->peer.set_session;
     kp->original_save_session = r->upstream->peer.save_session;
@@ -253,6 +310,14 @@ ngx_http_upstream_get_keepalive_peer(ngx_peer_connection_t *pc, void *data)
         return rc;
     }
 
+    if (!kp->active) {
+        kp->active = 1;
+
+        if (++kp->conf->active > kp->conf->peak) {
+            kp->conf->peak = kp->conf->active;
+        }
+    }
+
     /* search cache for suitable connection */
 
     cache = &kp->conf->cache;
@@ -282,6 +347,11 @@ found:
     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, pc->log, 0,
                    "get keepalive peer: using connection %p", c);
 
+    if (item->warm) {
+        item->warm->idle--;
+        item->warm = NULL;
+    }
+
     c->idle = 0;
     c->sent = 0;
     c->data = NULL;
@@ -315,6 +385,11 @@ ngx_http_upstream_free_keepalive_peer(ngx_peer_connection_t *pc, void *data,
     ngx_log_debug0(NGX_LOG_DEBUG_HTTP, pc->log, 0,
                    "free keepalive peer");
 
+    if (kp->active) {
+        kp->active = 0;
+        kp->conf->active--;
+    }
+
     /* cache valid connections */
 
     u = kp->upstream;
@@ -367,6 +442,10 @@ ngx_http_upstream_free_keepalive_peer(ngx_peer_connection_t *pc, void *data,
 
         ngx_http_upstream_keepalive_close(item->connection);
 
+        if (item->warm) {
+            item->warm->idle--;
+        }
+
     } else {
         q = ngx_queue_head(&kp->conf->free);
         ngx_queue_remove(q);
@@ -377,6 +456,7 @@ ngx_http_upstream_free_keepalive_peer(ngx_peer_connection_t *pc, void *data,
     ngx_queue_insert_head(&kp->conf->cache, q);
 
     item->connection = c;
+    item->warm = NULL;
 
     pc->connection = NULL;
 
@@ -410,6 +490,16 @@ invalid:
 }
 
 
+static void
+ngx_http_upstream_notify_keepalive_peer(ngx_peer_connection_t *pc, void *data,
+    ngx_uint_t type)
+{
+    ngx_http_upstream_keepalive_peer_data_t  *kp = data;
+
+    kp->original_notify(pc, kp->data, type);
+}
+
+
 static void
 ngx_http_upstream_keepalive_dummy_handler(ngx_event_t *ev)
 {
@@ -456,6 +546,11 @@ close:
 
     ngx_http_upstream_keepalive_close(c);
 
+    if (item->warm) {
+        item->warm->idle--;
+        item->warm = NULL;
+    }
+
     ngx_queue_remove(&item->queue);
     ngx_queue_insert_head(&conf->free, &item->queue);
 }
@@ -484,6 +579,277 @@ ngx_http_upstream_keepalive_close(ngx_connection_t *c)
 }
 
 
+static void
+ngx_http_upstream_keepalive_warm_handler(ngx_event_t *ev)
+{
+    ngx_http_upstream_keepalive_srv_conf_t   *kcf;
+    ngx_http_upstream_keepalive_warm_peer_t  *wp;
+    ngx_http_upstream_keepalive_cache_t      *item;
+
+    ngx_uint_t    i, n, target, limit;
+    ngx_queue_t  *q;
+
+    if (ngx_exiting || ngx_terminate) {
+        return;
+    }
+
+    kcf = ev->data;
+    wp = kcf->warm_peers;
+
+    target = kcf->warm;
+
+    if (kcf->warm_adaptive) {
+
+        /* keep enough idle connections to absorb the last observed peak */
+
+        n = (kcf->peak + kcf->nwarm - 1) / kcf->nwarm;
+
+        if (n > target) {
+            target = n;
+        }
+    }
+
+    kcf->peak = kcf->active;
+
+    limit = kcf->max_cached / kcf->nwarm;
+
+    if (limit == 0) {
+        limit = 1;
+    }
+
+    if (target > limit) {
+        target = limit;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, ev->log, 0,
+                   "keepalive warm: %ui connections per peer, %ui peers",
+                   target, kcf->nwarm);
+
+    for (i = 0; i < kcf->nwarm; i++) {
+
+        n = wp[i].connecting;
+
+        for (q = ngx_queue_head(&kcf->cache);
+             q != ngx_queue_sentinel(&kcf->cache);
+             q = ngx_queue_next(q))
+        {
+            item = ngx_queue_data(q, ngx_http_upstream_keepalive_cache_t,
+                                  queue);
+
+            if (ngx_memn2cmp((u_char *) &item->sockaddr,
+                             (u_char *) wp[i].peer->sockaddr,
+                             item->socklen, wp[i].peer->socklen)
+                == 0)
+            {
+                n++;
+            }
+        }
+
+        while (n++ < target) {
+            if (ngx_http_upstream_keepalive_warm_acquire(&wp[i]) != NGX_OK) {
+                break;
+            }
+
+            if (ngx_http_upstream_keepalive_warm_connect(&wp[i]) != NGX_OK) {
+                ngx_http_upstream_keepalive_warm_release(&wp[i]);
+                break;
+            }
+        }
+    }
+
+    ngx_add_timer(ev, kcf->warm_interval);
+}
+
+
+static ngx_int_t
+ngx_http_upstream_keepalive_warm_connect(
+    ngx_http_upstream_keepalive_warm_peer_t *wp)
+{
+    ngx_int_t              rc;
+    ngx_connection_t      *c;
+    ngx_peer_connection_t  pc;
+
+    ngx_memzero(&pc, sizeof(ngx_peer_connection_t));
+
+    pc.sockaddr = wp->peer->sockaddr;
+    pc.socklen = wp->peer->socklen;
+    pc.name = &wp->peer->name;
+    pc.get = ngx_event_get_peer;
+    pc.log = ngx_cycle->log;
+    pc.log_error = NGX_ERROR_ERR;
+
+    rc = ngx_event_connect_peer(&pc);
+
+    if (rc != NGX_OK && rc != NGX_AGAIN) {
+        return NGX_ERROR;
+    }
+
+    c = pc.connection;
+
+    c->pool = ngx_create_pool(128, ngx_cycle->log);
+    if (c->pool == NULL) {
+        ngx_close_connection(c);
+        return NGX_ERROR;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "keepalive warm: connecting to %V, connection %p",
+                   pc.name, c);
+
+    wp->connecting++;
+
+    c->data = wp;
+    c->read->handler = ngx_http_upstream_keepalive_warm_connect_handler;
+    c->write->handler = ngx_http_upstream_keepalive_warm_connect_handler;
+
+    if (rc == NGX_OK) {
+        ngx_http_upstream_keepalive_warm_connect_handler(c->write);
+        return NGX_OK;
+    }
+
+    c->write->cancelable = 1;
+    ngx_add_timer(c->write, wp->conf->warm_interval);
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_upstream_keepalive_warm_connect_handler(ngx_event_t *ev)
+{
+    ngx_http_upstream_keepalive_srv_conf_t   *kcf;
+    ngx_http_upstream_keepalive_warm_peer_t  *wp;
+    ngx_http_upstream_keepalive_cache_t      *item;
+
+    ngx_queue_t       *q;
+    ngx_connection_t  *c;
+
+    c = ev->data;
+    wp = c->data;
+    kcf = wp->conf;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "keepalive warm connect handler");
+
+    wp->connecting--;
+
+    if (c->write->timedout) {
+        if (!ngx_exiting && !ngx_terminate) {
+            ngx_log_error(NGX_LOG_ERR, c->log, NGX_ETIMEDOUT,
+                          "keepalive warm connection to %V timed out",
+                          &wp->peer->name);
+        }
+
+        goto close;
+    }
+
+    if (c->write->timer_set) {
+        ngx_del_timer(c->write);
+    }
+
+    c->write->cancelable = 0;
+
+    if (ngx_http_upstream_test_connect(c) != NGX_OK) {
+        c->log->action = NULL;
+        goto close;
+    }
+
+    if (ngx_exiting || ngx_terminate || ngx_queue_empty(&kcf->free)) {
+        goto close;
+    }
+
+    if (ngx_handle_read_event(c->read, 0) != NGX_OK) {
+        goto close;
+    }
+
+    q = ngx_queue_head(&kcf->free);
+    ngx_queue_remove(q);
+
+    item = ngx_queue_data(q, ngx_http_upstream_keepalive_cache_t, queue);
+
+    ngx_queue_insert_head(&kcf->cache, q);
+
+    item->connection = c;
+    item->warm = wp;
+    wp->idle++;
+    item->socklen = wp->peer->socklen;
+    ngx_memcpy(&item->sockaddr, wp->peer->sockaddr, wp->peer->socklen);
+
+    ngx_add_timer(c->read, kcf->timeout);
+
+    c->write->handler = ngx_http_upstream_keepalive_dummy_handler;
+    c->read->handler = ngx_http_upstream_keepalive_close_handler;
+
+    c->data = item;
+    c->idle = 1;
+
+    ngx_http_upstream_keepalive_warm_release(wp);
+
+    if (c->read->ready) {
+        ngx_http_upstream_keepalive_close_handler(c->read);
+    }
+
+    return;
+
+close:
+
+    ngx_destroy_pool(c->pool);
+    ngx_close_connection(c);
+
+    ngx_http_upstream_keepalive_warm_release(wp);
+}
+
+
+static ngx_int_t
+ngx_http_upstream_keepalive_warm_acquire(
+    ngx_http_upstream_keepalive_warm_peer_t *wp)
+{
+    ngx_int_t                     rc;
+    ngx_http_upstream_rr_peer_t  *peer;
+
+    /*
+     * a warm connection is counted in the peer's conns while connecting;
+     * once idle in the cache, it still counts towards max_conns here,
+     * so warming never opens more connections than the peer allows
+     */
+
+    peer = wp->peer;
+
+    ngx_http_upstream_rr_peers_rlock(wp->peers);
+    ngx_http_upstream_rr_peer_lock(wp->peers, peer);
+
+    if (peer->down
+        || ngx_http_upstream_rr_peer_ejected(peer)
+        || (peer->max_conns && peer->conns + wp->idle >= peer->max_conns))
+    {
+        rc = NGX_BUSY;
+
+    } else {
+        peer->conns++;
+        rc = NGX_OK;
+    }
+
+    ngx_http_upstream_rr_peer_unlock(wp->peers, peer);
+    ngx_http_upstream_rr_peers_unlock(wp->peers);
+
+    return rc;
+}
+
+
+static void
+ngx_http_upstream_keepalive_warm_release(
+    ngx_http_upstream_keepalive_warm_peer_t *wp)
+{
+    ngx_http_upstream_rr_peers_rlock(wp->peers);
+    ngx_http_upstream_rr_peer_lock(wp->peers, wp->peer);
+
+    wp->peer->conns--;
+
+    ngx_http_upstream_rr_peer_unlock(wp->peers, wp->peer);
+    ngx_http_upstream_rr_peers_unlock(wp->peers);
+}
+
+
 #if (NGX_HTTP_SSL)
 
 static ngx_int_t
@@ -524,8 +890,16 @@ ngx_http_upstream_keepalive_create_conf(ngx_conf_t *cf)
      *     conf->original_init_upstream = NULL;
      *     conf->original_init_peer = NULL;
      *     conf->max_cached = 0;
+     *     conf->warm = 0;
+     *     conf->warm_adaptive = 0;
+     *     conf->active = 0;
+     *     conf->peak = 0;
+     *     conf->nwarm = 0;
+     *     conf->warm_peers = NULL;
+     *     conf->warm_event = NULL;
      */
 
+    conf->warm_interval = NGX_CONF_UNSET_MSEC;
     conf->time = NGX_CONF_UNSET_MSEC;
     conf->timeout = NGX_CONF_UNSET_MSEC;
     conf->requests = NGX_CONF_UNSET_UINT;
@@ -574,3 +948,161 @@ ngx_http_upstream_keepalive(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 
     return NGX_CONF_OK;
 }
+
+
+static char *
+ngx_http_upstream_keepalive_warm(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf)
+{
+    ngx_http_upstream_keepalive_srv_conf_t  *kcf = conf;
+
+    ngx_int_t    n;
+    ngx_str_t   *value, s;
+    ngx_uint_t   i;
+
+    if (kcf->warm) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    n = ngx_atoi(value[1].data, value[1].len);
+
+    if (n == NGX_ERROR || n == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid value \"%V\" in \"%V\" directive",
+                           &value[1], &cmd->name);
+        return NGX_CONF_ERROR;
+    }
+
+    kcf->warm = n;
+
+    for (i = 2; i < cf->args->nelts; i++) {
+
+        if (ngx_strncmp(value[i].data, "interval=", 9) == 0) {
+
+            s.len = value[i].len - 9;
+            s.data = &value[i].data[9];
+
+            kcf->warm_interval = ngx_parse_time(&s, 0);
+
+            if (kcf->warm_interval == (ngx_msec_t) NGX_ERROR
+                || kcf->warm_interval == 0)
+            {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid value \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strcmp(value[i].data, "adaptive") == 0) {
+            kcf->warm_adaptive = 1;
+            continue;
+        }
+
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid parameter \"%V\"", &value[i]);
+        return NGX_CONF_ERROR;
+    }
+
+    return NGX_CONF_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_keepalive_init_process(ngx_cycle_t *cycle)
+{
+    ngx_uint_t                                i, n;
+    ngx_event_t                              *ev;
+    ngx_http_upstream_rr_peer_t              *peer;
+    ngx_http_upstream_rr_peers_t             *peers;
+    ngx_http_upstream_srv_conf_t            **uscfp;
+    ngx_http_upstream_main_conf_t            *umcf;
+    ngx_http_upstream_keepalive_srv_conf_t   *kcf;
+    ngx_http_upstream_keepalive_warm_peer_t  *wp;
+
+    if (ngx_process != NGX_PROCESS_WORKER
+        && ngx_process != NGX_PROCESS_SINGLE)
+    {
+        return NGX_OK;
+    }
+
+    umcf = ngx_http_cycle_get_module_main_conf(cycle, ngx_http_upstream_module);
+
+    if (umcf == NULL) {
+        return NGX_OK;
+    }
+
+    uscfp = umcf->upstreams.elts;
+
+    for (i = 0; i < umcf->upstreams.nelts; i++) {
+
+        if (uscfp[i]->srv_conf == NULL || uscfp[i]->servers == NULL) {
+            continue;
+        }
+
+        kcf = ngx_http_conf_upstream_srv_conf(uscfp[i],
+                                          ngx_http_upstream_keepalive_module);
+
+        if (kcf->warm == 0 || kcf->max_cached == 0) {
+            continue;
+        }
+
+        /* backup and down servers are not warmed up */
+
+        peers = uscfp[i]->peer.data;
+
+        n = 0;
+
+        for (peer = peers->peer; peer; peer = peer->next) {
+            if (!peer->down) {
+                n++;
+            }
+        }
+
+        if (n == 0) {
+            continue;
+        }
+
+        wp = ngx_pcalloc(cycle->pool,
+                         n * sizeof(ngx_http_upstream_keepalive_warm_peer_t));
+        if (wp == NULL) {
+            return NGX_ERROR;
+        }
+
+        n = 0;
+
+        for (peer = peers->peer; peer; peer = peer->next) {
+            if (peer->down) {
+                continue;
+            }
+
+            wp[n].conf = kcf;
+            wp[n].peers = peers;
+            wp[n].peer = peer;
+            n++;
+        }
+
+        ev = ngx_pcalloc(cycle->pool, sizeof(ngx_event_t));
+        if (ev == NULL) {
+            return NGX_ERROR;
+        }
+
+        ev->handler = ngx_http_upstream_keepalive_warm_handler;
+        ev->data = kcf;
+        ev->log = cycle->log;
+        ev->cancelable = 1;
+
+        ngx_conf_init_msec_value(kcf->warm_interval, 1000);
+
+        kcf->nwarm = n;
+        kcf->warm_peers = wp;
+        kcf->warm_event = ev;
+
+        ngx_add_timer(ev, 0);
+    }
+
+    return NGX_OK;
+}
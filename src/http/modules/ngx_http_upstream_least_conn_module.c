@@ -111,6 +111,10 @@ ngx_http_upstream_get_least_conn_peer(ngx_peer_connection_t *pc, void *data)
     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, pc->log, 0,
                    "get least conn peer, try: %ui", pc->tries);
 
+    if (ngx_http_upstream_rr_peers_admit(pc, rrp) != NGX_OK) {
+        return NGX_BUSY;
+    }
+
     if (rrp->peers->single) {
         return ngx_http_upstream_get_round_robin_peer(pc, rrp);
     }
@@ -154,6 +158,10 @@ ngx_http_upstream_get_least_conn_peer(ngx_peer_connection_t *pc, void *data)
             continue;
         }
 
+        if (ngx_http_upstream_rr_peer_ejected(peer)) {
+            continue;
+        }
+
         if (peer->max_conns && peer->conns >= peer->max_conns) {
             continue;
         }
@@ -213,6 +221,10 @@ ngx_http_upstream_get_least_conn_peer(ngx_peer_connection_t *pc, void *data)
                 continue;
             }
 
+            if (ngx_http_upstream_rr_peer_ejected(peer)) {
+                continue;
+            }
+
             if (peer->max_conns && peer->conns >= peer->max_conns) {
                 continue;
             }
@@ -243,6 +255,8 @@ ngx_http_upstream_get_least_conn_peer(ngx_peer_connection_t *pc, void *data)
 
     best->conns++;
 
+    ngx_http_upstream_rr_peers_acquire(rrp);
+
     rrp->current = best;
 
     n = p / (8 * sizeof(uintptr_t));
@@ -215,6 +215,10 @@ ngx_http_upstream_get_random_peer(ngx_peer_connection_t *pc, void *data)
     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, pc->log, 0,
                    "get random peer, try: %ui", pc->tries);
 
+    if (ngx_http_upstream_rr_peers_admit(pc, &rp->rrp) != NGX_OK) {
+        return NGX_BUSY;
+    }
+
     rrp = &rp->rrp;
     peers = rrp->peers;
 
@@ -258,6 +262,11 @@ ngx_http_upstream_get_random_peer(ngx_peer_connection_t *pc, void *data)
             goto next;
         }
 
+        if (ngx_http_upstream_rr_peer_ejected(peer)) {
+            ngx_http_upstream_rr_peer_unlock(peers, peer);
+            goto next;
+        }
+
         if (peer->max_conns && peer->conns >= peer->max_conns) {
             ngx_http_upstream_rr_peer_unlock(peers, peer);
             goto next;
@@ -285,6 +294,8 @@ ngx_http_upstream_get_random_peer(ngx_peer_connection_t *pc, void *data)
 
     peer->conns++;
 
+    ngx_http_upstream_rr_peers_acquire(rrp);
+
     ngx_http_upstream_rr_peer_unlock(peers, peer);
     ngx_http_upstream_rr_peers_unlock(peers);
 
@@ -309,6 +320,10 @@ ngx_http_upstream_get_random2_peer(ngx_peer_connection_t *pc, void *data)
     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, pc->log, 0,
                    "get random2 peer, try: %ui", pc->tries);
 
+    if (ngx_http_upstream_rr_peers_admit(pc, &rp->rrp) != NGX_OK) {
+        return NGX_BUSY;
+    }
+
     rrp = &rp->rrp;
     peers = rrp->peers;
 
@@ -358,6 +373,10 @@ ngx_http_upstream_get_random2_peer(ngx_peer_connection_t *pc, void *data)
             goto next;
         }
 
+        if (ngx_http_upstream_rr_peer_ejected(peer)) {
+            goto next;
+        }
+
         if (peer->max_conns && peer->conns >= peer->max_conns) {
             goto next;
         }
@@ -395,6 +414,8 @@ ngx_http_upstream_get_random2_peer(ngx_peer_connection_t *pc, void *data)
 
     peer->conns++;
 
+    ngx_http_upstream_rr_peers_acquire(rrp);
+
     ngx_http_upstream_rr_peers_unlock(peers);
 
     rrp->tried[n] |= m;
@@ -0,0 +1,1118 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+
+#include <zstd.h>
+
+#if (NGX_OPENSSL)
+#include <openssl/evp.h>
+#endif
+
+
+#define NGX_HTTP_ZSTD_CACHED_CONTEXTS  4
+
+#define NGX_HTTP_ZSTD_DCZ_HEADER_LEN   40
+
+#define NGX_HTTP_ZSTD_MIN_WLOG         10
+#define NGX_HTTP_ZSTD_MAX_WLOG         27
+
+
+typedef struct {
+    ngx_flag_t           enable;
+
+    ngx_hash_t           types;
+
+    ngx_bufs_t           bufs;
+
+    ngx_int_t            level;
+    size_t               wlog;
+    ssize_t              min_length;
+
+    ngx_array_t         *types_keys;
+
+#if (NGX_OPENSSL)
+    ngx_str_t            dict_file;
+    ZSTD_CDict          *dict;
+    u_char               dict_hash[32];
+#endif
+} ngx_http_zstd_conf_t;
+
+
+typedef struct {
+    ngx_chain_t         *in;
+    ngx_chain_t         *free;
+    ngx_chain_t         *busy;
+    ngx_chain_t         *out;
+    ngx_chain_t        **last_out;
+
+    ngx_buf_t           *in_buf;
+    ngx_buf_t           *out_buf;
+    ngx_int_t            bufs;
+
+    ZSTD_CCtx           *cctx;
+    ZSTD_inBuffer        input;
+    ZSTD_outBuffer       output;
+    ZSTD_EndDirective    action;
+
+    ngx_uint_t           wlog;
+
+    unsigned             redo:1;
+    unsigned             done:1;
+    unsigned             nomem:1;
+    unsigned             dictionary:1;
+    unsigned             dcz_header:1;
+
+    ngx_http_request_t  *request;
+} ngx_http_zstd_ctx_t;
+
+
+static ngx_int_t ngx_http_zstd_filter_start(ngx_http_request_t *r,
+    ngx_http_zstd_ctx_t *ctx);
+static ngx_int_t ngx_http_zstd_filter_add_data(ngx_http_request_t *r,
+    ngx_http_zstd_ctx_t *ctx);
+static ngx_int_t ngx_http_zstd_filter_get_buf(ngx_http_request_t *r,
+    ngx_http_zstd_ctx_t *ctx);
+static ngx_int_t ngx_http_zstd_filter_compress(ngx_http_request_t *r,
+    ngx_http_zstd_ctx_t *ctx);
+static void ngx_http_zstd_filter_end(ngx_http_zstd_ctx_t *ctx);
+static void ngx_http_zstd_filter_cleanup(void *data);
+
+#if (NGX_OPENSSL)
+static ngx_int_t ngx_http_zstd_dictionary_ok(ngx_http_request_t *r,
+    ngx_http_zstd_conf_t *conf);
+static char *ngx_http_zstd_dictionary(ngx_conf_t *cf,
+    ngx_http_zstd_conf_t *conf);
+static void ngx_http_zstd_free_dictionary(void *data);
+#endif
+
+static ngx_int_t ngx_http_zstd_filter_init(ngx_conf_t *cf);
+static void *ngx_http_zstd_create_conf(ngx_conf_t *cf);
+static char *ngx_http_zstd_merge_conf(ngx_conf_t *cf,
+    void *parent, void *child);
+static char *ngx_http_zstd_window(ngx_conf_t *cf, void *post, void *data);
+static void ngx_http_zstd_exit_process(ngx_cycle_t *cycle);
+
+
+static ngx_conf_num_bounds_t  ngx_http_zstd_comp_level_bounds = {
+    ngx_conf_check_num_bounds, 1, 19
+};
+
+static ngx_conf_post_handler_pt  ngx_http_zstd_window_p = ngx_http_zstd_window;
+
+
+static ngx_command_t  ngx_http_zstd_filter_commands[] = {
+
+    { ngx_string("zstd"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_HTTP_LIF_CONF
+                        |NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_zstd_conf_t, enable),
+      NULL },
+
+    { ngx_string("zstd_buffers"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE2,
+      ngx_conf_set_bufs_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_zstd_conf_t, bufs),
+      NULL },
+
+    { ngx_string("zstd_types"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_1MORE,
+      ngx_http_types_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_zstd_conf_t, types_keys),
+      &ngx_http_html_default_types[0] },
+
+    { ngx_string("zstd_comp_level"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_num_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_zstd_conf_t, level),
+      &ngx_http_zstd_comp_level_bounds },
+
+    { ngx_string("zstd_window"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_size_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_zstd_conf_t, wlog),
+      &ngx_http_zstd_window_p },
+
+    { ngx_string("zstd_min_length"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_size_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_zstd_conf_t, min_length),
+      NULL },
+
+#if (NGX_OPENSSL)
+
+    { ngx_string("zstd_dictionary"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_str_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_zstd_conf_t, dict_file),
+      NULL },
+
+#endif
+
+      ngx_null_command
+};
+
+
+static ngx_http_module_t  ngx_http_zstd_filter_module_ctx = {
+    NULL,                                  /* preconfiguration */
+    ngx_http_zstd_filter_init,             /* postconfiguration */
+
+    NULL,                                  /* create main configuration */
+    NULL,                                  /* init main configuration */
+
+    NULL,                                  /* create server configuration */
+    NULL,                                  /* merge server configuration */
+
+    ngx_http_zstd_create_conf,             /* create location configuration */
+    ngx_http_zstd_merge_conf               /* merge location configuration */
+};
+
+
+ngx_module_t  ngx_http_zstd_filter_module = {
+    NGX_MODULE_V1,
+    &ngx_http_zstd_filter_module_ctx,      /* module context */
+    ngx_http_zstd_filter_commands,         /* module directives */
+    NGX_HTTP_MODULE,                       /* module type */
+    NULL,                                  /* init master */
+    NULL,                                  /* init module */
+    NULL,                                  /* init process */
+    NULL,                                  /* init thread */
+    NULL,                                  /* exit thread */
+    ngx_http_zstd_exit_process,            /* exit process */
+    NULL,                                  /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+static ngx_str_t  ngx_http_zstd_encoding = ngx_string("zstd");
+
+#if (NGX_OPENSSL)
+
+static ngx_str_t  ngx_http_zstd_dcz_encoding = ngx_string("dcz");
+static ngx_str_t  ngx_http_zstd_available_dictionary =
+    ngx_string("Available-Dictionary");
+
+/* a skippable zstd frame magic followed by the frame length */
+
+static u_char  ngx_http_zstd_dcz_magic[] = {
+    0x5e, 0x2a, 0x4d, 0x18, 0x20, 0x00, 0x00, 0x00
+};
+
+#endif
+
+
+/*
+ * compression contexts keep their workspace between requests,
+ * so a few of them are cached in a worker process
+ */
+
+static ZSTD_CCtx   *ngx_http_zstd_contexts[NGX_HTTP_ZSTD_CACHED_CONTEXTS];
+static ngx_uint_t   ngx_http_zstd_ncontexts;
+
+
+static ngx_http_output_header_filter_pt  ngx_http_next_header_filter;
+static ngx_http_output_body_filter_pt    ngx_http_next_body_filter;
+
+
+static ngx_int_t
+ngx_http_zstd_header_filter(ngx_http_request_t *r)
+{
+    ngx_table_elt_t       *h;
+    ngx_pool_cleanup_t    *cln;
+    ngx_http_zstd_ctx_t   *ctx;
+    ngx_http_zstd_conf_t  *conf;
+
+    conf = ngx_http_get_module_loc_conf(r, ngx_http_zstd_filter_module);
+
+    if (!conf->enable
+        || (r->headers_out.status != NGX_HTTP_OK
+            && r->headers_out.status != NGX_HTTP_FORBIDDEN
+            && r->headers_out.status != NGX_HTTP_NOT_FOUND)
+        || (r->headers_out.content_encoding
+            && r->headers_out.content_encoding->value.len)
+        || (r->headers_out.content_length_n != -1
+            && r->headers_out.content_length_n < conf->min_length)
+        || ngx_http_test_content_type(r, &conf->types) == NULL
+        || r->header_only)
+    {
+        return ngx_http_next_header_filter(r);
+    }
+
+    r->gzip_vary = 1;
+
+#if (NGX_HTTP_DEGRADATION)
+    {
+    ngx_http_core_loc_conf_t  *clcf;
+
+    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+
+    if (clcf->gzip_disable_degradation && ngx_http_degraded(r)) {
+        return ngx_http_next_header_filter(r);
+    }
+    }
+#endif
+
+    ctx = ngx_pcalloc(r->pool, sizeof(ngx_http_zstd_ctx_t));
+    if (ctx == NULL) {
+        return NGX_ERROR;
+    }
+
+#if (NGX_OPENSSL)
+
+    switch (ngx_http_zstd_dictionary_ok(r, conf)) {
+
+    case NGX_OK:
+        ctx->dictionary = 1;
+        ctx->dcz_header = 1;
+        break;
+
+    case NGX_ERROR:
+        return NGX_ERROR;
+
+    default: /* NGX_DECLINED */
+        break;
+    }
+
+#endif
+
+    if (!ctx->dictionary
+        && ngx_http_encoding_ok(r, &ngx_http_zstd_encoding) != NGX_OK)
+    {
+        return ngx_http_next_header_filter(r);
+    }
+
+    cln = ngx_pool_cleanup_add(r->pool, 0);
+    if (cln == NULL) {
+        return NGX_ERROR;
+    }
+
+    cln->handler = ngx_http_zstd_filter_cleanup;
+    cln->data = ctx;
+
+    ngx_http_set_ctx(r, ctx, ngx_http_zstd_filter_module);
+
+    ctx->request = r;
+    ctx->wlog = conf->wlog;
+
+    if (r->headers_out.content_length_n > 0) {
+
+        /* there is no need in a window larger than the response */
+
+        while (ctx->wlog > NGX_HTTP_ZSTD_MIN_WLOG
+               && r->headers_out.content_length_n
+                  <= (off_t) 1 << (ctx->wlog - 1))
+        {
+            ctx->wlog--;
+        }
+    }
+
+    h = ngx_list_push(&r->headers_out.headers);
+    if (h == NULL) {
+        return NGX_ERROR;
+    }
+
+    h->hash = 1;
+    h->next = NULL;
+    ngx_str_set(&h->key, "Content-Encoding");
+
+    if (ctx->dictionary) {
+        ngx_str_set(&h->value, "dcz");
+
+    } else {
+        ngx_str_set(&h->value, "zstd");
+    }
+
+    r->headers_out.content_encoding = h;
+
+#if (NGX_OPENSSL)
+
+    if (conf->dict) {
+        h = ngx_list_push(&r->headers_out.headers);
+        if (h == NULL) {
+            return NGX_ERROR;
+        }
+
+        h->hash = 1;
+        h->next = NULL;
+        ngx_str_set(&h->key, "Vary");
+        ngx_str_set(&h->value, "Available-Dictionary");
+    }
+
+#endif
+
+    r->main_filter_need_in_memory = 1;
+
+    ngx_http_clear_content_length(r);
+    ngx_http_clear_accept_ranges(r);
+    ngx_http_weak_etag(r);
+
+    return ngx_http_next_header_filter(r);
+}
+
+
+static ngx_int_t
+ngx_http_zstd_body_filter(ngx_http_request_t *r, ngx_chain_t *in)
+{
+    ngx_int_t             rc;
+    ngx_uint_t            flush;
+    ngx_chain_t          *cl;
+    ngx_http_zstd_ctx_t  *ctx;
+
+    ctx = ngx_http_get_module_ctx(r, ngx_http_zstd_filter_module);
+
+    if (ctx == NULL || ctx->done || r->header_only) {
+        return ngx_http_next_body_filter(r, in);
+    }
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http zstd filter");
+
+    if (ctx->cctx == NULL) {
+        if (ngx_http_zstd_filter_start(r, ctx) != NGX_OK) {
+            goto failed;
+        }
+    }
+
+    if (in) {
+        if (ngx_chain_add_copy(r->pool, &ctx->in, in) != NGX_OK) {
+            goto failed;
+        }
+
+        r->connection->buffered |= NGX_HTTP_GZIP_BUFFERED;
+    }
+
+    if (ctx->nomem) {
+
+        /* flush busy buffers */
+
+        if (ngx_http_next_body_filter(r, NULL) == NGX_ERROR) {
+            goto failed;
+        }
+
+        cl = NULL;
+
+        ngx_chain_update_chains(r->pool, &ctx->free, &ctx->busy, &cl,
+                                (ngx_buf_tag_t) &ngx_http_zstd_filter_module);
+        ctx->nomem = 0;
+        flush = 0;
+
+    } else {
+        flush = ctx->busy ? 1 : 0;
+    }
+
+    for ( ;; ) {
+
+        /* cycle while we can write to a client */
+
+        for ( ;; ) {
+
+            /* cycle while there is data to feed zstd and ... */
+
+            rc = ngx_http_zstd_filter_add_data(r, ctx);
+
+            if (rc == NGX_DECLINED) {
+                break;
+            }
+
+            if (rc == NGX_AGAIN) {
+                continue;
+            }
+
+
+            /* ... there are buffers to write zstd output */
+
+            rc = ngx_http_zstd_filter_get_buf(r, ctx);
+
+            if (rc == NGX_DECLINED) {
+                break;
+            }
+
+            if (rc == NGX_ERROR) {
+                goto failed;
+            }
+
+
+            rc = ngx_http_zstd_filter_compress(r, ctx);
+
+            if (rc == NGX_OK) {
+                break;
+            }
+
+            if (rc == NGX_ERROR) {
+                goto failed;
+            }
+
+            /* rc == NGX_AGAIN */
+        }
+
+        if (ctx->out == NULL && !flush) {
+            return ctx->busy ? NGX_AGAIN : NGX_OK;
+        }
+
+        rc = ngx_http_next_body_filter(r, ctx->out);
+
+        if (rc == NGX_ERROR) {
+            goto failed;
+        }
+
+        ngx_chain_update_chains(r->pool, &ctx->free, &ctx->busy, &ctx->out,
+                                (ngx_buf_tag_t) &ngx_http_zstd_filter_module);
+        ctx->last_out = &ctx->out;
+
+        ctx->nomem = 0;
+        flush = 0;
+
+        if (ctx->done) {
+            return rc;
+        }
+    }
+
+    /* unreachable */
+
+failed:
+
+    ctx->done = 1;
+
+    ngx_http_zstd_filter_end(ctx);
+
+    return NGX_ERROR;
+}
+
+
+static ngx_int_t
+ngx_http_zstd_filter_start(ngx_http_request_t *r, ngx_http_zstd_ctx_t *ctx)
+{
+    size_t                 rc;
+    ngx_http_zstd_conf_t  *conf;
+
+    conf = ngx_http_get_module_loc_conf(r, ngx_http_zstd_filter_module);
+
+    if (ngx_http_zstd_ncontexts) {
+        ctx->cctx = ngx_http_zstd_contexts[--ngx_http_zstd_ncontexts];
+
+    } else {
+        ctx->cctx = ZSTD_createCCtx();
+        if (ctx->cctx == NULL) {
+            ngx_log_error(NGX_LOG_ALERT, r->connection->log, 0,
+                          "ZSTD_createCCtx() failed");
+            return NGX_ERROR;
+        }
+    }
+
+#if (NGX_OPENSSL)
+    if (ctx->dictionary) {
+
+        /* the compression level is set in the dictionary */
+
+        rc = ZSTD_CCtx_refCDict(ctx->cctx, conf->dict);
+
+    } else
+#endif
+    {
+        rc = ZSTD_CCtx_setParameter(ctx->cctx, ZSTD_c_compressionLevel,
+                                    (int) conf->level);
+    }
+
+    if (!ZSTD_isError(rc)) {
+        rc = ZSTD_CCtx_setParameter(ctx->cctx, ZSTD_c_windowLog,
+                                    (int) ctx->wlog);
+    }
+
+    if (ZSTD_isError(rc)) {
+        ngx_log_error(NGX_LOG_ALERT, r->connection->log, 0,
+                      "ZSTD_CCtx_setParameter() failed: %s",
+                      ZSTD_getErrorName(rc));
+        return NGX_ERROR;
+    }
+
+    ctx->last_out = &ctx->out;
+    ctx->action = ZSTD_e_continue;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_zstd_filter_add_data(ngx_http_request_t *r, ngx_http_zstd_ctx_t *ctx)
+{
+    ngx_chain_t  *cl;
+
+    if (ctx->input.pos < ctx->input.size
+        || ctx->action != ZSTD_e_continue
+        || ctx->redo)
+    {
+        return NGX_OK;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "zstd in: %p", ctx->in);
+
+    if (ctx->in == NULL) {
+        return NGX_DECLINED;
+    }
+
+    cl = ctx->in;
+    ctx->in_buf = cl->buf;
+    ctx->in = cl->next;
+
+    ngx_free_chain(r->pool, cl);
+
+    ctx->input.src = ctx->in_buf->pos;
+    ctx->input.size = ctx->in_buf->last - ctx->in_buf->pos;
+    ctx->input.pos = 0;
+
+    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "zstd in_buf:%p pos:%p size:%uz",
+                   ctx->in_buf, ctx->input.src, ctx->input.size);
+
+    if (ctx->in_buf->last_buf) {
+        ctx->action = ZSTD_e_end;
+
+    } else if (ctx->in_buf->flush) {
+        ctx->action = ZSTD_e_flush;
+
+    } else if (ctx->input.size == 0) {
+        /* ctx->action == ZSTD_e_continue */
+        return NGX_AGAIN;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_zstd_filter_get_buf(ngx_http_request_t *r, ngx_http_zstd_ctx_t *ctx)
+{
+    ngx_chain_t           *cl;
+    ngx_http_zstd_conf_t  *conf;
+
+    if (ctx->output.pos < ctx->output.size) {
+        return NGX_OK;
+    }
+
+    conf = ngx_http_get_module_loc_conf(r, ngx_http_zstd_filter_module);
+
+    if (ctx->free) {
+
+        cl = ctx->free;
+        ctx->out_buf = cl->buf;
+        ctx->free = cl->next;
+
+        ngx_free_chain(r->pool, cl);
+
+    } else if (ctx->bufs < conf->bufs.num) {
+
+        ctx->out_buf = ngx_create_temp_buf(r->pool, conf->bufs.size);
+        if (ctx->out_buf == NULL) {
+            return NGX_ERROR;
+        }
+
+        ctx->out_buf->tag = (ngx_buf_tag_t) &ngx_http_zstd_filter_module;
+        ctx->out_buf->recycled = 1;
+        ctx->bufs++;
+
+    } else {
+        ctx->nomem = 1;
+        return NGX_DECLINED;
+    }
+
+    ctx->output.dst = ctx->out_buf->pos;
+    ctx->output.size = conf->bufs.size;
+    ctx->output.pos = 0;
+
+#if (NGX_OPENSSL)
+
+    if (ctx->dcz_header) {
+
+        /* the dictionary-compressed stream header */
+
+        ngx_memcpy(ctx->output.dst, ngx_http_zstd_dcz_magic,
+                   sizeof(ngx_http_zstd_dcz_magic));
+        ngx_memcpy((u_char *) ctx->output.dst
+                   + sizeof(ngx_http_zstd_dcz_magic),
+                   conf->dict_hash, 32);
+
+        ctx->output.pos = NGX_HTTP_ZSTD_DCZ_HEADER_LEN;
+        ctx->dcz_header = 0;
+    }
+
+#endif
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_zstd_filter_compress(ngx_http_request_t *r, ngx_http_zstd_ctx_t *ctx)
+{
+    size_t        rc;
+    ngx_buf_t    *b;
+    ngx_chain_t  *cl;
+
+    ngx_log_debug5(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "zstd compress in: in:%uz/%uz out:%uz/%uz a:%d",
+                   ctx->input.pos, ctx->input.size,
+                   ctx->output.pos, ctx->output.size, ctx->action);
+
+    rc = ZSTD_compressStream2(ctx->cctx, &ctx->output, &ctx->input,
+                              ctx->action);
+
+    if (ZSTD_isError(rc)) {
+        ngx_log_error(NGX_LOG_ALERT, r->connection->log, 0,
+                      "ZSTD_compressStream2() failed: %s",
+                      ZSTD_getErrorName(rc));
+        return NGX_ERROR;
+    }
+
+    ngx_log_debug5(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "zstd compress out: in:%uz/%uz out:%uz/%uz rc:%uz",
+                   ctx->input.pos, ctx->input.size,
+                   ctx->output.pos, ctx->output.size, rc);
+
+    if (ctx->in_buf) {
+        ctx->in_buf->pos = (u_char *) ctx->input.src + ctx->input.pos;
+    }
+
+    ctx->out_buf->last = (u_char *) ctx->output.dst + ctx->output.pos;
+
+    if (ctx->output.pos == ctx->output.size
+        && (rc != 0 || ctx->action == ZSTD_e_continue))
+    {
+        /* zstd wants to output some more compressed data */
+
+        cl = ngx_alloc_chain_link(r->pool);
+        if (cl == NULL) {
+            return NGX_ERROR;
+        }
+
+        cl->buf = ctx->out_buf;
+        cl->next = NULL;
+        *ctx->last_out = cl;
+        ctx->last_out = &cl->next;
+
+        ctx->redo = 1;
+
+        return NGX_AGAIN;
+    }
+
+    ctx->redo = 0;
+
+    if (ctx->action == ZSTD_e_flush) {
+        ctx->action = ZSTD_e_continue;
+
+        cl = ngx_alloc_chain_link(r->pool);
+        if (cl == NULL) {
+            return NGX_ERROR;
+        }
+
+        b = ctx->out_buf;
+
+        if (ngx_buf_size(b) == 0) {
+
+            b = ngx_calloc_buf(ctx->request->pool);
+            if (b == NULL) {
+                return NGX_ERROR;
+            }
+
+        } else {
+            ctx->output.pos = ctx->output.size;
+        }
+
+        b->flush = 1;
+
+        cl->buf = b;
+        cl->next = NULL;
+        *ctx->last_out = cl;
+        ctx->last_out = &cl->next;
+
+        r->connection->buffered &= ~NGX_HTTP_GZIP_BUFFERED;
+
+        return NGX_OK;
+    }
+
+    if (ctx->action == ZSTD_e_end) {
+
+        ngx_http_zstd_filter_end(ctx);
+
+        cl = ngx_alloc_chain_link(r->pool);
+        if (cl == NULL) {
+            return NGX_ERROR;
+        }
+
+        b = ctx->out_buf;
+
+        if (ngx_buf_size(b) == 0) {
+            b->temporary = 0;
+        }
+
+        b->last_buf = 1;
+
+        cl->buf = b;
+        cl->next = NULL;
+        *ctx->last_out = cl;
+        ctx->last_out = &cl->next;
+
+        ctx->output.pos = ctx->output.size;
+        ctx->done = 1;
+
+        r->connection->buffered &= ~NGX_HTTP_GZIP_BUFFERED;
+
+        return NGX_OK;
+    }
+
+    return NGX_AGAIN;
+}
+
+
+static void
+ngx_http_zstd_filter_end(ngx_http_zstd_ctx_t *ctx)
+{
+    ZSTD_CCtx  *cctx;
+
+    cctx = ctx->cctx;
+
+    if (cctx == NULL) {
+        return;
+    }
+
+    ctx->cctx = NULL;
+
+    if (ngx_http_zstd_ncontexts == NGX_HTTP_ZSTD_CACHED_CONTEXTS) {
+        ZSTD_freeCCtx(cctx);
+        return;
+    }
+
+    (void) ZSTD_CCtx_reset(cctx, ZSTD_reset_session_and_parameters);
+
+    ngx_http_zstd_contexts[ngx_http_zstd_ncontexts++] = cctx;
+}
+
+
+static void
+ngx_http_zstd_filter_cleanup(void *data)
+{
+    ngx_http_zstd_ctx_t  *ctx = data;
+
+    ngx_http_zstd_filter_end(ctx);
+}
+
+
+#if (NGX_OPENSSL)
+
+static ngx_int_t
+ngx_http_zstd_dictionary_ok(ngx_http_request_t *r, ngx_http_zstd_conf_t *conf)
+{
+    u_char            hash[33];
+    ngx_str_t         src, dst;
+    ngx_uint_t        i;
+    ngx_list_part_t  *part;
+    ngx_table_elt_t  *h;
+
+    if (conf->dict == NULL) {
+        return NGX_DECLINED;
+    }
+
+    part = &r->headers_in.headers.part;
+    h = part->elts;
+
+    for (i = 0; /* void */ ; i++) {
+
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                return NGX_DECLINED;
+            }
+
+            part = part->next;
+            h = part->elts;
+            i = 0;
+        }
+
+        if (h[i].hash == 0
+            || h[i].key.len != ngx_http_zstd_available_dictionary.len
+            || ngx_strncasecmp(h[i].key.data,
+                               ngx_http_zstd_available_dictionary.data,
+                               h[i].key.len)
+               != 0)
+        {
+            continue;
+        }
+
+        break;
+    }
+
+    /* a structured field byte sequence, ":<base64>:" */
+
+    src = h[i].value;
+
+    if (src.len < 2 || src.data[0] != ':' || src.data[src.len - 1] != ':'
+        || ngx_base64_decoded_length(src.len - 2) > sizeof(hash))
+    {
+        return NGX_DECLINED;
+    }
+
+    src.data++;
+    src.len -= 2;
+
+    dst.data = hash;
+
+    if (ngx_decode_base64(&dst, &src) != NGX_OK
+        || dst.len != sizeof(conf->dict_hash)
+        || ngx_memcmp(hash, conf->dict_hash, dst.len) != 0)
+    {
+        return NGX_DECLINED;
+    }
+
+    return ngx_http_encoding_ok(r, &ngx_http_zstd_dcz_encoding);
+}
+
+
+static char *
+ngx_http_zstd_dictionary(ngx_conf_t *cf, ngx_http_zstd_conf_t *conf)
+{
+    u_char           *buf;
+    size_t            size;
+    ssize_t           n;
+    ngx_fd_t          fd;
+    ngx_file_info_t   fi;
+    unsigned int      len;
+
+    if (ngx_conf_full_name(cf->cycle, &conf->dict_file, 1) != NGX_OK) {
+        return NGX_CONF_ERROR;
+    }
+
+    fd = ngx_open_file(conf->dict_file.data, NGX_FILE_RDONLY,
+                       NGX_FILE_OPEN, 0);
+
+    if (fd == NGX_INVALID_FILE) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, ngx_errno,
+                           ngx_open_file_n " \"%s\" failed",
+                           conf->dict_file.data);
+        return NGX_CONF_ERROR;
+    }
+
+    if (ngx_fd_info(fd, &fi) == NGX_FILE_ERROR) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, ngx_errno,
+                           ngx_fd_info_n " \"%s\" failed",
+                           conf->dict_file.data);
+        goto failed;
+    }
+
+    size = ngx_file_size(&fi);
+
+    buf = ngx_pnalloc(cf->temp_pool, size);
+    if (buf == NULL) {
+        goto failed;
+    }
+
+    n = ngx_read_fd(fd, buf, size);
+
+    if (n == -1) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, ngx_errno,
+                           ngx_read_fd_n " \"%s\" failed",
+                           conf->dict_file.data);
+        goto failed;
+    }
+
+    if ((size_t) n != size) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           ngx_read_fd_n " \"%s\" returned only %z bytes "
+                           "instead of %uz", conf->dict_file.data, n, size);
+        goto failed;
+    }
+
+    if (ngx_close_file(fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, cf->log, ngx_errno,
+                      ngx_close_file_n " \"%s\" failed",
+                      conf->dict_file.data);
+    }
+
+    if (EVP_Digest(buf, size, conf->dict_hash, &len, EVP_sha256(), NULL) == 0
+        || len != sizeof(conf->dict_hash))
+    {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0, "EVP_Digest() failed");
+        return NGX_CONF_ERROR;
+    }
+
+    conf->dict = ZSTD_createCDict(buf, size, (int) conf->level);
+    if (conf->dict == NULL) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "ZSTD_createCDict(\"%s\") failed",
+                           conf->dict_file.data);
+        return NGX_CONF_ERROR;
+    }
+
+    return NGX_CONF_OK;
+
+failed:
+
+    if (ngx_close_file(fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, cf->log, ngx_errno,
+                      ngx_close_file_n " \"%s\" failed",
+                      conf->dict_file.data);
+    }
+
+    return NGX_CONF_ERROR;
+}
+
+
+static void
+ngx_http_zstd_free_dictionary(void *data)
+{
+    ZSTD_CDict  *dict = data;
+
+    ZSTD_freeCDict(dict);
+}
+
+#endif
+
+
+static void *
+ngx_http_zstd_create_conf(ngx_conf_t *cf)
+{
+    ngx_http_zstd_conf_t  *conf;
+
+    conf = ngx_pcalloc(cf->pool, sizeof(ngx_http_zstd_conf_t));
+    if (conf == NULL) {
+        return NULL;
+    }
+
+    /*
+     * set by ngx_pcalloc():
+     *
+     *     conf->bufs.num = 0;
+     *     conf->types = { NULL };
+     *     conf->types_keys = NULL;
+     *     conf->dict_file = { 0, NULL };
+     *     conf->dict = NULL;
+     */
+
+    conf->enable = NGX_CONF_UNSET;
+    conf->level = NGX_CONF_UNSET;
+    conf->wlog = NGX_CONF_UNSET_SIZE;
+    conf->min_length = NGX_CONF_UNSET;
+
+    return conf;
+}
+
+
+static char *
+ngx_http_zstd_merge_conf(ngx_conf_t *cf, void *parent, void *child)
+{
+    ngx_http_zstd_conf_t *prev = parent;
+    ngx_http_zstd_conf_t *conf = child;
+
+#if (NGX_OPENSSL)
+    ngx_pool_cleanup_t  *cln;
+#endif
+
+    ngx_conf_merge_value(conf->enable, prev->enable, 0);
+
+    ngx_conf_merge_bufs_value(conf->bufs, prev->bufs,
+                              (128 * 1024) / ngx_pagesize, ngx_pagesize);
+
+    ngx_conf_merge_value(conf->level, prev->level, 3);
+    ngx_conf_merge_size_value(conf->wlog, prev->wlog, 19);
+    ngx_conf_merge_value(conf->min_length, prev->min_length, 20);
+
+    if (ngx_http_merge_types(cf, &conf->types_keys, &conf->types,
+                             &prev->types_keys, &prev->types,
+                             ngx_http_html_default_types)
+        != NGX_OK)
+    {
+        return NGX_CONF_ERROR;
+    }
+
+#if (NGX_OPENSSL)
+
+    if (conf->dict_file.data == NULL) {
+        conf->dict_file = prev->dict_file;
+
+        if (conf->level == prev->level) {
+            conf->dict = prev->dict;
+            ngx_memcpy(conf->dict_hash, prev->dict_hash, 32);
+        }
+    }
+
+    if (conf->dict_file.len && conf->bufs.size < NGX_HTTP_ZSTD_DCZ_HEADER_LEN) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"zstd_buffers\" size %uz is too small "
+                           "for \"zstd_dictionary\", at least %d is required",
+                           conf->bufs.size, NGX_HTTP_ZSTD_DCZ_HEADER_LEN);
+        return NGX_CONF_ERROR;
+    }
+
+    if (conf->dict_file.len && conf->dict == NULL) {
+
+        if (ngx_http_zstd_dictionary(cf, conf) != NGX_CONF_OK) {
+            return NGX_CONF_ERROR;
+        }
+
+        cln = ngx_pool_cleanup_add(cf->pool, 0);
+        if (cln == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        cln->handler = ngx_http_zstd_free_dictionary;
+        cln->data = conf->dict;
+    }
+
+#endif
+
+    return NGX_CONF_OK;
+}
+
+
+static ngx_int_t
+ngx_http_zstd_filter_init(ngx_conf_t *cf)
+{
+    ngx_http_next_header_filter = ngx_http_top_header_filter;
+    ngx_http_top_header_filter = ngx_http_zstd_header_filter;
+
+    ngx_http_next_body_filter = ngx_http_top_body_filter;
+    ngx_http_top_body_filter = ngx_http_zstd_body_filter;
+
+    return NGX_OK;
+}
+
+
+static char *
+ngx_http_zstd_window(ngx_conf_t *cf, void *post, void *data)
+{
+    size_t *np = data;
+
+    size_t  wlog;
+
+    for (wlog = NGX_HTTP_ZSTD_MIN_WLOG;
+         wlog <= NGX_HTTP_ZSTD_MAX_WLOG;
+         wlog++)
+    {
+        if ((size_t) 1 << wlog == *np) {
+            *np = wlog;
+            return NGX_CONF_OK;
+        }
+    }
+
+    return "must be a power of two between 1k and 128m";
+}
+
+
+static void
+ngx_http_zstd_exit_process(ngx_cycle_t *cycle)
+{
+    while (ngx_http_zstd_ncontexts) {
+        ZSTD_freeCCtx(ngx_http_zstd_contexts[--ngx_http_zstd_ncontexts]);
+    }
+}
@@ -29,6 +29,9 @@
 
 #define NGX_HTTP_CACHE_VERSION       5
 
+#define NGX_HTTP_CACHE_LOCK_WAIT_MIN 25
+#define NGX_HTTP_CACHE_LOCK_WAIT_MAX 500
+
 
 typedef struct {
     ngx_uint_t                       status;
@@ -80,6 +83,10 @@ struct ngx_http_cache_s {
     ngx_str_t                        vary;
     u_char                           variant[NGX_HTTP_CACHE_KEY_LEN];
 
+    ngx_str_t                        encoding;
+    u_char                           encoded_key[NGX_HTTP_CACHE_KEY_LEN];
+    ngx_http_file_cache_node_t      *encoded_node;
+
     size_t                           buffer_size;
     size_t                           header_start;
     size_t                           body_start;
@@ -104,11 +111,14 @@ struct ngx_http_cache_s {
     ngx_msec_t                       lock_age;
     ngx_msec_t                       lock_time;
     ngx_msec_t                       wait_time;
+    ngx_msec_t                       wait_delay;
 
     ngx_event_t                      wait_event;
+    ngx_queue_t                      wait_queue;
 
     unsigned                         lock:1;
     unsigned                         waiting:1;
+    unsigned                         waiter:1;
 
     unsigned                         updated:1;
     unsigned                         updating:1;
@@ -119,9 +129,12 @@ struct ngx_http_cache_s {
     unsigned                         secondary:1;
     unsigned                         update_variant:1;
     unsigned                         background:1;
+    unsigned                         updater:1;
+    unsigned                         encoded:1;
 
     unsigned                         stale_updating:1;
     unsigned                         stale_error:1;
+    unsigned                         refresh:1;
 };
 
 
@@ -144,6 +157,12 @@ typedef struct {
 } ngx_http_file_cache_header_t;
 
 
+typedef struct {
+    ngx_pid_t                        pid;
+    ngx_uint_t                       updates;
+} ngx_http_file_cache_updater_t;
+
+
 typedef struct {
     ngx_rbtree_t                     rbtree;
     ngx_rbtree_node_t                sentinel;
@@ -153,6 +172,9 @@ typedef struct {
     off_t                            size;
     ngx_uint_t                       count;
     ngx_uint_t                       watermark;
+    ngx_uint_t                       updates;
+    ngx_http_file_cache_updater_t   *updaters;
+    ngx_uint_t                       nupdaters;
 } ngx_http_file_cache_sh_t;
 
 
@@ -170,6 +192,10 @@ struct ngx_http_file_cache_s {
 
     time_t                           fail_time;
 
+    ngx_uint_t                       max_updates;
+    time_t                           refresh_ahead;
+    ngx_uint_t                       refresh_min_uses;
+
     ngx_uint_t                       files;
     ngx_uint_t                       loader_files;
     ngx_msec_t                       last;
@@ -182,6 +208,8 @@ struct ngx_http_file_cache_s {
 
     ngx_shm_zone_t                  *shm_zone;
 
+    ngx_queue_t                      waiters;
+
     ngx_uint_t                       use_temp_path;
                                      /* unsigned use_temp_path:1 */
 };
@@ -190,10 +218,15 @@ struct ngx_http_file_cache_s {
 ngx_int_t ngx_http_file_cache_new(ngx_http_request_t *r);
 ngx_int_t ngx_http_file_cache_create(ngx_http_request_t *r);
 void ngx_http_file_cache_create_key(ngx_http_request_t *r);
+void ngx_http_file_cache_encoding_key(ngx_http_request_t *r);
 ngx_int_t ngx_http_file_cache_open(ngx_http_request_t *r);
+ngx_int_t ngx_http_file_cache_background_update(ngx_http_request_t *r);
 ngx_int_t ngx_http_file_cache_set_header(ngx_http_request_t *r, u_char *buf);
 void ngx_http_file_cache_update(ngx_http_request_t *r, ngx_temp_file_t *tf);
 void ngx_http_file_cache_update_header(ngx_http_request_t *r);
+void ngx_http_file_cache_encoded_update(ngx_http_request_t *r,
+    ngx_temp_file_t *tf, size_t body_start);
+void ngx_http_file_cache_encoded_free(ngx_http_cache_t *c);
 ngx_int_t ngx_http_cache_send(ngx_http_request_t *);
 void ngx_http_file_cache_free(ngx_http_cache_t *c, ngx_temp_file_t *tf);
 time_t ngx_http_file_cache_valid(ngx_array_t *cache_valid, ngx_uint_t status);
@@ -75,8 +75,11 @@ static char *ngx_http_core_internal(ngx_conf_t *cf, ngx_command_t *cmd,
 static char *ngx_http_core_resolver(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 #if (NGX_HTTP_GZIP)
+static ngx_int_t ngx_http_gzip_conditions(ngx_http_request_t *r);
 static ngx_int_t ngx_http_gzip_accept_encoding(ngx_str_t *ae);
 static ngx_uint_t ngx_http_gzip_quantity(u_char *p, u_char *last);
+static ngx_uint_t ngx_http_encoding_quality(ngx_str_t *ae, ngx_str_t *coding);
+static ngx_uint_t ngx_http_encoding_qvalue(u_char **pos, u_char *last);
 static char *ngx_http_gzip_disable(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 #endif
@@ -177,6 +180,16 @@ static ngx_str_t  ngx_http_gzip_no_cache = ngx_string("no-cache");
 static ngx_str_t  ngx_http_gzip_no_store = ngx_string("no-store");
 static ngx_str_t  ngx_http_gzip_private = ngx_string("private");
 
+
+/* content codings in the order of server preference */
+
+static ngx_str_t  ngx_http_encodings[] = {
+    ngx_string("zstd"),
+    ngx_string("br"),
+    ngx_string("gzip"),
+    ngx_null_string
+};
+
 #endif
 
 
@@ -2023,10 +2036,7 @@ ngx_http_auth_basic_user(ngx_http_request_t *r)
 ngx_int_t
 ngx_http_gzip_ok(ngx_http_request_t *r)
 {
-    time_t                     date, expires;
-    ngx_uint_t                 p;
-    ngx_table_elt_t           *e, *d, *ae, *cc;
-    ngx_http_core_loc_conf_t  *clcf;
+    ngx_table_elt_t  *ae;
 
     r->gzip_tested = 1;
 
@@ -2058,6 +2068,146 @@ ngx_http_gzip_ok(ngx_http_request_t *r)
         return NGX_DECLINED;
     }
 
+    if (ngx_http_gzip_conditions(r) != NGX_OK) {
+        return NGX_DECLINED;
+    }
+
+    r->gzip_ok = 1;
+
+    return NGX_OK;
+}
+
+
+/*
+ * tests if the response may be compressed with the content coding,
+ * a coding is declined if the client prefers another known coding
+ * with a higher quantity; gzip_http_version, gzip_proxied, and
+ * gzip_disable are applied to all codings
+ */
+
+ngx_int_t
+ngx_http_encoding_ok(ngx_http_request_t *r, ngx_str_t *coding)
+{
+    ngx_uint_t        q;
+    ngx_str_t        *c;
+    ngx_table_elt_t  *ae;
+
+    if (r != r->main) {
+        return NGX_DECLINED;
+    }
+
+    ae = r->headers_in.accept_encoding;
+    if (ae == NULL) {
+        return NGX_DECLINED;
+    }
+
+    q = ngx_http_encoding_quality(&ae->value, coding);
+
+    if (q == 0) {
+        return NGX_DECLINED;
+    }
+
+    for (c = ngx_http_encodings; c->len; c++) {
+
+        if (c->len == coding->len
+            && ngx_strncasecmp(c->data, coding->data, c->len) == 0)
+        {
+            continue;
+        }
+
+        if (ngx_http_encoding_quality(&ae->value, c) > q) {
+            return NGX_DECLINED;
+        }
+    }
+
+    return ngx_http_gzip_conditions(r);
+}
+
+
+/*
+ * builds the set of the known content codings acceptable for the request
+ * along with their quantities, e.g. "zstd,br,gzip;q=0.500"; the set does
+ * not depend on the response, so it is declined for proxied requests
+ * unless "gzip_proxied any" is used
+ */
+
+ngx_int_t
+ngx_http_encoding_set(ngx_http_request_t *r, ngx_str_t *set)
+{
+    u_char                    *p;
+    size_t                     len;
+    ngx_str_t                 *c;
+    ngx_uint_t                 q;
+    ngx_table_elt_t           *ae;
+    ngx_http_core_loc_conf_t  *clcf;
+
+    if (r != r->main) {
+        return NGX_DECLINED;
+    }
+
+    ae = r->headers_in.accept_encoding;
+    if (ae == NULL) {
+        return NGX_DECLINED;
+    }
+
+    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+
+    if (r->headers_in.via
+        && !(clcf->gzip_proxied & NGX_HTTP_GZIP_PROXIED_ANY))
+    {
+        return NGX_DECLINED;
+    }
+
+    if (ngx_http_gzip_conditions(r) != NGX_OK) {
+        return NGX_DECLINED;
+    }
+
+    len = 0;
+
+    for (c = ngx_http_encodings; c->len; c++) {
+        len += c->len + sizeof(",;q=0.000") - 1;
+    }
+
+    p = ngx_pnalloc(r->pool, len);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    set->data = p;
+
+    for (c = ngx_http_encodings; c->len; c++) {
+
+        q = ngx_http_encoding_quality(&ae->value, c);
+
+        if (q == 0) {
+            continue;
+        }
+
+        if (p != set->data) {
+            *p++ = ',';
+        }
+
+        p = ngx_cpymem(p, c->data, c->len);
+
+        if (q < 1000) {
+            p = ngx_sprintf(p, ";q=0.%03ui", q);
+        }
+    }
+
+    set->len = p - set->data;
+
+    return set->len ? NGX_OK : NGX_DECLINED;
+}
+
+
+static ngx_int_t
+ngx_http_gzip_conditions(ngx_http_request_t *r)
+{
+    time_t                     date, expires;
+    ngx_uint_t                 p;
+    ngx_table_elt_t           *e, *d, *cc;
+    ngx_http_core_loc_conf_t  *clcf;
+
     clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
 
     if (r->headers_in.msie6 && clcf->gzip_disable_msie6) {
@@ -2174,8 +2324,6 @@ ok:
 
 #endif
 
-    r->gzip_ok = 1;
-
     return NGX_OK;
 }
 
@@ -2308,6 +2456,108 @@ ngx_http_gzip_quantity(u_char *p, u_char *last)
     return q;
 }
 
+
+/*
+ * returns the quantity of the coding in thousandths,
+ * or the quantity of "*" if the coding is not listed
+ */
+
+static ngx_uint_t
+ngx_http_encoding_quality(ngx_str_t *ae, ngx_str_t *coding)
+{
+    u_char      *p, *last, *token;
+    size_t       len;
+    ngx_uint_t   q, any;
+
+    p = ae->data;
+    last = p + ae->len;
+
+    any = 0;
+
+    while (p < last) {
+
+        while (p < last && (*p == ' ' || *p == ',' || *p == '\t')) {
+            p++;
+        }
+
+        token = p;
+
+        while (p < last && *p != ',' && *p != ';' && *p != ' ' && *p != '\t')
+        {
+            p++;
+        }
+
+        len = p - token;
+        q = 1000;
+
+        while (p < last && *p != ',') {
+
+            if (*p++ != ';') {
+                continue;
+            }
+
+            while (p < last && (*p == ' ' || *p == '\t')) {
+                p++;
+            }
+
+            if (last - p > 2 && (*p == 'q' || *p == 'Q') && p[1] == '=') {
+                p += 2;
+                q = ngx_http_encoding_qvalue(&p, last);
+            }
+        }
+
+        if (len == coding->len
+            && ngx_strncasecmp(token, coding->data, len) == 0)
+        {
+            return q;
+        }
+
+        if (len == 1 && *token == '*') {
+            any = q;
+        }
+    }
+
+    return any;
+}
+
+
+static ngx_uint_t
+ngx_http_encoding_qvalue(u_char **pos, u_char *last)
+{
+    u_char      *p, c;
+    ngx_uint_t   n, q, scale;
+
+    p = *pos;
+
+    c = *p++;
+
+    if (c != '0' && c != '1') {
+        *pos = p;
+        return 0;
+    }
+
+    q = (c - '0') * 1000;
+
+    if (p < last && *p == '.') {
+        p++;
+
+        scale = 100;
+
+        for (n = 0; p < last && *p >= '0' && *p <= '9'; n++) {
+            q += (*p++ - '0') * scale;
+            scale /= 10;
+        }
+
+        if (n > 3) {
+            q = 0;
+        }
+    }
+
+    *pos = p;
+
+    return (q > 1000) ? 0 : q;
+}
+
 #endif
 
 
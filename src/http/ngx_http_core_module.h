@@ -506,6 +506,8 @@ u_char *ngx_http_map_uri_to_path(ngx_http_request_t *r, ngx_str_t *name,
 ngx_int_t ngx_http_auth_basic_user(ngx_http_request_t *r);
 #if (NGX_HTTP_GZIP)
 ngx_int_t ngx_http_gzip_ok(ngx_http_request_t *r);
+ngx_int_t ngx_http_encoding_ok(ngx_http_request_t *r, ngx_str_t *coding);
+ngx_int_t ngx_http_encoding_set(ngx_http_request_t *r, ngx_str_t *set);
 #endif
 
 
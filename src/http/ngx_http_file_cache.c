@@ -16,8 +16,13 @@ static ngx_int_t ngx_http_file_cache_lock(ngx_http_request_t *r,
 static void ngx_http_file_cache_lock_wait_handler(ngx_event_t *ev);
 static void ngx_http_file_cache_lock_wait(ngx_http_request_t *r,
     ngx_http_cache_t *c);
+static void ngx_http_file_cache_lock_wakeup(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_node_t *fcn);
 static ngx_int_t ngx_http_file_cache_read(ngx_http_request_t *r,
     ngx_http_cache_t *c);
+static ngx_http_file_cache_updater_t *ngx_http_file_cache_updater(
+    ngx_http_file_cache_t *cache, ngx_uint_t add);
+static void ngx_http_file_cache_reap_updates(ngx_http_file_cache_t *cache);
 static ssize_t ngx_http_file_cache_aio_read(ngx_http_request_t *r,
     ngx_http_cache_t *c);
 #if (NGX_HAVE_FILE_AIO)
@@ -42,6 +47,8 @@ static void ngx_http_file_cache_vary_header(ngx_http_request_t *r,
     ngx_md5_t *md5, ngx_str_t *name);
 static ngx_int_t ngx_http_file_cache_reopen(ngx_http_request_t *r,
     ngx_http_cache_t *c);
+static ngx_int_t ngx_http_file_cache_encoded_reopen(ngx_http_request_t *r,
+    ngx_http_cache_t *c);
 static ngx_int_t ngx_http_file_cache_update_variant(ngx_http_request_t *r,
     ngx_http_cache_t *c);
 static void ngx_http_file_cache_cleanup(void *data);
@@ -151,6 +158,9 @@ ngx_http_file_cache_init(ngx_shm_zone_t *shm_zone, void *data)
     cache->sh->size = 0;
     cache->sh->count = 0;
     cache->sh->watermark = (ngx_uint_t) -1;
+    cache->sh->updates = 0;
+    cache->sh->updaters = NULL;
+    cache->sh->nupdaters = 0;
 
     cache->bsize = ngx_fs_bsize(cache->path->name.data);
 
@@ -261,6 +271,51 @@ ngx_http_file_cache_create_key(ngx_http_request_t *r)
 }
 
 
+void
+ngx_http_file_cache_encoding_key(ngx_http_request_t *r)
+{
+    ngx_md5_t                    md5;
+    ngx_file_uniq_t              uniq;
+    ngx_http_cache_t            *c;
+    ngx_http_file_cache_t       *cache;
+    ngx_http_file_cache_node_t  *fcn;
+
+    c = r->cache;
+    cache = c->file_cache;
+
+    /*
+     * the variant key includes the file identity of the main entry,
+     * so a variant is not used once the main entry is replaced
+     */
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    fcn = ngx_http_file_cache_lookup(cache, c->main);
+    uniq = (fcn && fcn->exists) ? fcn->uniq : 0;
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http file cache encoding: \"%V\" main:%uL",
+                   &c->encoding, (uint64_t) uniq);
+
+    if (uniq == 0) {
+        return;
+    }
+
+    ngx_md5_init(&md5);
+    ngx_md5_update(&md5, c->main, NGX_HTTP_CACHE_KEY_LEN);
+    ngx_md5_update(&md5, &uniq, sizeof(ngx_file_uniq_t));
+    ngx_md5_update(&md5, "Content-Encoding:", sizeof("Content-Encoding:") - 1);
+    ngx_md5_update(&md5, c->encoding.data, c->encoding.len);
+    ngx_md5_final(c->encoded_key, &md5);
+
+    ngx_memcpy(c->key, c->encoded_key, NGX_HTTP_CACHE_KEY_LEN);
+
+    c->encoded = 1;
+}
+
+
 ngx_int_t
 ngx_http_file_cache_open(ngx_http_request_t *r)
 {
@@ -279,7 +334,8 @@ ngx_http_file_cache_open(ngx_http_request_t *r)
     }
 
     if (c->reading) {
-        return ngx_http_file_cache_read(r, c);
+        rc = ngx_http_file_cache_read(r, c);
+        goto read;
     }
 
     cache = c->file_cache;
@@ -305,6 +361,13 @@ ngx_http_file_cache_open(ngx_http_request_t *r)
         return rc;
     }
 
+    if (c->encoded
+        && (rc == NGX_AGAIN || c->error
+            || (rc == NGX_DECLINED && !cache->sh->cold)))
+    {
+        return ngx_http_file_cache_encoded_reopen(r, c);
+    }
+
     if (rc == NGX_AGAIN) {
         return NGX_HTTP_CACHE_SCARCE;
     }
@@ -389,10 +452,22 @@ ngx_http_file_cache_open(ngx_http_request_t *r)
         return NGX_ERROR;
     }
 
-    return ngx_http_file_cache_read(r, c);
+    rc = ngx_http_file_cache_read(r, c);
+
+read:
+
+    if (c->encoded && rc != NGX_OK && rc != NGX_AGAIN && rc != NGX_ERROR) {
+        return ngx_http_file_cache_encoded_reopen(r, c);
+    }
+
+    return rc;
 
 done:
 
+    if (c->encoded) {
+        return ngx_http_file_cache_encoded_reopen(r, c);
+    }
+
     if (rv == NGX_DECLINED) {
         return ngx_http_file_cache_lock(r, c);
     }
@@ -444,15 +519,27 @@ ngx_http_file_cache_lock(ngx_http_request_t *r, ngx_http_cache_t *c)
 
     if (c->wait_time == 0) {
         c->wait_time = now + c->lock_timeout;
+        c->wait_delay = NGX_HTTP_CACHE_LOCK_WAIT_MIN;
 
         c->wait_event.handler = ngx_http_file_cache_lock_wait_handler;
         c->wait_event.data = r;
         c->wait_event.log = r->connection->log;
     }
 
+    /*
+     * a lock held in this worker process wakes up waiters as soon
+     * as it is released, while a lock held in other processes is
+     * polled with increasing intervals
+     */
+
+    if (!c->waiter) {
+        ngx_queue_insert_tail(&cache->waiters, &c->wait_queue);
+        c->waiter = 1;
+    }
+
     timer = c->wait_time - now;
 
-    ngx_add_timer(&c->wait_event, (timer > 500) ? 500 : timer);
+    ngx_add_timer(&c->wait_event, ngx_min(timer, c->wait_delay));
 
     r->main->blocked++;
 
@@ -512,18 +599,64 @@ ngx_http_file_cache_lock_wait(ngx_http_request_t *r, ngx_http_cache_t *c)
     ngx_shmtx_unlock(&cache->shpool->mutex);
 
     if (wait) {
-        ngx_add_timer(&c->wait_event, (timer > 500) ? 500 : timer);
+        c->wait_delay = ngx_min(2 * c->wait_delay, NGX_HTTP_CACHE_LOCK_WAIT_MAX);
+
+        if (!c->waiter) {
+            ngx_queue_insert_tail(&cache->waiters, &c->wait_queue);
+            c->waiter = 1;
+        }
+
+        ngx_add_timer(&c->wait_event, ngx_min(timer, c->wait_delay));
         return;
     }
 
 wakeup:
 
+    if (c->waiter) {
+        ngx_queue_remove(&c->wait_queue);
+        c->waiter = 0;
+    }
+
     c->waiting = 0;
     r->main->blocked--;
     r->write_event_handler(r);
 }
 
 
+static void
+ngx_http_file_cache_lock_wakeup(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_node_t *fcn)
+{
+    ngx_queue_t       *q, *next;
+    ngx_http_cache_t  *c;
+
+    for (q = ngx_queue_head(&cache->waiters);
+         q != ngx_queue_sentinel(&cache->waiters);
+         q = next)
+    {
+        next = ngx_queue_next(q);
+
+        c = ngx_queue_data(q, ngx_http_cache_t, wait_queue);
+
+        if (c->node != fcn) {
+            continue;
+        }
+
+        ngx_log_debug0(NGX_LOG_DEBUG_HTTP, c->wait_event.log, 0,
+                       "http file cache lock wakeup");
+
+        ngx_queue_remove(q);
+        c->waiter = 0;
+
+        if (c->wait_event.timer_set) {
+            ngx_del_timer(&c->wait_event);
+        }
+
+        ngx_post_event(&c->wait_event, &ngx_posted_events);
+    }
+}
+
+
 static ngx_int_t
 ngx_http_file_cache_read(ngx_http_request_t *r, ngx_http_cache_t *c)
 {
@@ -601,6 +734,12 @@ ngx_http_file_cache_read(ngx_http_request_t *r, ngx_http_cache_t *c)
         }
     }
 
+    if (c->encoded && h->valid_sec < ngx_time()) {
+        ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "http file cache encoded variant expired");
+        return NGX_DECLINED;
+    }
+
     c->buf->last += n;
 
     c->valid_sec = h->valid_sec;
@@ -634,6 +773,19 @@ ngx_http_file_cache_read(ngx_http_request_t *r, ngx_http_cache_t *c)
         ngx_shmtx_unlock(&cache->shpool->mutex);
     }
 
+    if (c->node->uniq == 0) {
+
+        /* the node was added by the cache loader */
+
+        ngx_shmtx_lock(&cache->shpool->mutex);
+
+        if (c->node->exists && c->node->uniq == 0) {
+            c->node->uniq = c->uniq;
+        }
+
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+    }
+
     now = ngx_time();
 
     if (c->valid_sec < now) {
@@ -661,10 +813,237 @@ ngx_http_file_cache_read(ngx_http_request_t *r, ngx_http_cache_t *c)
         return rc;
     }
 
+    if (cache->refresh_ahead && c->valid_sec - now < cache->refresh_ahead) {
+
+        /*
+         * a hot response which is about to expire is refreshed
+         * by a background update started by a request seeing it
+         */
+
+        rc = NGX_OK;
+
+        ngx_shmtx_lock(&cache->shpool->mutex);
+
+        if (c->node->updating) {
+
+            if (r->background) {
+                rc = NGX_HTTP_CACHE_UPDATING;
+            }
+
+        } else if (c->node->uses >= cache->refresh_min_uses) {
+            c->refresh = 1;
+        }
+
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+
+        ngx_log_debug3(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "http file cache refresh ahead: %i %T %T",
+                       rc, c->valid_sec, now);
+
+        return rc;
+    }
+
     return NGX_OK;
 }
 
 
+ngx_int_t
+ngx_http_file_cache_background_update(ngx_http_request_t *r)
+{
+    ngx_uint_t                      wakeup, refresh;
+    ngx_http_cache_t               *c;
+    ngx_http_file_cache_t          *cache;
+    ngx_http_file_cache_node_t     *fcn;
+    ngx_http_file_cache_updater_t  *u;
+
+    c = r->cache;
+    cache = c->file_cache;
+    fcn = c->node;
+
+    wakeup = 0;
+    refresh = 0;
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    if (!c->updating) {
+
+        /* refresh ahead of expiration */
+
+        if (fcn->updating) {
+            ngx_shmtx_unlock(&cache->shpool->mutex);
+            return NGX_DECLINED;
+        }
+
+        refresh = 1;
+
+        fcn->updating = 1;
+        c->updating = 1;
+        c->lock_time = fcn->lock_time;
+    }
+
+    if (cache->max_updates && cache->sh->updates >= cache->max_updates) {
+
+        /*
+         * the update is left to one of the next requests
+         * if too many background updates are in progress
+         */
+
+        if (fcn->lock_time == c->lock_time) {
+            fcn->updating = 0;
+            wakeup = 1;
+        }
+
+        c->updating = 0;
+
+    } else {
+
+        if (cache->max_updates) {
+            cache->sh->updates++;
+
+            u = ngx_http_file_cache_updater(cache, 1);
+
+            if (u) {
+                u->updates++;
+                c->updater = 1;
+            }
+        }
+
+        c->background = 1;
+
+        if (refresh) {
+            /* the uses are counted anew until the next refresh */
+            fcn->uses = 0;
+        }
+    }
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http file cache background update: %d", c->background);
+
+    if (wakeup) {
+        ngx_http_file_cache_lock_wakeup(cache, fcn);
+    }
+
+    return c->background ? NGX_OK : NGX_DECLINED;
+}
+
+
+static ngx_http_file_cache_updater_t *
+ngx_http_file_cache_updater(ngx_http_file_cache_t *cache, ngx_uint_t add)
+{
+    ngx_uint_t                      i, n;
+    ngx_core_conf_t                *ccf;
+    ngx_http_file_cache_updater_t  *u, *free;
+
+    /*
+     * background updates are counted per process, so that updates
+     * of a process which exited abnormally can be released
+     */
+
+    u = cache->sh->updaters;
+    free = NULL;
+
+    for (i = 0; i < cache->sh->nupdaters; i++) {
+
+        if (u[i].pid == ngx_pid) {
+            return &u[i];
+        }
+
+        if (free == NULL && u[i].pid == 0) {
+            free = &u[i];
+        }
+    }
+
+    if (!add) {
+        return NULL;
+    }
+
+    if (free == NULL) {
+
+        /*
+         * the table is sized for the workers of the old and new cycles
+         * during reconfiguration and grows if more processes update
+         */
+
+        if (cache->sh->nupdaters) {
+            n = cache->sh->nupdaters * 2;
+
+        } else {
+            ccf = (ngx_core_conf_t *) ngx_get_conf(ngx_cycle->conf_ctx,
+                                                   ngx_core_module);
+            n = ccf->worker_processes * 2;
+        }
+
+        u = ngx_slab_calloc_locked(cache->shpool,
+                                   n * sizeof(ngx_http_file_cache_updater_t));
+        if (u == NULL) {
+            return NULL;
+        }
+
+        if (cache->sh->updaters) {
+            ngx_memcpy(u, cache->sh->updaters,
+                       cache->sh->nupdaters
+                       * sizeof(ngx_http_file_cache_updater_t));
+
+            ngx_slab_free_locked(cache->shpool, cache->sh->updaters);
+        }
+
+        free = &u[cache->sh->nupdaters];
+
+        cache->sh->updaters = u;
+        cache->sh->nupdaters = n;
+    }
+
+    free->pid = ngx_pid;
+    free->updates = 0;
+
+    return free;
+}
+
+
+static void
+ngx_http_file_cache_reap_updates(ngx_http_file_cache_t *cache)
+{
+#if !(NGX_WIN32)
+
+    ngx_uint_t                      i, n;
+    ngx_http_file_cache_updater_t  *u;
+
+    n = 0;
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    u = cache->sh->updaters;
+
+    for (i = 0; i < cache->sh->nupdaters; i++) {
+
+        if (u[i].pid == 0
+            || kill(u[i].pid, 0) != -1
+            || ngx_errno != NGX_ESRCH)
+        {
+            continue;
+        }
+
+        n += u[i].updates;
+        cache->sh->updates -= u[i].updates;
+
+        u[i].pid = 0;
+        u[i].updates = 0;
+    }
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    if (n) {
+        ngx_log_error(NGX_LOG_WARN, ngx_cycle->log, 0,
+                      "released %ui background updates of exited processes "
+                      "in cache \"%V\"", n, &cache->shm_zone->shm.name);
+    }
+
+#endif
+}
+
+
 static ssize_t
 ngx_http_file_cache_aio_read(ngx_http_request_t *r, ngx_http_cache_t *c)
 {
@@ -1240,6 +1619,52 @@ ngx_http_file_cache_reopen(ngx_http_request_t *r, ngx_http_cache_t *c)
 }
 
 
+static ngx_int_t
+ngx_http_file_cache_encoded_reopen(ngx_http_request_t *r, ngx_http_cache_t *c)
+{
+    ngx_http_file_cache_t       *cache;
+    ngx_http_file_cache_node_t  *fcn;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http file cache encoded variant miss");
+
+    cache = c->file_cache;
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    fcn = c->node;
+
+    /*
+     * the request that finds the variant missing becomes responsible
+     * for storing it, provided that the variant is used often enough
+     * and no other request is storing it already
+     */
+
+    if (!fcn->updating && fcn->uses >= c->min_uses) {
+        fcn->updating = 1;
+        c->encoded_node = fcn;
+
+    } else {
+        fcn->count--;
+    }
+
+    c->node = NULL;
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    c->encoded = 0;
+    c->exists = 0;
+    c->error = 0;
+    c->temp_file = 0;
+    c->file.name.len = 0;
+    c->body_start = c->buffer_size;
+
+    ngx_memcpy(c->key, c->main, NGX_HTTP_CACHE_KEY_LEN);
+
+    return ngx_http_file_cache_open(r);
+}
+
+
 ngx_int_t
 ngx_http_file_cache_set_header(ngx_http_request_t *r, u_char *buf)
 {
@@ -1308,7 +1733,8 @@ ngx_http_file_cache_set_header(ngx_http_request_t *r, u_char *buf)
 static ngx_int_t
 ngx_http_file_cache_update_variant(ngx_http_request_t *r, ngx_http_cache_t *c)
 {
-    ngx_http_file_cache_t  *cache;
+    ngx_http_file_cache_t       *cache;
+    ngx_http_file_cache_node_t  *fcn;
 
     if (!c->secondary) {
         return NGX_OK;
@@ -1332,12 +1758,16 @@ ngx_http_file_cache_update_variant(ngx_http_request_t *r, ngx_http_cache_t *c)
 
     ngx_shmtx_lock(&cache->shpool->mutex);
 
-    c->node->count--;
-    c->node->updating = 0;
+    fcn = c->node;
+
+    fcn->count--;
+    fcn->updating = 0;
     c->node = NULL;
 
     ngx_shmtx_unlock(&cache->shpool->mutex);
 
+    ngx_http_file_cache_lock_wakeup(cache, fcn);
+
     c->file.name.len = 0;
     c->update_variant = 1;
 
@@ -1427,6 +1857,8 @@ ngx_http_file_cache_update(ngx_http_request_t *r, ngx_temp_file_t *tf)
     c->node->updating = 0;
 
     ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    ngx_http_file_cache_lock_wakeup(cache, c->node);
 }
 
 
@@ -1562,6 +1994,127 @@ done:
 }
 
 
+void
+ngx_http_file_cache_encoded_update(ngx_http_request_t *r, ngx_temp_file_t *tf,
+    size_t body_start)
+{
+    off_t                        fs_size;
+    u_char                      *p;
+    ngx_int_t                    rc;
+    ngx_str_t                    name;
+    ngx_path_t                  *path;
+    ngx_file_uniq_t              uniq;
+    ngx_file_info_t              fi;
+    ngx_http_cache_t            *c;
+    ngx_ext_rename_file_t        ext;
+    ngx_http_file_cache_t       *cache;
+    ngx_http_file_cache_node_t  *fcn;
+
+    c = r->cache;
+    fcn = c->encoded_node;
+
+    if (fcn == NULL) {
+        return;
+    }
+
+    cache = c->file_cache;
+    path = cache->path;
+
+    uniq = 0;
+    fs_size = 0;
+
+    name.len = path->name.len + 1 + path->len + 2 * NGX_HTTP_CACHE_KEY_LEN;
+
+    name.data = ngx_pnalloc(r->pool, name.len + 1);
+    if (name.data == NULL) {
+        rc = NGX_ERROR;
+        goto failed;
+    }
+
+    ngx_memcpy(name.data, path->name.data, path->name.len);
+
+    p = name.data + path->name.len + 1 + path->len;
+    p = ngx_hex_dump(p, c->encoded_key, NGX_HTTP_CACHE_KEY_LEN);
+    *p = '\0';
+
+    ngx_create_hashed_filename(path, name.data, name.len);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http file cache encoded rename: \"%s\" to \"%s\"",
+                   tf->file.name.data, name.data);
+
+    ext.access = NGX_FILE_OWNER_ACCESS;
+    ext.path_access = NGX_FILE_OWNER_ACCESS;
+    ext.time = -1;
+    ext.create_path = 1;
+    ext.delete_file = 1;
+    ext.log = r->connection->log;
+
+    rc = ngx_ext_rename_file(&tf->file.name, &name, &ext);
+
+    if (rc == NGX_OK) {
+
+        if (ngx_fd_info(tf->file.fd, &fi) == NGX_FILE_ERROR) {
+            ngx_log_error(NGX_LOG_CRIT, r->connection->log, ngx_errno,
+                          ngx_fd_info_n " \"%s\" failed", tf->file.name.data);
+
+            rc = NGX_ERROR;
+
+        } else {
+            uniq = ngx_file_uniq(&fi);
+            fs_size = (ngx_file_fs_size(&fi) + cache->bsize - 1) / cache->bsize;
+        }
+    }
+
+failed:
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    fcn->count--;
+    fcn->updating = 0;
+
+    if (rc == NGX_OK) {
+        fcn->error = 0;
+        fcn->uniq = uniq;
+        fcn->body_start = body_start;
+
+        cache->sh->size += fs_size - fcn->fs_size;
+        fcn->fs_size = fs_size;
+
+        fcn->exists = 1;
+    }
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    c->encoded_node = NULL;
+}
+
+
+void
+ngx_http_file_cache_encoded_free(ngx_http_cache_t *c)
+{
+    ngx_http_file_cache_t  *cache;
+
+    if (c->encoded_node == NULL) {
+        return;
+    }
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, c->file.log, 0,
+                   "http file cache encoded free");
+
+    cache = c->file_cache;
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    c->encoded_node->count--;
+    c->encoded_node->updating = 0;
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    c->encoded_node = NULL;
+}
+
+
 ngx_int_t
 ngx_http_cache_send(ngx_http_request_t *r)
 {
@@ -1615,8 +2168,10 @@ ngx_http_cache_send(ngx_http_request_t *r)
 void
 ngx_http_file_cache_free(ngx_http_cache_t *c, ngx_temp_file_t *tf)
 {
-    ngx_http_file_cache_t       *cache;
-    ngx_http_file_cache_node_t  *fcn;
+    ngx_uint_t                      wakeup;
+    ngx_http_file_cache_t          *cache;
+    ngx_http_file_cache_node_t     *fcn;
+    ngx_http_file_cache_updater_t  *u;
 
     if (c->updated || c->node == NULL) {
         return;
@@ -1632,8 +2187,23 @@ ngx_http_file_cache_free(ngx_http_cache_t *c, ngx_temp_file_t *tf)
     fcn = c->node;
     fcn->count--;
 
+    wakeup = 0;
+
     if (c->updating && fcn->lock_time == c->lock_time) {
         fcn->updating = 0;
+        wakeup = 1;
+    }
+
+    if (c->background && cache->max_updates) {
+        cache->sh->updates--;
+
+        if (c->updater) {
+            u = ngx_http_file_cache_updater(cache, 0);
+
+            if (u && --u->updates == 0) {
+                u->pid = 0;
+            }
+        }
     }
 
     if (c->error) {
@@ -1654,6 +2224,10 @@ ngx_http_file_cache_free(ngx_http_cache_t *c, ngx_temp_file_t *tf)
 
     ngx_shmtx_unlock(&cache->shpool->mutex);
 
+    if (wakeup) {
+        ngx_http_file_cache_lock_wakeup(cache, fcn);
+    }
+
     c->updated = 1;
     c->updating = 0;
 
@@ -1671,9 +2245,18 @@ ngx_http_file_cache_free(ngx_http_cache_t *c, ngx_temp_file_t *tf)
         }
     }
 
+    if (c->waiter) {
+        ngx_queue_remove(&c->wait_queue);
+        c->waiter = 0;
+    }
+
     if (c->wait_event.timer_set) {
         ngx_del_timer(&c->wait_event);
     }
+
+    if (c->wait_event.posted) {
+        ngx_delete_posted_event(&c->wait_event);
+    }
 }
 
 
@@ -1682,6 +2265,8 @@ ngx_http_file_cache_cleanup(void *data)
 {
     ngx_http_cache_t  *c = data;
 
+    ngx_http_file_cache_encoded_free(c);
+
     if (c->updated) {
         return;
     }
@@ -1972,6 +2557,10 @@ ngx_http_file_cache_manager(void *data)
     cache->last = ngx_current_msec;
     cache->files = 0;
 
+    if (cache->max_updates) {
+        ngx_http_file_cache_reap_updates(cache);
+    }
+
     next = (ngx_msec_t) ngx_http_file_cache_expire(cache) * 1000;
 
     if (next == 0) {
@@ -2036,6 +2625,15 @@ ngx_http_file_cache_manager(void *data)
 
 done:
 
+    /*
+     * background updates of exited processes are released
+     * within a second to keep max_updates accurate
+     */
+
+    if (cache->max_updates && next > 1000) {
+        next = 1000;
+    }
+
     elapsed = ngx_abs((ngx_msec_int_t) (ngx_current_msec - cache->last));
 
     ngx_log_debug3(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
@@ -2326,7 +2924,9 @@ ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     time_t                  inactive;
     ssize_t                 size;
     ngx_str_t               s, name, *value;
-    ngx_int_t               loader_files, manager_files;
+    time_t                  refresh_ahead;
+    ngx_int_t               loader_files, manager_files, max_updates,
+                            refresh_min_uses;
     ngx_msec_t              loader_sleep, manager_sleep, loader_threshold,
                             manager_threshold;
     ngx_uint_t              i, n, use_temp_path;
@@ -2338,6 +2938,8 @@ ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
         return NGX_CONF_ERROR;
     }
 
+    ngx_queue_init(&cache->waiters);
+
     cache->path = ngx_pcalloc(cf->pool, sizeof(ngx_path_t));
     if (cache->path == NULL) {
         return NGX_CONF_ERROR;
@@ -2360,6 +2962,10 @@ ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     max_size = NGX_MAX_OFF_T_VALUE;
     min_free = 0;
 
+    max_updates = 0;
+    refresh_ahead = 0;
+    refresh_min_uses = 3;
+
     value = cf->args->elts;
 
     cache->path->name = value[1];
@@ -2601,6 +3207,48 @@ ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
             continue;
         }
 
+        if (ngx_strncmp(value[i].data, "max_updates=", 12) == 0) {
+
+            max_updates = ngx_atoi(value[i].data + 12, value[i].len - 12);
+            if (max_updates == NGX_ERROR) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid max_updates value \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "refresh_ahead=", 14) == 0) {
+
+            s.len = value[i].len - 14;
+            s.data = value[i].data + 14;
+
+            refresh_ahead = ngx_parse_time(&s, 1);
+            if (refresh_ahead == (time_t) NGX_ERROR) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid refresh_ahead value \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "refresh_min_uses=", 17) == 0) {
+
+            refresh_min_uses = ngx_atoi(value[i].data + 17, value[i].len - 17);
+
+            /* the uses of a cache node are counted in 10 bits */
+
+            if (refresh_min_uses == NGX_ERROR || refresh_min_uses > 1023) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid refresh_min_uses value \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
         ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
                            "invalid parameter \"%V\"", &value[i]);
         return NGX_CONF_ERROR;
@@ -2624,6 +3272,9 @@ ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     cache->manager_files = manager_files;
     cache->manager_sleep = manager_sleep;
     cache->manager_threshold = manager_threshold;
+    cache->max_updates = max_updates;
+    cache->refresh_ahead = refresh_ahead;
+    cache->refresh_min_uses = refresh_min_uses;
 
     if (ngx_add_path(cf, &cache->path) != NGX_OK) {
         return NGX_CONF_ERROR;
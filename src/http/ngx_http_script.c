@@ -11,6 +11,10 @@
 
 
 static ngx_int_t ngx_http_script_init_arrays(ngx_http_script_compile_t *sc);
+static ngx_int_t ngx_http_complex_value_parts(ngx_conf_t *cf,
+    ngx_http_complex_value_t *cv);
+static ngx_int_t ngx_http_complex_value_run_parts(ngx_http_request_t *r,
+    ngx_http_complex_value_t *val, ngx_str_t *value);
 static ngx_int_t ngx_http_script_done(ngx_http_script_compile_t *sc);
 static ngx_int_t ngx_http_script_add_copy_code(ngx_http_script_compile_t *sc,
     ngx_str_t *value, ngx_uint_t last);
@@ -70,6 +74,10 @@ ngx_http_complex_value(ngx_http_request_t *r, ngx_http_complex_value_t *val,
 
     ngx_http_script_flush_complex_value(r, val);
 
+    if (val->parts) {
+        return ngx_http_complex_value_run_parts(r, val, value);
+    }
+
     ngx_memzero(&e, sizeof(ngx_http_script_engine_t));
 
     e.ip = val->lengths;
@@ -104,6 +112,61 @@ ngx_http_complex_value(ngx_http_request_t *r, ngx_http_complex_value_t *val,
 }
 
 
+static ngx_int_t
+ngx_http_complex_value_run_parts(ngx_http_request_t *r,
+    ngx_http_complex_value_t *val, ngx_str_t *value)
+{
+    u_char                     *p;
+    size_t                      len;
+    ngx_uint_t                  i;
+    ngx_http_script_part_t     *part;
+    ngx_http_variable_value_t  *vv[NGX_HTTP_SCRIPT_MAX_PARTS];
+
+    part = val->parts;
+    len = 0;
+
+    for (i = 0; i < val->nparts; i++) {
+
+        if (part[i].data) {
+            len += part[i].len;
+            continue;
+        }
+
+        vv[i] = ngx_http_get_indexed_variable(r, part[i].index);
+
+        if (vv[i] == NULL || vv[i]->not_found) {
+            vv[i] = NULL;
+            continue;
+        }
+
+        len += vv[i]->len;
+    }
+
+    p = ngx_pnalloc(r->pool, len);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    value->len = len;
+    value->data = p;
+
+    for (i = 0; i < val->nparts; i++) {
+
+        if (part[i].data) {
+            p = ngx_cpymem(p, part[i].data, part[i].len);
+
+        } else if (vv[i]) {
+            p = ngx_cpymem(p, vv[i]->data, vv[i]->len);
+        }
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http complex value: \"%V\"", value);
+
+    return NGX_OK;
+}
+
+
 size_t
 ngx_http_complex_value_size(ngx_http_request_t *r,
     ngx_http_complex_value_t *val, size_t default_value)
@@ -174,6 +237,8 @@ ngx_http_compile_complex_value(ngx_http_compile_complex_value_t *ccv)
     ccv->complex_value->flushes = NULL;
     ccv->complex_value->lengths = NULL;
     ccv->complex_value->values = NULL;
+    ccv->complex_value->parts = NULL;
+    ccv->complex_value->nparts = 0;
 
     if (nv == 0 && nc == 0) {
         return NGX_OK;
@@ -235,10 +300,152 @@ ngx_http_compile_complex_value(ngx_http_compile_complex_value_t *ccv)
     ccv->complex_value->lengths = lengths.elts;
     ccv->complex_value->values = values.elts;
 
+    return ngx_http_complex_value_parts(ccv->cf, ccv->complex_value);
+}
+
+
+static ngx_int_t
+ngx_http_complex_value_parts(ngx_conf_t *cf, ngx_http_complex_value_t *cv)
+{
+    u_char       *ip;
+    ngx_int_t     rc;
+    ngx_array_t  *parts;
+
+    parts = ngx_array_create(cf->pool, 4, sizeof(ngx_http_script_part_t));
+    if (parts == NULL) {
+        return NGX_ERROR;
+    }
+
+    ip = cv->values;
+
+    rc = ngx_http_script_compile_parts(parts, &ip);
+
+    if (rc == NGX_ERROR) {
+        return NGX_ERROR;
+    }
+
+    if (rc == NGX_OK && parts->nelts <= NGX_HTTP_SCRIPT_MAX_PARTS) {
+        cv->parts = parts->elts;
+        cv->nparts = parts->nelts;
+    }
+
     return NGX_OK;
 }
 
 
+ngx_int_t
+ngx_http_script_compile_parts(ngx_array_t *parts, u_char **ipp)
+{
+    u_char                       *ip;
+    ngx_http_script_code_pt       code;
+    ngx_http_script_part_t       *part;
+    ngx_http_script_var_code_t   *vcode;
+    ngx_http_script_copy_code_t  *ccode;
+
+    /*
+     * value codes which consist of constant strings and variables only
+     * are converted to parts: variables are fetched once and the constant
+     * strings are copied in place, without running the codes
+     */
+
+    for (ip = *ipp; *(uintptr_t *) ip; /* void */) {
+
+        code = *(ngx_http_script_code_pt *) ip;
+
+        if (code == ngx_http_script_copy_code) {
+            ccode = (ngx_http_script_copy_code_t *) ip;
+
+            part = ngx_array_push(parts);
+            if (part == NULL) {
+                return NGX_ERROR;
+            }
+
+            part->data = ip + sizeof(ngx_http_script_copy_code_t);
+            part->len = ccode->len;
+            part->index = 0;
+
+            ip += sizeof(ngx_http_script_copy_code_t)
+                  + ((ccode->len + sizeof(uintptr_t) - 1)
+                     & ~(sizeof(uintptr_t) - 1));
+
+        } else if (code == ngx_http_script_copy_var_code) {
+            vcode = (ngx_http_script_var_code_t *) ip;
+
+            part = ngx_array_push(parts);
+            if (part == NULL) {
+                return NGX_ERROR;
+            }
+
+            part->data = NULL;
+            part->len = 0;
+            part->index = vcode->index;
+
+            ip += sizeof(ngx_http_script_var_code_t);
+
+        } else {
+            return NGX_DECLINED;
+        }
+    }
+
+    *ipp = ip + sizeof(uintptr_t);
+
+    return NGX_OK;
+}
+
+
+size_t
+ngx_http_script_parts_len(ngx_http_request_t *r, ngx_http_script_part_t *part,
+    ngx_uint_t n)
+{
+    size_t                      len;
+    ngx_uint_t                  i;
+    ngx_http_variable_value_t  *vv;
+
+    len = 0;
+
+    for (i = 0; i < n; i++) {
+
+        if (part[i].data) {
+            len += part[i].len;
+            continue;
+        }
+
+        vv = ngx_http_get_indexed_variable(r, part[i].index);
+
+        if (vv && !vv->not_found) {
+            len += vv->len;
+        }
+    }
+
+    return len;
+}
+
+
+u_char *
+ngx_http_script_parts_copy(ngx_http_request_t *r, u_char *p,
+    ngx_http_script_part_t *part, ngx_uint_t n)
+{
+    ngx_uint_t                  i;
+    ngx_http_variable_value_t  *vv;
+
+    for (i = 0; i < n; i++) {
+
+        if (part[i].data) {
+            p = ngx_cpymem(p, part[i].data, part[i].len);
+            continue;
+        }
+
+        vv = ngx_http_get_indexed_variable(r, part[i].index);
+
+        if (vv && !vv->not_found) {
+            p = ngx_cpymem(p, vv->data, vv->len);
+        }
+    }
+
+    return p;
+}
+
+
 char *
 ngx_http_set_complex_value_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
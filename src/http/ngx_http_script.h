@@ -63,12 +63,26 @@ typedef struct {
 } ngx_http_script_compile_t;
 
 
+#define NGX_HTTP_SCRIPT_MAX_PARTS  16
+
+
+typedef struct {
+    u_char                     *data;
+    size_t                      len;
+    ngx_uint_t                  index;
+} ngx_http_script_part_t;
+
+
 typedef struct {
     ngx_str_t                   value;
     ngx_uint_t                 *flushes;
     void                       *lengths;
     void                       *values;
 
+    /* constant and variable parts, if there is nothing else to run */
+    ngx_http_script_part_t     *parts;
+    ngx_uint_t                  nparts;
+
     union {
         size_t                  size;
     } u;
@@ -214,6 +228,11 @@ ngx_int_t ngx_http_complex_value(ngx_http_request_t *r,
 size_t ngx_http_complex_value_size(ngx_http_request_t *r,
     ngx_http_complex_value_t *val, size_t default_value);
 ngx_int_t ngx_http_compile_complex_value(ngx_http_compile_complex_value_t *ccv);
+ngx_int_t ngx_http_script_compile_parts(ngx_array_t *parts, u_char **ipp);
+size_t ngx_http_script_parts_len(ngx_http_request_t *r,
+    ngx_http_script_part_t *part, ngx_uint_t n);
+u_char *ngx_http_script_parts_copy(ngx_http_request_t *r, u_char *p,
+    ngx_http_script_part_t *part, ngx_uint_t n);
 char *ngx_http_set_complex_value_slot(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 char *ngx_http_set_complex_value_zero_slot(ngx_conf_t *cf, ngx_command_t *cmd,
@@ -48,11 +48,23 @@ static void ngx_http_upstream_send_request_handler(ngx_http_request_t *r,
 static void ngx_http_upstream_read_request_handler(ngx_http_request_t *r);
 static void ngx_http_upstream_process_header(ngx_http_request_t *r,
     ngx_http_upstream_t *u);
+static ngx_int_t ngx_http_upstream_hedge_init(ngx_http_request_t *r,
+    ngx_http_upstream_t *u);
+static void ngx_http_upstream_hedge_handler(ngx_event_t *ev);
+static ngx_int_t ngx_http_upstream_hedge_get_peer(ngx_peer_connection_t *pc,
+    void *data);
+static void ngx_http_upstream_hedged_handler(ngx_event_t *ev);
+static void ngx_http_upstream_hedge_switch(ngx_http_request_t *r,
+    ngx_http_upstream_t *u);
+static void ngx_http_upstream_hedge_cancel(ngx_http_request_t *r,
+    ngx_http_upstream_t *u);
+static void ngx_http_upstream_hedge_free(ngx_http_upstream_hedge_t *hedge,
+    ngx_uint_t state);
+static void ngx_http_upstream_hedge_close(ngx_connection_t *c);
 static ngx_int_t ngx_http_upstream_test_next(ngx_http_request_t *r,
     ngx_http_upstream_t *u);
 static ngx_int_t ngx_http_upstream_intercept_errors(ngx_http_request_t *r,
     ngx_http_upstream_t *u);
-static ngx_int_t ngx_http_upstream_test_connect(ngx_connection_t *c);
 static ngx_int_t ngx_http_upstream_process_headers(ngx_http_request_t *r,
     ngx_http_upstream_t *u);
 static ngx_int_t ngx_http_upstream_process_trailers(ngx_http_request_t *r,
@@ -169,6 +181,10 @@ static ngx_int_t ngx_http_upstream_cookie_variable(ngx_http_request_t *r,
 static char *ngx_http_upstream(ngx_conf_t *cf, ngx_command_t *cmd, void *dummy);
 static char *ngx_http_upstream_server(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
+static char *ngx_http_upstream_adaptive_concurrency(ngx_conf_t *cf,
+    ngx_command_t *cmd, void *conf);
+static char *ngx_http_upstream_outlier_detection(ngx_conf_t *cf,
+    ngx_command_t *cmd, void *conf);
 
 static ngx_int_t ngx_http_upstream_set_local(ngx_http_request_t *r,
   ngx_http_upstream_t *u, ngx_http_upstream_local_t *local);
@@ -339,6 +355,20 @@ static ngx_command_t  ngx_http_upstream_commands[] = {
       0,
       NULL },
 
+    { ngx_string("outlier_detection"),
+      NGX_HTTP_UPS_CONF|NGX_CONF_1MORE,
+      ngx_http_upstream_outlier_detection,
+      NGX_HTTP_SRV_CONF_OFFSET,
+      0,
+      NULL },
+
+    { ngx_string("adaptive_concurrency"),
+      NGX_HTTP_UPS_CONF|NGX_CONF_ANY,
+      ngx_http_upstream_adaptive_concurrency,
+      NGX_HTTP_SRV_CONF_OFFSET,
+      0,
+      NULL },
+
       ngx_null_command
 };
 
@@ -895,6 +925,22 @@ ngx_http_upstream_cache(ngx_http_request_t *r, ngx_http_upstream_t *u)
         c->lock_timeout = u->conf->cache_lock_timeout;
         c->lock_age = u->conf->cache_lock_age;
 
+#if (NGX_HTTP_GZIP)
+
+        if (u->conf->cache_encodings) {
+            rc = ngx_http_encoding_set(r, &c->encoding);
+
+            if (rc == NGX_ERROR) {
+                return NGX_ERROR;
+            }
+
+            if (rc == NGX_OK) {
+                ngx_http_file_cache_encoding_key(r);
+            }
+        }
+
+#endif
+
         u->cache_status = NGX_HTTP_CACHE_MISS;
     }
 
@@ -911,8 +957,16 @@ ngx_http_upstream_cache(ngx_http_request_t *r, ngx_http_upstream_t *u)
              || c->stale_updating) && !r->background
             && u->conf->cache_background_update)
         {
+            if (ngx_http_file_cache_background_update(r) != NGX_OK) {
+
+                /* too many background updates, send the stale response */
+
+                u->cache_status = NGX_HTTP_CACHE_UPDATING;
+                rc = NGX_OK;
+                break;
+            }
+
             if (ngx_http_upstream_cache_background_update(r, u) == NGX_OK) {
-                r->cache->background = 1;
                 u->cache_status = rc;
                 rc = NGX_OK;
 
@@ -939,6 +993,14 @@ ngx_http_upstream_cache(ngx_http_request_t *r, ngx_http_upstream_t *u)
 
     case NGX_OK:
         u->cache_status = NGX_HTTP_CACHE_HIT;
+
+        if (c->refresh && !r->background && u->conf->cache_background_update
+            && ngx_http_file_cache_background_update(r) == NGX_OK)
+        {
+            if (ngx_http_upstream_cache_background_update(r, u) != NGX_OK) {
+                rc = NGX_ERROR;
+            }
+        }
     }
 
     switch (rc) {
@@ -1091,6 +1153,16 @@ ngx_http_upstream_cache_send(ngx_http_request_t *r, ngx_http_upstream_t *u)
             return NGX_DONE;
         }
 
+#if (NGX_HTTP_GZIP)
+
+        if (c->encoded) {
+            /* encoded variants are stored without the length */
+            r->headers_out.content_length_n = c->length - c->body_start;
+            r->gzip_vary = 1;
+        }
+
+#endif
+
         return ngx_http_cache_send(r);
     }
 
@@ -1566,7 +1638,15 @@ ngx_http_upstream_connect(ngx_http_request_t *r, ngx_http_upstream_t *u)
     u->state->peer = u->peer.name;
 
     if (rc == NGX_BUSY) {
-        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0, "no live upstreams");
+        if (u->peer.limited) {
+            ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                          "upstream concurrency limit reached");
+
+        } else {
+            ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                          "no live upstreams");
+        }
+
         ngx_http_upstream_next(r, u, NGX_HTTP_UPSTREAM_FT_NOLIVE);
         return;
     }
@@ -2180,6 +2260,14 @@ ngx_http_upstream_send_request(ngx_http_request_t *r, ngx_http_upstream_t *u,
 
         ngx_add_timer(c->read, u->conf->read_timeout);
 
+        if (u->conf->hedge_after
+            && ngx_http_upstream_hedge_init(r, u) != NGX_OK)
+        {
+            ngx_http_upstream_finalize_request(r, u,
+                                               NGX_HTTP_INTERNAL_SERVER_ERROR);
+            return;
+        }
+
         if (c->read->ready) {
             ngx_http_upstream_process_header(r, u);
             return;
@@ -2188,6 +2276,368 @@ ngx_http_upstream_send_request(ngx_http_request_t *r, ngx_http_upstream_t *u,
 }
 
 
+static ngx_int_t
+ngx_http_upstream_hedge_init(ngx_http_request_t *r, ngx_http_upstream_t *u)
+{
+    ngx_http_upstream_hedge_t  *hedge;
+
+    /*
+     * hedging needs a balancer to be instantiated again for the second
+     * peer, and the original response is detected by peeking the socket,
+     * which is not possible over SSL
+     */
+
+    if (!(r->method & (NGX_HTTP_GET|NGX_HTTP_HEAD))
+        || r->request_body_no_buffering
+        || u->peer.tries <= 1
+        || u->upstream == NULL
+        || u->ssl)
+    {
+        return NGX_OK;
+    }
+
+    hedge = u->hedge;
+
+    if (hedge == NULL) {
+        hedge = ngx_pcalloc(r->pool, sizeof(ngx_http_upstream_hedge_t));
+        if (hedge == NULL) {
+            return NGX_ERROR;
+        }
+
+        hedge->event.handler = ngx_http_upstream_hedge_handler;
+        hedge->event.data = r;
+        hedge->event.log = r->connection->log;
+
+        u->hedge = hedge;
+
+    } else if (hedge->fired || hedge->event.timer_set) {
+        return NGX_OK;
+    }
+
+    ngx_add_timer(&hedge->event, u->conf->hedge_after);
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_upstream_hedge_handler(ngx_event_t *ev)
+{
+    ngx_connection_t           *c, *pc;
+    ngx_http_request_t         *r;
+    ngx_http_upstream_t        *u;
+    ngx_http_upstream_hedge_t  *hedge;
+
+    r = ev->data;
+    u = r->upstream;
+    c = r->connection;
+
+    ngx_http_set_log_request(c->log, r);
+
+    pc = u->peer.connection;
+
+    /* the response has started to arrive, or there is nowhere to hedge */
+
+    if (pc == NULL
+        || pc->read->ready
+        || u->state->bytes_received
+        || !u->request_body_sent
+        || u->peer.tries <= 1
+        || (u->conf->next_upstream_timeout
+            && ngx_current_msec - u->peer.start_time
+               >= u->conf->next_upstream_timeout))
+    {
+        return;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "http upstream hedge, no response from %V", u->peer.name);
+
+    hedge = u->hedge;
+
+    hedge->fired = 1;
+    hedge->peer = u->peer;
+    hedge->state = u->state - (ngx_http_upstream_state_t *)
+                                  r->upstream_states->elts;
+    hedge->start_time = u->start_time;
+
+    u->state->bytes_sent = pc->sent;
+
+    /*
+     * the original peer stays acquired from its balancer until
+     * its connection is closed, and the hedged request gets
+     * a balancer of its own
+     */
+
+    u->peer.data = NULL;
+    u->peer.sockaddr = NULL;
+    u->peer.connection = NULL;
+
+    if (u->upstream->peer.init(r, u->upstream) != NGX_OK) {
+        u->peer = hedge->peer;
+        hedge->peer.connection = NULL;
+        return;
+    }
+
+    u->peer.tries = hedge->peer.tries - 1;
+
+    hedge->get = u->peer.get;
+    hedge->data = u->peer.data;
+
+    u->peer.get = ngx_http_upstream_hedge_get_peer;
+    u->peer.data = hedge;
+
+    pc->read->handler = ngx_http_upstream_hedged_handler;
+    pc->write->handler = ngx_http_upstream_hedged_handler;
+
+    ngx_http_upstream_connect(r, u);
+
+    ngx_http_run_posted_requests(c);
+}
+
+
+static ngx_int_t
+ngx_http_upstream_hedge_get_peer(ngx_peer_connection_t *pc, void *data)
+{
+    ngx_http_upstream_hedge_t  *hedge = data;
+
+    ngx_int_t  rc;
+
+    pc->get = hedge->get;
+    pc->data = hedge->data;
+
+    /* the new balancer does not know the original peer was tried */
+
+    for ( ;; ) {
+        rc = pc->get(pc, pc->data);
+
+        if ((rc != NGX_OK && rc != NGX_DONE)
+            || ngx_memn2cmp((u_char *) pc->sockaddr,
+                            (u_char *) hedge->peer.sockaddr,
+                            pc->socklen, hedge->peer.socklen)
+               != 0)
+        {
+            return rc;
+        }
+
+        if (rc == NGX_DONE) {
+            ngx_http_upstream_hedge_close(pc->connection);
+            pc->connection = NULL;
+        }
+
+        /* the balancer has marked it as tried, this is not a retry */
+
+        pc->free(pc, pc->data, 0);
+        pc->sockaddr = NULL;
+        pc->tries++;
+    }
+}
+
+
+static void
+ngx_http_upstream_hedged_handler(ngx_event_t *ev)
+{
+    int                         n;
+    char                        buf[1];
+    ngx_err_t                   err;
+    ngx_connection_t           *c, *pc;
+    ngx_http_request_t         *r;
+    ngx_http_upstream_t        *u;
+    ngx_http_upstream_state_t  *state;
+
+    pc = ev->data;
+    r = pc->data;
+    u = r->upstream;
+    c = r->connection;
+
+    ngx_http_set_log_request(c->log, r);
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                   "http upstream hedged handler");
+
+    if (ev->write) {
+        return;
+    }
+
+    if (ev->timedout) {
+        ngx_log_error(NGX_LOG_ERR, pc->log, NGX_ETIMEDOUT,
+                      "upstream timed out while hedging");
+        goto failed;
+    }
+
+    n = recv(pc->fd, buf, 1, MSG_PEEK);
+
+    err = ngx_socket_errno;
+
+    if (n == -1 && err == NGX_EAGAIN) {
+        ev->ready = 0;
+
+        if (ngx_handle_read_event(ev, 0) != NGX_OK) {
+            goto failed;
+        }
+
+        return;
+    }
+
+    if (n <= 0) {
+        ngx_log_error(NGX_LOG_ERR, pc->log, (n == -1) ? err : 0,
+                      "upstream prematurely closed connection "
+                      "while hedging");
+        goto failed;
+    }
+
+    /* the original peer responded first */
+
+    ngx_http_upstream_hedge_switch(r, u);
+
+    ngx_http_run_posted_requests(c);
+
+    return;
+
+failed:
+
+    state = r->upstream_states->elts;
+
+    state[u->hedge->state].status = ev->timedout ? NGX_HTTP_GATEWAY_TIME_OUT
+                                                 : NGX_HTTP_BAD_GATEWAY;
+
+    ngx_http_upstream_hedge_free(u->hedge, NGX_PEER_FAILED);
+}
+
+
+static void
+ngx_http_upstream_hedge_switch(ngx_http_request_t *r, ngx_http_upstream_t *u)
+{
+    ngx_connection_t           *c;
+    ngx_http_upstream_state_t  *state;
+    ngx_http_upstream_hedge_t  *hedge;
+
+    hedge = u->hedge;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http upstream hedge switch to %V", hedge->peer.name);
+
+    if (u->state->response_time == (ngx_msec_t) -1) {
+        u->state->response_time = ngx_current_msec - u->start_time;
+    }
+
+    c = u->peer.connection;
+    u->peer.connection = NULL;
+
+    if (c) {
+        u->state->bytes_sent = c->sent;
+    }
+
+    /* the hedged peer did not fail, it is just no longer needed */
+
+    if (u->peer.sockaddr) {
+        u->peer.free(&u->peer, u->peer.data, 0);
+        u->peer.sockaddr = NULL;
+    }
+
+    if (c) {
+        ngx_http_upstream_hedge_close(c);
+    }
+
+    u->peer = hedge->peer;
+    hedge->peer.connection = NULL;
+
+    c = u->peer.connection;
+
+    state = r->upstream_states->elts;
+
+    u->state = &state[hedge->state];
+    u->state->response_time = (ngx_msec_t) -1;
+    u->start_time = hedge->start_time;
+
+    if (ngx_http_upstream_reinit(r, u) != NGX_OK) {
+        ngx_http_upstream_finalize_request(r, u,
+                                           NGX_HTTP_INTERNAL_SERVER_ERROR);
+        return;
+    }
+
+    u->writer.out = NULL;
+    u->writer.last = &u->writer.out;
+    u->writer.connection = c;
+
+    u->request_sent = 1;
+    u->request_body_sent = 1;
+    u->request_body_blocked = 0;
+
+    c->read->handler = ngx_http_upstream_handler;
+    c->write->handler = ngx_http_upstream_handler;
+
+    u->write_event_handler = ngx_http_upstream_dummy_handler;
+    u->read_event_handler = ngx_http_upstream_process_header;
+
+    ngx_http_upstream_process_header(r, u);
+}
+
+
+static void
+ngx_http_upstream_hedge_cancel(ngx_http_request_t *r, ngx_http_upstream_t *u)
+{
+    ngx_http_upstream_hedge_t  *hedge;
+
+    hedge = u->hedge;
+
+    if (hedge->event.timer_set) {
+        ngx_del_timer(&hedge->event);
+    }
+
+    if (hedge->peer.connection) {
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "http upstream hedge cancel %V", hedge->peer.name);
+
+        ngx_http_upstream_hedge_free(hedge, 0);
+    }
+}
+
+
+static void
+ngx_http_upstream_hedge_free(ngx_http_upstream_hedge_t *hedge,
+    ngx_uint_t state)
+{
+    ngx_connection_t  *c;
+
+    /*
+     * the connection is detached first, so a keepalive balancer
+     * does not cache it with the request still in flight
+     */
+
+    c = hedge->peer.connection;
+    hedge->peer.connection = NULL;
+
+    hedge->peer.free(&hedge->peer, hedge->peer.data, state);
+
+    ngx_http_upstream_hedge_close(c);
+}
+
+
+static void
+ngx_http_upstream_hedge_close(ngx_connection_t *c)
+{
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "close http upstream connection: %d", c->fd);
+
+#if (NGX_HTTP_SSL)
+
+    if (c->ssl) {
+        c->ssl->no_wait_shutdown = 1;
+        c->ssl->no_send_shutdown = 1;
+
+        (void) ngx_ssl_shutdown(c);
+    }
+#endif
+
+    if (c->pool) {
+        ngx_destroy_pool(c->pool);
+    }
+
+    ngx_close_connection(c);
+}
+
+
 static ngx_int_t
 ngx_http_upstream_send_request_body(ngx_http_request_t *r,
     ngx_http_upstream_t *u, ngx_uint_t do_write)
@@ -2465,6 +2915,10 @@ ngx_http_upstream_process_header(ngx_http_request_t *r, ngx_http_upstream_t *u)
 
         u->buffer.last += n;
 
+        if (u->hedge) {
+            ngx_http_upstream_hedge_cancel(r, u);
+        }
+
 #if 0
         u->valid_header_in = 0;
 
@@ -2505,6 +2959,11 @@ ngx_http_upstream_process_header(ngx_http_request_t *r, ngx_http_upstream_t *u)
 
     u->state->header_time = ngx_current_msec - u->start_time;
 
+    if (u->peer.notify) {
+        u->peer.notify(&u->peer, u->peer.data,
+                       NGX_HTTP_UPSTREAM_NOTIFY_HEADER);
+    }
+
     if (u->headers_in.status_n >= NGX_HTTP_SPECIAL_RESPONSE) {
 
         if (ngx_http_upstream_test_next(r, u) == NGX_OK) {
@@ -2759,7 +3218,7 @@ ngx_http_upstream_intercept_errors(ngx_http_request_t *r,
 }
 
 
-static ngx_int_t
+ngx_int_t
 ngx_http_upstream_test_connect(ngx_connection_t *c)
 {
     int        err;
@@ -4382,6 +4841,11 @@ ngx_http_upstream_next(ngx_http_request_t *r, ngx_http_upstream_t *u,
         status = NGX_HTTP_TOO_MANY_REQUESTS;
         break;
 
+    case NGX_HTTP_UPSTREAM_FT_NOLIVE:
+        status = u->peer.limited ? NGX_HTTP_SERVICE_UNAVAILABLE
+                                 : NGX_HTTP_BAD_GATEWAY;
+        break;
+
     /*
      * NGX_HTTP_UPSTREAM_FT_BUSY_LOCK and NGX_HTTP_UPSTREAM_FT_MAX_WAITING
      * never reach here
@@ -4399,6 +4863,21 @@ ngx_http_upstream_next(ngx_http_request_t *r, ngx_http_upstream_t *u,
 
     u->state->status = status;
 
+    if (u->hedge) {
+
+        if (u->hedge->peer.connection) {
+
+            /* the hedged request failed, wait for the original one */
+
+            ngx_http_upstream_hedge_switch(r, u);
+            return;
+        }
+
+        if (u->hedge->event.timer_set) {
+            ngx_del_timer(&u->hedge->event);
+        }
+    }
+
     timeout = u->conf->next_upstream_timeout;
 
     if (u->request_sent
@@ -4507,6 +4986,10 @@ ngx_http_upstream_finalize_request(ngx_http_request_t *r,
         u->resolved->ctx = NULL;
     }
 
+    if (u->hedge) {
+        ngx_http_upstream_hedge_cancel(r, u);
+    }
+
     if (u->state && u->state->response_time == (ngx_msec_t) -1) {
         u->state->response_time = ngx_current_msec - u->start_time;
 
@@ -4524,7 +5007,9 @@ ngx_http_upstream_finalize_request(ngx_http_request_t *r,
     u->finalize_request(r, rc);
 
     if (u->peer.free && u->peer.sockaddr) {
-        u->peer.free(&u->peer, u->peer.data, 0);
+        u->peer.free(&u->peer, u->peer.data,
+                     u->headers_in.status_n >= NGX_HTTP_INTERNAL_SERVER_ERROR
+                     ? NGX_PEER_SERVER_ERROR : 0);
         u->peer.sockaddr = NULL;
     }
 
@@ -6301,6 +6786,181 @@ not_supported:
 }
 
 
+static char *
+ngx_http_upstream_outlier_detection(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf)
+{
+    ngx_http_upstream_srv_conf_t  *uscf = conf;
+
+    ngx_int_t                     n;
+    ngx_str_t                    *value, s;
+    ngx_uint_t                    i;
+    ngx_http_upstream_outlier_t  *outlier;
+
+    outlier = &uscf->outlier;
+
+    if (outlier->errors) {
+        return "is duplicate";
+    }
+
+    outlier->time = 10000;
+    outlier->max_time = 300000;
+    outlier->max_percent = 50;
+
+    value = cf->args->elts;
+
+    for (i = 1; i < cf->args->nelts; i++) {
+
+        if (ngx_strncmp(value[i].data, "errors=", 7) == 0) {
+
+            n = ngx_atoi(&value[i].data[7], value[i].len - 7);
+
+            if (n == NGX_ERROR || n == 0) {
+                goto invalid;
+            }
+
+            outlier->errors = n;
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "time=", 5) == 0) {
+
+            s.len = value[i].len - 5;
+            s.data = &value[i].data[5];
+
+            outlier->time = ngx_parse_time(&s, 0);
+
+            if (outlier->time == (ngx_msec_t) NGX_ERROR
+                || outlier->time == 0)
+            {
+                goto invalid;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "max_time=", 9) == 0) {
+
+            s.len = value[i].len - 9;
+            s.data = &value[i].data[9];
+
+            outlier->max_time = ngx_parse_time(&s, 0);
+
+            if (outlier->max_time == (ngx_msec_t) NGX_ERROR) {
+                goto invalid;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "max_percent=", 12) == 0) {
+
+            n = ngx_atoi(&value[i].data[12], value[i].len - 12);
+
+            if (n == NGX_ERROR || n > 100) {
+                goto invalid;
+            }
+
+            outlier->max_percent = n;
+
+            continue;
+        }
+
+        goto invalid;
+    }
+
+    if (outlier->errors == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"errors\" parameter must be specified");
+        return NGX_CONF_ERROR;
+    }
+
+    if (outlier->max_time < outlier->time) {
+        outlier->max_time = outlier->time;
+    }
+
+    return NGX_CONF_OK;
+
+invalid:
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "invalid parameter \"%V\"", &value[i]);
+
+    return NGX_CONF_ERROR;
+}
+
+
+static char *
+ngx_http_upstream_adaptive_concurrency(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf)
+{
+    ngx_http_upstream_srv_conf_t  *uscf = conf;
+
+    ngx_int_t                         n;
+    ngx_str_t                        *value;
+    ngx_uint_t                        i;
+    ngx_http_upstream_concurrency_t  *concurrency;
+
+    concurrency = &uscf->concurrency;
+
+    if (concurrency->max) {
+        return "is duplicate";
+    }
+
+    concurrency->min = 10;
+    concurrency->max = 1000;
+
+    value = cf->args->elts;
+
+    for (i = 1; i < cf->args->nelts; i++) {
+
+        if (ngx_strncmp(value[i].data, "min=", 4) == 0) {
+
+            n = ngx_atoi(&value[i].data[4], value[i].len - 4);
+
+            if (n == NGX_ERROR || n == 0) {
+                goto invalid;
+            }
+
+            concurrency->min = n;
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "max=", 4) == 0) {
+
+            n = ngx_atoi(&value[i].data[4], value[i].len - 4);
+
+            if (n == NGX_ERROR || n == 0 || n > 65535) {
+                goto invalid;
+            }
+
+            concurrency->max = n;
+
+            continue;
+        }
+
+        goto invalid;
+    }
+
+    if (concurrency->min > concurrency->max) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"min\" must not be greater than \"max\"");
+        return NGX_CONF_ERROR;
+    }
+
+    return NGX_CONF_OK;
+
+invalid:
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "invalid parameter \"%V\"", &value[i]);
+
+    return NGX_CONF_ERROR;
+}
+
+
 ngx_http_upstream_srv_conf_t *
 ngx_http_upstream_add(ngx_conf_t *cf, ngx_url_t *u, ngx_uint_t flags)
 {
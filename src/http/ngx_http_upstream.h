@@ -45,6 +45,9 @@
 #define NGX_HTTP_UPSTREAM_INVALID_HEADER     40
 
 
+#define NGX_HTTP_UPSTREAM_NOTIFY_HEADER      0x1
+
+
 #define NGX_HTTP_UPSTREAM_IGN_XA_REDIRECT    0x00000002
 #define NGX_HTTP_UPSTREAM_IGN_XA_EXPIRES     0x00000004
 #define NGX_HTTP_UPSTREAM_IGN_EXPIRES        0x00000008
@@ -109,6 +112,20 @@ typedef struct {
 } ngx_http_upstream_server_t;
 
 
+typedef struct {
+    ngx_uint_t                       errors;
+    ngx_msec_t                       time;
+    ngx_msec_t                       max_time;
+    ngx_uint_t                       max_percent;
+} ngx_http_upstream_outlier_t;
+
+
+typedef struct {
+    ngx_uint_t                       min;
+    ngx_uint_t                       max;
+} ngx_http_upstream_concurrency_t;
+
+
 #define NGX_HTTP_UPSTREAM_CREATE        0x0001
 #define NGX_HTTP_UPSTREAM_WEIGHT        0x0002
 #define NGX_HTTP_UPSTREAM_MAX_FAILS     0x0004
@@ -131,6 +148,9 @@ struct ngx_http_upstream_srv_conf_s {
     in_port_t                        port;
     ngx_uint_t                       no_port;  /* unsigned no_port:1 */
 
+    ngx_http_upstream_outlier_t      outlier;
+    ngx_http_upstream_concurrency_t  concurrency;
+
 #if (NGX_HTTP_UPSTREAM_ZONE)
     ngx_shm_zone_t                  *shm_zone;
 #endif
@@ -153,6 +173,7 @@ typedef struct {
     ngx_msec_t                       send_timeout;
     ngx_msec_t                       read_timeout;
     ngx_msec_t                       next_upstream_timeout;
+    ngx_msec_t                       hedge_after;
 
     size_t                           send_lowat;
     size_t                           buffer_size;
@@ -208,6 +229,7 @@ typedef struct {
     ngx_flag_t                       cache_revalidate;
     ngx_flag_t                       cache_convert_head;
     ngx_flag_t                       cache_background_update;
+    ngx_flag_t                       cache_encodings;
 
     ngx_array_t                     *cache_valid;
     ngx_array_t                     *cache_bypass;
@@ -314,6 +336,21 @@ typedef struct {
 } ngx_http_upstream_resolved_t;
 
 
+typedef struct {
+    ngx_event_t                      event;
+
+    /* the original peer, kept while the hedged request is running */
+    ngx_peer_connection_t            peer;
+    ngx_uint_t                       state;
+    ngx_msec_t                       start_time;
+
+    ngx_event_get_peer_pt            get;
+    void                            *data;
+
+    unsigned                         fired:1;
+} ngx_http_upstream_hedge_t;
+
+
 typedef void (*ngx_http_upstream_handler_pt)(ngx_http_request_t *r,
     ngx_http_upstream_t *u);
 
@@ -341,6 +378,8 @@ struct ngx_http_upstream_s {
 
     ngx_http_upstream_resolved_t    *resolved;
 
+    ngx_http_upstream_hedge_t       *hedge;
+
     ngx_buf_t                        from_client;
 
     ngx_buf_t                        buffer;
@@ -417,6 +456,7 @@ typedef struct {
 
 ngx_int_t ngx_http_upstream_create(ngx_http_request_t *r);
 void ngx_http_upstream_init(ngx_http_request_t *r);
+ngx_int_t ngx_http_upstream_test_connect(ngx_connection_t *c);
 ngx_int_t ngx_http_upstream_non_buffered_filter_init(void *data);
 ngx_int_t ngx_http_upstream_non_buffered_filter(void *data, ssize_t bytes);
 ngx_http_upstream_srv_conf_t *ngx_http_upstream_add(ngx_conf_t *cf,
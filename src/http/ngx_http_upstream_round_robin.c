@@ -16,6 +16,11 @@
 
 static ngx_http_upstream_rr_peer_t *ngx_http_upstream_get_peer(
     ngx_http_upstream_rr_peer_data_t *rrp);
+static void ngx_http_upstream_rr_peer_outlier(ngx_peer_connection_t *pc,
+    ngx_http_upstream_rr_peers_t *peers, ngx_http_upstream_rr_peer_t *peer,
+    ngx_uint_t state);
+static void ngx_http_upstream_rr_peers_release(ngx_peer_connection_t *pc,
+    ngx_http_upstream_rr_peer_data_t *rrp, ngx_uint_t state);
 
 #if (NGX_HTTP_SSL)
 
@@ -82,6 +87,9 @@ ngx_http_upstream_init_round_robin(ngx_conf_t *cf,
         peers->total_weight = w;
         peers->tries = t;
         peers->name = &us->host;
+        peers->outlier = us->outlier;
+        peers->concurrency = us->concurrency;
+        peers->limit = us->concurrency.min << 4;
 
         n = 0;
         peerp = &peers->peer;
@@ -152,6 +160,9 @@ ngx_http_upstream_init_round_robin(ngx_conf_t *cf,
         backup->total_weight = w;
         backup->tries = t;
         backup->name = &us->host;
+        backup->outlier = us->outlier;
+        backup->concurrency = us->concurrency;
+        backup->limit = us->concurrency.min << 4;
 
         n = 0;
         peerp = &backup->peer;
@@ -274,6 +285,7 @@ ngx_http_upstream_init_round_robin_peer(ngx_http_request_t *r,
     rrp->peers = us->peer.data;
     rrp->current = NULL;
     rrp->config = 0;
+    rrp->inflight = 0;
 
     n = rrp->peers->number;
 
@@ -296,6 +308,7 @@ ngx_http_upstream_init_round_robin_peer(ngx_http_request_t *r,
 
     r->upstream->peer.get = ngx_http_upstream_get_round_robin_peer;
     r->upstream->peer.free = ngx_http_upstream_free_round_robin_peer;
+    r->upstream->peer.notify = ngx_http_upstream_notify_round_robin_peer;
     r->upstream->peer.tries = ngx_http_upstream_tries(rrp->peers);
 #if (NGX_HTTP_SSL)
     r->upstream->peer.set_session =
@@ -400,6 +413,7 @@ ngx_http_upstream_create_round_robin_peer(ngx_http_request_t *r,
     rrp->peers = peers;
     rrp->current = NULL;
     rrp->config = 0;
+    rrp->inflight = 0;
 
     if (rrp->peers->number <= 8 * sizeof(uintptr_t)) {
         rrp->tried = &rrp->data;
@@ -440,6 +454,10 @@ ngx_http_upstream_get_round_robin_peer(ngx_peer_connection_t *pc, void *data)
     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, pc->log, 0,
                    "get rr peer, try: %ui", pc->tries);
 
+    if (ngx_http_upstream_rr_peers_admit(pc, rrp) != NGX_OK) {
+        return NGX_BUSY;
+    }
+
     pc->cached = 0;
     pc->connection = NULL;
 
@@ -480,6 +498,8 @@ ngx_http_upstream_get_round_robin_peer(ngx_peer_connection_t *pc, void *data)
 
     peer->conns++;
 
+    ngx_http_upstream_rr_peers_acquire(rrp);
+
     ngx_http_upstream_rr_peers_unlock(peers);
 
     return NGX_OK;
@@ -558,6 +578,10 @@ ngx_http_upstream_get_peer(ngx_http_upstream_rr_peer_data_t *rrp)
             continue;
         }
 
+        if (ngx_http_upstream_rr_peer_ejected(peer)) {
+            continue;
+        }
+
         if (peer->max_conns && peer->conns >= peer->max_conns) {
             continue;
         }
@@ -610,6 +634,10 @@ ngx_http_upstream_free_round_robin_peer(ngx_peer_connection_t *pc, void *data,
 
     /* TODO: NGX_PEER_KEEPALIVE */
 
+    if (rrp->inflight) {
+        ngx_http_upstream_rr_peers_release(pc, rrp, state);
+    }
+
     peer = rrp->current;
 
     ngx_http_upstream_rr_peers_rlock(rrp->peers);
@@ -659,6 +687,10 @@ ngx_http_upstream_free_round_robin_peer(ngx_peer_connection_t *pc, void *data,
         }
     }
 
+    if (rrp->peers->outlier.errors) {
+        ngx_http_upstream_rr_peer_outlier(pc, rrp->peers, peer, state);
+    }
+
     peer->conns--;
 
     ngx_http_upstream_rr_peer_unlock(rrp->peers, peer);
@@ -670,6 +702,217 @@ ngx_http_upstream_free_round_robin_peer(ngx_peer_connection_t *pc, void *data,
 }
 
 
+static void
+ngx_http_upstream_rr_peer_outlier(ngx_peer_connection_t *pc,
+    ngx_http_upstream_rr_peers_t *peers, ngx_http_upstream_rr_peer_t *peer,
+    ngx_uint_t state)
+{
+    ngx_msec_t  now, time;
+    ngx_uint_t  n;
+
+    if (!(state & (NGX_PEER_FAILED|NGX_PEER_SERVER_ERROR))) {
+
+        peer->errors = 0;
+
+        if (peer->eject_time
+            && !ngx_http_upstream_rr_peer_eject_active(peer))
+        {
+
+            /* the half-open request succeeded */
+
+            peer->eject_time = 0;
+            (void) ngx_atomic_fetch_add(&peers->ejected, -1);
+
+            ngx_log_error(NGX_LOG_NOTICE, pc->log, 0,
+                          "upstream server readmitted");
+        }
+
+        return;
+    }
+
+    if (++peer->errors < peers->outlier.errors
+        || (peer->eject_time && ngx_http_upstream_rr_peer_eject_active(peer)))
+    {
+        return;
+    }
+
+    if (peer->eject_time == 0) {
+
+        if ((peers->ejected + 1) * 100
+            > peers->outlier.max_percent * peers->number)
+        {
+            ngx_log_debug1(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                           "free rr peer not ejected, %uA peers ejected",
+                           peers->ejected);
+            return;
+        }
+
+        (void) ngx_atomic_fetch_add(&peers->ejected, 1);
+    }
+
+    now = ngx_current_msec;
+
+    /* the back-off is reset if the peer was healthy for max_time */
+
+    if (now - peer->eject_start > peers->outlier.max_time) {
+        peer->ejections = 0;
+    }
+
+    n = ngx_min(peer->ejections, 16);
+    time = peers->outlier.time << n;
+
+    if (time > peers->outlier.max_time) {
+        time = peers->outlier.max_time;
+    }
+
+    peer->ejections++;
+    peer->eject_start = now;
+    peer->eject_time = time;
+
+    ngx_log_error(NGX_LOG_WARN, pc->log, 0,
+                  "upstream server ejected for %M ms after %ui errors",
+                  time, peer->errors);
+}
+
+
+ngx_int_t
+ngx_http_upstream_rr_peers_admit(ngx_peer_connection_t *pc,
+    ngx_http_upstream_rr_peer_data_t *rrp)
+{
+    ngx_http_upstream_rr_peers_t  *peers;
+
+    peers = rrp->peers;
+
+    pc->limited = 0;
+
+    if (peers->concurrency.max == 0 || peers->inflight < peers->limit >> 4) {
+        return NGX_OK;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                   "rr peers concurrency limit reached: %uA of %ui",
+                   peers->inflight, peers->limit >> 4);
+
+    pc->limited = 1;
+    pc->name = peers->name;
+
+    return NGX_BUSY;
+}
+
+
+void
+ngx_http_upstream_rr_peers_acquire(ngx_http_upstream_rr_peer_data_t *rrp)
+{
+    if (rrp->peers->concurrency.max == 0) {
+        return;
+    }
+
+    (void) ngx_atomic_fetch_add(&rrp->peers->inflight, 1);
+
+    rrp->start = ngx_current_msec;
+    rrp->rtt = 0;
+    rrp->inflight = 1;
+}
+
+
+void
+ngx_http_upstream_notify_round_robin_peer(ngx_peer_connection_t *pc,
+    void *data, ngx_uint_t type)
+{
+    ngx_http_upstream_rr_peer_data_t  *rrp = data;
+
+    ngx_msec_t  rtt;
+
+    /* the round-trip time is measured up to the response header */
+
+    if (type == NGX_HTTP_UPSTREAM_NOTIFY_HEADER && rrp->inflight) {
+        rtt = ngx_current_msec - rrp->start;
+        rrp->rtt = ngx_max(rtt, 1);
+    }
+}
+
+
+static void
+ngx_http_upstream_rr_peers_release(ngx_peer_connection_t *pc,
+    ngx_http_upstream_rr_peer_data_t *rrp, ngx_uint_t state)
+{
+    ngx_msec_t                     rtt;
+    ngx_uint_t                     limit, n, gradient, inflight;
+    ngx_http_upstream_rr_peers_t  *peers;
+
+    peers = rrp->peers;
+
+    rrp->inflight = 0;
+
+    inflight = ngx_atomic_fetch_add(&peers->inflight, -1);
+
+    /* the limit and round-trip times have 4 fractional bits */
+
+    rtt = rrp->rtt << 4;
+
+    ngx_http_upstream_rr_peers_wlock(peers);
+
+    limit = peers->limit;
+
+    if (state & NGX_PEER_FAILED) {
+
+        /* errors and timeouts decrease the limit multiplicatively */
+
+        limit = limit * 9 / 10;
+
+    } else if (rtt) {
+
+        /*
+         * a short-term average is compared to a long-term one, which
+         * approximates the round-trip time without queueing; the latter
+         * is pulled down faster if the load has gone away
+         */
+
+        if (peers->rtt == 0) {
+            peers->rtt = rtt;
+            peers->rtt_noload = rtt;
+
+        } else {
+            peers->rtt += (ngx_msec_int_t) (rtt - peers->rtt) / 8;
+            peers->rtt_noload += (ngx_msec_int_t) (rtt - peers->rtt_noload)
+                                 / 128;
+
+            if (peers->rtt_noload > 2 * peers->rtt) {
+                peers->rtt_noload = peers->rtt_noload * 15 / 16;
+            }
+        }
+
+        /* 1.5 tolerance, the gradient is within 0.5 .. 1 */
+
+        gradient = peers->rtt_noload * 1500 / ngx_max(peers->rtt, 1);
+        gradient = ngx_max(ngx_min(gradient, 1000), 500);
+
+        n = limit * gradient / 1000 + (4 << 4);
+
+        /* the limit is not grown unless it is actually used */
+
+        if (inflight * 2 < limit >> 4) {
+            n = ngx_min(n, limit);
+        }
+
+        limit = (limit * 4 + n) / 5;
+    }
+
+    limit = ngx_max(limit, peers->concurrency.min << 4);
+    limit = ngx_min(limit, peers->concurrency.max << 4);
+
+    peers->limit = limit;
+
+    ngx_http_upstream_rr_peers_unlock(peers);
+
+    ngx_log_debug4(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                   "free rr peers concurrency limit: %ui, inflight: %ui, "
+                   "rtt: %M, noload: %M",
+                   limit >> 4, inflight - 1, peers->rtt >> 4,
+                   peers->rtt_noload >> 4);
+}
+
+
 #if (NGX_HTTP_SSL)
 
 ngx_int_t
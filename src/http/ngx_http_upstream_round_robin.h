@@ -38,6 +38,11 @@ struct ngx_http_upstream_rr_peer_s {
     ngx_msec_t                      slow_start;
     ngx_msec_t                      start_time;
 
+    ngx_uint_t                      errors;
+    ngx_uint_t                      ejections;
+    ngx_msec_t                      eject_start;
+    ngx_msec_t                      eject_time;
+
     ngx_uint_t                      down;
 
 #if (NGX_HTTP_SSL || NGX_COMPAT)
@@ -70,6 +75,15 @@ struct ngx_http_upstream_rr_peers_s {
     ngx_uint_t                      total_weight;
     ngx_uint_t                      tries;
 
+    ngx_http_upstream_outlier_t     outlier;
+    ngx_atomic_t                    ejected;
+
+    ngx_http_upstream_concurrency_t  concurrency;
+    ngx_atomic_t                    inflight;
+    ngx_uint_t                      limit;
+    ngx_msec_t                      rtt;
+    ngx_msec_t                      rtt_noload;
+
     unsigned                        single:1;
     unsigned                        weighted:1;
 
@@ -125,12 +139,29 @@ struct ngx_http_upstream_rr_peers_s {
 #endif
 
 
+#define ngx_http_upstream_rr_peer_eject_active(peer)                          \
+    ((ngx_msec_int_t) (ngx_current_msec - (peer)->eject_start)                \
+     < (ngx_msec_int_t) (peer)->eject_time)
+
+/*
+ * once the ejection time expires, the peer is half-open: it is given
+ * a single request at a time until a successful response readmits it
+ */
+
+#define ngx_http_upstream_rr_peer_ejected(peer)                               \
+    ((peer)->eject_time                                                       \
+     && (ngx_http_upstream_rr_peer_eject_active(peer) || (peer)->conns))
+
+
 typedef struct {
     ngx_uint_t                      config;
     ngx_http_upstream_rr_peers_t   *peers;
     ngx_http_upstream_rr_peer_t    *current;
     uintptr_t                      *tried;
     uintptr_t                       data;
+    ngx_msec_t                      start;
+    ngx_msec_t                      rtt;
+    ngx_uint_t                      inflight;  /* unsigned  inflight:1; */
 } ngx_http_upstream_rr_peer_data_t;
 
 
@@ -144,6 +175,11 @@ ngx_int_t ngx_http_upstream_get_round_robin_peer(ngx_peer_connection_t *pc,
     void *data);
 void ngx_http_upstream_free_round_robin_peer(ngx_peer_connection_t *pc,
     void *data, ngx_uint_t state);
+void ngx_http_upstream_notify_round_robin_peer(ngx_peer_connection_t *pc,
+    void *data, ngx_uint_t type);
+ngx_int_t ngx_http_upstream_rr_peers_admit(ngx_peer_connection_t *pc,
+    ngx_http_upstream_rr_peer_data_t *rrp);
+void ngx_http_upstream_rr_peers_acquire(ngx_http_upstream_rr_peer_data_t *rrp);
 
 #if (NGX_HTTP_SSL)
 ngx_int_t
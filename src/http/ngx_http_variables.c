@@ -145,6 +145,13 @@ static ngx_int_t ngx_http_variable_time_iso8601(ngx_http_request_t *r,
 static ngx_int_t ngx_http_variable_time_local(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data);
 
+#if (NGX_PCRE)
+static ngx_int_t ngx_http_regex_literal(ngx_conf_t *cf,
+    ngx_regex_compile_t *rc, ngx_http_regex_t *re);
+static ngx_int_t ngx_http_regex_literal_found(ngx_http_regex_t *re,
+    ngx_str_t *s);
+#endif
+
 /*
  * TODO:
  *     Apache CGI: AUTH_TYPE, PATH_INFO (null), PATH_TRANSLATED
@@ -2566,6 +2573,10 @@ ngx_http_regex_compile(ngx_conf_t *cf, ngx_regex_compile_t *rc)
     re->ncaptures = rc->captures;
     re->name = rc->pattern;
 
+    if (ngx_http_regex_literal(cf, rc, re) != NGX_OK) {
+        return NULL;
+    }
+
     cmcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_core_module);
     cmcf->ncaptures = ngx_max(cmcf->ncaptures, re->ncaptures);
 
@@ -2619,6 +2630,10 @@ ngx_http_regex_exec(ngx_http_request_t *r, ngx_http_regex_t *re, ngx_str_t *s)
     ngx_http_variable_value_t  *vv;
     ngx_http_core_main_conf_t  *cmcf;
 
+    if (re->literal.len && !ngx_http_regex_literal_found(re, s)) {
+        return NGX_DECLINED;
+    }
+
     cmcf = ngx_http_get_module_main_conf(r, ngx_http_core_module);
 
     if (re->ncaptures) {
@@ -2680,6 +2695,267 @@ ngx_http_regex_exec(ngx_http_request_t *r, ngx_http_regex_t *re, ngx_str_t *s)
     return NGX_OK;
 }
 
+
+static ngx_int_t
+ngx_http_regex_literal(ngx_conf_t *cf, ngx_regex_compile_t *rc,
+    ngx_http_regex_t *re)
+{
+    u_char      *p, *last, *run, *best, c;
+    size_t       len, blen;
+    ngx_uint_t   depth;
+
+    /*
+     * finds the longest string which is matched literally at the top
+     * level of the pattern, so every match contains it; anything that
+     * is not understood disables the check
+     */
+
+    run = ngx_pnalloc(cf->temp_pool, rc->pattern.len);
+    if (run == NULL) {
+        return NGX_ERROR;
+    }
+
+    best = ngx_pnalloc(cf->temp_pool, rc->pattern.len);
+    if (best == NULL) {
+        return NGX_ERROR;
+    }
+
+    p = rc->pattern.data;
+    last = p + rc->pattern.len;
+
+    depth = 0;
+    len = 0;
+    blen = 0;
+
+    while (p < last) {
+
+        c = *p++;
+
+        switch (c) {
+
+        case '\\':
+
+            if (p == last) {
+                return NGX_OK;
+            }
+
+            c = *p++;
+
+            if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')
+                || (c >= '0' && c <= '9'))
+            {
+                if (ngx_strchr("dDwWsSbBAzZGhHvVRX", c) == NULL) {
+                    return NGX_OK;
+                }
+
+                break;
+            }
+
+            if (c < 0x20 || c >= 0x7f) {
+                break;
+            }
+
+            if (depth == 0) {
+                run[len++] = c;
+            }
+
+            continue;
+
+        case '[':
+
+            if (p < last && *p == '^') {
+                p++;
+            }
+
+            if (p < last && *p == ']') {
+                p++;
+            }
+
+            while (p < last && *p != ']') {
+
+                if (*p == '\\') {
+                    if (p + 1 < last && p[1] == 'Q') {
+                        return NGX_OK;
+                    }
+
+                    p++;
+
+                } else if (*p == '[' && p + 1 < last && p[1] == ':') {
+                    for (p += 2; p + 1 < last; p++) {
+                        if (p[0] == ':' && p[1] == ']') {
+                            break;
+                        }
+                    }
+
+                    p++;
+                }
+
+                p++;
+            }
+
+            if (p >= last) {
+                return NGX_OK;
+            }
+
+            p++;
+            break;
+
+        case '(':
+
+            if (depth == 0 && p < last
+                && (*p == '*'
+                    || (*p == '?'
+                        && (p + 1 == last
+                            || ngx_strchr(":=!<>|#P'", p[1]) == NULL))))
+            {
+                /* verbs, options, recursion, or conditions */
+                return NGX_OK;
+            }
+
+            depth++;
+            break;
+
+        case ')':
+
+            if (depth == 0) {
+                return NGX_OK;
+            }
+
+            depth--;
+            break;
+
+        case '|':
+
+            if (depth == 0) {
+                return NGX_OK;
+            }
+
+            break;
+
+        case '*':
+        case '+':
+        case '?':
+
+            if (len) {
+                len--;
+            }
+
+            break;
+
+        case '{':
+
+            while (p < last && ((*p >= '0' && *p <= '9') || *p == ',')) {
+                p++;
+            }
+
+            if (p == last || *p != '}') {
+                return NGX_OK;
+            }
+
+            p++;
+
+            if (len) {
+                len--;
+            }
+
+            break;
+
+        case '.':
+        case '^':
+        case '$':
+            break;
+
+        default:
+
+            if (c < 0x20 || c >= 0x7f) {
+                break;
+            }
+
+            if (depth == 0) {
+                run[len++] = c;
+            }
+
+            continue;
+        }
+
+        /* the run of literal characters is over */
+
+        if (len > blen) {
+            ngx_memcpy(best, run, len);
+            blen = len;
+        }
+
+        len = 0;
+    }
+
+    if (depth) {
+        return NGX_OK;
+    }
+
+    if (len > blen) {
+        ngx_memcpy(best, run, len);
+        blen = len;
+    }
+
+    if (blen == 0) {
+        return NGX_OK;
+    }
+
+    re->literal.data = ngx_pnalloc(cf->pool, blen);
+    if (re->literal.data == NULL) {
+        return NGX_ERROR;
+    }
+
+    if (rc->options & NGX_REGEX_CASELESS) {
+        ngx_strlow(re->literal.data, best, blen);
+        re->caseless = 1;
+
+    } else {
+        ngx_memcpy(re->literal.data, best, blen);
+    }
+
+    re->literal.len = blen;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_regex_literal_found(ngx_http_regex_t *re, ngx_str_t *s)
+{
+    u_char  *p, *last;
+
+    if (s->len < re->literal.len) {
+        return 0;
+    }
+
+    p = s->data;
+    last = s->data + s->len;
+
+    if (re->caseless) {
+        return ngx_strlcasestrn(p, last, re->literal.data, re->literal.len - 1)
+               != NULL;
+    }
+
+    last -= re->literal.len - 1;
+
+    for ( ;; ) {
+        p = ngx_strlchr(p, last, re->literal.data[0]);
+
+        if (p == NULL) {
+            return 0;
+        }
+
+        if (ngx_memcmp(p + 1, re->literal.data + 1, re->literal.len - 1)
+            == 0)
+        {
+            return 1;
+        }
+
+        p++;
+    }
+}
+
 #endif
 
 
@@ -76,6 +76,8 @@ typedef struct {
     ngx_http_regex_variable_t    *variables;
     ngx_uint_t                    nvariables;
     ngx_str_t                     name;
+    ngx_str_t                     literal;
+    unsigned                      caseless:1;
 } ngx_http_regex_t;
 
 
@@ -11,9 +11,47 @@
 
 #if (NGX_HAVE_MAP_ANON)
 
+#if (NGX_HAVE_MAP_HUGETLB)
+
+/* 2M huge pages are explicitly requested, as the size is needed to unmap */
+
+#define NGX_SHM_HUGE_SIZE   (2 * 1024 * 1024)
+#define NGX_SHM_HUGE_FLAGS  (MAP_HUGETLB|(21 << MAP_HUGE_SHIFT))
+
+#endif
+
+
 ngx_int_t
 ngx_shm_alloc(ngx_shm_t *shm)
 {
+    shm->hugetlb = 0;
+
+#if (NGX_HAVE_MAP_HUGETLB)
+
+    if (shm->hugepages) {
+        shm->addr = (u_char *) mmap(NULL,
+                                    ngx_align(shm->size, NGX_SHM_HUGE_SIZE),
+                                    PROT_READ|PROT_WRITE,
+                                    MAP_ANON|MAP_SHARED|NGX_SHM_HUGE_FLAGS,
+                                    -1, 0);
+
+        if (shm->addr != MAP_FAILED) {
+            shm->hugetlb = 1;
+
+            ngx_log_error(NGX_LOG_NOTICE, shm->log, 0,
+                          "shared memory zone \"%V\" uses huge pages",
+                          &shm->name);
+
+            return NGX_OK;
+        }
+
+        ngx_log_error(NGX_LOG_INFO, shm->log, ngx_errno,
+                      "mmap(MAP_HUGETLB, %uz) failed for zone \"%V\"",
+                      shm->size, &shm->name);
+    }
+
+#endif
+
     shm->addr = (u_char *) mmap(NULL, shm->size,
                                 PROT_READ|PROT_WRITE,
                                 MAP_ANON|MAP_SHARED, -1, 0);
@@ -24,6 +62,26 @@ ngx_shm_alloc(ngx_shm_t *shm)
         return NGX_ERROR;
     }
 
+#if (NGX_HAVE_MADV_HUGEPAGE)
+
+    if (shm->hugepages) {
+
+        /* transparent huge pages, if enabled for shared memory */
+
+        if (madvise(shm->addr, shm->size, MADV_HUGEPAGE) == -1) {
+            ngx_log_error(NGX_LOG_INFO, shm->log, ngx_errno,
+                          "madvise(MADV_HUGEPAGE) failed for zone \"%V\"",
+                          &shm->name);
+
+        } else {
+            ngx_log_error(NGX_LOG_NOTICE, shm->log, 0,
+                          "shared memory zone \"%V\" is advised to use "
+                          "transparent huge pages", &shm->name);
+        }
+    }
+
+#endif
+
     return NGX_OK;
 }
 
@@ -31,9 +89,19 @@ ngx_shm_alloc(ngx_shm_t *shm)
 void
 ngx_shm_free(ngx_shm_t *shm)
 {
-    if (munmap((void *) shm->addr, shm->size) == -1) {
+    size_t  size;
+
+    size = shm->size;
+
+#if (NGX_HAVE_MAP_HUGETLB)
+    if (shm->hugetlb) {
+        size = ngx_align(size, NGX_SHM_HUGE_SIZE);
+    }
+#endif
+
+    if (munmap((void *) shm->addr, size) == -1) {
         ngx_log_error(NGX_LOG_ALERT, shm->log, ngx_errno,
-                      "munmap(%p, %uz) failed", shm->addr, shm->size);
+                      "munmap(%p, %uz) failed", shm->addr, size);
     }
 }
 